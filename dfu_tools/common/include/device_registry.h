@@ -0,0 +1,197 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: device_registry.h
+**
+** DESCRIPTION: Every DFU-mode device heard on the wire, indexed by MAC
+**              and by TYPE/VARIANT, with change notifications.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "dfu_client_config.h"
+#include "dfu_client.h"
+#include "dfu_client_api.h"
+
+/*
+** What happened to a device.
+**
+**   APPEARED: First heard (or heard again after it vanished).
+**   CHANGED:  Heard again with a different TYPE, VARIANT, status bits,
+**             core image mask or bootloader version.
+**   VANISHED: Not heard for DEVICE_REGISTRY_TTL_SECS, or pushed out by
+**             a newer device when the registry was full.
+**
+*/
+typedef enum
+{
+    DEVICE_EVENT_APPEARED = 0,
+    DEVICE_EVENT_CHANGED,
+    DEVICE_EVENT_VANISHED
+}deviceRegistryEventEnum;
+
+/*
+** Change notification.  Called with the registry unlocked, on the
+** thread that made the change, so it may use the registry (even
+** unsubscribe itself).
+**
+*/
+typedef void (*deviceRegistryCallback)(void *ctx, deviceRegistryEventEnum event, const deviceInfoStruct *device);
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: deviceRegistrySubscribe
+**
+** DESCRIPTION: Starts delivering change events to a callback.
+**
+** PARAMETERS: replay: true to deliver APPEARED for every device already
+**                     in the registry first.
+**
+** RETURNS: false if DEVICE_REGISTRY_MAX_LISTENERS are already
+**          subscribed.
+**
+** COMMENTS:
+**
+*/
+bool deviceRegistrySubscribe(deviceRegistryCallback callback, void *ctx, bool replay);
+
+/*!
+** FUNCTION: deviceRegistryUnsubscribe
+**
+** DESCRIPTION: Stops delivering events to a callback (matched on both
+**              the callback and its context).
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void deviceRegistryUnsubscribe(deviceRegistryCallback callback, void *ctx);
+
+/*!
+** FUNCTION: deviceRegistryUpdate
+**
+** DESCRIPTION: Adds or refreshes one device from a discovery record.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A record already older than the TTL is ignored, so a stale
+**           entry in the client's list doesn't come back to life.
+**
+*/
+void deviceRegistryUpdate(const deviceInfoStruct *device);
+
+/*!
+** FUNCTION: deviceRegistryCollect
+**
+** DESCRIPTION: Takes in everything the client has heard
+**              (dfuClientAPI_LL_GetFirstDevice / GetNextDevice), then
+**              expires devices that have gone quiet.
+**
+** PARAMETERS:
+**
+** RETURNS: How many discovery records were read.
+**
+** COMMENTS:
+**
+*/
+uint32_t deviceRegistryCollect(dfuClientAPI *apiHandle);
+
+/*!
+** FUNCTION: deviceRegistryExpire
+**
+** DESCRIPTION: Removes every device not heard for
+**              DEVICE_REGISTRY_TTL_SECS.
+**
+** PARAMETERS: now: Usually time(NULL).
+**
+** RETURNS: How many were removed.
+**
+** COMMENTS: Only looks at the devices that actually expire.
+**
+*/
+uint32_t deviceRegistryExpire(time_t now);
+
+/*!
+** FUNCTION: deviceRegistryFind
+**
+** DESCRIPTION: Looks up one device by MAC.
+**
+** PARAMETERS: mac:    MAX_INTERFACE_MAC_LEN bytes.
+**             device: Gets a copy of the record.  May be NULL.
+**
+** RETURNS: true if the device is known.
+**
+** COMMENTS:
+**
+*/
+bool deviceRegistryFind(const uint8_t *mac, deviceInfoStruct *device);
+
+/*!
+** FUNCTION: deviceRegistryFindByType
+**
+** DESCRIPTION: Every known device of one TYPE and VARIANT.
+**
+** PARAMETERS: devices:    Gets copies of the records, newest first.
+**             maxDevices: Room in "devices".
+**
+** RETURNS: How many were copied.
+**
+** COMMENTS:
+**
+*/
+uint32_t deviceRegistryFindByType(uint8_t deviceType,
+                                  uint8_t deviceVariant,
+                                  deviceInfoStruct *devices,
+                                  uint32_t maxDevices);
+
+/*!
+** FUNCTION: deviceRegistryCount
+**
+** DESCRIPTION: How many devices are known.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint32_t deviceRegistryCount(void);
+
+/*!
+** FUNCTION: deviceRegistryClear
+**
+** DESCRIPTION: Forgets every device (each one is reported VANISHED).
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void deviceRegistryClear(void);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,390 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: dfu_sim.h
+**
+** DESCRIPTION: Simulated DFU target, for testing and benchmarking the
+**              tools without a board.
+**
+** A simulated device keeps the state a real target does (session,
+** images received and installed, flash) and answers the DFU commands
+** from it, after configurable flash erase/write delays.  It runs in the
+** same process as the tools: control commands are plain calls
+** (dfuSimBeginRcv(), dfuSimImageStatus(), ...) and image data goes
+** through an xferTransportOps, so the window engine drives it exactly
+** as it drives a real transport.  Each device has its own thread that
+** "writes flash" while the sender carries on.  A dfuSimGroupStruct
+** stands for several devices hearing the same broadcast (DFU_TARGET_ANY)
+** frames, for the multicast engine.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+#include "dfu_client.h"
+#include "xfer_window.h"
+#include "xfer_multicast.h"
+
+/*
+** Image index the challenge response is sent to (as sequence_ops does).
+** Installing it opens the session.
+**
+*/
+#define DFU_SIM_SESSION_IMAGE_INDEX         (127)
+
+/*
+** IMAGE_STATUS flags reported by a simulated device.  PARTIAL_KEPT goes
+** with RECEIVING: the device keeps what it has received across sessions
+** (see XFER_STATUS_PARTIAL_KEPT).
+**
+*/
+#define DFU_SIM_STATUS_RECEIVING            (0x01)
+#define DFU_SIM_STATUS_COMPLETE             (0x02)
+#define DFU_SIM_STATUS_INSTALLED            (0x04)
+#define DFU_SIM_STATUS_PARTIAL_KEPT         (0x08)
+
+/*
+** Opaque simulated device.
+**
+*/
+typedef struct dfuSimDeviceStruct dfuSimDeviceStruct;
+
+/*
+** How a simulated device looks and behaves.  dfuSimDefaultConfig() fills
+** in a small, fast board.
+**
+**   maxMTU:           Largest message NEGOTIATE_MTU will agree to.
+**   flashSize:        Total room for images.
+**   sectorSize:       Erase granularity.  BEGIN_RCV erases enough
+**                     sectors for the image.
+**   eraseUSPerSector: Time to erase one sector.
+**   writeUSPerKB:     Time to program 1KB.
+**   installUS:        Time INSTALL_IMAGE takes.
+**   latencyUS:        One-way link delay, added to every ack.
+**   rxWindow:         Chunks the device can buffer.  Anything sent
+**                     while the buffer is full is dropped (and resent
+**                     by the window engine).
+**   ackEvery:         Acks are coalesced: one after this many chunks,
+**                     or as soon as the buffer drains.
+**
+*/
+typedef struct
+{
+    uint8_t                 mac[MAX_INTERFACE_MAC_LEN];
+    uint8_t                 deviceType;
+    uint8_t                 deviceVariant;
+    uint8_t                 blVersionMajor;
+    uint8_t                 blVersionMinor;
+    uint8_t                 blVersionPatch;
+    uint16_t                maxMTU;
+    uint32_t                flashSize;
+    uint32_t                sectorSize;
+    uint32_t                eraseUSPerSector;
+    uint32_t                writeUSPerKB;
+    uint32_t                installUS;
+    uint32_t                latencyUS;
+    uint16_t                rxWindow;
+    uint16_t                ackEvery;
+}dfuSimConfigStruct;
+
+/*
+** Devices that hear the same broadcast.  The caller fills in "members"
+** and "count"; the group transport counts what goes on the wire.
+**
+**   broadcasts: Chunks sent once to every member (DFU_TARGET_ANY).
+**   unicasts:   Repair chunks sent to one member.
+**
+*/
+typedef struct
+{
+    dfuSimDeviceStruct *    members[DFU_SIM_MAX_DEVICES];
+    uint32_t                count;
+    uint32_t                broadcasts;
+    uint32_t                unicasts;
+}dfuSimGroupStruct;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: dfuSimDefaultConfig
+**
+** DESCRIPTION: Fills in the defaults (DFU_SIM_DEFAULT_xxx).
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void dfuSimDefaultConfig(dfuSimConfigStruct *config);
+
+/*!
+** FUNCTION: dfuSimCreate
+**
+** DESCRIPTION: Powers up a simulated device.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if DFU_SIM_MAX_DEVICES are already running.
+**
+** COMMENTS:
+**
+*/
+dfuSimDeviceStruct *dfuSimCreate(const dfuSimConfigStruct *config);
+
+/*!
+** FUNCTION: dfuSimDestroy
+**
+** DESCRIPTION: Stops the device's thread and frees everything it holds.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void dfuSimDestroy(dfuSimDeviceStruct *sim);
+
+/*!
+** FUNCTION: dfuSimMACString
+**
+** DESCRIPTION: The device's address in the tools' "xx:xx:xx:xx:xx:xx"
+**              form, for use as a destination string.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+const char *dfuSimMACString(dfuSimDeviceStruct *sim);
+
+/*!
+** FUNCTION: dfuSimDiscoveryRecord
+**
+** DESCRIPTION: The record the device would broadcast right now.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: statusBits carries DFU_SIM_STATUS_xxx for the image being
+**           received; bit n of coreImageMask is set when image n+1 is
+**           installed.
+**
+*/
+void dfuSimDiscoveryRecord(dfuSimDeviceStruct *sim, deviceInfoStruct *record);
+
+/*!
+** FUNCTION: dfuSimBeginSession
+**
+** DESCRIPTION: BEGIN_SESSION.
+**
+** PARAMETERS:
+**
+** RETURNS: The challenge, or 0 if the type or variant don't match.
+**
+** COMMENTS: The session opens once the challenge response has been
+**           received and installed at DFU_SIM_SESSION_IMAGE_INDEX.  The
+**           response is not checked: the simulator holds no key.
+**
+*/
+uint32_t dfuSimBeginSession(dfuSimDeviceStruct *sim, uint8_t deviceType, uint8_t deviceVariant);
+
+/*!
+** FUNCTION: dfuSimEndSession
+**
+** DESCRIPTION: END_SESSION.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimEndSession(dfuSimDeviceStruct *sim);
+
+/*!
+** FUNCTION: dfuSimNegotiateMTU
+**
+** DESCRIPTION: NEGOTIATE_MTU.
+**
+** PARAMETERS:
+**
+** RETURNS: The smaller of "requested" and the device's maxMTU.
+**
+** COMMENTS:
+**
+*/
+uint16_t dfuSimNegotiateMTU(dfuSimDeviceStruct *sim, uint16_t requested);
+
+/*!
+** FUNCTION: dfuSimBeginRcv
+**
+** DESCRIPTION: BEGIN_RCV.  Erases room for the image (taking
+**              eraseUSPerSector per sector) and starts receiving it.
+**
+** PARAMETERS:
+**
+** RETURNS: false if no session is open (except for the challenge
+**          response), or the image doesn't fit.
+**
+** COMMENTS:
+**
+*/
+bool dfuSimBeginRcv(dfuSimDeviceStruct *sim,
+                    uint8_t imageIndex,
+                    uint32_t imageSize,
+                    uint32_t imageAddress,
+                    bool isEncrypted);
+
+/*!
+** FUNCTION: dfuSimRcvData
+**
+** DESCRIPTION: RCV_DATA.  Writes the next "len" bytes of the image.
+**
+** PARAMETERS:
+**
+** RETURNS: false if nothing is being received or it would overrun the
+**          image.
+**
+** COMMENTS: Blocks for the write time, like a target that only answers
+**           once the data is in flash.
+**
+*/
+bool dfuSimRcvData(dfuSimDeviceStruct *sim, const uint8_t *data, uint32_t len);
+
+/*!
+** FUNCTION: dfuSimRcvComplete
+**
+** DESCRIPTION: RCV_COMPLETE.
+**
+** PARAMETERS:
+**
+** RETURNS: true if exactly "imageSize" bytes have been received.
+**
+** COMMENTS:
+**
+*/
+bool dfuSimRcvComplete(dfuSimDeviceStruct *sim, uint32_t imageSize);
+
+/*!
+** FUNCTION: dfuSimImageStatus
+**
+** DESCRIPTION: IMAGE_STATUS.
+**
+** PARAMETERS: imageIndex: In: the image asked about.  Out: the image
+**                         the answer is for.
+**
+** RETURNS: false if the device knows nothing of that image.
+**
+** COMMENTS: "size" is how much has been received so far, so a sender
+**           can resume from it.
+**
+*/
+bool dfuSimImageStatus(dfuSimDeviceStruct *sim,
+                       uint8_t *imageIndex,
+                       uint32_t imageAddress,
+                       uint8_t *flags,
+                       uint32_t *size);
+
+/*!
+** FUNCTION: dfuSimInstallImage
+**
+** DESCRIPTION: INSTALL_IMAGE, for the image last completed.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Takes installUS.
+**
+*/
+bool dfuSimInstallImage(dfuSimDeviceStruct *sim);
+
+/*!
+** FUNCTION: dfuSimReboot
+**
+** DESCRIPTION: REBOOT.  Drops the session and anything half received;
+**              installed images stay.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimReboot(dfuSimDeviceStruct *sim);
+
+/*!
+** FUNCTION: dfuSimImageData
+**
+** DESCRIPTION: What the device has received for an image, to check a
+**              transfer against the file.
+**
+** PARAMETERS: size: Bytes received so far.
+**
+** RETURNS: NULL if the device knows nothing of that image.
+**
+** COMMENTS:
+**
+*/
+const uint8_t *dfuSimImageData(dfuSimDeviceStruct *sim, uint8_t imageIndex, uint32_t *size);
+
+/*!
+** FUNCTION: dfuSimTransportOps
+**
+** DESCRIPTION: Fills in a window engine transport that delivers chunks
+**              to this device.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Call once per xferWindowRun() (it resets the sequence
+**           numbering) and after dfuSimBeginRcv().  Chunks are
+**           written at their offset, so a resumed transfer works.
+**
+*/
+void dfuSimTransportOps(dfuSimDeviceStruct *sim, xferTransportOps *ops);
+
+/*!
+** FUNCTION: dfuSimGroupTransportOps
+**
+** DESCRIPTION: Fills in a multicast engine transport for a group of
+**              devices.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: As dfuSimTransportOps(), once per xferMulticastRun(), after
+**           every member's dfuSimBeginRcv().  sendChunk puts the one
+**           chunk in every member's receive buffer, as a broadcast frame
+**           would; a member whose buffer is full loses it.  The window
+**           is the smallest member's rxWindow.
+**
+*/
+void dfuSimGroupTransportOps(dfuSimGroupStruct *group, xferGroupTransportOps *ops);
+
+#if defined(__cplusplus)
+}
+#endif
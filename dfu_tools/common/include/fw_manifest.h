@@ -35,6 +35,59 @@
 #define FW_MANIFEST_CORE_IMAGE_COUNT_KEY                    ("core_image_count")
 #define FW_MANIFEST_CHALLENGE_KEY_PATH_KEY                  ("challenge_key_path")
 
+/*
+** Limits for a loaded (indexed) manifest.
+**
+*/
+#define FW_MANIFEST_MAX_ENTRIES                             (256)
+#define FW_MANIFEST_HASH_BUCKETS                            (512)     // Power of 2, > MAX_ENTRIES
+#define FW_MANIFEST_MAX_IMAGES                              (64)
+#define FW_MANIFEST_MAX_SHARED                              (8)
+
+/*
+** One core image, as listed in the manifest (image_N_*).
+**
+**   filename:      NULL if the manifest doesn't name one.
+**   coreIndex:     255 if missing.
+**
+*/
+typedef struct
+{
+    const char*         filename;
+    uint32_t            flashAddress;
+    uint8_t             coreIndex;
+}fwManifestImageStruct;
+
+typedef struct
+{
+    const char*         key;
+    const char*         value;
+    uint32_t            hash;
+}fwManifestEntryStruct;
+
+/*
+** A manifest loaded into memory.  Read-only once loaded, so any number
+** of sessions can use it at once.  Values have their quotes stripped.
+**
+*/
+typedef struct
+{
+    char                path[512];
+    dfuToolFileStampStruct  stamp;
+    uint32_t            refs;
+    char*               text;
+    uint32_t            entryCount;
+    fwManifestEntryStruct   entries[FW_MANIFEST_MAX_ENTRIES];
+    uint16_t            buckets[FW_MANIFEST_HASH_BUCKETS];  // entry + 1, 0 = empty
+
+    // Typed copies of the values every update needs
+    uint8_t             deviceType;
+    uint8_t             deviceVariant;
+    const char*         keyPath;
+    uint8_t             imageCount;
+    fwManifestImageStruct   images[FW_MANIFEST_MAX_IMAGES + 1];   // [1..imageCount]
+}fwManifestStruct;
+
 
 #if defined(__cplusplus)
 extern "C" {
@@ -126,23 +179,75 @@ uint32_t getFWManifestCoreImageFlashAddress(fkvpStruct *fkvp, uint32_t index);
 ///
 uint8_t getFWManifestCoreImageIndex(fkvpStruct* fkvp, uint32_t index);
 
+///
+/// @fn: loadFWManifest
+///
+/// @details Reads a manifest once and indexes it.  If the same file
+///          (path and modification time) is already loaded, that copy
+///          is shared.
+///
+/// @param[in] manifestPath
+///
+/// @returns NULL if the file can't be read.  Give it back with
+///          releaseFWManifest().
+///
+fwManifestStruct* loadFWManifest(const char* manifestPath);
+
+///
+/// @fn: releaseFWManifest
+///
+/// @details Drops one reference to a loaded manifest; the last one frees
+///          it.
+///
+/// @param[in] manifest
+///
+/// @returns
+///
+void releaseFWManifest(fwManifestStruct* manifest);
+
+///
+/// @fn: lookupFWManifestValue
+///
+/// @details Hash lookup of any key in a loaded manifest.
+///
+/// @param[in] manifest
+/// @param[in] keyname
+///
+/// @returns NULL if the key isn't there.  If a key appears twice, the
+///          first one wins (as with fkvpFind).
+///
+const char* lookupFWManifestValue(const fwManifestStruct* manifest, const char* keyname);
+
+///
+/// @fn: getFWManifestImage
+///
+/// @details One core image from a loaded manifest.
+///
+/// @param[in] manifest
+/// @param[in] number: 1..imageCount
+///
+/// @returns NULL if out of range.
+///
+const fwManifestImageStruct* getFWManifestImage(const fwManifestStruct* manifest, uint32_t number);
+
 
 /*
-** Macros to access manifest values (using constant Key names above)
+** Macros to access manifest values (using constant Key names above).
+** These take a loaded manifest (fwManifestStruct*).
 **
 */
-#define FWMAN_CREATION_DATETIME(fkvp)   dfuToolStripQuotes(getFWManifestValue(fkvp, FW_MANIFEST_CREATION_DATETIME_KEY))
-#define FWMAN_MANIFEST_VERSION(fkvp)    dfuToolStripQuotes(getFWManifestValue(fkvp, FW_MANIFEST_VERSION_KEY))
-#define FWMAN_DEV_NAME(fkvp)            dfuToolStripQuotes(getFWManifestValue(fkvp, FW_MANIFEST_DEVICE_TYPE_NAME_KEY))
-#define FWMAN_DEV_TYPE(fkvp)            (dfuDeviceTypeEnum)strtoul(getFWManifestValue(fkvp, FW_MANIFEST_DEVICE_TYPE_ID_KEY), NULL, 10)
-#define FWMAN_DEV_VARIANT(fkvp)         (uint8_t)strtoul(getFWManifestValue(fkvp, FW_MANIFEST_DEVICE_VARIANT_ID_KEY), NULL, 10)
-#define FWMAN_TARGET_MCU(fkvp)          dfuToolStripQuotes(getFWManifestValue(fkvp, FW_MANIFEST_TARGET_MCU_KEY))
-#define FWMAN_SYSTEM_VERSION(fkvp)      getFWManifestValue(fkvp, FW_MANIFEST_SYSTEM_VERSION_KEY)
-#define FWMAN_IMAGE_COUNT(fkvp)         (uint8_t)strtoul(getFWManifestValue(fkvp, FW_MANIFEST_CORE_IMAGE_COUNT_KEY), NULL, 10)
-#define FWMAN_KEY_PATH(fkvp)            dfuToolStripQuotes(getFWManifestValue(fkvp, FW_MANIFEST_CHALLENGE_KEY_PATH_KEY))
-#define FWMAN_IMAGE_FILENAME(fkvp, x)   dfuToolStripQuotes(getFWManifestCoreImageFilename(fkvp, x))
-#define FWMAN_IMAGE_ADDRESS(fkvp, x)    getFWManifestCoreImageFlashAddress(fkvp, x)
-#define FWMAN_IMAGE_INDEX(fkvp, x)      getFWManifestCoreImageIndex(fkvp, x)
+#define FWMAN_CREATION_DATETIME(man)    lookupFWManifestValue(man, FW_MANIFEST_CREATION_DATETIME_KEY)
+#define FWMAN_MANIFEST_VERSION(man)     lookupFWManifestValue(man, FW_MANIFEST_VERSION_KEY)
+#define FWMAN_DEV_NAME(man)             lookupFWManifestValue(man, FW_MANIFEST_DEVICE_TYPE_NAME_KEY)
+#define FWMAN_DEV_TYPE(man)             (dfuDeviceTypeEnum)((man)->deviceType)
+#define FWMAN_DEV_VARIANT(man)          ((man)->deviceVariant)
+#define FWMAN_TARGET_MCU(man)           lookupFWManifestValue(man, FW_MANIFEST_TARGET_MCU_KEY)
+#define FWMAN_SYSTEM_VERSION(man)       lookupFWManifestValue(man, FW_MANIFEST_SYSTEM_VERSION_KEY)
+#define FWMAN_IMAGE_COUNT(man)          ((man)->imageCount)
+#define FWMAN_KEY_PATH(man)             ((man)->keyPath)
+#define FWMAN_IMAGE_FILENAME(man, x)    (getFWManifestImage(man, x)->filename)
+#define FWMAN_IMAGE_ADDRESS(man, x)     (getFWManifestImage(man, x)->flashAddress)
+#define FWMAN_IMAGE_INDEX(man, x)       (getFWManifestImage(man, x)->coreIndex)
 
 #if defined(__cplusplus)
 }
@@ -17,6 +17,20 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/stat.h>
+
+/*
+** What a file looked like on disk: any difference means it was
+** rewritten or replaced.
+**
+*/
+typedef struct
+{
+    int64_t                 seconds;
+    int64_t                 nanoseconds;
+    int64_t                 size;
+    uint64_t                inode;
+}dfuToolFileStampStruct;
 
 
 #if defined(__cplusplus)
@@ -92,6 +106,52 @@ char * dfuToolStristr(const char *haystack, const char *needle);
 */
 uint32_t dfuToolGetFileSize(char *filename);
 
+/*!
+** FUNCTION: dfuToolFileStamp
+**
+** DESCRIPTION: Takes the modification time (to the nanosecond), size
+**              and inode from a stat() or fstat().
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Compare stamps with memcmp().  A file rewritten within the
+**           same second, or replaced by a rename, still reads as
+**           changed.  Windows has whole seconds and no inode.
+**
+*/
+void dfuToolFileStamp(const struct stat *info, dfuToolFileStampStruct *stamp);
+
+/*!
+** FUNCTION: dfuToolCRC32
+**
+** DESCRIPTION: Continues a CRC-32 (IEEE 802.3) over another block of
+**              data.
+**
+** PARAMETERS: crc: 0 to start a new CRC, else the previous result.
+**
+** RETURNS: The CRC of everything so far.
+**
+** COMMENTS:
+**
+*/
+uint32_t dfuToolCRC32(uint32_t crc, const uint8_t *data, uint32_t length);
+
+/*!
+** FUNCTION: dfuToolGetFileCRC32
+**
+** DESCRIPTION: CRC-32 of the named file's whole contents.
+**
+** PARAMETERS:
+**
+** RETURNS: true if the file could be read.
+**
+** COMMENTS:
+**
+*/
+bool dfuToolGetFileCRC32(char *filename, uint32_t *crc);
+
 ///
 /// @fn: dfuToolExtractPath
 ///
@@ -0,0 +1,97 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: image_source.h
+**
+** DESCRIPTION: Read-only, in-memory view of an image file, shared by
+**              every transfer that sends the same file.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+#include "general_utils.h"
+
+/*
+** One open image.  "data" is valid until the last imageSourceClose().
+**
+*/
+typedef struct
+{
+    const uint8_t *         data;
+    uint32_t                size;
+    char                    path[512];
+    dfuToolFileStampStruct  stamp;
+    bool                    mapped;
+    uint32_t                refs;
+}imageSourceStruct;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: imageSourceOpen
+**
+** DESCRIPTION: Gets the whole of an image file as one block of memory.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if the file can't be read, is empty, or
+**          IMAGE_SOURCE_MAX_OPEN different files are already open.
+**
+** COMMENTS: On Linux the file is mmap()ed (MAP_POPULATE,
+**           MADV_SEQUENTIAL), so chunks come straight out of the page
+**           cache.  Elsewhere it is read into the heap once.  If the
+**           file is already open (same path, size, inode and
+**           nanosecond modification time) the same view is handed back.
+**           Replace images by writing a new file and renaming it over
+**           the old one: open views keep the old inode.  A file cut
+**           short in place is only caught while it is being opened.
+**
+*/
+imageSourceStruct *imageSourceOpen(const char *filenameStr);
+
+/*!
+** FUNCTION: imageSourceWrap
+**
+** DESCRIPTION: Makes a source out of an image the caller already has in
+**              memory.
+**
+** PARAMETERS: source: Caller-owned; "data" must outlive it.
+**
+** RETURNS:
+**
+** COMMENTS: Not shared, and imageSourceClose() leaves it alone.
+**
+*/
+void imageSourceWrap(imageSourceStruct *source, const uint8_t *data, uint32_t size);
+
+/*!
+** FUNCTION: imageSourceClose
+**
+** DESCRIPTION: Drops one reference; the last one releases the memory.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void imageSourceClose(imageSourceStruct *source);
+
+#if defined(__cplusplus)
+}
+#endif
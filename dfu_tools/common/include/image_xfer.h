@@ -19,6 +19,15 @@
 #include <stdbool.h>
 
 #include "dfu_client.h"
+#include "xfer_window.h"
+
+/*
+** Chunks the blocking transaction transport keeps in flight: RCV_DATA
+** has no offset, so the device can't place a chunk that overtakes a lost
+** one.  This is the window every transfer to a real board runs at.
+**
+*/
+#define XFER_BLOCKING_WINDOW_SIZE           (1U)
 
 
 #if defined(__cplusplus)
@@ -32,6 +41,85 @@ bool xferImage(char *filenameStr,
                bool isEncrypted,
                dfuClientEnvStruct *dfuClient);
 
+/*!
+** FUNCTION: xferImageWithTransport
+**
+** DESCRIPTION: Transfer an image to the target, keeping up to
+**              "windowSize" RCV_DATA chunks in flight.
+**
+** PARAMETERS: transport:  NULL for the blocking transaction transport.
+**             windowSize: 0 to use the size configured for the
+**                         target's device type.
+**
+** RETURNS:
+**
+** COMMENTS: The blocking transport keeps XFER_BLOCKING_WINDOW_SIZE
+**           chunks in flight whatever the window.  Only a transport that
+**           numbers its chunks can use a larger one.
+**
+*/
+bool xferImageWithTransport(char *filenameStr,
+                            char *destStr,
+                            uint8_t imageIndex,
+                            uint32_t imageAddress,
+                            bool isEncrypted,
+                            dfuClientEnvStruct *dfuClient,
+                            const xferTransportOps *transport,
+                            uint16_t windowSize);
+
+/*!
+** FUNCTION: xferBuffer
+**
+** DESCRIPTION: Transfer an image that is already in memory.
+**
+** PARAMETERS: nameStr: Only used in the transfer report.
+**
+** RETURNS:
+**
+** COMMENTS: Same as xferImage() otherwise.  Nothing touches the
+**           filesystem.
+**
+*/
+bool xferBuffer(const uint8_t *data,
+                uint32_t length,
+                char *nameStr,
+                char *destStr,
+                uint8_t imageIndex,
+                uint32_t imageAddress,
+                bool isEncrypted,
+                dfuClientEnvStruct *dfuClient);
+
+/*!
+** FUNCTION: xferHasCheckpoint
+**
+** DESCRIPTION: Is there a resume checkpoint for this image on this
+**              device?
+**
+** PARAMETERS:
+**
+** RETURNS: true if an interrupted transfer could be resumed.
+**
+** COMMENTS: Only images of XFER_RESUME_MIN_IMAGE_SIZE or more are
+**           checkpointed.
+**
+*/
+bool xferHasCheckpoint(char *destStr, uint8_t imageIndex, uint32_t imageAddress);
+
+/*!
+** FUNCTION: xferSetDeviceType
+**
+** DESCRIPTION: Records the device type of the target a client is
+**              talking to, so transfers can pick its window size.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferSetDeviceType(dfuClientEnvStruct *dfuClient, uint8_t deviceType);
+
 
 #if defined(__cplusplus)
 }
@@ -14,15 +14,15 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
-#define LOG_BUFFER_SIZE 4096
-#define LOG_MAX_ENTRY_SIZE 128
+#include "dfu_client_config.h"
 
 /*
 ** Supported logging levels
 **
 */
-typedef enum 
+typedef enum
 {
     LOG_LEVEL_ERROR = 0,
     LOG_LEVEL_WARN  = 1,
@@ -31,52 +31,53 @@ typedef enum
     LOG_LEVEL_COUNT = 4  // Used for array sizing
 } logLevelEnum;
 
-
 /*
-** Each log entry has one of these at the front.
+** Where the drain thread sends entries.
 **
-*/
-typedef struct 
-{
-    uint32_t        timestamp;
-    uint32_t        msgLen;
-    uint32_t        crc;
-} logEntryHeaderStruct;
-
-
-/*
-** Each log level buffer has this structure
+**   LOGGER_OUTPUT_TEXT:   Formatted lines (stdout if no path is given).
+**   LOGGER_OUTPUT_BINARY: Raw entries, rendered later by loggerDecode().
+**                         The cheapest option for the drain thread.
 **
 */
-typedef struct 
+typedef enum
 {
-    uint8_t         buffer[LOG_BUFFER_SIZE];
-    uint32_t        writeIndex;
-    uint32_t        readIndex;
-    uint32_t        entryCount;
-} logBufferStruct;
+    LOGGER_OUTPUT_TEXT = 0,
+    LOGGER_OUTPUT_BINARY
+} loggerOutputEnum;
 
 /*
-** This is the top-level logging structure
+** One call site's format string.  The LOG_xxx() macros keep one of
+** these per call site; the first write gives it an ID and works out
+** the argument types, so later writes just copy raw arguments.
 **
 */
-typedef struct 
+typedef struct
 {
-    logBufferStruct     buffers[LOG_LEVEL_COUNT];
-    logLevelEnum        maxLevel;
-} logSystemStruct;
+    const char *        text;
+    uint16_t            id;
+} loggerFormatStruct;
 
 /*
-** Allows clients to read from the logs
+** Logging macros.  The format is printf-style; arguments are copied
+** as-is and only formatted by the drain thread (a "%s" argument is
+** copied, up to the room left in the entry).  Nothing is done unless
+** loggerStart() has been called.
 **
 */
-typedef struct 
-{
-    uint32_t            timestamp;
-    logLevelEnum        level;
-    uint32_t            msg_len;
-    const uint8_t*      msg;
-} logEntryStruct;
+#define LOGGER_LOG(level, fmt, ...)                                     \
+    do                                                                  \
+    {                                                                   \
+        static loggerFormatStruct _loggerFormat = { (fmt), 0 };         \
+        if (loggerEnabled(level))                                       \
+        {                                                               \
+            loggerWrite((level), &_loggerFormat, ##__VA_ARGS__);        \
+        }                                                               \
+    } while (0)
+
+#define LOG_ERROR(fmt, ...)     LOGGER_LOG(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)      LOGGER_LOG(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)      LOGGER_LOG(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...)     LOGGER_LOG(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
 
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
@@ -84,29 +85,35 @@ typedef struct
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 
-// Initialize the logging system
-void logerInit(LogSystem* log);
-
-// Core logging function that takes pre-formatted message
-bool loggerWrite(LogSystem* log, logLevelEnum level, const uint8_t* msg, uint32_t len);
+#if defined(__cplusplus)
+extern "C" {
+#endif
 
-// Helper functions for common number types
-bool loggerWrite_uint32(LogSystem* log, logLevelEnum level, const uint8_t* prefix, uint32_t value);
-bool loggerWrite_hex32(LogSystem* log, logLevelEnum level, const uint8_t* prefix, uint32_t value);
+// Opens the output and starts the drain thread.  "path" may be NULL for
+// text on stdout.
+bool loggerStart(const char *path, loggerOutputEnum output, logLevelEnum maxLevel);
 
-// Read functions
-bool loggerReadNext(LogSystem* log, logLevelEnum level, logEntryStruct* entry);
-void loggerReadReset(LogSystem* log, logLevelEnum level);
-uint32_t log_get_entry_count(LogSystem* log, logLevelEnum level);
+// Writes out everything still queued, stops the drain thread and closes
+// the output.
+void loggerStop(void);
 
+// Changes the most verbose level that is kept.
+void loggerSetLevel(logLevelEnum maxLevel);
 
-#if defined(__cplusplus)
-extern "C" {
-#endif
+// Would an entry at this level be kept?
+bool loggerEnabled(logLevelEnum level);
 
+// Queues one entry.  Never blocks: if the level's ring is full the entry
+// is counted as dropped.  Use the LOG_xxx() macros rather than calling
+// this directly.
+bool loggerWrite(logLevelEnum level, loggerFormatStruct *format, ...);
 
+// How many entries have been dropped because a ring was full.
+uint32_t loggerDropped(void);
 
+// Renders a LOGGER_OUTPUT_BINARY file as text.
+bool loggerDecode(FILE *in, FILE *out);
 
 #if defined(__cplusplus)
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,204 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: net_impair.h
+**
+** DESCRIPTION: Network impairment shim: latency, jitter, loss,
+**              duplication, reordering and a bandwidth cap, for one
+**              direction of a link.
+**
+** Messages go in with netImpairSubmit() and come back out of
+** netImpairNext() once their time is up (or never, if they were lost).
+** Every random choice comes from the profile's seed, so the same seed
+** and the same traffic give the same run.
+**
+** The Ethernet interface uses a pair (one per direction) between the
+** protocol callbacks and the socket; dfu_bench uses a pair between the
+** window engine and the simulated target.  An instance isn't locked:
+** use it from one thread.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+
+/*
+** What to do to a direction's traffic.  Probabilities are in parts per
+** million.
+**
+**   latencyUS:    Added to every message.
+**   jitterUS:     Each message gets up to this much more or less
+**                 latency.  Messages still come out in order unless
+**                 they were picked for reordering.
+**   lossPPM:      Chance a message is dropped.
+**   duplicatePPM: Chance a message is delivered twice.
+**   reorderPPM:   Chance a message is held back "reorderUS" so the
+**                 next ones overtake it.
+**   reorderUS:    How long a reordered message is held back.
+**   rateKbps:     Link speed; messages queue behind each other.  0 is
+**                 unlimited.
+**   seed:         Seeds every random choice.
+**
+*/
+typedef struct
+{
+    uint32_t                latencyUS;
+    uint32_t                jitterUS;
+    uint32_t                lossPPM;
+    uint32_t                duplicatePPM;
+    uint32_t                reorderPPM;
+    uint32_t                reorderUS;
+    uint32_t                rateKbps;
+    uint32_t                seed;
+}netImpairProfileStruct;
+
+/*
+** What happened to a direction's traffic so far.  "overflowed" counts
+** messages dropped because the queue was full.
+**
+*/
+typedef struct
+{
+    uint32_t                submitted;
+    uint32_t                delivered;
+    uint32_t                lost;
+    uint32_t                duplicated;
+    uint32_t                reordered;
+    uint32_t                overflowed;
+}netImpairStatsStruct;
+
+/*
+** Opaque impairment instance.
+**
+*/
+typedef struct netImpairStruct netImpairStruct;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: netImpairParseProfile
+**
+** DESCRIPTION: Reads a profile from text.
+**
+** PARAMETERS: text: Comma separated.  A bare name starts from one of
+**                   the presets ("lossy", "harness", "slow"); key=value
+**                   pairs then set fields:
+**                     latency, jitter, reorder-gap:  uS
+**                     loss, dup, reorder:            percent (may be
+**                                                    fractional)
+**                     rate:                          kbit/s
+**                     seed
+**                   e.g. "lossy,seed=7" or "latency=500,loss=0.5".
+**
+** RETURNS: false on anything it doesn't understand.
+**
+** COMMENTS: Fields not mentioned are 0, except reorder-gap
+**           (NET_IMPAIR_DEFAULT_REORDER_US) and seed
+**           (NET_IMPAIR_DEFAULT_SEED).
+**
+*/
+bool netImpairParseProfile(const char *text, netImpairProfileStruct *profile);
+
+/*!
+** FUNCTION: netImpairCreate
+**
+** DESCRIPTION: Sets up one direction.
+**
+** PARAMETERS: maxLen: Largest message that will be submitted.
+**
+** RETURNS: NULL if NET_IMPAIR_MAX_INSTANCES are in use or memory ran
+**          out.
+**
+** COMMENTS: Holds up to NET_IMPAIR_QUEUE_LEN messages at a time.
+**
+*/
+netImpairStruct *netImpairCreate(const netImpairProfileStruct *profile, uint16_t maxLen);
+
+/*!
+** FUNCTION: netImpairDestroy
+**
+** DESCRIPTION: Frees an instance and anything still queued in it.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void netImpairDestroy(netImpairStruct *impair);
+
+/*!
+** FUNCTION: netImpairSubmit
+**
+** DESCRIPTION: Hands a message to the link.
+**
+** PARAMETERS: nowUS: TIMER_GetMicroseconds().
+**
+** RETURNS: How many copies will come out (0 if it was lost or the
+**          queue was full, 2 if it was duplicated).
+**
+** COMMENTS: The message is copied.
+**
+*/
+uint32_t netImpairSubmit(netImpairStruct *impair, const uint8_t *msg, uint16_t len, uint64_t nowUS);
+
+/*!
+** FUNCTION: netImpairNext
+**
+** DESCRIPTION: The next message whose time is up.
+**
+** PARAMETERS: len: [OUT] Its length.
+**
+** RETURNS: NULL if nothing is due yet.
+**
+** COMMENTS: The message stays valid until the next call (or
+**           netImpairDestroy()).
+**
+*/
+const uint8_t *netImpairNext(netImpairStruct *impair, uint64_t nowUS, uint16_t *len);
+
+/*!
+** FUNCTION: netImpairNextDue
+**
+** DESCRIPTION: When the next queued message is due.
+**
+** PARAMETERS: dueUS: [OUT]
+**
+** RETURNS: false if nothing is queued.
+**
+** COMMENTS:
+**
+*/
+bool netImpairNextDue(netImpairStruct *impair, uint64_t *dueUS);
+
+/*!
+** FUNCTION: netImpairGetStats
+**
+** DESCRIPTION: Copies out the counters.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void netImpairGetStats(netImpairStruct *impair, netImpairStatsStruct *stats);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -97,6 +97,27 @@ bool sequenceTransferAndInstallImage(dfuClientEnvStruct * dfuClient,
                                      uint32_t imageAddress,
                                      char *dest);
 
+/*!
+** FUNCTION: sequenceTransferAndInstallBuffer
+**
+** DESCRIPTION: Sends an image held in memory to the target and then
+**              instructs it to be installed.
+**
+** PARAMETERS: nameStr: Only used in the transfer report.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool sequenceTransferAndInstallBuffer(dfuClientEnvStruct * dfuClient,
+                                      const uint8_t *data,
+                                      uint32_t length,
+                                      char *nameStr,
+                                      uint8_t imageIndex,
+                                      uint32_t imageAddress,
+                                      char *dest);
+
 /*!
 ** FUNCTION: sequenceNegotiateMTU
 **
@@ -0,0 +1,105 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+//
+/// @file vehicle_install.h
+/// @brief Updates every board on a vehicle from a vehicle manifest.
+///
+/// @details A vehicle manifest is a KVP file that lists board-level
+///          firmware manifests:
+///
+///              board_manifest_count: 2
+///              board_1_manifest: "control/control_manifest.yaml"
+///              board_1_count: 1
+///              board_2_manifest: "motor/motor_manifest.yaml"
+///              board_2_count: 4
+///
+///          "board_N_count" is OPTIONAL (default 1) and says how many
+///          boards of that TYPE & VARIANT the vehicle has.  Paths are
+///          relative to the vehicle manifest.
+///
+/// @copyright 2024,2025 Glydways, Inc
+/// @copyright https://glydways.com
+//
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "dfu_client.h"
+#include "dfu_client_api.h"
+#include "dfu_client_config.h"
+#include "fw_update_process.h"
+
+#define VEHICLE_MANIFEST_BOARD_COUNT_KEY        ("board_manifest_count")
+
+/*
+** Outcome for one board.
+**
+*/
+typedef struct
+{
+    char                    manifestPath[MAX_PATH_LEN];
+    uint8_t                 deviceType;
+    uint8_t                 deviceVariant;
+    uint8_t                 mac[MAX_INTERFACE_MAC_LEN];
+    bool                    found;
+    apiErrorCodeEnum        result;
+    uint32_t                elapsedMS;
+}vehicleBoardResultStruct;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+///
+/// @fn: vehicleInstallRun
+///
+/// @details Reads the vehicle manifest, listens for DFU-mode devices
+///          until every expected board has been heard from (or no new
+///          device shows up for listenTimeoutMS), then updates the
+///          boards that were found, up to maxConcurrent at a time.
+///
+/// @param[in] apiHandle:     Used for device discovery.
+/// @param[in] ifaceType:     Interface the boards are on.
+/// @param[in] ifaceName:     Interface name (as given to the API).
+/// @param[in] manifestPath:  Vehicle manifest.
+/// @param[in] listenTimeoutMS
+/// @param[in] maxConcurrent: 0 => VEHICLE_MAX_CONCURRENT_PER_INTERFACE,
+///                           which is also the upper limit.
+///
+/// @returns API_ERR_NONE only if every expected board was found and
+///          updated.  Per-board details from vehicleInstallGetResult().
+///
+apiErrorCodeEnum vehicleInstallRun(dfuClientAPI* apiHandle,
+                                   interfaceTypeEnum ifaceType,
+                                   char* ifaceName,
+                                   char* manifestPath,
+                                   uint32_t listenTimeoutMS,
+                                   uint32_t maxConcurrent);
+
+///
+/// @fn: vehicleInstallResultCount
+///
+/// @details
+///
+/// @returns How many boards the last vehicleInstallRun() expected.
+///
+uint32_t vehicleInstallResultCount(void);
+
+///
+/// @fn: vehicleInstallGetResult
+///
+/// @details
+///
+/// @param[in] index: 0 .. vehicleInstallResultCount()-1
+///
+/// @returns NULL if out of range.
+///
+const vehicleBoardResultStruct* vehicleInstallGetResult(uint32_t index);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,158 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_multicast.h
+**
+** DESCRIPTION: One-to-many image transfer for boards that take the same
+**              image.
+**
+** The data goes through a group transport (xferGroupTransportOps):
+** sendChunk is the one DFU_TARGET_ANY send the whole group hears.  The
+** protocol library in this tree has no group RCV_DATA transaction, so
+** the only group transport so far is the simulator's
+** (dfuSimGroupTransportOps()); against real boards xferImageMulticast()
+** is given none and sends the image to each board in turn.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client.h"
+#include "xfer_window.h"
+
+/*
+** What one member reports back for a multicast stream.  Unlike the
+** window engine's ack, the bitmap can sit anywhere past the cumulative
+** point, so a member can report chunks it got well after a gap.
+**
+**   cumulativeSeq: Every chunk with seq < cumulativeSeq has been received.
+**   bitmapBase:    Bit n of "bitmap" set => chunk (bitmapBase + n) has
+**                  been received.
+**   rejected:      Member refused the data and leaves the group.
+**
+*/
+#define XFER_GROUP_ACK_BITMAP_WORDS         (8U)
+
+typedef struct
+{
+    uint32_t                cumulativeSeq;
+    uint32_t                bitmapBase;
+    uint32_t                bitmap[XFER_GROUP_ACK_BITMAP_WORDS];
+    bool                    rejected;
+}xferGroupAckStruct;
+
+/*
+** One board in a multicast group.  The caller fills in the client and
+** destination; the engine fills in the rest.
+**
+**   active:      Taking part.  xferMulticastRun() skips a member that
+**                isn't, and clears it for one that rejects the data or
+**                can't be repaired.
+**   ok:          Whole image received (and, from xferImageMulticast(),
+**                RCV_COMPLETE accepted).
+**   repairs:     Chunks that had to be resent to this board alone.
+**
+*/
+typedef struct
+{
+    dfuClientEnvStruct *    dfuClient;
+    char *                  destStr;
+    bool                    active;
+    bool                    ok;
+    uint32_t                repairs;
+}xferGroupMemberStruct;
+
+/*
+** Transport for a multicast group.
+**
+**   sendChunk:   Send one chunk ONCE to every member (broadcast or
+**                multicast address).
+**   sendRepair:  Resend one chunk to a single member.
+**   pollAck:     Wait up to timeoutMS for one member's acknowledgement.
+**                Same seq numbering as sendChunk.
+**   flush:       OPTIONAL.  Push out anything queued.
+**   maxBurst:    Chunks sent between ack collections.  0 uses
+**                XFER_MULTICAST_BURST.
+**   maxWindow:   Chunks a member can take past its cumulative point.
+**                The stream waits for the slowest member that is
+**                keeping up; one that stops acking is left to the
+**                repair pass.  0 uses maxBurst.
+**
+*/
+typedef struct
+{
+    void *                  ctx;
+    bool                  (*sendChunk)(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+    bool                  (*sendRepair)(void *ctx, uint32_t member, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+    bool                  (*pollAck)(void *ctx, uint32_t member, xferGroupAckStruct *ack, uint32_t timeoutMS);
+    void                  (*flush)(void *ctx);
+    uint16_t                maxBurst;
+    uint16_t                maxWindow;
+}xferGroupTransportOps;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: xferImageMulticast
+**
+** DESCRIPTION: Transfers one image to every member of a group.  The image
+**              is streamed once through the group transport; each
+**              member's gaps are then repaired with unicast resends.
+**
+** PARAMETERS: members:  Sessions must already be open with each one.
+**             group:    NULL (or fewer than two members) sends the
+**                       image to each member in turn with xferImage().
+**
+** RETURNS: true if every member got the whole image.  Per-member
+**          results are in members[].ok.
+**
+** COMMENTS: BEGIN_RCV and RCV_COMPLETE are plain per-member
+**           transactions.
+**
+*/
+bool xferImageMulticast(char *filenameStr,
+                        uint8_t imageIndex,
+                        uint32_t imageAddress,
+                        bool isEncrypted,
+                        xferGroupMemberStruct *members,
+                        uint32_t memberCount,
+                        const xferGroupTransportOps *group);
+
+/*!
+** FUNCTION: xferMulticastRun
+**
+** DESCRIPTION: The data phase on its own: streams the image once to the
+**              group, then repairs each active member's gaps.
+**
+** PARAMETERS: members:  Only "active" ones take part; each must already
+**                       have accepted BEGIN_RCV.
+**
+** RETURNS: true if every active member got every chunk.  members[].ok
+**          says which did.
+**
+** COMMENTS: For callers that run the control transactions themselves,
+**           as dfu_bench does against the simulator.
+**
+*/
+bool xferMulticastRun(const uint8_t *image,
+                      uint32_t imageSize,
+                      uint16_t chunkLen,
+                      xferGroupMemberStruct *members,
+                      uint32_t memberCount,
+                      const xferGroupTransportOps *group);
+
+#if defined(__cplusplus)
+}
+#endif
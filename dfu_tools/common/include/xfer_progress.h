@@ -0,0 +1,154 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_progress.h
+**
+** DESCRIPTION: Transfer progress table and its renderer.
+**
+** Transfers publish their counters into a shared table (a few relaxed
+** stores, no I/O).  A renderer thread samples the table
+** XFER_PROGRESS_RATE_HZ times a second and draws it one of three ways:
+** a row per session on a terminal, nothing at all, or an NDJSON event
+** stream for other programs.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+
+/*
+** How progress is shown.
+**
+**   TTY:    One status line for all running sessions, redrawn in place
+**           with "\r".  A session's final row is left on a line of its
+**           own when it ends.
+**   QUIET:  Nothing (the transfer's own summary is still printed).
+**   NDJSON: One JSON object per line: "start" and "end" events, and a
+**           "progress" event per running session at every sample.
+**
+*/
+typedef enum
+{
+    XFER_PROGRESS_TTY = 0,
+    XFER_PROGRESS_QUIET,
+    XFER_PROGRESS_NDJSON
+}xferProgressModeEnum;
+
+/*
+** "No session" from xferProgressOpen().
+**
+*/
+#define XFER_PROGRESS_NONE          (-1)
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: xferProgressDefaultMode
+**
+** DESCRIPTION: TTY when stdout is a terminal, QUIET when it is redirected.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+xferProgressModeEnum xferProgressDefaultMode(void);
+
+/*!
+** FUNCTION: xferProgressStart
+**
+** DESCRIPTION: Starts the renderer.
+**
+** PARAMETERS: path: NDJSON only.  File to write the events to, or NULL
+**                   for stderr (stdout carries the tool's own output).
+**
+** RETURNS: false if it is already running or can't start.
+**
+** COMMENTS: Until this is called, sessions are tracked but not shown.
+**
+*/
+bool xferProgressStart(xferProgressModeEnum mode, const char *path);
+
+/*!
+** FUNCTION: xferProgressStop
+**
+** DESCRIPTION: Draws a last sample and stops the renderer.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferProgressStop(void);
+
+/*!
+** FUNCTION: xferProgressOpen
+**
+** DESCRIPTION: Adds a session to the table.
+**
+** PARAMETERS: name:       Shown in its row (usually the destination).
+**             totalBytes: Image size.
+**             startBytes: Already there (a resumed transfer).
+**
+** RETURNS: The session, or XFER_PROGRESS_NONE if the table is full (the
+**          other calls accept that and do nothing).
+**
+** COMMENTS:
+**
+*/
+int xferProgressOpen(const char *name, uint32_t totalBytes, uint32_t startBytes);
+
+/*!
+** FUNCTION: xferProgressUpdate
+**
+** DESCRIPTION: Publishes a session's counters.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Cheap enough to call for every chunk: a handful of relaxed
+**           atomic stores.  Only the session's owner may call it.
+**
+*/
+void xferProgressUpdate(int session,
+                        uint32_t bytes,
+                        uint32_t chunks,
+                        uint32_t retries,
+                        uint32_t timeouts);
+
+/*!
+** FUNCTION: xferProgressClose
+**
+** DESCRIPTION: Ends a session.  Its final state is drawn before this
+**              returns, so output printed afterwards follows it.
+**
+** PARAMETERS: ok: Whether the transfer succeeded.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferProgressClose(int session, bool ok);
+
+#if defined(__cplusplus)
+}
+#endif
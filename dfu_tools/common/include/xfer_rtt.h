@@ -0,0 +1,196 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_rtt.h
+**
+** DESCRIPTION: Per-device round-trip time estimator, used to size
+**              transaction and ack timeouts.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+#include "async_timer.h"
+
+/*
+** Estimator state (Jacobson/Karels).  srttUS8 is the smoothed RTT in
+** 1/8 uS, rttvarUS4 the mean deviation in 1/4 uS: a LAN round trip is
+** well under a millisecond, so mS samples would read as 0 or 1.
+**
+** The device's answer to the last jumbo MTU offer rides along, so a
+** device that ignored it isn't made to time out on it every session:
+** probedMTU is what was offered (0: never), probeReply what came back
+** (0: no answer).
+**
+*/
+typedef struct
+{
+    uint32_t                srttUS8;
+    uint32_t                rttvarUS4;
+    uint32_t                rtoMS;
+    uint8_t                 backoffShift;
+    uint32_t                samples;
+    uint32_t                backoffs;
+    uint16_t                probedMTU;
+    uint16_t                probeReply;
+}xferRttStruct;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: xferRttGet
+**
+** DESCRIPTION: Copies out a device's estimator, starting a new one (at
+**              XFER_RTT_INITIAL_TIMEOUT_MS) the first time the device
+**              is seen.
+**
+** PARAMETERS: rtt: [OUT] The caller's copy, to sample into and hand
+**                  back with xferRttPut().
+**
+** RETURNS: false only if destStr or rtt is NULL.
+**
+** COMMENTS: Once the table is full the oldest device is forgotten;
+**           a copy already handed out isn't affected.
+**
+*/
+bool xferRttGet(const char *destStr, xferRttStruct *rtt);
+
+/*!
+** FUNCTION: xferRttPut
+**
+** DESCRIPTION: Stores a copy taken with xferRttGet() back as the
+**              device's estimator.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A device forgotten in the meantime is added again.
+**
+*/
+void xferRttPut(const char *destStr, const xferRttStruct *rtt);
+
+/*!
+** FUNCTION: xferRttEndForDevice
+**
+** DESCRIPTION: xferRttEnd() on a device's stored estimator, for a
+**              single transaction outside a transfer.
+**
+** PARAMETERS:
+**
+** RETURNS: true if the transaction timed out.
+**
+** COMMENTS:
+**
+*/
+bool xferRttEndForDevice(const char *destStr, uint64_t startUS, uint32_t timeoutMS);
+
+/*!
+** FUNCTION: xferRttTimeoutMS
+**
+** DESCRIPTION: The timeout to use for the next transaction: the RTO,
+**              doubled for each back-off since the last good sample.
+**
+** PARAMETERS: rtt: NULL gives XFER_RTT_INITIAL_TIMEOUT_MS.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint32_t xferRttTimeoutMS(const xferRttStruct *rtt);
+
+/*!
+** FUNCTION: xferRttDataTimeoutMS
+**
+** DESCRIPTION: The timeout for a data chunk: xferRttTimeoutMS(), but
+**              never below XFER_RTT_DATA_MIN_TIMEOUT_MS.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A chunk may make the target erase flash before it answers,
+**           which no RTT sample of an ordinary exchange predicts.
+**
+*/
+uint32_t xferRttDataTimeoutMS(const xferRttStruct *rtt);
+
+/*!
+** FUNCTION: xferRttEnd
+**
+** DESCRIPTION: Accounts for one finished transaction.  If it came back
+**              before its timeout, the elapsed time is a new sample;
+**              otherwise the timeout backs off.
+**
+** PARAMETERS: startUS:   TIMER_GetMicroseconds() just before the
+**                        transaction.
+**             timeoutMS: What the transaction was given.
+**
+** RETURNS: true if the transaction timed out.
+**
+** COMMENTS: A NAK still counts as an answer.
+**
+*/
+bool xferRttEnd(xferRttStruct *rtt, uint64_t startUS, uint32_t timeoutMS);
+
+/*!
+** FUNCTION: xferRttSample
+**
+** DESCRIPTION: Folds one measured round trip into the estimate.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Only sample exchanges that were not retransmitted (Karn).
+**           Clears any back-off.
+**
+*/
+void xferRttSample(xferRttStruct *rtt, uint32_t measuredUS);
+
+/*!
+** FUNCTION: xferRttBackoff
+**
+** DESCRIPTION: Something timed out: double the timeout until the next
+**              good sample.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferRttBackoff(xferRttStruct *rtt);
+
+/*!
+** FUNCTION: xferRttPrint
+**
+** DESCRIPTION: One-line summary of the estimator for a transfer report.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferRttPrint(const xferRttStruct *rtt);
+
+#if defined(__cplusplus)
+}
+#endif
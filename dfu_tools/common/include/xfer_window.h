@@ -0,0 +1,233 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_window.h
+**
+** DESCRIPTION: Sliding-window engine for image data transfers.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+#include "dfu_proto_config.h"
+#include "async_timer.h"
+#include "xfer_rtt.h"
+
+/*
+** Largest chunk a window slot can hold.
+**
+*/
+#define XFER_MAX_CHUNK_LEN                  (MAX_MSG_LEN)
+
+/*
+** What came back from the target for the data chunks.
+**
+**   cumulativeSeq: Every chunk with seq < cumulativeSeq has been received.
+**   selectiveMask: Bit n set => chunk (cumulativeSeq + 1 + n) has also
+**                  been received (the chunk AT cumulativeSeq is missing).
+**   rejected:      Target refused the data.  The transfer is aborted.
+**
+*/
+typedef struct
+{
+    uint32_t                cumulativeSeq;
+    uint32_t                selectiveMask;
+    bool                    rejected;
+}xferAckStruct;
+
+/*
+** Transport used by the window engine.
+**
+**   sendChunk: Hand one chunk to the target.  May return before the
+**              target answers.  Returns false on a hard failure.
+**   pollAck:   Wait up to timeoutMS for acknowledgement.  Returns true
+**              and fills "ack" if one arrived.
+**   flush:     OPTIONAL.  Push out anything the transport has queued
+**              (called once per burst of sendChunk calls).
+**   maxWindow: How many chunks the transport can keep in flight.  A
+**              transport that blocks in sendChunk uses 1.
+**
+*/
+typedef struct
+{
+    void *                  ctx;
+    bool                  (*sendChunk)(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+    bool                  (*pollAck)(void *ctx, xferAckStruct *ack, uint32_t timeoutMS);
+    void                  (*flush)(void *ctx);
+    uint16_t                maxWindow;
+}xferTransportOps;
+
+/*
+** Where the chunk data comes from.  Called in offset order, once per
+** chunk; returns the number of bytes placed in "dest" (0 at the end).
+**
+*/
+typedef uint32_t (*xferReadChunkFunc)(void *ctx, uint8_t *dest, uint32_t maxLen);
+
+/*
+** Results of one windowed transfer.
+**
+*/
+typedef struct
+{
+    uint32_t                bytesAcked;
+    uint32_t                chunksSent;
+    uint32_t                retransmits;
+    uint32_t                timeouts;
+}xferWindowStatsStruct;
+
+/*
+** Progress callback (OPTIONAL).  Called after every ack, ack timeout or
+** retransmit pass with the counters so far.
+**
+*/
+typedef void (*xferProgressFunc)(void *ctx, const xferWindowStatsStruct *stats);
+
+/*
+** Everything one windowed transfer needs.
+**
+**   image:       OPTIONAL.  The whole image in memory.  When set, chunks
+**                are sent straight out of it and readChunk isn't used.
+**   startOffset: Offset of the first chunk "readChunk" returns (non-zero
+**                when a transfer resumes part way through the image).
+**   rtt:         OPTIONAL.  When set, the ack timeout follows this
+**                estimator (and the acks feed it) instead of the fixed
+**                ackTimeoutMS.
+**
+*/
+typedef struct
+{
+    const xferTransportOps *transport;
+    xferReadChunkFunc       readChunk;
+    void *                  readCtx;
+    const uint8_t *         image;
+    uint32_t                imageSize;
+    xferProgressFunc        progress;
+    void *                  progressCtx;
+    uint16_t                chunkLen;
+    uint16_t                windowSize;
+    uint32_t                ackTimeoutMS;
+    uint8_t                 maxRetransmits;
+    uint32_t                startOffset;
+    xferRttStruct *         rtt;
+}xferWindowParamsStruct;
+
+/*
+** One in-flight chunk.  "chunk" points at "data", or into the caller's
+** image.
+**
+*/
+typedef struct
+{
+    uint32_t                seq;
+    uint32_t                offset;
+    uint16_t                len;
+    bool                    inUse;
+    bool                    acked;
+    uint8_t                 retries;
+    ASYNC_TIMER_STRUCT      sentTimer;
+    uint64_t                sentUS;
+    const uint8_t *         chunk;
+    uint8_t                 data[XFER_MAX_CHUNK_LEN];
+}xferWindowSlotStruct;
+
+/*
+** Window engine state, with one slot per chunk that may be in flight.
+** Made by xferWindowCreate() for the window actually used: each slot
+** holds a whole chunk.
+**
+*/
+typedef struct
+{
+    uint32_t                baseSeq;
+    uint32_t                nextSeq;
+    uint32_t                nextOffset;
+    bool                    endOfData;
+    uint16_t                slotCount;
+    xferWindowSlotStruct    slots[];
+}xferWindowStruct;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: xferWindowCreate
+**
+** DESCRIPTION: Allocates engine state for up to "windowSize" chunks in
+**              flight.
+**
+** PARAMETERS: windowSize: 0 is taken as 1; more than
+**                         XFER_MAX_WINDOW_SIZE as that.
+**
+** RETURNS: NULL if out of memory.  Free with xferWindowDestroy().
+**
+** COMMENTS: Size it for the effective window: a stop-and-wait transfer
+**           only needs one slot.
+**
+*/
+xferWindowStruct *xferWindowCreate(uint16_t windowSize);
+
+/*!
+** FUNCTION: xferWindowDestroy
+**
+** DESCRIPTION: Frees engine state from xferWindowCreate().
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: NULL is ignored.
+**
+*/
+void xferWindowDestroy(xferWindowStruct *window);
+
+/*!
+** FUNCTION: xferWindowRun
+**
+** DESCRIPTION: Sends everything "readChunk" produces, keeping up to
+**              windowSize chunks in flight and retransmitting only the
+**              ones that were not acknowledged.
+**
+** PARAMETERS: window: From xferWindowCreate(), owned by the caller.
+**             stats:  OPTIONAL.
+**
+** RETURNS: true if every chunk was acknowledged.
+**
+** COMMENTS: The effective window is the smallest of windowSize, the
+**           transport's maxWindow and the window's slot count.
+**
+*/
+bool xferWindowRun(xferWindowStruct *window,
+                   const xferWindowParamsStruct *params,
+                   xferWindowStatsStruct *stats);
+
+/*!
+** FUNCTION: xferWindowSizeForDeviceType
+**
+** DESCRIPTION: Looks up the configured window size for a device type.
+**
+** PARAMETERS:
+**
+** RETURNS: The entry from XFER_WINDOW_BY_DEVICE_TYPE, or
+**          XFER_DEFAULT_WINDOW_SIZE if there isn't one.
+**
+** COMMENTS:
+**
+*/
+uint16_t xferWindowSizeForDeviceType(uint8_t deviceType);
+
+#if defined(__cplusplus)
+}
+#endif
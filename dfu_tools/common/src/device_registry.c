@@ -0,0 +1,952 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: device_registry.c
+**
+** DESCRIPTION: Every DFU-mode device heard on the wire, indexed by MAC
+**              and by TYPE/VARIANT, with change notifications.
+**
+**   Entries live in a fixed pool and are threaded onto three lists:
+**   a hash chain by MAC, a list per TYPE/VARIANT bucket, and an age
+**   list (least recently heard first) that expiry walks from the front.
+**   Links are pool index + 1, so 0 is "none".
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "device_registry.h"
+
+#define REGISTRY_ENTRY(ref)                     (&entries[(ref) - 1])
+
+/*
+** Most events one locked update raises: a device pushed out of a full
+** registry, then the new one.
+**
+*/
+#define REGISTRY_MAX_PENDING                    (2U)
+
+/*
+** One known device.
+**
+*/
+typedef struct
+{
+    deviceInfoStruct                info;
+    uint16_t                        hashNext;
+    uint16_t                        typePrev;
+    uint16_t                        typeNext;
+    uint16_t                        agePrev;
+    uint16_t                        ageNext;
+    bool                            inUse;
+}deviceRegistryEntryStruct;
+
+/*
+** One subscriber.
+**
+*/
+typedef struct
+{
+    deviceRegistryCallback          callback;
+    void *                          ctx;
+}deviceRegistryListenerStruct;
+
+/*
+** Events raised while the registry is locked, and who to give them to
+** once it isn't.
+**
+*/
+typedef struct
+{
+    deviceRegistryListenerStruct    listeners[DEVICE_REGISTRY_MAX_LISTENERS];
+    deviceRegistryEventEnum         events[REGISTRY_MAX_PENDING];
+    deviceInfoStruct                devices[REGISTRY_MAX_PENDING];
+    uint32_t                        count;
+}deviceRegistryPendingStruct;
+
+static deviceRegistryEntryStruct    entries[DEVICE_REGISTRY_MAX_DEVICES];
+static uint16_t                     macBuckets[DEVICE_REGISTRY_HASH_BUCKETS];
+static uint16_t                     typeBuckets[DEVICE_REGISTRY_TYPE_BUCKETS];
+static uint16_t                     ageHead = 0;
+static uint16_t                     ageTail = 0;
+static uint16_t                     freeHead = 0;
+static uint32_t                     deviceCount = 0;
+static bool                         registryReady = false;
+static deviceRegistryListenerStruct listeners[DEVICE_REGISTRY_MAX_LISTENERS];
+static pthread_mutex_t              registryLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static void _deviceRegistryInit(void);
+static uint32_t _deviceRegistryMacBucket(const uint8_t *mac);
+static uint32_t _deviceRegistryTypeBucket(uint8_t deviceType, uint8_t deviceVariant);
+static uint16_t _deviceRegistryLookup(const uint8_t *mac);
+static uint16_t _deviceRegistryAdd(const deviceInfoStruct *device, deviceRegistryPendingStruct *pending);
+static void _deviceRegistryRemove(uint16_t ref, deviceRegistryPendingStruct *pending);
+static void _deviceRegistryTypeLink(uint16_t ref);
+static void _deviceRegistryTypeUnlink(uint16_t ref);
+static void _deviceRegistryAgeLink(uint16_t ref);
+static void _deviceRegistryAgeUnlink(uint16_t ref);
+static bool _deviceRegistryChanged(const deviceInfoStruct *was, const deviceInfoStruct *now);
+static void _deviceRegistryPendingStart(deviceRegistryPendingStruct *pending);
+static void _deviceRegistryNotify(deviceRegistryPendingStruct *pending, deviceRegistryEventEnum event, const deviceInfoStruct *device);
+static void _deviceRegistryDeliver(const deviceRegistryPendingStruct *pending);
+static uint32_t _deviceRegistryExpireOne(time_t now, bool all);
+
+
+/*!
+** FUNCTION: deviceRegistrySubscribe
+**
+** DESCRIPTION: Starts delivering change events to a callback.
+**
+** PARAMETERS: replay: true to deliver APPEARED for every device already
+**                     in the registry first.
+**
+** RETURNS: false if DEVICE_REGISTRY_MAX_LISTENERS are already
+**          subscribed, or there was no memory for the replay.
+**
+** COMMENTS: The replay is a copy taken as the callback is added, and is
+**           delivered with the registry unlocked, so an event raised on
+**           another thread meanwhile may arrive ahead of it.
+**
+*/
+bool deviceRegistrySubscribe(deviceRegistryCallback callback, void *ctx, bool replay)
+{
+    bool                            ret = false;
+    deviceInfoStruct *              devices = NULL;
+    uint32_t                        count = 0;
+    uint32_t                        index;
+    uint16_t                        ref;
+
+    if (callback)
+    {
+        pthread_mutex_lock(&registryLock);
+        _deviceRegistryInit();
+
+        if ( (replay) && (deviceCount > 0) )
+        {
+            devices = (deviceInfoStruct *)malloc(deviceCount * sizeof(deviceInfoStruct));
+        }
+
+        if ( (!replay) || (deviceCount == 0) || (devices) )
+        {
+            for (index = 0; index < DEVICE_REGISTRY_MAX_LISTENERS; index++)
+            {
+                if (listeners[index].callback == NULL)
+                {
+                    listeners[index].callback = callback;
+                    listeners[index].ctx = ctx;
+                    ret = true;
+                    break;
+                }
+            }
+        }
+
+        if ( (ret) && (devices) )
+        {
+            for (ref = ageHead; ref != 0; ref = REGISTRY_ENTRY(ref)->ageNext)
+            {
+                devices[count++] = REGISTRY_ENTRY(ref)->info;
+            }
+        }
+
+        pthread_mutex_unlock(&registryLock);
+
+        for (index = 0; index < count; index++)
+        {
+            callback(ctx, DEVICE_EVENT_APPEARED, &devices[index]);
+        }
+        free(devices);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: deviceRegistryUnsubscribe
+**
+** DESCRIPTION: Stops delivering events to a callback (matched on both
+**              the callback and its context).
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: An event already being delivered on another thread may
+**           still reach the callback after this returns.
+**
+*/
+void deviceRegistryUnsubscribe(deviceRegistryCallback callback, void *ctx)
+{
+    uint32_t                        index;
+
+    pthread_mutex_lock(&registryLock);
+
+    for (index = 0; index < DEVICE_REGISTRY_MAX_LISTENERS; index++)
+    {
+        if (
+               (listeners[index].callback == callback) &&
+               (listeners[index].ctx == ctx)
+           )
+        {
+            listeners[index].callback = NULL;
+            listeners[index].ctx = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&registryLock);
+
+    return;
+}
+
+/*!
+** FUNCTION: deviceRegistryUpdate
+**
+** DESCRIPTION: Adds or refreshes one device from a discovery record.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A record already older than the TTL is ignored, so a stale
+**           entry in the client's list doesn't come back to life.
+**
+*/
+void deviceRegistryUpdate(const deviceInfoStruct *device)
+{
+    uint16_t                        ref;
+    deviceRegistryEntryStruct *     entry;
+    bool                            heardAgain;
+    deviceRegistryPendingStruct     pending;
+
+    if (device)
+    {
+        pthread_mutex_lock(&registryLock);
+        _deviceRegistryInit();
+        _deviceRegistryPendingStart(&pending);
+
+        ref = _deviceRegistryLookup(device->physicalID);
+        if (ref != 0)
+        {
+            entry = REGISTRY_ENTRY(ref);
+            heardAgain = (device->timestamp > entry->info.timestamp);
+
+            if (_deviceRegistryChanged(&entry->info, device))
+            {
+                bool                retype = ( (entry->info.deviceType != device->deviceType) ||
+                                               (entry->info.deviceVariant != device->deviceVariant) );
+
+                if (retype)
+                {
+                    _deviceRegistryTypeUnlink(ref);
+                }
+                entry->info = *device;
+                if (retype)
+                {
+                    _deviceRegistryTypeLink(ref);
+                }
+
+                _deviceRegistryNotify(&pending, DEVICE_EVENT_CHANGED, &entry->info);
+            }
+
+            // Heard again: to the back of the age list
+            if (heardAgain)
+            {
+                entry->info.timestamp = device->timestamp;
+                _deviceRegistryAgeUnlink(ref);
+                _deviceRegistryAgeLink(ref);
+            }
+        }
+        else
+        if ((time(NULL) - device->timestamp) < (time_t)DEVICE_REGISTRY_TTL_SECS)
+        {
+            ref = _deviceRegistryAdd(device, &pending);
+            if (ref != 0)
+            {
+                _deviceRegistryNotify(&pending, DEVICE_EVENT_APPEARED, &REGISTRY_ENTRY(ref)->info);
+            }
+        }
+
+        pthread_mutex_unlock(&registryLock);
+        _deviceRegistryDeliver(&pending);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: deviceRegistryCollect
+**
+** DESCRIPTION: Takes in everything the client has heard
+**              (dfuClientAPI_LL_GetFirstDevice / GetNextDevice), then
+**              expires devices that have gone quiet.
+**
+** PARAMETERS:
+**
+** RETURNS: How many discovery records were read.
+**
+** COMMENTS:
+**
+*/
+uint32_t deviceRegistryCollect(dfuClientAPI *apiHandle)
+{
+    uint32_t                        ret = 0;
+    deviceInfoStruct *              deviceRecord;
+
+    if (apiHandle)
+    {
+        deviceRecord = dfuClientAPI_LL_GetFirstDevice(apiHandle);
+        while (deviceRecord)
+        {
+            deviceRegistryUpdate(deviceRecord);
+            ret++;
+
+            deviceRecord = dfuClientAPI_LL_GetNextDevice(apiHandle);
+        }
+
+        deviceRegistryExpire(time(NULL));
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: deviceRegistryExpire
+**
+** DESCRIPTION: Removes every device not heard for
+**              DEVICE_REGISTRY_TTL_SECS.
+**
+** PARAMETERS: now: Usually time(NULL).
+**
+** RETURNS: How many were removed.
+**
+** COMMENTS: Only looks at the devices that actually expire.
+**
+*/
+uint32_t deviceRegistryExpire(time_t now)
+{
+    uint32_t                        ret = 0;
+
+    while (_deviceRegistryExpireOne(now, false) > 0)
+    {
+        ret++;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: deviceRegistryFind
+**
+** DESCRIPTION: Looks up one device by MAC.
+**
+** PARAMETERS: mac:    MAX_INTERFACE_MAC_LEN bytes.
+**             device: Gets a copy of the record.  May be NULL.
+**
+** RETURNS: true if the device is known.
+**
+** COMMENTS:
+**
+*/
+bool deviceRegistryFind(const uint8_t *mac, deviceInfoStruct *device)
+{
+    bool                            ret = false;
+    uint16_t                        ref;
+
+    if (mac)
+    {
+        pthread_mutex_lock(&registryLock);
+        _deviceRegistryInit();
+
+        ref = _deviceRegistryLookup(mac);
+        if (ref != 0)
+        {
+            if (device)
+            {
+                *device = REGISTRY_ENTRY(ref)->info;
+            }
+            ret = true;
+        }
+
+        pthread_mutex_unlock(&registryLock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: deviceRegistryFindByType
+**
+** DESCRIPTION: Every known device of one TYPE and VARIANT.
+**
+** PARAMETERS: devices:    Gets copies of the records, newest first.
+**             maxDevices: Room in "devices".
+**
+** RETURNS: How many were copied.
+**
+** COMMENTS: Other TYPE/VARIANTs can share the bucket; they are skipped.
+**
+*/
+uint32_t deviceRegistryFindByType(uint8_t deviceType,
+                                  uint8_t deviceVariant,
+                                  deviceInfoStruct *devices,
+                                  uint32_t maxDevices)
+{
+    uint32_t                        ret = 0;
+    uint16_t                        ref;
+
+    if (devices)
+    {
+        pthread_mutex_lock(&registryLock);
+        _deviceRegistryInit();
+
+        ref = typeBuckets[_deviceRegistryTypeBucket(deviceType, deviceVariant)];
+        while ( (ref != 0) && (ret < maxDevices) )
+        {
+            deviceRegistryEntryStruct *     entry = REGISTRY_ENTRY(ref);
+
+            if (
+                   (entry->info.deviceType == deviceType) &&
+                   (entry->info.deviceVariant == deviceVariant)
+               )
+            {
+                devices[ret++] = entry->info;
+            }
+            ref = entry->typeNext;
+        }
+
+        pthread_mutex_unlock(&registryLock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: deviceRegistryCount
+**
+** DESCRIPTION: How many devices are known.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint32_t deviceRegistryCount(void)
+{
+    uint32_t                        ret;
+
+    pthread_mutex_lock(&registryLock);
+    ret = deviceCount;
+    pthread_mutex_unlock(&registryLock);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: deviceRegistryClear
+**
+** DESCRIPTION: Forgets every device (each one is reported VANISHED).
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void deviceRegistryClear(void)
+{
+    while (_deviceRegistryExpireOne(0, true) > 0)
+    {
+        // One device at a time
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _deviceRegistryInit
+**
+** DESCRIPTION: Threads the pool onto the free list, the first time.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held.  The free list reuses
+**           "hashNext".
+**
+*/
+static void _deviceRegistryInit(void)
+{
+    uint32_t                        index;
+
+    if (!registryReady)
+    {
+        for (index = 0; index < DEVICE_REGISTRY_MAX_DEVICES; index++)
+        {
+            entries[index].hashNext = (index + 1 < DEVICE_REGISTRY_MAX_DEVICES) ? (uint16_t)(index + 2) : 0;
+            entries[index].inUse = false;
+        }
+        freeHead = 1;
+        registryReady = true;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryMacBucket
+**
+** DESCRIPTION: FNV-1a of the MAC.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _deviceRegistryMacBucket(const uint8_t *mac)
+{
+    uint32_t                        hash = 2166136261U;
+    uint32_t                        index;
+
+    for (index = 0; index < MAX_INTERFACE_MAC_LEN; index++)
+    {
+        hash ^= mac[index];
+        hash *= 16777619U;
+    }
+
+    return (hash & (DEVICE_REGISTRY_HASH_BUCKETS - 1));
+}
+
+/*!
+** FUNCTION: _deviceRegistryTypeBucket
+**
+** DESCRIPTION:
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _deviceRegistryTypeBucket(uint8_t deviceType, uint8_t deviceVariant)
+{
+    return ((((uint32_t)deviceType * 31U) + deviceVariant) & (DEVICE_REGISTRY_TYPE_BUCKETS - 1));
+}
+
+/*!
+** FUNCTION: _deviceRegistryLookup
+**
+** DESCRIPTION: Finds a device by MAC.
+**
+** PARAMETERS:
+**
+** RETURNS: Its link, or 0.
+**
+** COMMENTS: Called with registryLock held.
+**
+*/
+static uint16_t _deviceRegistryLookup(const uint8_t *mac)
+{
+    uint16_t                        ret = macBuckets[_deviceRegistryMacBucket(mac)];
+
+    while (
+              (ret != 0) &&
+              (memcmp(REGISTRY_ENTRY(ret)->info.physicalID, mac, MAX_INTERFACE_MAC_LEN) != 0)
+          )
+    {
+        ret = REGISTRY_ENTRY(ret)->hashNext;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _deviceRegistryAdd
+**
+** DESCRIPTION: Takes a free entry for a new device and links it in.
+**
+** PARAMETERS:
+**
+** RETURNS: Its link.
+**
+** COMMENTS: Called with registryLock held.  When the pool is full the
+**           least recently heard device is pushed out (VANISHED).
+**
+*/
+static uint16_t _deviceRegistryAdd(const deviceInfoStruct *device, deviceRegistryPendingStruct *pending)
+{
+    uint16_t                        ret;
+    deviceRegistryEntryStruct *     entry;
+    uint32_t                        bucket;
+
+    if ( (freeHead == 0) && (ageHead != 0) )
+    {
+        _deviceRegistryRemove(ageHead, pending);
+    }
+
+    ret = freeHead;
+    if (ret != 0)
+    {
+        entry = REGISTRY_ENTRY(ret);
+        freeHead = entry->hashNext;
+
+        memset(entry, 0, sizeof(deviceRegistryEntryStruct));
+        entry->info = *device;
+        entry->inUse = true;
+
+        bucket = _deviceRegistryMacBucket(device->physicalID);
+        entry->hashNext = macBuckets[bucket];
+        macBuckets[bucket] = ret;
+
+        _deviceRegistryTypeLink(ret);
+        _deviceRegistryAgeLink(ret);
+        deviceCount++;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _deviceRegistryRemove
+**
+** DESCRIPTION: Unlinks a device, queues VANISHED and frees its entry.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held.
+**
+*/
+static void _deviceRegistryRemove(uint16_t ref, deviceRegistryPendingStruct *pending)
+{
+    deviceRegistryEntryStruct *     entry = REGISTRY_ENTRY(ref);
+    uint16_t *                      link = &macBuckets[_deviceRegistryMacBucket(entry->info.physicalID)];
+
+    while ( (*link != 0) && (*link != ref) )
+    {
+        link = &REGISTRY_ENTRY(*link)->hashNext;
+    }
+    if (*link == ref)
+    {
+        *link = entry->hashNext;
+    }
+
+    _deviceRegistryTypeUnlink(ref);
+    _deviceRegistryAgeUnlink(ref);
+    deviceCount--;
+
+    _deviceRegistryNotify(pending, DEVICE_EVENT_VANISHED, &entry->info);
+
+    entry->inUse = false;
+    entry->hashNext = freeHead;
+    freeHead = ref;
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryTypeLink
+**
+** DESCRIPTION: Puts a device at the front of its TYPE/VARIANT list.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held.
+**
+*/
+static void _deviceRegistryTypeLink(uint16_t ref)
+{
+    deviceRegistryEntryStruct *     entry = REGISTRY_ENTRY(ref);
+    uint16_t *                      head = &typeBuckets[_deviceRegistryTypeBucket(entry->info.deviceType,
+                                                                                  entry->info.deviceVariant)];
+
+    entry->typePrev = 0;
+    entry->typeNext = *head;
+    if (*head != 0)
+    {
+        REGISTRY_ENTRY(*head)->typePrev = ref;
+    }
+    *head = ref;
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryTypeUnlink
+**
+** DESCRIPTION: Takes a device off its TYPE/VARIANT list.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held, before its TYPE/VARIANT
+**           changes.
+**
+*/
+static void _deviceRegistryTypeUnlink(uint16_t ref)
+{
+    deviceRegistryEntryStruct *     entry = REGISTRY_ENTRY(ref);
+
+    if (entry->typePrev != 0)
+    {
+        REGISTRY_ENTRY(entry->typePrev)->typeNext = entry->typeNext;
+    }
+    else
+    {
+        typeBuckets[_deviceRegistryTypeBucket(entry->info.deviceType, entry->info.deviceVariant)] = entry->typeNext;
+    }
+
+    if (entry->typeNext != 0)
+    {
+        REGISTRY_ENTRY(entry->typeNext)->typePrev = entry->typePrev;
+    }
+
+    entry->typePrev = 0;
+    entry->typeNext = 0;
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryAgeLink
+**
+** DESCRIPTION: Puts a device at the back (most recently heard end) of
+**              the age list.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held.
+**
+*/
+static void _deviceRegistryAgeLink(uint16_t ref)
+{
+    deviceRegistryEntryStruct *     entry = REGISTRY_ENTRY(ref);
+
+    entry->agePrev = ageTail;
+    entry->ageNext = 0;
+    if (ageTail != 0)
+    {
+        REGISTRY_ENTRY(ageTail)->ageNext = ref;
+    }
+    else
+    {
+        ageHead = ref;
+    }
+    ageTail = ref;
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryAgeUnlink
+**
+** DESCRIPTION: Takes a device off the age list.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held.
+**
+*/
+static void _deviceRegistryAgeUnlink(uint16_t ref)
+{
+    deviceRegistryEntryStruct *     entry = REGISTRY_ENTRY(ref);
+
+    if (entry->agePrev != 0)
+    {
+        REGISTRY_ENTRY(entry->agePrev)->ageNext = entry->ageNext;
+    }
+    else
+    {
+        ageHead = entry->ageNext;
+    }
+
+    if (entry->ageNext != 0)
+    {
+        REGISTRY_ENTRY(entry->ageNext)->agePrev = entry->agePrev;
+    }
+    else
+    {
+        ageTail = entry->agePrev;
+    }
+
+    entry->agePrev = 0;
+    entry->ageNext = 0;
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryChanged
+**
+** DESCRIPTION: Does a new record say anything different (apart from
+**              when it was heard)?
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _deviceRegistryChanged(const deviceInfoStruct *was, const deviceInfoStruct *now)
+{
+    return ( (was->deviceType != now->deviceType) ||
+             (was->deviceVariant != now->deviceVariant) ||
+             (was->statusBits != now->statusBits) ||
+             (was->coreImageMask != now->coreImageMask) ||
+             (was->blVersionMajor != now->blVersionMajor) ||
+             (was->blVersionMinor != now->blVersionMinor) ||
+             (was->blVersionPatch != now->blVersionPatch) );
+}
+
+/*!
+** FUNCTION: _deviceRegistryPendingStart
+**
+** DESCRIPTION: Readies a pending list: no events yet, and the current
+**              subscribers to hand them to.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held.
+**
+*/
+static void _deviceRegistryPendingStart(deviceRegistryPendingStruct *pending)
+{
+    memcpy(pending->listeners, listeners, sizeof(listeners));
+    pending->count = 0;
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryNotify
+**
+** DESCRIPTION: Queues an event for every subscriber.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock held.  The device is copied, since
+**           its entry may be reused before the event is delivered.
+**
+*/
+static void _deviceRegistryNotify(deviceRegistryPendingStruct *pending, deviceRegistryEventEnum event, const deviceInfoStruct *device)
+{
+    if (pending->count < REGISTRY_MAX_PENDING)
+    {
+        pending->events[pending->count] = event;
+        pending->devices[pending->count] = *device;
+        pending->count++;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryDeliver
+**
+** DESCRIPTION: Hands the queued events to the subscribers.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with registryLock released, so a callback may use
+**           the registry.
+**
+*/
+static void _deviceRegistryDeliver(const deviceRegistryPendingStruct *pending)
+{
+    uint32_t                        event;
+    uint32_t                        index;
+
+    for (event = 0; event < pending->count; event++)
+    {
+        for (index = 0; index < DEVICE_REGISTRY_MAX_LISTENERS; index++)
+        {
+            if (pending->listeners[index].callback)
+            {
+                pending->listeners[index].callback(pending->listeners[index].ctx,
+                                                   pending->events[event],
+                                                   &pending->devices[event]);
+            }
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _deviceRegistryExpireOne
+**
+** DESCRIPTION: Removes the least recently heard device, if it has
+**              expired (or "all"), and reports it.
+**
+** PARAMETERS:
+**
+** RETURNS: 1 if a device was removed, else 0.
+**
+** COMMENTS: One device per lock, so VANISHED goes out unlocked.
+**
+*/
+static uint32_t _deviceRegistryExpireOne(time_t now, bool all)
+{
+    uint32_t                        ret = 0;
+    deviceRegistryPendingStruct     pending;
+
+    pthread_mutex_lock(&registryLock);
+    _deviceRegistryPendingStart(&pending);
+
+    if (
+           (ageHead != 0) &&
+           (
+               (all) ||
+               ((now - REGISTRY_ENTRY(ageHead)->info.timestamp) >= (time_t)DEVICE_REGISTRY_TTL_SECS)
+           )
+       )
+    {
+        _deviceRegistryRemove(ageHead, &pending);
+        ret = 1;
+    }
+
+    pthread_mutex_unlock(&registryLock);
+    _deviceRegistryDeliver(&pending);
+
+    return (ret);
+}
@@ -0,0 +1,1334 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: dfu_sim.c
+**
+** DESCRIPTION: Simulated DFU target.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dfu_sim.h"
+#include "async_timer.h"
+
+/*
+** How far past the cumulative point the device keeps chunks (one bit
+** each in "held").  The ack's selective mask reports the first 32.
+**
+*/
+#define DFU_SIM_SPAN                (64U)
+
+/*
+** Acks in flight back to the sender.
+**
+*/
+#define DFU_SIM_ACK_QUEUE           (64U)
+
+/*
+** One image the device knows about.
+**
+*/
+typedef struct
+{
+    bool                            inUse;
+    uint8_t                         index;
+    uint8_t                         flags;
+    uint32_t                        address;
+    uint32_t                        size;
+    uint32_t                        received;
+    uint8_t *                       data;
+}dfuSimImageStruct;
+
+/*
+** One chunk waiting in the device's receive buffer.
+**
+*/
+typedef struct
+{
+    uint32_t                        seq;
+    uint32_t                        offset;
+    uint16_t                        len;
+    uint64_t                        arriveUS;
+    uint8_t *                       data;
+}dfuSimChunkStruct;
+
+/*
+** One ack on its way back.
+**
+*/
+typedef struct
+{
+    xferAckStruct                   ack;
+    uint64_t                        readyUS;
+}dfuSimAckStruct;
+
+/*
+** Simulated device.  Everything below "lock" is under it.
+**
+*/
+struct dfuSimDeviceStruct
+{
+    bool                            inUse;
+    dfuSimConfigStruct              config;
+    char                            macStr[18];
+    pthread_t                       thread;
+    pthread_mutex_t                 lock;
+    pthread_cond_t                  rxCond;
+    pthread_cond_t                  ackCond;
+
+    bool                            stopping;
+    bool                            sessionOpen;
+    uint32_t                        challenge;
+    uint32_t                        flashUsed;
+    dfuSimImageStruct               images[DFU_SIM_MAX_IMAGES];
+    dfuSimImageStruct *             receiving;
+    dfuSimImageStruct *             completed;
+
+    // Window transport
+    dfuSimChunkStruct *             rxQueue;
+    uint8_t *                       rxData;
+    uint32_t                        rxHead;
+    uint32_t                        rxCount;
+    uint32_t                        cumulativeSeq;
+    uint64_t                        held;
+    uint32_t                        heldEnd[DFU_SIM_SPAN];
+    uint32_t                        sinceAck;
+    dfuSimAckStruct                 acks[DFU_SIM_ACK_QUEUE];
+    uint32_t                        ackHead;
+    uint32_t                        ackCount;
+};
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          INTERNAL SUPPORT PROTOTYPES
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+static void *_dfuSimThread(void *arg);
+static void _dfuSimReceiveChunk(dfuSimDeviceStruct *sim, const dfuSimChunkStruct *chunk);
+static void _dfuSimQueueAck(dfuSimDeviceStruct *sim, bool rejected);
+static bool _dfuSimSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+static bool _dfuSimPollAck(void *ctx, xferAckStruct *ack, uint32_t timeoutMS);
+static bool _dfuSimGroupSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+static bool _dfuSimGroupSendRepair(void *ctx, uint32_t member, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+static bool _dfuSimGroupPollAck(void *ctx, uint32_t member, xferGroupAckStruct *ack, uint32_t timeoutMS);
+static dfuSimImageStruct *_dfuSimFindImage(dfuSimDeviceStruct *sim, uint8_t imageIndex);
+static void _dfuSimDropImage(dfuSimDeviceStruct *sim, dfuSimImageStruct *image);
+static void _dfuSimResetTransport(dfuSimDeviceStruct *sim);
+static uint32_t _dfuSimWriteUS(const dfuSimDeviceStruct *sim, uint32_t len);
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          LOCAL DATA
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+static dfuSimDeviceStruct           simDevices[DFU_SIM_MAX_DEVICES];
+static pthread_mutex_t              simPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          EXPORTED FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: dfuSimDefaultConfig
+**
+** DESCRIPTION: Fills in the defaults (DFU_SIM_DEFAULT_xxx).
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The address is a locally administered one; give each
+**           device its own last byte.
+**
+*/
+void dfuSimDefaultConfig(dfuSimConfigStruct *config)
+{
+    static const uint8_t            defaultMAC[MAX_INTERFACE_MAC_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+    if (config)
+    {
+        memset(config, 0, sizeof(*config));
+        memcpy(config->mac, defaultMAC, sizeof(config->mac));
+        config->blVersionMajor = 1;
+        config->maxMTU = MAX_MSG_LEN;
+        config->flashSize = DFU_SIM_DEFAULT_FLASH_SIZE;
+        config->sectorSize = DFU_SIM_DEFAULT_SECTOR_SIZE;
+        config->eraseUSPerSector = DFU_SIM_DEFAULT_ERASE_US;
+        config->writeUSPerKB = DFU_SIM_DEFAULT_WRITE_US_PER_KB;
+        config->installUS = DFU_SIM_DEFAULT_INSTALL_US;
+        config->latencyUS = DFU_SIM_DEFAULT_LATENCY_US;
+        config->rxWindow = DFU_SIM_DEFAULT_RX_WINDOW;
+        config->ackEvery = DFU_SIM_DEFAULT_ACK_EVERY;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: dfuSimCreate
+**
+** DESCRIPTION: Powers up a simulated device.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+dfuSimDeviceStruct *dfuSimCreate(const dfuSimConfigStruct *config)
+{
+    dfuSimDeviceStruct *            ret = NULL;
+    uint32_t                        index;
+
+    pthread_mutex_lock(&simPoolLock);
+
+    for (index = 0; (config) && (index < DFU_SIM_MAX_DEVICES); index++)
+    {
+        if (!simDevices[index].inUse)
+        {
+            dfuSimDeviceStruct *    sim = &simDevices[index];
+
+            memset(sim, 0, sizeof(*sim));
+            sim->config = *config;
+            if ( (sim->config.rxWindow == 0) || (sim->config.rxWindow > DFU_SIM_SPAN) )
+            {
+                sim->config.rxWindow = DFU_SIM_SPAN;
+            }
+            if (sim->config.ackEvery == 0)
+            {
+                sim->config.ackEvery = 1;
+            }
+            if (sim->config.sectorSize == 0)
+            {
+                sim->config.sectorSize = DFU_SIM_DEFAULT_SECTOR_SIZE;
+            }
+
+            snprintf(sim->macStr,
+                     sizeof(sim->macStr),
+                     "%02X:%02X:%02X:%02X:%02X:%02X",
+                     sim->config.mac[0],
+                     sim->config.mac[1],
+                     sim->config.mac[2],
+                     sim->config.mac[3],
+                     sim->config.mac[4],
+                     sim->config.mac[5]);
+
+            sim->rxQueue = (dfuSimChunkStruct *)calloc(sim->config.rxWindow, sizeof(dfuSimChunkStruct));
+            sim->rxData = (uint8_t *)malloc((size_t)sim->config.rxWindow * XFER_MAX_CHUNK_LEN);
+
+            if ( (sim->rxQueue) && (sim->rxData) )
+            {
+                uint32_t            slot;
+
+                for (slot = 0; slot < sim->config.rxWindow; slot++)
+                {
+                    sim->rxQueue[slot].data = &sim->rxData[(size_t)slot * XFER_MAX_CHUNK_LEN];
+                }
+
+                pthread_mutex_init(&sim->lock, NULL);
+                pthread_cond_init(&sim->rxCond, NULL);
+                pthread_cond_init(&sim->ackCond, NULL);
+
+                if (pthread_create(&sim->thread, NULL, _dfuSimThread, sim) == 0)
+                {
+                    sim->inUse = true;
+                    ret = sim;
+                }
+                else
+                {
+                    printf("\r\n Could not start the simulated device's thread!");
+                    pthread_cond_destroy(&sim->ackCond);
+                    pthread_cond_destroy(&sim->rxCond);
+                    pthread_mutex_destroy(&sim->lock);
+                }
+            }
+            else
+            {
+                printf("\r\n Out of memory for the simulated device!");
+            }
+
+            if (ret == NULL)
+            {
+                free(sim->rxQueue);
+                free(sim->rxData);
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&simPoolLock);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimDestroy
+**
+** DESCRIPTION: Stops the device's thread and frees everything it holds.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void dfuSimDestroy(dfuSimDeviceStruct *sim)
+{
+    uint32_t                        index;
+
+    if ( (sim) && (sim->inUse) )
+    {
+        pthread_mutex_lock(&sim->lock);
+        sim->stopping = true;
+        pthread_cond_broadcast(&sim->rxCond);
+        pthread_mutex_unlock(&sim->lock);
+
+        pthread_join(sim->thread, NULL);
+
+        for (index = 0; index < DFU_SIM_MAX_IMAGES; index++)
+        {
+            free(sim->images[index].data);
+        }
+        free(sim->rxQueue);
+        free(sim->rxData);
+
+        pthread_cond_destroy(&sim->ackCond);
+        pthread_cond_destroy(&sim->rxCond);
+        pthread_mutex_destroy(&sim->lock);
+
+        pthread_mutex_lock(&simPoolLock);
+        sim->inUse = false;
+        pthread_mutex_unlock(&simPoolLock);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: dfuSimMACString
+**
+** DESCRIPTION: The device's address as a destination string.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+const char *dfuSimMACString(dfuSimDeviceStruct *sim)
+{
+    return ( (sim) ? sim->macStr : "" );
+}
+
+/*!
+** FUNCTION: dfuSimDiscoveryRecord
+**
+** DESCRIPTION: The record the device would broadcast right now.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void dfuSimDiscoveryRecord(dfuSimDeviceStruct *sim, deviceInfoStruct *record)
+{
+    uint32_t                        index;
+
+    if ( (sim) && (record) )
+    {
+        memset(record, 0, sizeof(*record));
+        memcpy(record->physicalID, sim->config.mac, sizeof(sim->config.mac));
+        record->deviceType = sim->config.deviceType;
+        record->deviceVariant = sim->config.deviceVariant;
+        record->blVersionMajor = sim->config.blVersionMajor;
+        record->blVersionMinor = sim->config.blVersionMinor;
+        record->blVersionPatch = sim->config.blVersionPatch;
+        record->timestamp = time(NULL);
+
+        pthread_mutex_lock(&sim->lock);
+        record->statusBits = (sim->receiving) ? sim->receiving->flags : 0;
+        for (index = 0; index < DFU_SIM_MAX_IMAGES; index++)
+        {
+            const dfuSimImageStruct *   image = &sim->images[index];
+
+            if (
+                   (image->inUse) &&
+                   (image->flags & DFU_SIM_STATUS_INSTALLED) &&
+                   (image->index >= 1) &&
+                   (image->index <= 8)
+               )
+            {
+                record->coreImageMask |= (uint8_t)(1U << (image->index - 1));
+            }
+        }
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: dfuSimBeginSession
+**
+** DESCRIPTION: BEGIN_SESSION.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint32_t dfuSimBeginSession(dfuSimDeviceStruct *sim, uint8_t deviceType, uint8_t deviceVariant)
+{
+    uint32_t                        ret = 0;
+
+    if (
+           (sim) &&
+           (deviceType == sim->config.deviceType) &&
+           (deviceVariant == sim->config.deviceVariant)
+       )
+    {
+        // Any non-zero value will do; it only has to differ per session.
+        ret = (uint32_t)(TIMER_GetMicroseconds() * 2654435761ULL) | 1U;
+
+        pthread_mutex_lock(&sim->lock);
+        sim->challenge = ret;
+        sim->sessionOpen = false;
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimEndSession
+**
+** DESCRIPTION: END_SESSION.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimEndSession(dfuSimDeviceStruct *sim)
+{
+    bool                            ret = false;
+
+    if (sim)
+    {
+        pthread_mutex_lock(&sim->lock);
+        ret = sim->sessionOpen;
+        sim->sessionOpen = false;
+        sim->challenge = 0;
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimNegotiateMTU
+**
+** DESCRIPTION: NEGOTIATE_MTU.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint16_t dfuSimNegotiateMTU(dfuSimDeviceStruct *sim, uint16_t requested)
+{
+    uint16_t                        ret = 0;
+
+    if (sim)
+    {
+        ret = (requested < sim->config.maxMTU) ? requested : sim->config.maxMTU;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimBeginRcv
+**
+** DESCRIPTION: BEGIN_RCV.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A new image at an index replaces the old one.
+**
+*/
+bool dfuSimBeginRcv(dfuSimDeviceStruct *sim,
+                    uint8_t imageIndex,
+                    uint32_t imageSize,
+                    uint32_t imageAddress,
+                    bool isEncrypted)
+{
+    bool                            ret = false;
+    uint32_t                        sectors = 0;
+
+    (void)isEncrypted;
+
+    if (sim)
+    {
+        pthread_mutex_lock(&sim->lock);
+
+        if (
+               ( (sim->sessionOpen) ||
+                 ( (imageIndex == DFU_SIM_SESSION_IMAGE_INDEX) && (sim->challenge != 0) ) ) &&
+               (imageSize > 0)
+           )
+        {
+            dfuSimImageStruct *     image = _dfuSimFindImage(sim, imageIndex);
+
+            if (image)
+            {
+                _dfuSimDropImage(sim, image);
+            }
+            else
+            {
+                image = _dfuSimFindImage(sim, 0);
+            }
+
+            if (
+                   (image) &&
+                   (sim->flashUsed + imageSize <= sim->config.flashSize)
+               )
+            {
+                image->data = (uint8_t *)malloc(imageSize);
+                if (image->data)
+                {
+                    image->inUse = true;
+                    image->index = imageIndex;
+                    image->flags = (DFU_SIM_STATUS_RECEIVING | DFU_SIM_STATUS_PARTIAL_KEPT);
+                    image->address = imageAddress;
+                    image->size = imageSize;
+                    image->received = 0;
+                    sim->flashUsed += imageSize;
+                    sim->receiving = image;
+                    sim->completed = NULL;
+                    sectors = (imageSize + sim->config.sectorSize - 1) / sim->config.sectorSize;
+                    ret = true;
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+
+        // The erase, outside the lock (the device isn't answering anyway)
+        if (ret)
+        {
+            TIMER_SleepUS(sectors * sim->config.eraseUSPerSector);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimRcvData
+**
+** DESCRIPTION: RCV_DATA.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimRcvData(dfuSimDeviceStruct *sim, const uint8_t *data, uint32_t len)
+{
+    bool                            ret = false;
+
+    if ( (sim) && (data) )
+    {
+        pthread_mutex_lock(&sim->lock);
+
+        if (
+               (sim->receiving) &&
+               (sim->receiving->received + len <= sim->receiving->size)
+           )
+        {
+            memcpy(&sim->receiving->data[sim->receiving->received], data, len);
+            sim->receiving->received += len;
+            ret = true;
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+
+        TIMER_SleepUS(_dfuSimWriteUS(sim, len) + (2U * sim->config.latencyUS));
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimRcvComplete
+**
+** DESCRIPTION: RCV_COMPLETE.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimRcvComplete(dfuSimDeviceStruct *sim, uint32_t imageSize)
+{
+    bool                            ret = false;
+
+    if (sim)
+    {
+        pthread_mutex_lock(&sim->lock);
+
+        if (
+               (sim->receiving) &&
+               (sim->receiving->size == imageSize) &&
+               (sim->receiving->received == imageSize)
+           )
+        {
+            sim->receiving->flags = DFU_SIM_STATUS_COMPLETE;
+            sim->completed = sim->receiving;
+            sim->receiving = NULL;
+            ret = true;
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimImageStatus
+**
+** DESCRIPTION: IMAGE_STATUS.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimImageStatus(dfuSimDeviceStruct *sim,
+                       uint8_t *imageIndex,
+                       uint32_t imageAddress,
+                       uint8_t *flags,
+                       uint32_t *size)
+{
+    bool                            ret = false;
+
+    (void)imageAddress;
+
+    if ( (sim) && (imageIndex) && (flags) && (size) )
+    {
+        dfuSimImageStruct *         image;
+
+        pthread_mutex_lock(&sim->lock);
+
+        image = _dfuSimFindImage(sim, *imageIndex);
+        if (image)
+        {
+            *flags = image->flags;
+            *size = image->received;
+            ret = true;
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimInstallImage
+**
+** DESCRIPTION: INSTALL_IMAGE.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimInstallImage(dfuSimDeviceStruct *sim)
+{
+    bool                            ret = false;
+
+    if (sim)
+    {
+        pthread_mutex_lock(&sim->lock);
+
+        if (sim->completed)
+        {
+            sim->completed->flags |= DFU_SIM_STATUS_INSTALLED;
+            if (sim->completed->index == DFU_SIM_SESSION_IMAGE_INDEX)
+            {
+                sim->sessionOpen = (sim->challenge != 0);
+            }
+            sim->completed = NULL;
+            ret = true;
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+
+        if (ret)
+        {
+            TIMER_SleepUS(sim->config.installUS);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimReboot
+**
+** DESCRIPTION: REBOOT.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuSimReboot(dfuSimDeviceStruct *sim)
+{
+    bool                            ret = false;
+    uint32_t                        index;
+
+    if (sim)
+    {
+        pthread_mutex_lock(&sim->lock);
+
+        sim->sessionOpen = false;
+        sim->challenge = 0;
+        sim->receiving = NULL;
+        sim->completed = NULL;
+        for (index = 0; index < DFU_SIM_MAX_IMAGES; index++)
+        {
+            if (
+                   (sim->images[index].inUse) &&
+                   (!(sim->images[index].flags & DFU_SIM_STATUS_INSTALLED))
+               )
+            {
+                _dfuSimDropImage(sim, &sim->images[index]);
+            }
+        }
+        _dfuSimResetTransport(sim);
+        ret = true;
+
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimImageData
+**
+** DESCRIPTION: What the device has received for an image.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+const uint8_t *dfuSimImageData(dfuSimDeviceStruct *sim, uint8_t imageIndex, uint32_t *size)
+{
+    const uint8_t *                 ret = NULL;
+
+    if ( (sim) && (size) )
+    {
+        dfuSimImageStruct *         image;
+
+        pthread_mutex_lock(&sim->lock);
+
+        image = _dfuSimFindImage(sim, imageIndex);
+        if (image)
+        {
+            *size = image->received;
+            ret = image->data;
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuSimTransportOps
+**
+** DESCRIPTION: Fills in a window engine transport for this device.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void dfuSimTransportOps(dfuSimDeviceStruct *sim, xferTransportOps *ops)
+{
+    if ( (sim) && (ops) )
+    {
+        pthread_mutex_lock(&sim->lock);
+        _dfuSimResetTransport(sim);
+        pthread_mutex_unlock(&sim->lock);
+
+        memset(ops, 0, sizeof(*ops));
+        ops->ctx = sim;
+        ops->sendChunk = _dfuSimSendChunk;
+        ops->pollAck = _dfuSimPollAck;
+        ops->maxWindow = DFU_SIM_SPAN;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: dfuSimGroupTransportOps
+**
+** DESCRIPTION: Fills in a multicast engine transport for a group of
+**              devices.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Resets every member's transport and the group's counters.
+**
+*/
+void dfuSimGroupTransportOps(dfuSimGroupStruct *group, xferGroupTransportOps *ops)
+{
+    uint32_t                        index;
+
+    if ( (group) && (ops) && (group->count <= DFU_SIM_MAX_DEVICES) )
+    {
+        memset(ops, 0, sizeof(*ops));
+        ops->ctx = group;
+        ops->sendChunk = _dfuSimGroupSendChunk;
+        ops->sendRepair = _dfuSimGroupSendRepair;
+        ops->pollAck = _dfuSimGroupPollAck;
+        ops->maxWindow = DFU_SIM_SPAN;
+
+        for (index = 0; index < group->count; index++)
+        {
+            dfuSimDeviceStruct *    sim = group->members[index];
+
+            pthread_mutex_lock(&sim->lock);
+            _dfuSimResetTransport(sim);
+            if (sim->config.rxWindow < ops->maxWindow)
+            {
+                ops->maxWindow = sim->config.rxWindow;
+            }
+            pthread_mutex_unlock(&sim->lock);
+        }
+
+        group->broadcasts = 0;
+        group->unicasts = 0;
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _dfuSimThread
+**
+** DESCRIPTION: The device: takes chunks out of the receive buffer as
+**              they "arrive", writes them to flash and queues acks.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The write time is spent outside the lock, so the sender
+**           keeps filling the buffer meanwhile, as it would with a
+**           real board.
+**
+*/
+static void *_dfuSimThread(void *arg)
+{
+    dfuSimDeviceStruct *            sim = (dfuSimDeviceStruct *)arg;
+    dfuSimChunkStruct               chunk;
+    uint8_t *                       scratch = (uint8_t *)malloc(XFER_MAX_CHUNK_LEN);
+
+    pthread_mutex_lock(&sim->lock);
+
+    while ( (scratch) && (!sim->stopping) )
+    {
+        if (sim->rxCount == 0)
+        {
+            pthread_cond_wait(&sim->rxCond, &sim->lock);
+        }
+        else
+        {
+            uint64_t                nowUS = TIMER_GetMicroseconds();
+
+            chunk = sim->rxQueue[sim->rxHead];
+            if (chunk.arriveUS > nowUS)
+            {
+                pthread_mutex_unlock(&sim->lock);
+                TIMER_SleepUS(chunk.arriveUS - nowUS);
+                pthread_mutex_lock(&sim->lock);
+            }
+            else
+            {
+                memcpy(scratch, chunk.data, chunk.len);
+                chunk.data = scratch;
+                sim->rxHead = (sim->rxHead + 1) % sim->config.rxWindow;
+                sim->rxCount--;
+
+                pthread_mutex_unlock(&sim->lock);
+                TIMER_SleepUS(_dfuSimWriteUS(sim, chunk.len));
+                pthread_mutex_lock(&sim->lock);
+
+                _dfuSimReceiveChunk(sim, &chunk);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&sim->lock);
+    free(scratch);
+
+    return (NULL);
+}
+
+/*!
+** FUNCTION: _dfuSimReceiveChunk
+**
+** DESCRIPTION: Stores one chunk and moves the cumulative point along.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with the lock held.  A chunk too far ahead is
+**           dropped without an ack; one already held is acked again.
+**
+*/
+static void _dfuSimReceiveChunk(dfuSimDeviceStruct *sim, const dfuSimChunkStruct *chunk)
+{
+    dfuSimImageStruct *             image = sim->receiving;
+
+    if (
+           (image == NULL) ||
+           (chunk->offset + chunk->len > image->size)
+       )
+    {
+        _dfuSimQueueAck(sim, true);
+    }
+    else
+    if (chunk->seq < sim->cumulativeSeq)
+    {
+        _dfuSimQueueAck(sim, false);
+    }
+    else
+    if (chunk->seq - sim->cumulativeSeq < DFU_SIM_SPAN)
+    {
+        uint32_t                    ahead = chunk->seq - sim->cumulativeSeq;
+
+        memcpy(&image->data[chunk->offset], chunk->data, chunk->len);
+        sim->held |= (1ULL << ahead);
+        sim->heldEnd[chunk->seq % DFU_SIM_SPAN] = chunk->offset + chunk->len;
+
+        while (sim->held & 1ULL)
+        {
+            if (sim->heldEnd[sim->cumulativeSeq % DFU_SIM_SPAN] > image->received)
+            {
+                image->received = sim->heldEnd[sim->cumulativeSeq % DFU_SIM_SPAN];
+            }
+            sim->cumulativeSeq++;
+            sim->held >>= 1;
+        }
+
+        if ( (++sim->sinceAck >= sim->config.ackEvery) || (sim->rxCount == 0) )
+        {
+            _dfuSimQueueAck(sim, false);
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _dfuSimQueueAck
+**
+** DESCRIPTION: Sends an ack back, due latencyUS from now.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with the lock held.  If the queue is full the oldest
+**           ack goes: acks are cumulative, so nothing is lost.
+**
+*/
+static void _dfuSimQueueAck(dfuSimDeviceStruct *sim, bool rejected)
+{
+    dfuSimAckStruct *               entry;
+
+    if (sim->ackCount == DFU_SIM_ACK_QUEUE)
+    {
+        sim->ackHead = (sim->ackHead + 1) % DFU_SIM_ACK_QUEUE;
+        sim->ackCount--;
+    }
+
+    entry = &sim->acks[(sim->ackHead + sim->ackCount) % DFU_SIM_ACK_QUEUE];
+    entry->ack.cumulativeSeq = sim->cumulativeSeq;
+    entry->ack.selectiveMask = (uint32_t)(sim->held >> 1);
+    entry->ack.rejected = rejected;
+    entry->readyUS = TIMER_GetMicroseconds() + sim->config.latencyUS;
+    sim->ackCount++;
+    sim->sinceAck = 0;
+
+    pthread_cond_broadcast(&sim->ackCond);
+
+    return;
+}
+
+/*!
+** FUNCTION: _dfuSimSendChunk
+**
+** DESCRIPTION: Transport sendChunk: puts a chunk in the device's
+**              receive buffer, due latencyUS from now.
+**
+** PARAMETERS:
+**
+** RETURNS: Always true; a chunk that doesn't fit is lost "on the wire".
+**
+** COMMENTS:
+**
+*/
+static bool _dfuSimSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+    dfuSimDeviceStruct *            sim = (dfuSimDeviceStruct *)ctx;
+
+    pthread_mutex_lock(&sim->lock);
+
+    if (
+           (sim->rxCount < sim->config.rxWindow) &&
+           (len <= XFER_MAX_CHUNK_LEN)
+       )
+    {
+        dfuSimChunkStruct *         chunk = &sim->rxQueue[(sim->rxHead + sim->rxCount) % sim->config.rxWindow];
+
+        chunk->seq = seq;
+        chunk->offset = offset;
+        chunk->len = len;
+        chunk->arriveUS = TIMER_GetMicroseconds() + sim->config.latencyUS;
+        memcpy(chunk->data, data, len);
+        sim->rxCount++;
+
+        pthread_cond_signal(&sim->rxCond);
+    }
+
+    pthread_mutex_unlock(&sim->lock);
+
+    return (true);
+}
+
+/*!
+** FUNCTION: _dfuSimPollAck
+**
+** DESCRIPTION: Transport pollAck: the newest ack that has made it back.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A rejection is returned as soon as it is due, ahead of any
+**           later acks.
+**
+*/
+static bool _dfuSimPollAck(void *ctx, xferAckStruct *ack, uint32_t timeoutMS)
+{
+    dfuSimDeviceStruct *            sim = (dfuSimDeviceStruct *)ctx;
+    uint64_t                        deadlineUS = TIMER_GetMicroseconds() + ((uint64_t)timeoutMS * 1000U);
+    bool                            ret = false;
+    bool                            done = false;
+
+    pthread_mutex_lock(&sim->lock);
+
+    while (!done)
+    {
+        uint64_t                    nowUS = TIMER_GetMicroseconds();
+        uint64_t                    wakeUS = deadlineUS;
+
+        while (
+                  (sim->ackCount > 0) &&
+                  (sim->acks[sim->ackHead].readyUS <= nowUS) &&
+                  ( (!ret) || (!ack->rejected) )
+              )
+        {
+            *ack = sim->acks[sim->ackHead].ack;
+            sim->ackHead = (sim->ackHead + 1) % DFU_SIM_ACK_QUEUE;
+            sim->ackCount--;
+            ret = true;
+        }
+
+        if ( (ret) || (nowUS >= deadlineUS) )
+        {
+            done = true;
+        }
+        else
+        {
+            struct timespec         until;
+            uint64_t                waitUS;
+
+            if ( (sim->ackCount > 0) && (sim->acks[sim->ackHead].readyUS < wakeUS) )
+            {
+                wakeUS = sim->acks[sim->ackHead].readyUS;
+            }
+            waitUS = wakeUS - nowUS;
+
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += (time_t)(waitUS / 1000000U);
+            until.tv_nsec += (long)(waitUS % 1000000U) * 1000L;
+            if (until.tv_nsec >= 1000000000L)
+            {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&sim->ackCond, &sim->lock, &until);
+        }
+    }
+
+    pthread_mutex_unlock(&sim->lock);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _dfuSimGroupSendChunk
+**
+** DESCRIPTION: Group transport sendChunk: one broadcast frame, heard by
+**              every member.
+**
+** PARAMETERS:
+**
+** RETURNS: Always true, as _dfuSimSendChunk().
+**
+** COMMENTS:
+**
+*/
+static bool _dfuSimGroupSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+    dfuSimGroupStruct *             group = (dfuSimGroupStruct *)ctx;
+    uint32_t                        index;
+
+    for (index = 0; index < group->count; index++)
+    {
+        (void)_dfuSimSendChunk(group->members[index], seq, offset, data, len);
+    }
+    group->broadcasts++;
+
+    return (true);
+}
+
+/*!
+** FUNCTION: _dfuSimGroupSendRepair
+**
+** DESCRIPTION: Group transport sendRepair: a unicast frame to one member.
+**
+** PARAMETERS:
+**
+** RETURNS: false for a member not in the group.
+**
+** COMMENTS:
+**
+*/
+static bool _dfuSimGroupSendRepair(void *ctx, uint32_t member, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+    dfuSimGroupStruct *             group = (dfuSimGroupStruct *)ctx;
+    bool                            ret = false;
+
+    if (member < group->count)
+    {
+        ret = _dfuSimSendChunk(group->members[member], seq, offset, data, len);
+        group->unicasts++;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _dfuSimGroupPollAck
+**
+** DESCRIPTION: Group transport pollAck: one member's newest ack.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The device's selective mask starts one past its cumulative
+**           point; it becomes the first word of the group bitmap.
+**
+*/
+static bool _dfuSimGroupPollAck(void *ctx, uint32_t member, xferGroupAckStruct *ack, uint32_t timeoutMS)
+{
+    dfuSimGroupStruct *             group = (dfuSimGroupStruct *)ctx;
+    xferAckStruct                   deviceAck;
+    bool                            ret = false;
+
+    if (
+           (member < group->count) &&
+           (_dfuSimPollAck(group->members[member], &deviceAck, timeoutMS))
+       )
+    {
+        memset(ack, 0, sizeof(*ack));
+        ack->cumulativeSeq = deviceAck.cumulativeSeq;
+        ack->bitmapBase = deviceAck.cumulativeSeq + 1U;
+        ack->bitmap[0] = deviceAck.selectiveMask;
+        ack->rejected = deviceAck.rejected;
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _dfuSimFindImage
+**
+** DESCRIPTION: The image at an index.
+**
+** PARAMETERS: imageIndex: 0 finds a free entry.
+**
+** RETURNS:
+**
+** COMMENTS: Called with the lock held.
+**
+*/
+static dfuSimImageStruct *_dfuSimFindImage(dfuSimDeviceStruct *sim, uint8_t imageIndex)
+{
+    dfuSimImageStruct *             ret = NULL;
+    uint32_t                        index;
+
+    for (index = 0; index < DFU_SIM_MAX_IMAGES; index++)
+    {
+        if (
+               ( (imageIndex == 0) && (!sim->images[index].inUse) ) ||
+               ( (imageIndex != 0) && (sim->images[index].inUse) && (sim->images[index].index == imageIndex) )
+           )
+        {
+            ret = &sim->images[index];
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _dfuSimDropImage
+**
+** DESCRIPTION: Frees an image's flash.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with the lock held.
+**
+*/
+static void _dfuSimDropImage(dfuSimDeviceStruct *sim, dfuSimImageStruct *image)
+{
+    if (sim->receiving == image)
+    {
+        sim->receiving = NULL;
+    }
+    if (sim->completed == image)
+    {
+        sim->completed = NULL;
+    }
+
+    sim->flashUsed -= image->size;
+    free(image->data);
+    memset(image, 0, sizeof(*image));
+
+    return;
+}
+
+/*!
+** FUNCTION: _dfuSimResetTransport
+**
+** DESCRIPTION: Empties the receive buffer and the acks, and starts the
+**              sequence numbering again.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called with the lock held.
+**
+*/
+static void _dfuSimResetTransport(dfuSimDeviceStruct *sim)
+{
+    sim->rxHead = 0;
+    sim->rxCount = 0;
+    sim->cumulativeSeq = 0;
+    sim->held = 0;
+    sim->sinceAck = 0;
+    sim->ackHead = 0;
+    sim->ackCount = 0;
+
+    return;
+}
+
+/*!
+** FUNCTION: _dfuSimWriteUS
+**
+** DESCRIPTION: How long programming "len" bytes takes.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _dfuSimWriteUS(const dfuSimDeviceStruct *sim, uint32_t len)
+{
+    return ((uint32_t)(((uint64_t)len * sim->config.writeUSPerKB) / 1024U));
+}
@@ -13,6 +13,10 @@
 //#############################################################################
 //#############################################################################
 //#############################################################################
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "fw_manifest.h"
 
 //
@@ -23,6 +27,18 @@
 #define FW_MANIFEST_IMAGE_ADDRESS_FORMAT                    "image_%d_flash_address"
 #define FW_MANIFEST_IMAGE_INDEX_FORMAT                      "image_%d_core_index"
 
+//
+// Loaded manifests, shared by path.  Only the table needs the lock; a
+// loaded manifest is never written again.
+//
+static fwManifestStruct*        sharedManifests[FW_MANIFEST_MAX_SHARED];
+static pthread_mutex_t          sharedManifestLock = PTHREAD_MUTEX_INITIALIZER;
+
+static fwManifestStruct* _fwManifestParse(const char* manifestPath, uint32_t fileSize);
+static bool _fwManifestAdd(fwManifestStruct* manifest, uint32_t* textUsed, uint32_t textSize, const char* key, const char* value);
+static uint32_t _fwManifestHash(const char* key);
+static uint32_t _fwManifestNumber(const fwManifestStruct* manifest, const char* keyname, uint32_t fallback, int base);
+
 
 ///
 /// @fn: openFWManifest
@@ -189,3 +205,411 @@ uint8_t getFWManifestCoreImageIndex(fkvpStruct* fkvp, uint32_t index)
     return ret;
 }
 
+///
+/// @fn: loadFWManifest
+///
+/// @details Reads a manifest once and indexes it.  If the same file
+///          (path, and the modification time, size and inode in its
+///          stamp) is already loaded, that copy is shared.
+///
+/// @param[in] manifestPath
+///
+/// @returns NULL if the file can't be read.  Give it back with
+///          releaseFWManifest().
+///
+fwManifestStruct* loadFWManifest(const char* manifestPath)
+{
+    fwManifestStruct*           ret = NULL;
+    struct stat                 info;
+    dfuToolFileStampStruct      stamp;
+
+    if (
+           (manifestPath) &&
+           (strlen(manifestPath) > 0) &&
+           (strlen(manifestPath) < sizeof(ret->path)) &&
+           (stat(manifestPath, &info) == 0)
+       )
+    {
+        int                     freeSlot = -1;
+        int                     index;
+
+        dfuToolFileStamp(&info, &stamp);
+
+        pthread_mutex_lock(&sharedManifestLock);
+
+        for (index = 0; index < FW_MANIFEST_MAX_SHARED; index++)
+        {
+            fwManifestStruct*   shared = sharedManifests[index];
+
+            if (shared == NULL)
+            {
+                if (freeSlot < 0)
+                {
+                    freeSlot = index;
+                }
+            }
+            else
+            if (
+                   (strcmp(shared->path, manifestPath) == 0) &&
+                   (memcmp(&shared->stamp, &stamp, sizeof(stamp)) == 0)
+               )
+            {
+                shared->refs++;
+                ret = shared;
+                break;
+            }
+        }
+
+        if (ret == NULL)
+        {
+            ret = _fwManifestParse(manifestPath, (uint32_t)info.st_size);
+            if (ret)
+            {
+                ret->stamp = stamp;
+                ret->refs = 1;
+
+                // No room to share it: the caller just gets a private copy
+                if (freeSlot >= 0)
+                {
+                    sharedManifests[freeSlot] = ret;
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&sharedManifestLock);
+    }
+
+    return ret;
+}
+
+///
+/// @fn: releaseFWManifest
+///
+/// @details Drops one reference to a loaded manifest; the last one frees
+///          it.
+///
+/// @param[in] manifest
+///
+/// @returns
+///
+void releaseFWManifest(fwManifestStruct* manifest)
+{
+    if (manifest)
+    {
+        bool                    freeIt = false;
+        int                     index;
+
+        pthread_mutex_lock(&sharedManifestLock);
+
+        if (manifest->refs > 0)
+        {
+            manifest->refs--;
+        }
+
+        if (manifest->refs == 0)
+        {
+            for (index = 0; index < FW_MANIFEST_MAX_SHARED; index++)
+            {
+                if (sharedManifests[index] == manifest)
+                {
+                    sharedManifests[index] = NULL;
+                }
+            }
+            freeIt = true;
+        }
+
+        pthread_mutex_unlock(&sharedManifestLock);
+
+        if (freeIt)
+        {
+            free(manifest->text);
+            free(manifest);
+        }
+    }
+
+    return;
+}
+
+///
+/// @fn: lookupFWManifestValue
+///
+/// @details Hash lookup of any key in a loaded manifest.
+///
+/// @param[in] manifest
+/// @param[in] keyname
+///
+/// @returns NULL if the key isn't there.  If a key appears twice, the
+///          first one wins (as with fkvpFind).
+///
+const char* lookupFWManifestValue(const fwManifestStruct* manifest, const char* keyname)
+{
+    const char*                 ret = NULL;
+
+    if ( (manifest) && (keyname) )
+    {
+        uint32_t                hash = _fwManifestHash(keyname);
+        uint32_t                bucket = hash & (FW_MANIFEST_HASH_BUCKETS - 1);
+
+        while (manifest->buckets[bucket] != 0)
+        {
+            const fwManifestEntryStruct*    entry = &manifest->entries[manifest->buckets[bucket] - 1];
+
+            if ( (entry->hash == hash) && (strcmp(entry->key, keyname) == 0) )
+            {
+                ret = entry->value;
+                break;
+            }
+            bucket = (bucket + 1) & (FW_MANIFEST_HASH_BUCKETS - 1);
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: getFWManifestImage
+///
+/// @details One core image from a loaded manifest.
+///
+/// @param[in] manifest
+/// @param[in] number: 1..imageCount
+///
+/// @returns NULL if out of range.
+///
+const fwManifestImageStruct* getFWManifestImage(const fwManifestStruct* manifest, uint32_t number)
+{
+    const fwManifestImageStruct*    ret = NULL;
+
+    if ( (manifest) && (number >= 1) && (number <= manifest->imageCount) )
+    {
+        ret = &manifest->images[number];
+    }
+
+    return ret;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                       INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+///
+/// @fn: _fwManifestParse
+///
+/// @details One pass over the file: every key and value is copied into
+///          one text block and indexed, then the typed fields are
+///          filled in.
+///
+/// @param[in] manifestPath
+/// @param[in] fileSize: Bounds the text block (keys and values are
+///                      never longer than the lines they came from).
+///
+/// @returns
+///
+static fwManifestStruct* _fwManifestParse(const char* manifestPath, uint32_t fileSize)
+{
+    fwManifestStruct*           ret = NULL;
+    fwManifestStruct*           manifest = (fwManifestStruct*)calloc(1, sizeof(fwManifestStruct));
+    uint32_t                    textSize = fileSize + 2;
+    fkvpStruct                  fkvp;
+
+    if (manifest)
+    {
+        manifest->text = (char*)malloc(textSize);
+    }
+
+    if (
+           (manifest) &&
+           (manifest->text) &&
+           (fkvpBegin((char*)manifestPath, &fkvp) != NULL)
+       )
+    {
+        PARSED_KVP*             line;
+        uint32_t                textUsed = 0;
+        uint32_t                number;
+        bool                    ok = true;
+
+        snprintf(manifest->path, sizeof(manifest->path), "%s", manifestPath);
+
+        while ( (ok) && ((line = fkvpNext(&fkvp)) != NULL) )
+        {
+            uint32_t            index;
+
+            for (index = 0; (ok) && (index < KVP_KEYCOUNT(line)); index++)
+            {
+                KVP*            kvp = KVPARSE_getKVPByIndex(line, index);
+
+                if ( (kvp) && (kvp->pKey) && (kvp->pValue) )
+                {
+                    ok = _fwManifestAdd(manifest, &textUsed, textSize, kvp->pKey, kvp->pValue);
+                }
+            }
+        }
+        fkvpEnd(&fkvp);
+
+        if (ok)
+        {
+            manifest->deviceType = (uint8_t)_fwManifestNumber(manifest, FW_MANIFEST_DEVICE_TYPE_ID_KEY, 0, 10);
+            manifest->deviceVariant = (uint8_t)_fwManifestNumber(manifest, FW_MANIFEST_DEVICE_VARIANT_ID_KEY, 0, 10);
+            manifest->keyPath = lookupFWManifestValue(manifest, FW_MANIFEST_CHALLENGE_KEY_PATH_KEY);
+            if (manifest->keyPath == NULL)
+            {
+                manifest->keyPath = "";
+            }
+
+            number = _fwManifestNumber(manifest, FW_MANIFEST_CORE_IMAGE_COUNT_KEY, 0, 10);
+            if (number > FW_MANIFEST_MAX_IMAGES)
+            {
+                printf("\r\n Manifest %s lists %u images; only the first %u are used!",
+                       manifestPath,
+                       number,
+                       FW_MANIFEST_MAX_IMAGES);
+                number = FW_MANIFEST_MAX_IMAGES;
+            }
+            manifest->imageCount = (uint8_t)number;
+
+            for (number = 1; number <= manifest->imageCount; number++)
+            {
+                fwManifestImageStruct*  image = &manifest->images[number];
+                char                    keyBuf[64];
+
+                snprintf(keyBuf, sizeof(keyBuf), FW_MANIFEST_IMAGE_FILENAME_FORMAT, number);
+                image->filename = lookupFWManifestValue(manifest, keyBuf);
+
+                snprintf(keyBuf, sizeof(keyBuf), FW_MANIFEST_IMAGE_ADDRESS_FORMAT, number);
+                image->flashAddress = _fwManifestNumber(manifest, keyBuf, 0, 16);
+
+                snprintf(keyBuf, sizeof(keyBuf), FW_MANIFEST_IMAGE_INDEX_FORMAT, number);
+                image->coreIndex = (uint8_t)_fwManifestNumber(manifest, keyBuf, 255, 16);
+            }
+
+            ret = manifest;
+        }
+        else
+        {
+            printf("\r\n Manifest %s has more than %u entries!", manifestPath, FW_MANIFEST_MAX_ENTRIES);
+        }
+    }
+
+    if ( (ret == NULL) && (manifest) )
+    {
+        free(manifest->text);
+        free(manifest);
+    }
+
+    return ret;
+}
+
+///
+/// @fn: _fwManifestAdd
+///
+/// @details Copies one key/value pair into the text block (stripping
+///          quotes from the value) and indexes it.
+///
+/// @param[in] manifest
+/// @param[in,out] textUsed
+/// @param[in] textSize
+/// @param[in] key
+/// @param[in] value
+///
+/// @returns false if the manifest is full.
+///
+static bool _fwManifestAdd(fwManifestStruct* manifest, uint32_t* textUsed, uint32_t textSize, const char* key, const char* value)
+{
+    bool                        ret = false;
+    uint32_t                    keyLen = strlen(key) + 1;
+    uint32_t                    valueLen = strlen(value) + 1;
+
+    if (
+           (manifest->entryCount < FW_MANIFEST_MAX_ENTRIES) &&
+           (*textUsed + keyLen + valueLen <= textSize)
+       )
+    {
+        fwManifestEntryStruct*  entry = &manifest->entries[manifest->entryCount];
+        char*                   keyCopy = &manifest->text[*textUsed];
+        char*                   valueCopy = &manifest->text[*textUsed + keyLen];
+        uint32_t                bucket;
+        bool                    duplicate = false;
+
+        memcpy(keyCopy, key, keyLen);
+        memcpy(valueCopy, value, valueLen);
+        dfuToolStripQuotes(valueCopy);
+
+        entry->key = keyCopy;
+        entry->value = valueCopy;
+        entry->hash = _fwManifestHash(keyCopy);
+
+        bucket = entry->hash & (FW_MANIFEST_HASH_BUCKETS - 1);
+        while (manifest->buckets[bucket] != 0)
+        {
+            const fwManifestEntryStruct*    other = &manifest->entries[manifest->buckets[bucket] - 1];
+
+            if ( (other->hash == entry->hash) && (strcmp(other->key, keyCopy) == 0) )
+            {
+                duplicate = true;
+                break;
+            }
+            bucket = (bucket + 1) & (FW_MANIFEST_HASH_BUCKETS - 1);
+        }
+
+        // First one wins; a repeated key is simply dropped
+        if (!duplicate)
+        {
+            manifest->buckets[bucket] = (uint16_t)(manifest->entryCount + 1);
+            manifest->entryCount++;
+            *textUsed += keyLen + valueLen;
+        }
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: _fwManifestHash
+///
+/// @details FNV-1a.
+///
+/// @param[in] key
+///
+/// @returns
+///
+static uint32_t _fwManifestHash(const char* key)
+{
+    uint32_t                    ret = 2166136261U;
+
+    while (*key)
+    {
+        ret ^= (uint8_t)*key++;
+        ret *= 16777619U;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: _fwManifestNumber
+///
+/// @details A value as a number.
+///
+/// @param[in] manifest
+/// @param[in] keyname
+/// @param[in] fallback: If the key is missing.
+/// @param[in] base
+///
+/// @returns
+///
+static uint32_t _fwManifestNumber(const fwManifestStruct* manifest, const char* keyname, uint32_t fallback, int base)
+{
+    uint32_t                    ret = fallback;
+    const char*                 valStr = lookupFWManifestValue(manifest, keyname);
+
+    if (valStr != NULL)
+    {
+        ret = strtoul(valStr, NULL, base);
+    }
+
+    return ret;
+}
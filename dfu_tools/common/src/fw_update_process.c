@@ -14,12 +14,55 @@
 //#############################################################################
 //#############################################################################
 //#############################################################################
+#include <pthread.h>
+
 #include "fw_update_process.h"
 #include "async_timer.h"
 #include "sequence_ops.h"
 #include "fw_manifest.h"
 #include "dfu_client_api.h"
+#include "image_xfer.h"
+#include "image_source.h"
+
+
+/*
+** An image being read in ahead of its turn.  The staging thread
+** holds a reference on the image source; the transfer then opens the
+** same (already loaded) source.
+**
+*/
+typedef struct
+{
+    pthread_t                   thread;
+    bool                        started;
+    char                        path[MAX_PATH_LEN];
+    imageSourceStruct*          source;
+}fwupdStagedImageStruct;
+
 
+/*
+** Internal support prototypes.
+**
+*/
+static bool _fwupdImagePath(const fwManifestStruct* manifest,
+                            const char* manifestPath,
+                            uint32_t number,
+                            char* pathBuf,
+                            uint32_t pathLen);
+static void _fwupdStageImage(fwupdStagedImageStruct* staged,
+                             const fwManifestStruct* manifest,
+                             const char* manifestPath,
+                             uint32_t number);
+static void* _fwupdStageThread(void* arg);
+static void _fwupdUnstageImage(fwupdStagedImageStruct* staged);
+static bool _fwupdTransferAndInstallWithResume(dfuClientEnvStruct* dfuClient,
+                                               dfuDeviceTypeEnum devType,
+                                               uint8_t devVariant,
+                                               char* dest,
+                                               char* challengeKeyFilename,
+                                               char* imageFilename,
+                                               uint8_t imageIndex,
+                                               uint32_t imageAddress);
 
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
@@ -56,22 +99,27 @@ apiErrorCodeEnum fwupdProcessFWManifestForDevice(dfuClientEnvStruct* dfuClient,
            (deviceMACLen > 0)
        )
     {
-        fkvpStruct              fkvp;
+        fwManifestStruct*       manifest = loadFWManifest(manifestPath);
 
-        if (openFWManifest(&fkvp, manifestPath) != NULL)
+        if (manifest != NULL)
         {
             // Get the fixed parameters we need from the manifest
-            dfuDeviceTypeEnum   devType = FWMAN_DEV_TYPE(&fkvp);
-            uint8_t             devVariant = FWMAN_DEV_VARIANT(&fkvp);
-            uint8_t             imageCount = FWMAN_IMAGE_COUNT(&fkvp);
+            dfuDeviceTypeEnum   devType = FWMAN_DEV_TYPE(manifest);
+            uint8_t             devVariant = FWMAN_DEV_VARIANT(manifest);
+            uint8_t             imageCount = FWMAN_IMAGE_COUNT(manifest);
             char                textBuf[MAX_PATH_LEN];
+            char                keyPath[MAX_PATH_LEN];
+            fwupdStagedImageStruct  staged[2];
+
+            // Image N is staged in staged[N & 1]
+            memset(staged, 0, sizeof(staged));
 
             // Build the path to the challenge key file
-            snprintf(textBuf, sizeof(textBuf), "%s", manifestPath);
-            dfuToolExtractPath(textBuf);
-            strcat(textBuf, FWMAN_KEY_PATH(&fkvp));
+            snprintf(keyPath, sizeof(keyPath), "%s", manifestPath);
+            dfuToolExtractPath(keyPath);
+            strcat(keyPath, FWMAN_KEY_PATH(manifest));
 
-            if (strlen(textBuf))
+            if (strlen(keyPath))
             {
                 char                dest[24];
 
@@ -81,6 +129,9 @@ apiErrorCodeEnum fwupdProcessFWManifestForDevice(dfuClientEnvStruct* dfuClient,
                                           dest,
                                           24);
 
+                // The first image can load while the session is set up
+                _fwupdStageImage(&staged[1], manifest, manifestPath, 1);
+
                 //
                 // Establish a Session. If that succeeds,
                 // begin updating the firmware.
@@ -89,7 +140,7 @@ apiErrorCodeEnum fwupdProcessFWManifestForDevice(dfuClientEnvStruct* dfuClient,
                                          devType,
                                          devVariant,
                                          dest,
-                                         textBuf))
+                                         keyPath))
                 {
                     //
                     // Transfer each image to the target,
@@ -97,29 +148,37 @@ apiErrorCodeEnum fwupdProcessFWManifestForDevice(dfuClientEnvStruct* dfuClient,
                     //
                     // !!! ALL IMAGE ID'S AND INDICES START AT 1 !!!
                     //
+                    // While the target installs one image, the next is
+                    // already being read in.
+                    //
+                    // Every image is sent, even one the target may already
+                    // run: IMAGE_STATUS reports only flags and a size, and
+                    // coreImageMask only which indexes are present, so the
+                    // target can't tell us what it runs.
+                    //
                     for (int index = 1; index <= imageCount; index++)
                     {
-                        uint32_t        imageAddress = FWMAN_IMAGE_ADDRESS(&fkvp, index);
-                        uint8_t         imageIndex = FWMAN_IMAGE_INDEX(&fkvp, index);
+                        uint32_t        imageAddress = FWMAN_IMAGE_ADDRESS(manifest, index);
+                        uint8_t         imageIndex = FWMAN_IMAGE_INDEX(manifest, index);
 
-                        // Build the path to the manifest
-                        snprintf(textBuf,
-                                 sizeof(textBuf),
-                                 "%s",
-                                 manifestPath);
-                        dfuToolExtractPath(textBuf);
-                        strcat(textBuf, FWMAN_IMAGE_FILENAME(&fkvp, index));
+                        if (index < imageCount)
+                        {
+                            _fwupdStageImage(&staged[(index + 1) & 1], manifest, manifestPath, index + 1);
+                        }
 
                         if (
-                               (strlen(textBuf) > 0) &&
+                               (_fwupdImagePath(manifest, manifestPath, index, textBuf, sizeof(textBuf))) &&
                                (imageIndex < 255)
                            )
                         {
-                            if (sequenceTransferAndInstallImage(dfuClient,
-                                                                textBuf,
-                                                                imageIndex,
-                                                                imageAddress,
-                                                                dest))
+                            if (_fwupdTransferAndInstallWithResume(dfuClient,
+                                                                   devType,
+                                                                   devVariant,
+                                                                   dest,
+                                                                   keyPath,
+                                                                   textBuf,
+                                                                   imageIndex,
+                                                                   imageAddress))
                             {
                                 // Result is GOOD!
                                 ret = API_ERR_NONE;
@@ -129,6 +188,8 @@ apiErrorCodeEnum fwupdProcessFWManifestForDevice(dfuClientEnvStruct* dfuClient,
                                 ret = API_ERR_IMAGE_INSTALLATION_FAILED;
                             }
                         }
+
+                        _fwupdUnstageImage(&staged[index & 1]);
                     }
 
                     // Now close the Session
@@ -141,7 +202,9 @@ apiErrorCodeEnum fwupdProcessFWManifestForDevice(dfuClientEnvStruct* dfuClient,
             }
 
             // Clean up
-            closeFWManifest(&fkvp);
+            _fwupdUnstageImage(&staged[0]);
+            _fwupdUnstageImage(&staged[1]);
+            releaseFWManifest(manifest);
         }
         else
         {
@@ -216,11 +279,14 @@ apiErrorCodeEnum fwupdInstallCoreImageFile(dfuClientEnvStruct* dfuClient,
                                      challengeKeyFilename))
             {
 
-                if (sequenceTransferAndInstallImage(dfuClient,
-                                                    imageFilename,
-                                                    imageIndex,
-                                                    flashBaseAddress,
-                                                    dest))
+                if (_fwupdTransferAndInstallWithResume(dfuClient,
+                                                       deviceType,
+                                                       deviceVariant,
+                                                       dest,
+                                                       challengeKeyFilename,
+                                                       imageFilename,
+                                                       imageIndex,
+                                                       flashBaseAddress))
                 {
                     // Result is GOOD!
                     ret = API_ERR_NONE;
@@ -251,3 +317,186 @@ apiErrorCodeEnum fwupdInstallCoreImageFile(dfuClientEnvStruct* dfuClient,
     return ret;
 }
 
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+///
+/// @fn: _fwupdTransferAndInstallWithResume
+///
+/// @details Transfers and installs one image.  If the transfer dies
+///          part way through and left a resume checkpoint, the session
+///          is re-opened and the image sent again, up to
+///          XFER_RESUME_MAX_ATTEMPTS tries in all.  It continues from
+///          where it got to only if the target reports that it kept the
+///          partial image (XFER_STATUS_PARTIAL_KEPT).
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+static bool _fwupdTransferAndInstallWithResume(dfuClientEnvStruct* dfuClient,
+                                               dfuDeviceTypeEnum devType,
+                                               uint8_t devVariant,
+                                               char* dest,
+                                               char* challengeKeyFilename,
+                                               char* imageFilename,
+                                               uint8_t imageIndex,
+                                               uint32_t imageAddress)
+{
+    bool                            ret = false;
+    uint32_t                        attempt;
+
+    for (attempt = 1; attempt <= XFER_RESUME_MAX_ATTEMPTS; attempt++)
+    {
+        ret = sequenceTransferAndInstallImage(dfuClient,
+                                              imageFilename,
+                                              imageIndex,
+                                              imageAddress,
+                                              dest);
+        if (
+               (ret) ||
+               (attempt == XFER_RESUME_MAX_ATTEMPTS) ||
+               (!xferHasCheckpoint(dest, imageIndex, imageAddress))
+           )
+        {
+            break;
+        }
+
+        printf("\r\n Transfer interrupted; re-opening the session to try again (attempt %u of %u)...",
+               attempt + 1,
+               XFER_RESUME_MAX_ATTEMPTS);
+
+        sequenceEndSession(dfuClient, dest);
+        if (!sequenceBeginSession(dfuClient,
+                                  devType,
+                                  devVariant,
+                                  dest,
+                                  challengeKeyFilename))
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: _fwupdImagePath
+///
+/// @details Full path to one of a manifest's images (image files sit
+///          next to the manifest).
+///
+/// @param[in] manifest
+/// @param[in] manifestPath
+/// @param[in] number: 1..imageCount
+/// @param[out] pathBuf
+/// @param[in] pathLen
+///
+/// @returns false if the manifest doesn't name that image.
+///
+static bool _fwupdImagePath(const fwManifestStruct* manifest,
+                            const char* manifestPath,
+                            uint32_t number,
+                            char* pathBuf,
+                            uint32_t pathLen)
+{
+    bool                            ret = false;
+    const fwManifestImageStruct*    image = getFWManifestImage(manifest, number);
+
+    if ( (image) && (image->filename) )
+    {
+        snprintf(pathBuf, pathLen, "%s", manifestPath);
+        dfuToolExtractPath(pathBuf);
+        strncat(pathBuf, image->filename, pathLen - strlen(pathBuf) - 1);
+
+        ret = (strlen(pathBuf) > 0);
+    }
+
+    return ret;
+}
+
+///
+/// @fn: _fwupdStageImage
+///
+/// @details Starts reading an image in on a background thread.
+///
+/// @param[in] staged: Must be idle.
+/// @param[in] manifest
+/// @param[in] manifestPath
+/// @param[in] number: 1..imageCount
+///
+/// @returns
+///
+/// @note If the thread can't be started nothing is lost: the transfer
+///       reads the file itself.
+///
+static void _fwupdStageImage(fwupdStagedImageStruct* staged,
+                             const fwManifestStruct* manifest,
+                             const char* manifestPath,
+                             uint32_t number)
+{
+#if (FWUPD_STAGE_NEXT_IMAGE==1)
+    if (
+           (!staged->started) &&
+           (_fwupdImagePath(manifest, manifestPath, number, staged->path, sizeof(staged->path)))
+       )
+    {
+        staged->source = NULL;
+        staged->started = (pthread_create(&staged->thread, NULL, _fwupdStageThread, staged) == 0);
+    }
+#else
+    (void)staged;
+    (void)manifest;
+    (void)manifestPath;
+    (void)number;
+#endif // FWUPD_STAGE_NEXT_IMAGE
+
+    return;
+}
+
+///
+/// @fn: _fwupdStageThread
+///
+/// @details Opens the image source, which pulls all of it into memory.
+///
+/// @param[in] arg: The fwupdStagedImageStruct.
+///
+/// @returns
+///
+static void* _fwupdStageThread(void* arg)
+{
+    fwupdStagedImageStruct*         staged = (fwupdStagedImageStruct*)arg;
+
+    staged->source = imageSourceOpen(staged->path);
+
+    return NULL;
+}
+
+///
+/// @fn: _fwupdUnstageImage
+///
+/// @details Waits for the staging thread and drops its reference.
+///
+/// @param[in] staged
+///
+/// @returns
+///
+static void _fwupdUnstageImage(fwupdStagedImageStruct* staged)
+{
+    if (staged->started)
+    {
+        pthread_join(staged->thread, NULL);
+        imageSourceClose(staged->source);
+
+        staged->source = NULL;
+        staged->started = false;
+    }
+
+    return;
+}
@@ -197,6 +197,108 @@ uint32_t dfuToolGetFileSize(char *filename)
     return (ret);
 }
 
+/*!
+** FUNCTION: dfuToolFileStamp
+**
+** DESCRIPTION: Takes the modification time (to the nanosecond), size
+**              and inode from a stat() or fstat().
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void dfuToolFileStamp(const struct stat *info, dfuToolFileStampStruct *stamp)
+{
+    memset(stamp, 0, sizeof(dfuToolFileStampStruct));
+    stamp->seconds = (int64_t)info->st_mtime;
+    stamp->size = (int64_t)info->st_size;
+
+#if defined(_WIN32) || defined(_WIN64)
+    // Whole seconds only, and st_ino is always 0: time and size it is.
+#elif defined(__APPLE__)
+    stamp->nanoseconds = (int64_t)info->st_mtimespec.tv_nsec;
+    stamp->inode = (uint64_t)info->st_ino;
+#else
+    stamp->nanoseconds = (int64_t)info->st_mtim.tv_nsec;
+    stamp->inode = (uint64_t)info->st_ino;
+#endif // defined
+
+    return;
+}
+
+/*!
+** FUNCTION: dfuToolCRC32
+**
+** DESCRIPTION: Continues a CRC-32 (IEEE 802.3) over another block of
+**              data.
+**
+** PARAMETERS: crc: 0 to start a new CRC, else the previous result.
+**
+** RETURNS: The CRC of everything so far.
+**
+** COMMENTS:
+**
+*/
+uint32_t dfuToolCRC32(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    uint32_t            index;
+    int                 bit;
+
+    crc = ~crc;
+    for (index = 0; index < length; index++)
+    {
+        crc ^= data[index];
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return (~crc);
+}
+
+/*!
+** FUNCTION: dfuToolGetFileCRC32
+**
+** DESCRIPTION: CRC-32 of the named file's whole contents.
+**
+** PARAMETERS:
+**
+** RETURNS: true if the file could be read.
+**
+** COMMENTS:
+**
+*/
+bool dfuToolGetFileCRC32(char *filename, uint32_t *crc)
+{
+    bool                ret = false;
+
+    if ( (filename) && (strlen(filename)) && (crc) )
+    {
+        FILE *                  handle = fopen(filename, "rb");
+
+        if (handle)
+        {
+            uint8_t             block[4096];
+            size_t              len;
+
+            *crc = 0;
+            while ((len = fread(block, 1, sizeof(block), handle)) > 0)
+            {
+                *crc = dfuToolCRC32(*crc, block, (uint32_t)len);
+            }
+
+            ret = (ferror(handle) == 0);
+            fclose(handle);
+        }
+    }
+
+    return (ret);
+}
+
 ///
 /// @fn: dfuToolExtractPath
 ///
@@ -0,0 +1,373 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: image_source.c
+**
+** DESCRIPTION: Read-only, in-memory view of an image file, shared by
+**              every transfer that sends the same file.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif // defined
+
+#include "image_source.h"
+
+static imageSourceStruct            sources[IMAGE_SOURCE_MAX_OPEN];
+static pthread_mutex_t              sourceLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static imageSourceStruct *_imageSourceFind(const char *filenameStr, const dfuToolFileStampStruct *stamp, imageSourceStruct **freeSource);
+static bool _imageSourceLoad(imageSourceStruct *source, const char *filenameStr);
+static void _imageSourceRelease(imageSourceStruct *source);
+
+
+/*!
+** FUNCTION: imageSourceOpen
+**
+** DESCRIPTION: Gets the whole of an image file as one block of memory.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if the file can't be read, is empty, or
+**          IMAGE_SOURCE_MAX_OPEN different files are already open.
+**
+** COMMENTS: A file that changed since it was opened gets a fresh view;
+**           sessions still on the old one keep it until they close it.
+**           The file is loaded without sourceLock held, so a large image
+**           doesn't hold up other sessions opening or closing theirs.
+**
+*/
+imageSourceStruct *imageSourceOpen(const char *filenameStr)
+{
+    imageSourceStruct *             ret = NULL;
+    imageSourceStruct *             freeSource = NULL;
+    imageSourceStruct               loaded;
+    bool                            claimed = false;
+    struct stat                     info;
+    dfuToolFileStampStruct          stamp;
+
+    if (
+           (filenameStr) &&
+           (strlen(filenameStr) < sizeof(sources[0].path)) &&
+           (stat(filenameStr, &info) == 0)
+       )
+    {
+        dfuToolFileStamp(&info, &stamp);
+
+        pthread_mutex_lock(&sourceLock);
+        ret = _imageSourceFind(filenameStr, &stamp, &freeSource);
+        pthread_mutex_unlock(&sourceLock);
+
+        if (
+               (ret == NULL) &&
+               (_imageSourceLoad(&loaded, filenameStr))
+           )
+        {
+            // Another session may have loaded the same file meanwhile.
+            pthread_mutex_lock(&sourceLock);
+            ret = _imageSourceFind(filenameStr, &loaded.stamp, &freeSource);
+            if (
+                   (ret == NULL) &&
+                   (freeSource)
+               )
+            {
+                *freeSource = loaded;
+                freeSource->refs = 1;
+                ret = freeSource;
+                claimed = true;
+            }
+            pthread_mutex_unlock(&sourceLock);
+
+            if (!claimed)
+            {
+                _imageSourceRelease(&loaded);
+            }
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: imageSourceWrap
+**
+** DESCRIPTION: Makes a source out of an image the caller already has in
+**              memory.
+**
+** PARAMETERS: source: Caller-owned; "data" must outlive it.
+**
+** RETURNS:
+**
+** COMMENTS: refs stays 0, so imageSourceClose() leaves it alone.
+**
+*/
+void imageSourceWrap(imageSourceStruct *source, const uint8_t *data, uint32_t size)
+{
+    if (source)
+    {
+        memset(source, 0, sizeof(imageSourceStruct));
+        source->data = data;
+        source->size = size;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: imageSourceClose
+**
+** DESCRIPTION: Drops one reference; the last one releases the memory.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The slot is cleared under sourceLock and the memory given
+**           back after it is dropped.
+**
+*/
+void imageSourceClose(imageSourceStruct *source)
+{
+    imageSourceStruct               released;
+
+    if (source)
+    {
+        memset(&released, 0, sizeof(released));
+
+        pthread_mutex_lock(&sourceLock);
+
+        if (source->refs > 0)
+        {
+            source->refs--;
+            if (source->refs == 0)
+            {
+                released = *source;
+                memset(source, 0, sizeof(imageSourceStruct));
+            }
+        }
+
+        pthread_mutex_unlock(&sourceLock);
+
+        _imageSourceRelease(&released);
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _imageSourceFind
+**
+** DESCRIPTION: Looks for an open view of this exact file, taking a
+**              reference to it if there is one.
+**
+** PARAMETERS: freeSource: Set to an unused slot, or NULL if none.
+**
+** RETURNS: NULL if the file isn't open.
+**
+** COMMENTS: Called with sourceLock held.
+**
+*/
+static imageSourceStruct *_imageSourceFind(const char *filenameStr, const dfuToolFileStampStruct *stamp, imageSourceStruct **freeSource)
+{
+    imageSourceStruct *             ret = NULL;
+    uint32_t                        index;
+
+    *freeSource = NULL;
+
+    for (index = 0; index < IMAGE_SOURCE_MAX_OPEN; index++)
+    {
+        if (sources[index].refs == 0)
+        {
+            if (*freeSource == NULL)
+            {
+                *freeSource = &sources[index];
+            }
+        }
+        else
+        if (
+               (strcmp(sources[index].path, filenameStr) == 0) &&
+               (memcmp(&sources[index].stamp, stamp, sizeof(dfuToolFileStampStruct)) == 0)
+           )
+        {
+            ret = &sources[index];
+            ret->refs++;
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _imageSourceLoad
+**
+** DESCRIPTION: Maps the file, or failing that reads it into the heap.
+**
+** PARAMETERS:
+**
+** RETURNS: false if it couldn't all be read.
+**
+** COMMENTS: The stamp is taken from the open file, so it describes
+**           what was mapped even if the path is renamed over meanwhile.
+**           MAP_POPULATE faults every page in now, off the send path,
+**           and the size is checked again once it has: a file cut short
+**           while being mapped fails here rather than raising SIGBUS in
+**           whichever session later reads past its new end.
+**
+*/
+static bool _imageSourceLoad(imageSourceStruct *source, const char *filenameStr)
+{
+    bool                            ret = false;
+    struct stat                     info;
+
+    memset(source, 0, sizeof(imageSourceStruct));
+    snprintf(source->path, sizeof(source->path), "%s", filenameStr);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    {
+        int                         fd = open(filenameStr, O_RDONLY);
+
+        if (
+               (fd >= 0) &&
+               (fstat(fd, &info) == 0) &&
+               (info.st_size > 0) &&
+               ((uint64_t)info.st_size <= UINT32_MAX)
+           )
+        {
+            void *                  map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+            dfuToolFileStamp(&info, &source->stamp);
+            source->size = (uint32_t)info.st_size;
+
+            if (map != MAP_FAILED)
+            {
+                if (
+                       (fstat(fd, &info) == 0) &&
+                       ((uint64_t)info.st_size == source->size)
+                   )
+                {
+                    // Chunks are read front to back: read ahead hard, drop behind.
+                    madvise(map, source->size, MADV_SEQUENTIAL);
+                    source->data = (const uint8_t *)map;
+                    source->mapped = true;
+                    ret = true;
+                }
+                else
+                {
+                    printf("\r\n [%s] changed size while being opened!", filenameStr);
+                    munmap(map, source->size);
+                    source->size = 0;
+                }
+            }
+        }
+
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+#else
+    if (
+           (stat(filenameStr, &info) == 0) &&
+           (info.st_size > 0) &&
+           ((uint64_t)info.st_size <= UINT32_MAX)
+       )
+    {
+        dfuToolFileStamp(&info, &source->stamp);
+        source->size = (uint32_t)info.st_size;
+    }
+#endif // defined
+
+    if (
+           (!ret) &&
+           (source->size > 0) &&
+           (source->mapped == false)
+       )
+    {
+        // No mmap() here, or it failed: read the file in instead.
+        FILE *                      handle = fopen(filenameStr, "rb");
+        uint8_t *                   buffer = (uint8_t *)malloc(source->size);
+
+        if (
+               (handle) &&
+               (buffer) &&
+               (fread(buffer, 1, source->size, handle) == source->size)
+           )
+        {
+            source->data = buffer;
+            ret = true;
+        }
+        else
+        {
+            printf("\r\n Failed to read [%s]!", filenameStr);
+            free(buffer);
+        }
+
+        if (handle)
+        {
+            fclose(handle);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _imageSourceRelease
+**
+** DESCRIPTION: Unmaps or frees the image.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called without sourceLock; "source" is a copy no slot refers
+**           to any more.  Does nothing for an empty one.
+**
+*/
+static void _imageSourceRelease(imageSourceStruct *source)
+{
+    if (source->data)
+    {
+#if !defined(_WIN32) && !defined(_WIN64)
+        if (source->mapped)
+        {
+            munmap((void *)source->data, source->size);
+        }
+        else
+#endif // defined
+        {
+            free((void *)source->data);
+        }
+    }
+
+    memset(source, 0, sizeof(imageSourceStruct));
+
+    return;
+}
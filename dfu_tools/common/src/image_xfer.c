@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #if defined(_WIN32) || defined (_WIN64)
     #include <conio.h>
@@ -34,10 +35,117 @@
 #include "dfu_client.h"
 #include "ethernet_sockets.h"
 #include "async_timer.h"
+#include "xfer_rtt.h"
+#include "image_source.h"
+#include "logger.h"
+#include "xfer_progress.h"
 
 
+/*
+** Fixed timeout for the transactions that make the target erase or write
+** FLASH (BEGIN_RCV, RCV_COMPLETE).  Everything else follows the
+** device's measured round trip.
+**
+*/
 #define XFER_TRANSACTION_TIMEOUT_MS             (5000)
 
+/*
+** Device type last seen for each client, so the transfer window can be
+** chosen per device type.
+**
+*/
+#define XFER_MAX_CLIENTS                        (MAX_ETHERNET_INTERFACES + MAX_CAN_INTERFACES)
+
+typedef struct
+{
+    dfuClientEnvStruct *            dfuClient;
+    uint8_t                         deviceType;
+}xferClientTypeStruct;
+
+static xferClientTypeStruct         clientTypes[XFER_MAX_CLIENTS];
+
+/*
+** Resume checkpoints: how far each device got with each image, so an
+** interrupted transfer can carry on from there.  Shared by every client
+** (vehicle installs run several at once), hence the lock.  Every field
+** is read and written with it held.  An entry can be reused for another
+** image while a transfer runs, so a transfer keeps a copy and finds its
+** entry again by device, index and address for every update.
+**
+*/
+typedef struct
+{
+    char                            destStr[24];
+    uint8_t                         imageIndex;
+    uint32_t                        imageAddress;
+    uint32_t                        imageSize;
+    uint32_t                        imageCRC;
+    uint32_t                        ackedOffset;
+    bool                            inUse;
+}xferCheckpointStruct;
+
+static xferCheckpointStruct         checkpoints[XFER_MAX_CHECKPOINTS];
+static uint32_t                     nextCheckpoint = 0;
+static pthread_mutex_t              checkpointLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+** Context for the default (blocking transaction) transport.
+**
+*/
+typedef struct
+{
+    dfuClientEnvStruct *            dfuClient;
+    char *                          destStr;
+    uint8_t                         imageIndex;
+    uint32_t                        imageAddress;
+    xferRttStruct *                 rtt;
+    uint32_t                        timeouts;
+    uint32_t                        lastSeq;
+    bool                            lastAccepted;
+    bool                            ackPending;
+}xferBlockingCtxStruct;
+
+/*
+** Context for the progress callback.
+**
+*/
+typedef struct
+{
+    uint32_t                        imageSize;
+    uint32_t                        startOffset;
+    xferCheckpointStruct            checkpoint;
+    int                             progress;
+}xferFileCtxStruct;
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static bool _xferBlockingSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+static bool _xferBlockingPollAck(void *ctx, xferAckStruct *ack, uint32_t timeoutMS);
+static bool _xferBlockingChunkLanded(xferBlockingCtxStruct *blocking, uint32_t offset, uint16_t len, bool *landed);
+static void _xferShowProgress(void *ctx, const xferWindowStatsStruct *stats);
+static bool _xferGetDeviceType(dfuClientEnvStruct *dfuClient, uint8_t *deviceType);
+static xferCheckpointStruct *_xferFindCheckpoint(const char *destStr, uint8_t imageIndex, uint32_t imageAddress, bool create);
+static void _xferUpdateCheckpoint(const xferCheckpointStruct *checkpoint, uint32_t ackedOffset, bool done);
+static bool _xferFromSource(const imageSourceStruct *source,
+                            char *nameStr,
+                            char *destStr,
+                            uint8_t imageIndex,
+                            uint32_t imageAddress,
+                            bool isEncrypted,
+                            dfuClientEnvStruct *dfuClient,
+                            const xferTransportOps *transport,
+                            uint16_t windowSize);
+static uint32_t _xferGetResumeOffset(dfuClientEnvStruct *dfuClient,
+                                     xferRttStruct *rtt,
+                                     const imageSourceStruct *source,
+                                     char *destStr,
+                                     uint8_t imageIndex,
+                                     uint32_t imageAddress,
+                                     xferCheckpointStruct *checkpoint);
+
 /*!
 ** FUNCTION: xferImage
 **
@@ -47,7 +155,8 @@
 **
 ** RETURNS:
 **
-** COMMENTS:
+** COMMENTS: Uses the blocking RCV_DATA transaction as the transport,
+**           so only one chunk is ever in flight.
 **
 */
 bool xferImage(char *filenameStr,
@@ -56,113 +165,76 @@ bool xferImage(char *filenameStr,
                uint32_t imageAddress,
                bool isEncrypted,
                dfuClientEnvStruct *dfuClient)
+{
+    return xferImageWithTransport(filenameStr,
+                                  destStr,
+                                  imageIndex,
+                                  imageAddress,
+                                  isEncrypted,
+                                  dfuClient,
+                                  NULL,
+                                  0);
+}
+
+/*!
+** FUNCTION: xferImageWithTransport
+**
+** DESCRIPTION: Transfer an image to the target, keeping up to
+**              "windowSize" RCV_DATA chunks in flight.
+**
+** PARAMETERS: transport:  NULL for the blocking transaction transport.
+**             windowSize: 0 to use the size configured for the
+**                         target's device type.
+**
+** RETURNS:
+**
+** COMMENTS: BEGIN_RCV and RCV_COMPLETE are always plain transactions.
+**           If an earlier attempt at the same image on the same device
+**           left a checkpoint, and the device reports that it kept
+**           exactly that much of it (XFER_STATUS_PARTIAL_KEPT), BEGIN_RCV
+**           is skipped and the transfer continues from the checkpoint.
+**
+*/
+bool xferImageWithTransport(char *filenameStr,
+                            char *destStr,
+                            uint8_t imageIndex,
+                            uint32_t imageAddress,
+                            bool isEncrypted,
+                            dfuClientEnvStruct *dfuClient,
+                            const xferTransportOps *transport,
+                            uint16_t windowSize)
 {
     bool                            ret = false;
-    uint32_t                        imageSize;
-    ASYNC_TIMER_STRUCT              startTimer;
-    ASYNC_TIMER_STRUCT              endTimer;
 
     if (
             (destStr) &&
             (filenameStr)
        )
     {
-        imageSize = dfuToolGetFileSize(filenameStr);
-
-        if (imageSize > 0)
+        if (dfuToolGetFileSize(filenameStr) > 0)
         {
-            FILE *                      handle;
-
-            printf("\r\n *** IMAGE TRANSFER ***");
-            printf("\r\n Destination   : %s", destStr);
-            printf("\r\n Sending       : %s", filenameStr);
-            printf("\r\n File size     : %u bytes", imageSize);
-            printf("\r\n Image Index   : %d", imageIndex);
-            printf("\r\n FLASH Address : 0x%08X", imageAddress);
-            printf("\r\n Encrypted     : %s", isEncrypted ? "yes" : "no");
-            fflush(stdout);
+            imageSourceStruct *         source;
 
-            // Open the file
-            handle = fopen(filenameStr, "rb");
-            if (handle)
+            // Open the file (shared with any other session sending it)
+            source = imageSourceOpen(filenameStr);
+            if (source)
             {
-                uint8_t                         buffer[1500];
-                size_t                          bytesRead = 0;
-                uint32_t                        totalSent = 0;
-                uint32_t                        totalTransactions = 0;
-
-                /*
-                ** First, get the transfer started
-                **
-                */
-                if (dfuClientTransaction_CMD_BEGIN_RCV(dfuClient,
-                                                       XFER_TRANSACTION_TIMEOUT_MS,
-                                                       destStr,
-                                                       imageIndex,
-                                                       imageSize,
-                                                       imageAddress,
-                                                       isEncrypted))
-                {
-                    TIMER_Start(&startTimer);
-                    printf("\n\n");
-                    fflush(stdout);
-
-                    ret = true;
-
-                    /*
-                    ** Send all of the image file data
-                    **
-                    */
-                    while ((bytesRead = fread(buffer, 1, dfuClientGetInternalMTU(dfuClient)-3, handle)) > 0)
-                    {
-                        printf("\r >> Exchange #: %5d. Sending [%4u] bytes...                     ", totalTransactions+1, (uint32_t)bytesRead);
-                        fflush(stdout);
-
-                        if (!dfuClientTransaction_CMD_RCV_DATA(dfuClient,
-                                                               XFER_TRANSACTION_TIMEOUT_MS,
-                                                               destStr,
-                                                               buffer,
-                                                               bytesRead))
-                        {
-                            printf("\r Client rejected image WRITE operation!          ");
-                            ret = false;
-                            break;
-                        }
-                        else
-                        {
-                            totalSent += bytesRead;
-                            ++totalTransactions;
-                        }
-                    } // while
-
-                    TIMER_Start(&endTimer);
-                    printf("\r\n\r\n Sent [%u] bytes.  Total transactions: [%d]", totalSent, totalTransactions);
-
-                    // Now send the "RCV_COMPLETE" transaction
-                    if (!dfuClientTransaction_CMD_RCV_COMPLETE(dfuClient,
-                                                               XFER_TRANSACTION_TIMEOUT_MS,
-                                                               destStr,
-                                                               totalSent))
-                    {
-                        printf("\r\n Target did not accept RCV_COMPLETE command!");
-                        ret = false;
-                    }
-
-                    fflush(stdout);
-                }
-                else
-                {
-                    printf("\r\n Target did not accept BEGIN_RCV command!");
-                }
-
-                fclose(handle);
+                ret = _xferFromSource(source,
+                                      filenameStr,
+                                      destStr,
+                                      imageIndex,
+                                      imageAddress,
+                                      isEncrypted,
+                                      dfuClient,
+                                      transport,
+                                      windowSize);
+
+                imageSourceClose(source);
             }
             else
             {
                 printf("\r\n Failed to open [%s]!", filenameStr);
             }
-
-            printf("\r\n Total transfer time (mS): %u", (uint32_t)TIMER_GetElapsedMillisecs(&startTimer, &endTimer));
         }
         else
         {
@@ -180,3 +252,767 @@ bool xferImage(char *filenameStr,
     return (ret);
 }
 
+/*!
+** FUNCTION: xferBuffer
+**
+** DESCRIPTION: Transfer an image that is already in memory.
+**
+** PARAMETERS: nameStr: Only used in the transfer report.
+**
+** RETURNS:
+**
+** COMMENTS: Same as xferImage() otherwise.  Nothing touches the
+**           filesystem.
+**
+*/
+bool xferBuffer(const uint8_t *data,
+                uint32_t length,
+                char *nameStr,
+                char *destStr,
+                uint8_t imageIndex,
+                uint32_t imageAddress,
+                bool isEncrypted,
+                dfuClientEnvStruct *dfuClient)
+{
+    bool                            ret = false;
+    imageSourceStruct               source;
+
+    if (
+            (data) &&
+            (length > 0) &&
+            (destStr)
+       )
+    {
+        imageSourceWrap(&source, data, length);
+        ret = _xferFromSource(&source,
+                              (nameStr) ? nameStr : "(memory)",
+                              destStr,
+                              imageIndex,
+                              imageAddress,
+                              isEncrypted,
+                              dfuClient,
+                              NULL,
+                              0);
+    }
+    else
+    {
+        printf("\r\n Invalid or missing parameters!");
+    }
+
+    printf("\r\n");
+    fflush(stdout);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferHasCheckpoint
+**
+** DESCRIPTION: Is there a resume checkpoint for this image on this
+**              device?
+**
+** PARAMETERS:
+**
+** RETURNS: true if an interrupted transfer could be resumed.
+**
+** COMMENTS:
+**
+*/
+bool xferHasCheckpoint(char *destStr, uint8_t imageIndex, uint32_t imageAddress)
+{
+    bool                            ret;
+    xferCheckpointStruct *          checkpoint;
+
+    pthread_mutex_lock(&checkpointLock);
+    checkpoint = _xferFindCheckpoint(destStr, imageIndex, imageAddress, false);
+    ret = ( (checkpoint) && (checkpoint->ackedOffset > 0) );
+    pthread_mutex_unlock(&checkpointLock);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferSetDeviceType
+**
+** DESCRIPTION: Records the device type of the target a client is
+**              talking to, so transfers can pick its window size.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferSetDeviceType(dfuClientEnvStruct *dfuClient, uint8_t deviceType)
+{
+    uint32_t                        index;
+    xferClientTypeStruct *          freeEntry = NULL;
+
+    if (dfuClient)
+    {
+        for (index = 0; index < XFER_MAX_CLIENTS; index++)
+        {
+            if (clientTypes[index].dfuClient == dfuClient)
+            {
+                clientTypes[index].deviceType = deviceType;
+                return;
+            }
+
+            if ( (freeEntry == NULL) && (clientTypes[index].dfuClient == NULL) )
+            {
+                freeEntry = &clientTypes[index];
+            }
+        }
+
+        if (freeEntry)
+        {
+            freeEntry->dfuClient = dfuClient;
+            freeEntry->deviceType = deviceType;
+        }
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _xferFromSource
+**
+** DESCRIPTION: The transfer itself, from an image already in memory.
+**
+** PARAMETERS: nameStr: For the transfer report.
+**
+** RETURNS:
+**
+** COMMENTS: See xferImageWithTransport().
+**
+*/
+static bool _xferFromSource(const imageSourceStruct *source,
+                            char *nameStr,
+                            char *destStr,
+                            uint8_t imageIndex,
+                            uint32_t imageAddress,
+                            bool isEncrypted,
+                            dfuClientEnvStruct *dfuClient,
+                            const xferTransportOps *transport,
+                            uint16_t windowSize)
+{
+    bool                            ret = false;
+    uint32_t                        imageSize = source->size;
+    ASYNC_TIMER_STRUCT              startTimer;
+    ASYNC_TIMER_STRUCT              endTimer;
+    xferBlockingCtxStruct           blockingCtx;
+    xferTransportOps                blockingOps;
+    xferFileCtxStruct               fileCtx;
+    xferWindowParamsStruct          params;
+    xferWindowStatsStruct           stats;
+    xferWindowStruct *              window;
+    uint8_t                         deviceType;
+    uint32_t                        resumeOffset;
+    xferRttStruct                   rtt;
+
+    // A private copy: the table entry may be reused while we run.
+    xferRttGet(destStr, &rtt);
+
+    TIMER_Start(&startTimer);
+    endTimer = startTimer;
+
+    printf("\r\n *** IMAGE TRANSFER ***");
+    printf("\r\n Destination   : %s", destStr);
+    printf("\r\n Sending       : %s", nameStr);
+    printf("\r\n File size     : %u bytes", imageSize);
+    printf("\r\n Image Index   : %d", imageIndex);
+    printf("\r\n FLASH Address : 0x%08X", imageAddress);
+    printf("\r\n Encrypted     : %s", isEncrypted ? "yes" : "no");
+    fflush(stdout);
+    LOG_INFO("xfer: %s -> %s, %u bytes, index %d at 0x%08X", nameStr, destStr, imageSize, imageIndex, imageAddress);
+
+    /*
+    ** No transport given: wrap the blocking transaction.
+    **
+    */
+    if (transport == NULL)
+    {
+        memset(&blockingCtx, 0, sizeof(blockingCtx));
+        blockingCtx.dfuClient = dfuClient;
+        blockingCtx.destStr = destStr;
+        blockingCtx.imageIndex = imageIndex;
+        blockingCtx.imageAddress = imageAddress;
+        blockingCtx.rtt = &rtt;
+
+        memset(&blockingOps, 0, sizeof(blockingOps));
+        blockingOps.ctx = &blockingCtx;
+        blockingOps.sendChunk = _xferBlockingSendChunk;
+        blockingOps.pollAck = _xferBlockingPollAck;
+
+        // RCV_DATA carries no offset: the device appends chunks in the
+        // order they arrive, so only one may ever be unanswered.
+        blockingOps.maxWindow = XFER_BLOCKING_WINDOW_SIZE;
+
+        transport = &blockingOps;
+    }
+
+    if (windowSize == 0)
+    {
+        windowSize = XFER_DEFAULT_WINDOW_SIZE;
+        if (_xferGetDeviceType(dfuClient, &deviceType))
+        {
+            windowSize = xferWindowSizeForDeviceType(deviceType);
+        }
+    }
+
+    if ( (transport->maxWindow > 0) && (windowSize > transport->maxWindow) )
+    {
+        windowSize = transport->maxWindow;
+    }
+    printf("\r\n Window        : %u chunk(s)", windowSize);
+
+    resumeOffset = _xferGetResumeOffset(dfuClient,
+                                        &rtt,
+                                        source,
+                                        destStr,
+                                        imageIndex,
+                                        imageAddress,
+                                        &fileCtx.checkpoint);
+
+    fileCtx.imageSize = imageSize;
+    fileCtx.startOffset = resumeOffset;
+    fileCtx.progress = XFER_PROGRESS_NONE;
+
+    memset(&params, 0, sizeof(params));
+    params.transport = transport;
+    params.image = source->data;
+    params.imageSize = imageSize;
+    params.progress = _xferShowProgress;
+    params.progressCtx = &fileCtx;
+    params.chunkLen = dfuClientGetInternalMTU(dfuClient)-3;
+    params.windowSize = windowSize;
+    params.ackTimeoutMS = XFER_ACK_TIMEOUT_MS;
+    params.maxRetransmits = XFER_MAX_RETRANSMITS;
+    params.startOffset = resumeOffset;
+
+    // The blocking transport times its own transactions.
+    if (transport != &blockingOps)
+    {
+        params.rtt = &rtt;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+
+    /*
+    ** First, get the transfer started (or pick up
+    ** where the last attempt left off).
+    **
+    */
+    if (resumeOffset > 0)
+    {
+        printf("\r\n Resuming at   : %u bytes", resumeOffset);
+    }
+
+    if (
+           (resumeOffset > 0) ||
+           (dfuClientTransaction_CMD_BEGIN_RCV(dfuClient,
+                                               XFER_TRANSACTION_TIMEOUT_MS,
+                                               destStr,
+                                               imageIndex,
+                                               imageSize,
+                                               imageAddress,
+                                               isEncrypted))
+       )
+    {
+        TIMER_Start(&startTimer);
+        fflush(stdout);
+        fileCtx.progress = xferProgressOpen(destStr, imageSize, resumeOffset);
+
+        /*
+        ** Send all of the image file data
+        **
+        */
+        window = xferWindowCreate(windowSize);
+        if (window)
+        {
+            ret = xferWindowRun(window, &params, &stats);
+            xferWindowDestroy(window);
+        }
+        else
+        {
+            printf("\r\n Out of memory for the transfer window!");
+        }
+        xferProgressClose(fileCtx.progress, ret);
+
+        if ( (window) && (!ret) )
+        {
+            printf("\r\n Client rejected image WRITE operation!");
+        }
+
+        TIMER_Start(&endTimer);
+        stats.bytesAcked += resumeOffset;
+        if (transport == &blockingOps)
+        {
+            stats.timeouts += blockingCtx.timeouts;
+        }
+        printf("\r\n\r\n Sent [%u] bytes.  Total transactions: [%u]", stats.bytesAcked, stats.chunksSent);
+        if ( (stats.retransmits > 0) || (stats.timeouts > 0) )
+        {
+            printf("\r\n Retransmits: [%u]  Ack timeouts: [%u]", stats.retransmits, stats.timeouts);
+        }
+        xferRttPrint(&rtt);
+        LOG_INFO("xfer: %s %u bytes acked, %u chunks, %u retransmits, %u timeouts",
+                 destStr, stats.bytesAcked, stats.chunksSent, stats.retransmits, stats.timeouts);
+
+        // Now send the "RCV_COMPLETE" transaction
+        if ( (ret) &&
+             (!dfuClientTransaction_CMD_RCV_COMPLETE(dfuClient,
+                                                     XFER_TRANSACTION_TIMEOUT_MS,
+                                                     destStr,
+                                                     stats.bytesAcked)) )
+        {
+            printf("\r\n Target did not accept RCV_COMPLETE command!");
+            ret = false;
+        }
+
+        // Done with the checkpoint once the image is complete.
+        if (ret)
+        {
+            _xferUpdateCheckpoint(&fileCtx.checkpoint, imageSize, true);
+        }
+
+        fflush(stdout);
+    }
+    else
+    {
+        printf("\r\n Target did not accept BEGIN_RCV command!");
+    }
+
+    printf("\r\n Total transfer time (mS): %u", (uint32_t)TIMER_GetElapsedMillisecs(&startTimer, &endTimer));
+    xferRttPut(destStr, &rtt);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferBlockingSendChunk
+**
+** DESCRIPTION: Default transport: one RCV_DATA transaction per chunk.
+**              The result is held until the engine polls for it.
+**
+** PARAMETERS:
+**
+** RETURNS: Always true; a rejected chunk is reported as a NAK.
+**
+** COMMENTS: Each transaction gets the device's current RTT timeout,
+**           but never less than XFER_RTT_DATA_MIN_TIMEOUT_MS, as a chunk
+**           may start a flash erase.  RCV_DATA carries no offset, so a
+**           chunk that timed out is only sent again on a target that
+**           reports how much it holds (XFER_STATUS_PARTIAL_KEPT): it is
+**           asked (IMAGE_STATUS) whether the chunk landed first, so a
+**           lost reply never writes the same data twice.  Elsewhere a
+**           timeout fails the chunk.
+**
+*/
+static bool _xferBlockingSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+    xferBlockingCtxStruct *         blocking = (xferBlockingCtxStruct *)ctx;
+    uint32_t                        attempt = 0;
+    bool                            done = false;
+
+    blocking->lastSeq = seq;
+    blocking->lastAccepted = false;
+
+    while ( (!done) && (attempt <= XFER_MAX_RETRANSMITS) )
+    {
+        uint64_t                    txStartUS = TIMER_GetMicroseconds();
+        uint32_t                    timeoutMS = xferRttDataTimeoutMS(blocking->rtt);
+        bool                        landed = false;
+
+        blocking->lastAccepted = dfuClientTransaction_CMD_RCV_DATA(blocking->dfuClient,
+                                                                   timeoutMS,
+                                                                   blocking->destStr,
+                                                                   (uint8_t *)data,
+                                                                   len);
+
+        if (
+               (blocking->lastAccepted) ||
+               (!xferRttEnd(blocking->rtt, txStartUS, timeoutMS))
+           )
+        {
+            // Answered (ACK or NAK)
+            done = true;
+        }
+        else
+        {
+            blocking->timeouts++;
+            if (
+                   (XFER_STATUS_PARTIAL_KEPT == 0) ||
+                   (!_xferBlockingChunkLanded(blocking, offset, len, &landed))
+               )
+            {
+                // Can't tell where the device is; give up on this chunk.
+                done = true;
+            }
+            else if (landed)
+            {
+                blocking->lastAccepted = true;
+                done = true;
+            }
+        }
+
+        attempt++;
+    }
+
+    blocking->ackPending = true;
+
+    return (true);
+}
+
+/*!
+** FUNCTION: _xferBlockingPollAck
+**
+** DESCRIPTION: Default transport: reports the result of the last
+**              RCV_DATA transaction.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _xferBlockingPollAck(void *ctx, xferAckStruct *ack, uint32_t timeoutMS)
+{
+    bool                            ret = false;
+    xferBlockingCtxStruct *         blocking = (xferBlockingCtxStruct *)ctx;
+
+    (void)timeoutMS;
+
+    if (blocking->ackPending)
+    {
+        ack->cumulativeSeq = blocking->lastSeq + (blocking->lastAccepted ? 1 : 0);
+        ack->selectiveMask = 0;
+        ack->rejected = !blocking->lastAccepted;
+
+        blocking->ackPending = false;
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferBlockingChunkLanded
+**
+** DESCRIPTION: After an RCV_DATA timeout, asks the device how much of the
+**              image it now holds.
+**
+** PARAMETERS: landed: Set true if the chunk at "offset" was received
+**                     (only the reply was lost).
+**
+** RETURNS: false if the device could not say, or holds neither "offset"
+**          nor "offset + len" bytes.
+**
+** COMMENTS:
+**
+*/
+static bool _xferBlockingChunkLanded(xferBlockingCtxStruct *blocking, uint32_t offset, uint16_t len, bool *landed)
+{
+    bool                            ret = false;
+    uint8_t                         statusIndex = blocking->imageIndex;
+    uint8_t                         statusFlags = 0;
+    uint32_t                        statusSize = 0;
+
+    if (
+           (dfuClientTransaction_CMD_IMAGE_STATUS(blocking->dfuClient,
+                                                  xferRttTimeoutMS(blocking->rtt),
+                                                  blocking->destStr,
+                                                  &statusIndex,
+                                                  blocking->imageAddress,
+                                                  &statusFlags,
+                                                  &statusSize)) &&
+           (statusIndex == blocking->imageIndex)
+       )
+    {
+        if (statusSize == offset + len)
+        {
+            *landed = true;
+            ret = true;
+        }
+        else if (statusSize == offset)
+        {
+            *landed = false;
+            ret = true;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferShowProgress
+**
+** DESCRIPTION: Moves the checkpoint along and publishes the counters
+**              to the progress table.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Called for every ack, so it does no I/O; the progress
+**           renderer draws at its own rate.
+**
+*/
+static void _xferShowProgress(void *ctx, const xferWindowStatsStruct *stats)
+{
+    xferFileCtxStruct *             fileCtx = (xferFileCtxStruct *)ctx;
+    uint32_t                        bytesAcked = stats->bytesAcked + fileCtx->startOffset;
+
+    _xferUpdateCheckpoint(&fileCtx->checkpoint, bytesAcked, false);
+
+    xferProgressUpdate(fileCtx->progress,
+                       bytesAcked,
+                       stats->chunksSent,
+                       stats->retransmits,
+                       stats->timeouts);
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferGetDeviceType
+**
+** DESCRIPTION: Finds the device type recorded for a client.
+**
+** PARAMETERS:
+**
+** RETURNS: true if one was recorded.
+**
+** COMMENTS:
+**
+*/
+static bool _xferGetDeviceType(dfuClientEnvStruct *dfuClient, uint8_t *deviceType)
+{
+    bool                            ret = false;
+    uint32_t                        index;
+
+    for (index = 0; index < XFER_MAX_CLIENTS; index++)
+    {
+        if ( (dfuClient) && (clientTypes[index].dfuClient == dfuClient) )
+        {
+            *deviceType = clientTypes[index].deviceType;
+            ret = true;
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferFindCheckpoint
+**
+** DESCRIPTION: Looks up the checkpoint for an image on a device,
+**              optionally claiming one if there isn't one yet.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Caller holds checkpointLock.  When every entry is in use
+**           the oldest claim is reused.
+**
+*/
+static xferCheckpointStruct *_xferFindCheckpoint(const char *destStr, uint8_t imageIndex, uint32_t imageAddress, bool create)
+{
+    xferCheckpointStruct *          ret = NULL;
+    xferCheckpointStruct *          freeEntry = NULL;
+    uint32_t                        index;
+
+    for (index = 0; (destStr) && (index < XFER_MAX_CHECKPOINTS); index++)
+    {
+        xferCheckpointStruct *      entry = &checkpoints[index];
+
+        if (
+               (entry->inUse) &&
+               (entry->imageIndex == imageIndex) &&
+               (entry->imageAddress == imageAddress) &&
+               (strncmp(entry->destStr, destStr, sizeof(entry->destStr)) == 0)
+           )
+        {
+            ret = entry;
+            break;
+        }
+
+        if ( (freeEntry == NULL) && (!entry->inUse) )
+        {
+            freeEntry = entry;
+        }
+    }
+
+    if ( (ret == NULL) && (create) && (destStr) )
+    {
+        if (freeEntry == NULL)
+        {
+            freeEntry = &checkpoints[nextCheckpoint];
+            nextCheckpoint = (nextCheckpoint + 1) % XFER_MAX_CHECKPOINTS;
+        }
+
+        memset(freeEntry, 0, sizeof(xferCheckpointStruct));
+        snprintf(freeEntry->destStr, sizeof(freeEntry->destStr), "%s", destStr);
+        freeEntry->imageIndex = imageIndex;
+        freeEntry->imageAddress = imageAddress;
+        freeEntry->inUse = true;
+        ret = freeEntry;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferUpdateCheckpoint
+**
+** DESCRIPTION: Records how far a transfer has got, or that it is done.
+**
+** PARAMETERS: checkpoint: The transfer's copy, from _xferGetResumeOffset().
+**             done:       Frees the entry instead.
+**
+** RETURNS:
+**
+** COMMENTS: Only touches the table entry that is still this image's
+**           (same device, index, address, size and CRC-32).  If it was
+**           reused meanwhile, the transfer just carries on without one.
+**
+*/
+static void _xferUpdateCheckpoint(const xferCheckpointStruct *checkpoint, uint32_t ackedOffset, bool done)
+{
+    xferCheckpointStruct *          entry;
+
+    if (checkpoint->inUse)
+    {
+        pthread_mutex_lock(&checkpointLock);
+
+        entry = _xferFindCheckpoint(checkpoint->destStr, checkpoint->imageIndex, checkpoint->imageAddress, false);
+        if (
+               (entry) &&
+               (entry->imageSize == checkpoint->imageSize) &&
+               (entry->imageCRC == checkpoint->imageCRC)
+           )
+        {
+            if (done)
+            {
+                entry->inUse = false;
+            }
+            else
+            {
+                entry->ackedOffset = ackedOffset;
+            }
+        }
+
+        pthread_mutex_unlock(&checkpointLock);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferGetResumeOffset
+**
+** DESCRIPTION: Decides where a transfer starts, and hands back a copy
+**              of the checkpoint to keep up to date while it runs.
+**
+** PARAMETERS: rtt:        Sizes the IMAGE_STATUS timeout.
+**             checkpoint: "inUse" is false for images too small to
+**                         bother checkpointing.
+**
+** RETURNS: The offset to resume from, or 0 to start over.
+**
+** COMMENTS: Resumes only if the image file is unchanged (size and
+**           CRC-32 match the checkpoint) AND IMAGE_STATUS says the
+**           device kept the partial image (XFER_STATUS_PARTIAL_KEPT)
+**           and holds exactly the checkpointed number of bytes.  The
+**           protocol has no BEGIN_RCV at an offset, so a device that
+**           doesn't report that is always started over.
+**
+*/
+static uint32_t _xferGetResumeOffset(dfuClientEnvStruct *dfuClient,
+                                     xferRttStruct *rtt,
+                                     const imageSourceStruct *source,
+                                     char *destStr,
+                                     uint8_t imageIndex,
+                                     uint32_t imageAddress,
+                                     xferCheckpointStruct *checkpoint)
+{
+    uint32_t                        ret = 0;
+    uint32_t                        imageSize = source->size;
+
+    memset(checkpoint, 0, sizeof(xferCheckpointStruct));
+
+    if (imageSize >= XFER_RESUME_MIN_IMAGE_SIZE)
+    {
+        uint32_t                    imageCRC = dfuToolCRC32(0, source->data, imageSize);
+        xferCheckpointStruct *      entry;
+        uint32_t                    resumeOffset = 0;
+
+        pthread_mutex_lock(&checkpointLock);
+        entry = _xferFindCheckpoint(destStr, imageIndex, imageAddress, true);
+        if (entry)
+        {
+            if (
+                   (entry->imageSize == imageSize) &&
+                   (entry->imageCRC == imageCRC) &&
+                   (entry->ackedOffset < imageSize)
+               )
+            {
+                resumeOffset = entry->ackedOffset;
+            }
+            else
+            {
+                entry->imageSize = imageSize;
+                entry->imageCRC = imageCRC;
+                entry->ackedOffset = 0;
+            }
+            *checkpoint = *entry;
+        }
+        pthread_mutex_unlock(&checkpointLock);
+
+        //
+        // The file matches; now make sure the device kept the partial
+        // image and still has exactly what we think it has.
+        //
+        if (resumeOffset > 0)
+        {
+            uint8_t                 statusIndex = imageIndex;
+            uint8_t                 statusFlags = 0;
+            uint32_t                statusSize = 0;
+
+            if (
+                   (XFER_STATUS_PARTIAL_KEPT != 0) &&
+                   (dfuClientTransaction_CMD_IMAGE_STATUS(dfuClient,
+                                                          xferRttTimeoutMS(rtt),
+                                                          destStr,
+                                                          &statusIndex,
+                                                          imageAddress,
+                                                          &statusFlags,
+                                                          &statusSize)) &&
+                   (statusIndex == imageIndex) &&
+                   (statusFlags & XFER_STATUS_PARTIAL_KEPT) &&
+                   (statusSize == resumeOffset)
+               )
+            {
+                ret = resumeOffset;
+            }
+            else
+            {
+                printf("\r\n Device did not keep the first %u bytes; starting over.", resumeOffset);
+                _xferUpdateCheckpoint(checkpoint, 0, false);
+                checkpoint->ackedOffset = 0;
+            }
+        }
+    }
+
+    return (ret);
+}
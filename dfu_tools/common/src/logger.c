@@ -5,7 +5,12 @@
 /// @file logger.c
 /// @brief Logger for the DFU interface tools.
 ///
-/// @details
+/// @details Each level has a bounded lock-free ring that any thread can
+///          write to.  An entry is binary: the call site's format ID, a
+///          monotonic timestamp, the writing thread and the raw
+///          arguments.  A drain thread takes entries off the rings in
+///          timestamp order and either formats them or writes them raw
+///          for loggerDecode().
 ///
 /// @copyright 2024 Glydways, Inc
 /// @copyright https://glydways.com
@@ -13,183 +18,524 @@
 //#############################################################################
 //#############################################################################
 //#############################################################################
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
 #include "logger.h"
+#include "async_timer.h"
 
-// log_system.c
-#include "log_system.h"
-#include <string.h>
+#define LOGGER_RING_MASK            (LOGGER_RING_ENTRIES - 1U)
+#define LOGGER_MAX_SPEC_LEN         (32U)
+#define LOGGER_MAX_LINE_LEN         (512U)
+
+/*
+** Binary output: file header, then records each starting with one of
+** the record types.
+**
+*/
+static const char LOGGER_FILE_MAGIC[8] = { 'D', 'F', 'U', 'L', 'O', 'G', 1, 0 };
+
+#define LOGGER_RECORD_FORMAT        ('F')
+#define LOGGER_RECORD_ENTRY         ('E')
+#define LOGGER_RECORD_DROPPED       ('D')
+
+/*
+** How each printf conversion's argument is passed and stored.
+**
+*/
+typedef enum
+{
+    LOGGER_ARG_NONE = 0,        // "%%", or nothing we understand
+    LOGGER_ARG_INT,
+    LOGGER_ARG_LONG,
+    LOGGER_ARG_LLONG,
+    LOGGER_ARG_SIZE,
+    LOGGER_ARG_INTMAX,
+    LOGGER_ARG_PTRDIFF,
+    LOGGER_ARG_DOUBLE,
+    LOGGER_ARG_LDOUBLE,
+    LOGGER_ARG_PTR,
+    LOGGER_ARG_STRING,
+    LOGGER_ARG_SKIP             // "%n": argument consumed, nothing shown
+}loggerArgTypeEnum;
+
+/*
+** A registered format.
+**
+*/
+typedef struct
+{
+    const char *                text;
+    uint8_t                     argCount;
+    uint8_t                     argTypes[LOGGER_MAX_ARGS];
+}loggerFormatInfoStruct;
+
+/*
+** Front of every entry (also its layout in a binary file).
+**
+*/
+typedef struct
+{
+    uint64_t                    timestampUS;
+    uint32_t                    threadId;
+    uint16_t                    formatId;
+    uint8_t                     level;
+    uint8_t                     argBytes;
+}loggerRecordHeaderStruct;
 
+/*
+** One ring slot.  "sequence" says whose turn it is: equal to the
+** enqueue position when free, one more once written.
+**
+*/
+typedef struct
+{
+    uint32_t                    sequence;
+    loggerRecordHeaderStruct    header;
+    uint8_t                     args[LOGGER_MAX_ARG_BYTES];
+}loggerSlotStruct;
+
+/*
+** One level's ring.  The producer and consumer positions are kept on
+** separate cache lines.
+**
+*/
+typedef struct
+{
+    uint32_t                    enqueuePos;
+    uint8_t                     pad1[60];
+    uint32_t                    dequeuePos;
+    uint32_t                    dropped;
+    uint32_t                    reportedDropped;
+    uint8_t                     pad2[52];
+    loggerSlotStruct            slots[LOGGER_RING_ENTRIES];
+}loggerRingStruct;
+
+static const char *             levelNames[LOG_LEVEL_COUNT] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+static loggerRingStruct         rings[LOG_LEVEL_COUNT];
+static loggerFormatInfoStruct   formatTable[LOGGER_MAX_FORMATS];
+static bool                     formatWritten[LOGGER_MAX_FORMATS];
+static uint32_t                 formatCount;
+static uint32_t                 threadCount;
+static __thread uint32_t        loggerThreadId;
+
+static bool                     loggerRunning;
+static bool                     loggerStopping;
+static uint32_t                 loggerWriters;
+static uint32_t                 loggerMaxLevel;
+static pthread_t                drainThread;
+static FILE *                   loggerOutput;
+static loggerOutputEnum         loggerOutputMode;
+static uint64_t                 loggerStartUS;
 
 
 /*
 ** Internal prototypes
 **
 */
-static uint32_t calculateCRC(const uint8_t* data, uint32_t length);
-static bool hasSpace(logBufferStruct* buffer, uint32_t needed);
+static uint16_t _loggerRegister(loggerFormatStruct *format);
+static const char *_loggerParseSpec(const char *fmt, char *spec, loggerArgTypeEnum *type, uint32_t *stars);
+static void _loggerExpandStars(const char *spec, const int *values, char *dest);
+static uint32_t _loggerPackArgs(const loggerFormatInfoStruct *info, va_list args, uint8_t *dest);
+static void _loggerRender(const char *fmt, const uint8_t *args, uint32_t argBytes, char *dest, size_t destSize);
+static void _loggerPrintEntry(FILE *out, const char *fmt, const loggerRecordHeaderStruct *header, const uint8_t *args, uint64_t originUS);
+static void *_loggerDrainThread(void *arg);
+static uint32_t _loggerDrain(void);
+static void _loggerReportDrops(void);
 
 
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          EXPORTED API FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 
-void log_init(logSystemStruct* log) 
+///
+/// @fn: loggerStart
+///
+/// @details Opens the output, empties the rings and starts the drain
+///          thread.
+///
+/// @param[in] path      File to write, or NULL for text on stdout.
+/// @param[in] output    Text or binary.
+/// @param[in] maxLevel  Most verbose level kept.
+///
+/// @returns false if already running, or the output couldn't be opened.
+///
+bool loggerStart(const char *path, loggerOutputEnum output, logLevelEnum maxLevel)
 {
-    log->maxLevel = LOG_LEVEL_INFO;
-    
-    for (int i = 0; i < LOG_LEVEL_COUNT; i++) 
+    bool                        ret = false;
+    uint32_t                    level;
+    uint32_t                    index;
+
+    if (!__atomic_load_n(&loggerRunning, __ATOMIC_ACQUIRE))
     {
-        log->buffers[i].writeIndex = 0;
-        log->buffers[i].readIndex = 0;
-        log->buffers[i].entryCount = 0;
+        loggerOutputMode = output;
+        loggerOutput = (path) ? fopen(path, (output == LOGGER_OUTPUT_BINARY) ? "wb" : "w") : stdout;
+
+        if (
+               (loggerOutput) &&
+               ( (path) || (output == LOGGER_OUTPUT_TEXT) )
+           )
+        {
+            for (level = 0; level < LOG_LEVEL_COUNT; level++)
+            {
+                rings[level].enqueuePos = 0;
+                rings[level].dequeuePos = 0;
+                rings[level].dropped = 0;
+                rings[level].reportedDropped = 0;
+                for (index = 0; index < LOGGER_RING_ENTRIES; index++)
+                {
+                    rings[level].slots[index].sequence = index;
+                }
+            }
+            memset(formatWritten, 0, sizeof(formatWritten));
+
+            loggerStartUS = TIMER_GetMicroseconds();
+            if (output == LOGGER_OUTPUT_BINARY)
+            {
+                int64_t         wallClock = (int64_t)time(NULL);
+
+                fwrite(LOGGER_FILE_MAGIC, sizeof(LOGGER_FILE_MAGIC), 1, loggerOutput);
+                fwrite(&loggerStartUS, sizeof(loggerStartUS), 1, loggerOutput);
+                fwrite(&wallClock, sizeof(wallClock), 1, loggerOutput);
+            }
+
+            __atomic_store_n(&loggerMaxLevel, (uint32_t)maxLevel, __ATOMIC_RELAXED);
+            __atomic_store_n(&loggerStopping, false, __ATOMIC_RELAXED);
+            __atomic_store_n(&loggerRunning, true, __ATOMIC_RELEASE);
+
+            if (pthread_create(&drainThread, NULL, _loggerDrainThread, NULL) == 0)
+            {
+                ret = true;
+            }
+            else
+            {
+                printf("\r\n Could not start the log drain thread!");
+                __atomic_store_n(&loggerRunning, false, __ATOMIC_RELEASE);
+            }
+        }
+        else
+        {
+            printf("\r\n Could not open log file [%s]!", path ? path : "(none)");
+        }
+
+        if ( (!ret) && (loggerOutput) && (loggerOutput != stdout) )
+        {
+            fclose(loggerOutput);
+        }
+        if (!ret)
+        {
+            loggerOutput = NULL;
+        }
     }
-}
 
+    return (ret);
+}
 
-bool log_write(logSystemStruct* log, logLevelEnum level, const uint8_t* msg, uint32_t len) 
+///
+/// @fn: loggerStop
+///
+/// @details Stops taking entries, waits for writes already under way,
+///          lets the drain thread write out everything queued, then
+///          closes the output.
+///
+/// @returns
+///
+/// @note Every loggerWrite() that returned true is in the output.
+///
+void loggerStop(void)
 {
-    if (level > log->maxLevel || len > LOG_MAX_ENTRY_SIZE) 
-    {
-        return false;
-    }
-    
-    logBufferStruct* buffer = &log->buffers[level];
-    uint32_t total_size = sizeof(logEntryHeaderStruct) + len;
-    
-    if (!has_space(buffer, total_size)) 
+    if (__atomic_load_n(&loggerRunning, __ATOMIC_ACQUIRE))
     {
-        // Buffer full
-        return false;
-    }
-    
-    LogEntryHeader header;
-    header.timestamp = /* get_system_timestamp() */ 0; // Implement based on your system
-    header.msg_len = len;
-    header.crc = calculate_crc(msg, len);
-    
-    // Write header
-    uint32_t space_to_end = LOG_BUFFER_SIZE - buffer->write_index;
-    if (space_to_end < sizeof(header)) {
-        // Split header across buffer boundary
-        uint32_t first_part = space_to_end;
-        memcpy(&buffer->buffer[buffer->write_index], &header, first_part);
-        memcpy(&buffer->buffer[0], (uint8_t*)&header + first_part, 
-               sizeof(header) - first_part);
-        buffer->write_index = sizeof(header) - first_part;
-    } else {
-        memcpy(&buffer->buffer[buffer->write_index], &header, sizeof(header));
-        buffer->write_index += sizeof(header);
-        if (buffer->write_index == LOG_BUFFER_SIZE) {
-            buffer->write_index = 0;
+        __atomic_store_n(&loggerRunning, false, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&loggerWriters, __ATOMIC_SEQ_CST) != 0)
+        {
+            TIMER_SleepUS(100U);
         }
-    }
-    
-    // Write message with potential wrap
-    space_to_end = LOG_BUFFER_SIZE - buffer->write_index;
-    if (space_to_end < len) {
-        memcpy(&buffer->buffer[buffer->write_index], msg, space_to_end);
-        memcpy(&buffer->buffer[0], msg + space_to_end, len - space_to_end);
-        buffer->write_index = len - space_to_end;
-    } else {
-        memcpy(&buffer->buffer[buffer->write_index], msg, len);
-        buffer->write_index += len;
-        if (buffer->write_index == LOG_BUFFER_SIZE) {
-            buffer->write_index = 0;
+        __atomic_store_n(&loggerStopping, true, __ATOMIC_RELEASE);
+        pthread_join(drainThread, NULL);
+
+        if (loggerOutput != stdout)
+        {
+            fclose(loggerOutput);
         }
+        else
+        {
+            fflush(loggerOutput);
+        }
+        loggerOutput = NULL;
     }
-    
-    buffer->entry_count++;
-    return true;
+
+    return;
 }
 
-bool log_read_next(LogSystem* log, LogLevel level, LogEntry* entry) {
-    if (level >= LOG_LEVEL_COUNT) return false;
-    
-    LogBuffer* buffer = &log->buffers[level];
-    if (buffer->read_index == buffer->write_index) {
-        return false;  // No more entries
-    }
-    
-    LogEntryHeader header;
-    uint32_t space_to_end = LOG_BUFFER_SIZE - buffer->read_index;
-    
-    // Read header
-    if (space_to_end < sizeof(header)) {
-        memcpy(&header, &buffer->buffer[buffer->read_index], space_to_end);
-        memcpy((uint8_t*)&header + space_to_end, &buffer->buffer[0], 
-               sizeof(header) - space_to_end);
-        buffer->read_index = sizeof(header) - space_to_end;
-    } else {
-        memcpy(&header, &buffer->buffer[buffer->read_index], sizeof(header));
-        buffer->read_index += sizeof(header);
-        if (buffer->read_index == LOG_BUFFER_SIZE) {
-            buffer->read_index = 0;
+///
+/// @fn: loggerSetLevel
+///
+/// @details Changes the most verbose level that is kept.
+///
+/// @param[in] maxLevel
+///
+/// @returns
+///
+void loggerSetLevel(logLevelEnum maxLevel)
+{
+    __atomic_store_n(&loggerMaxLevel, (uint32_t)maxLevel, __ATOMIC_RELAXED);
+
+    return;
+}
+
+///
+/// @fn: loggerEnabled
+///
+/// @details Would an entry at this level be kept?
+///
+/// @param[in] level
+///
+/// @returns
+///
+bool loggerEnabled(logLevelEnum level)
+{
+    return (
+               (__atomic_load_n(&loggerRunning, __ATOMIC_RELAXED)) &&
+               ((uint32_t)level <= __atomic_load_n(&loggerMaxLevel, __ATOMIC_RELAXED))
+           );
+}
+
+///
+/// @fn: loggerWrite
+///
+/// @details Claims a slot in the level's ring and copies the timestamp
+///          and raw arguments into it.  No formatting, no locks, no
+///          system calls beyond reading the clock.
+///
+/// @param[in] level
+/// @param[in] format  The call site's format (see LOGGER_LOG()).
+///
+/// @returns false if logging is off, the format table is full or the
+///          ring is full (the entry is then counted as dropped).
+///
+bool loggerWrite(logLevelEnum level, loggerFormatStruct *format, ...)
+{
+    bool                        ret = false;
+
+    // Counted in before looking at loggerRunning, so loggerStop() can
+    // wait for this write to land
+    __atomic_add_fetch(&loggerWriters, 1U, __ATOMIC_SEQ_CST);
+
+    if (
+           (format) &&
+           (format->text) &&
+           ((uint32_t)level < LOG_LEVEL_COUNT) &&
+           (__atomic_load_n(&loggerRunning, __ATOMIC_SEQ_CST)) &&
+           ((uint32_t)level <= __atomic_load_n(&loggerMaxLevel, __ATOMIC_RELAXED))
+       )
+    {
+        loggerRingStruct *      ring = &rings[level];
+        uint16_t                formatId = __atomic_load_n(&format->id, __ATOMIC_ACQUIRE);
+        uint32_t                pos;
+
+        if (formatId == 0)
+        {
+            formatId = _loggerRegister(format);
+        }
+
+        if (loggerThreadId == 0)
+        {
+            loggerThreadId = __atomic_add_fetch(&threadCount, 1U, __ATOMIC_RELAXED);
+        }
+
+        pos = __atomic_load_n(&ring->enqueuePos, __ATOMIC_RELAXED);
+        while (formatId != 0)
+        {
+            loggerSlotStruct *  slot = &ring->slots[pos & LOGGER_RING_MASK];
+            uint32_t            sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+            int32_t             diff = (int32_t)(sequence - pos);
+
+            if (diff == 0)
+            {
+                // Free slot: try to claim it
+                if (__atomic_compare_exchange_n(&ring->enqueuePos, &pos, pos + 1U, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    va_list     args;
+
+                    slot->header.timestampUS = TIMER_GetMicroseconds();
+                    slot->header.threadId = loggerThreadId;
+                    slot->header.formatId = formatId;
+                    slot->header.level = (uint8_t)level;
+
+                    va_start(args, format);
+                    slot->header.argBytes = (uint8_t)_loggerPackArgs(&formatTable[formatId], args, slot->args);
+                    va_end(args);
+
+                    __atomic_store_n(&slot->sequence, pos + 1U, __ATOMIC_RELEASE);
+                    ret = true;
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Full: the drain thread hasn't freed this slot yet
+                __atomic_add_fetch(&ring->dropped, 1U, __ATOMIC_RELAXED);
+                break;
+            }
+            else
+            {
+                pos = __atomic_load_n(&ring->enqueuePos, __ATOMIC_RELAXED);
+            }
         }
     }
-    
-    // Validate message length
-    if (header.msg_len > LOG_MAX_ENTRY_SIZE) {
-        return false;  // Corrupted entry
-    }
-    
-    // Setup entry response
-    entry->timestamp = header.timestamp;
-    entry->level = level;
-    entry->msg_len = header.msg_len;
-    
-    // For simplicity, we're returning a pointer into the buffer
-    // Be aware this means the client needs to copy data before the next read
-    entry->msg = &buffer->buffer[buffer->read_index];
-    
-    // Verify CRC
-    uint32_t calculated_crc = calculate_crc(entry->msg, entry->msg_len);
-    if (calculated_crc != header.crc) {
-        return false;  // CRC mismatch
-    }
-    
-    // Update read pointer
-    buffer->read_index += header.msg_len;
-    if (buffer->read_index >= LOG_BUFFER_SIZE) {
-        buffer->read_index -= LOG_BUFFER_SIZE;
-    }
-    
-    return true;
+
+    __atomic_sub_fetch(&loggerWriters, 1U, __ATOMIC_RELEASE);
+
+    return (ret);
 }
 
-void log_read_reset(LogSystem* log, LogLevel level) {
-    if (level < LOG_LEVEL_COUNT) {
-        log->buffers[level].read_index = 0;
+///
+/// @fn: loggerDropped
+///
+/// @details How many entries have been dropped because a ring was full.
+///
+/// @returns
+///
+uint32_t loggerDropped(void)
+{
+    uint32_t                    ret = 0;
+    uint32_t                    level;
+
+    for (level = 0; level < LOG_LEVEL_COUNT; level++)
+    {
+        ret += __atomic_load_n(&rings[level].dropped, __ATOMIC_RELAXED);
     }
-}
 
-uint32_t log_get_entry_count(LogSystem* log, LogLevel level) {
-    if (level >= LOG_LEVEL_COUNT) return 0;
-    return log->buffers[level].entry_count;
+    return (ret);
 }
 
-// Helper function implementations
-bool log_write_uint32(LogSystem* log, LogLevel level, const uint8_t* prefix, uint32_t value) {
-    uint8_t temp[LOG_MAX_ENTRY_SIZE];
-    uint32_t prefix_len = strlen((const char*)prefix);
-    
-    if (prefix_len >= LOG_MAX_ENTRY_SIZE) return false;
-    
-    memcpy(temp, prefix, prefix_len);
-    
-    uint32_t pos = prefix_len;
-    uint32_t val = value;
-    uint32_t digits[10];
-    uint32_t digit_count = 0;
-    
-    do {
-        digits[digit_count++] = val % 10;
-        val /= 10;
-    } while (val > 0);
-    
-    if ((pos + digit_count) >= LOG_MAX_ENTRY_SIZE) return false;
-    
-    while (digit_count > 0) {
-        temp[pos++] = '0' + digits[--digit_count];
+///
+/// @fn: loggerDecode
+///
+/// @details Renders a LOGGER_OUTPUT_BINARY file as the same text the
+///          drain thread would have written.
+///
+/// @param[in] in   Opened for binary reading.
+/// @param[in] out
+///
+/// @returns false if "in" isn't a log file or is damaged.  Anything
+///          before the damage has been written.
+///
+bool loggerDecode(FILE *in, FILE *out)
+{
+    bool                        ret = false;
+    char                        magic[sizeof(LOGGER_FILE_MAGIC)];
+    uint64_t                    originUS;
+    int64_t                     wallClock;
+    char *                      formats[LOGGER_MAX_FORMATS];
+    uint32_t                    index;
+
+    memset(formats, 0, sizeof(formats));
+
+    if (
+           (in) &&
+           (out) &&
+           (fread(magic, sizeof(magic), 1, in) == 1) &&
+           (memcmp(magic, LOGGER_FILE_MAGIC, sizeof(magic)) == 0) &&
+           (fread(&originUS, sizeof(originUS), 1, in) == 1) &&
+           (fread(&wallClock, sizeof(wallClock), 1, in) == 1)
+       )
+    {
+        time_t                  started = (time_t)wallClock;
+        int                     type;
+
+        fprintf(out, "Log started %s", ctime(&started));
+        ret = true;
+
+        while ( (ret) && ((type = fgetc(in)) != EOF) )
+        {
+            switch (type)
+            {
+                case LOGGER_RECORD_FORMAT:
+                {
+                    uint16_t                    id;
+                    uint16_t                    len;
+
+                    ret = (
+                              (fread(&id, sizeof(id), 1, in) == 1) &&
+                              (fread(&len, sizeof(len), 1, in) == 1) &&
+                              (id < LOGGER_MAX_FORMATS)
+                          );
+                    if (ret)
+                    {
+                        free(formats[id]);
+                        formats[id] = (char *)malloc((size_t)len + 1U);
+                        ret = ( (formats[id]) && (fread(formats[id], 1, len, in) == len) );
+                        if (ret)
+                        {
+                            formats[id][len] = '\0';
+                        }
+                    }
+                    break;
+                }
+
+                case LOGGER_RECORD_ENTRY:
+                {
+                    loggerRecordHeaderStruct    header;
+                    uint8_t                     args[LOGGER_MAX_ARG_BYTES];
+
+                    ret = (
+                              (fread(&header, sizeof(header), 1, in) == 1) &&
+                              (header.argBytes <= sizeof(args)) &&
+                              (header.level < LOG_LEVEL_COUNT) &&
+                              (header.formatId < LOGGER_MAX_FORMATS) &&
+                              (fread(args, 1, header.argBytes, in) == header.argBytes)
+                          );
+                    if (ret)
+                    {
+                        _loggerPrintEntry(out, formats[header.formatId], &header, args, originUS);
+                    }
+                    break;
+                }
+
+                case LOGGER_RECORD_DROPPED:
+                {
+                    uint8_t                     level;
+                    uint32_t                    count;
+
+                    ret = (
+                              (fread(&level, sizeof(level), 1, in) == 1) &&
+                              (fread(&count, sizeof(count), 1, in) == 1) &&
+                              (level < LOG_LEVEL_COUNT)
+                          );
+                    if (ret)
+                    {
+                        fprintf(out, "*** %u %s entries dropped ***\n", count, levelNames[level]);
+                    }
+                    break;
+                }
+
+                default:
+                    ret = false;
+                    break;
+            }
+        }
+
+        if (!ret)
+        {
+            fprintf(out, "*** Log file is damaged ***\n");
+        }
     }
-    
-    return log_write(log, level, temp, pos);
+
+    for (index = 0; index < LOGGER_MAX_FORMATS; index++)
+    {
+        free(formats[index]);
+    }
+
+    return (ret);
 }
 
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
@@ -199,65 +545,624 @@ bool log_write_uint32(LogSystem* log, LogLevel level, const uint8_t* prefix, uin
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 
 ///
-/// @fn: calculateCRC
+/// @fn: _loggerRegister
 ///
-/// @details Rudimentary CRC-32
+/// @details Gives a call site's format an ID and works out its argument
+///          types, once.
 ///
-/// @param[in] 
-/// @param[in] 
-/// @param[in] 
-/// @param[in] 
+/// @param[in] format
 ///
-/// @returns 
+/// @returns The ID, or 0 if the table is full.
 ///
-/// @tracereq(@req{xxxxxxx}}
+/// @note Two threads hitting a new call site together may each
+///       register it; one ID wins, the other is simply never reused.
 ///
-static uint32_t calculateCRC(const uint8_t* data, uint32_t length) 
+static uint16_t _loggerRegister(loggerFormatStruct *format)
 {
-    uint32_t crc = 0xFFFFFFFF;
-    for (uint32_t i = 0; i < length; i++) 
+    uint16_t                    ret = 0;
+    uint32_t                    id = __atomic_add_fetch(&formatCount, 1U, __ATOMIC_RELAXED);
+
+    if (id < LOGGER_MAX_FORMATS)
     {
-        crc ^= data[i];
-        for (int j = 0; j < 8; j++) 
+        loggerFormatInfoStruct *    info = &formatTable[id];
+        const char *                fmt = format->text;
+        char                        spec[LOGGER_MAX_SPEC_LEN];
+        loggerArgTypeEnum           type;
+        uint32_t                    stars;
+        uint16_t                    expected = 0;
+
+        info->text = format->text;
+        info->argCount = 0;
+
+        while (*fmt)
+        {
+            if (*fmt != '%')
+            {
+                fmt++;
+                continue;
+            }
+
+            fmt = _loggerParseSpec(fmt, spec, &type, &stars);
+
+            // A "*" width or precision is an int argument ahead of the value
+            if ( (type != LOGGER_ARG_NONE) && ((info->argCount + stars) < LOGGER_MAX_ARGS) )
+            {
+                while (stars-- > 0)
+                {
+                    info->argTypes[info->argCount++] = (uint8_t)LOGGER_ARG_INT;
+                }
+                info->argTypes[info->argCount++] = (uint8_t)type;
+            }
+        }
+
+        // Publish: the table entry is complete before anyone sees the ID
+        ret = (uint16_t)id;
+        if (!__atomic_compare_exchange_n(&format->id, &expected, ret, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
         {
-            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+            ret = expected;
         }
     }
 
-    return ~crc;
+    return (ret);
 }
 
 ///
-/// @fn: hasSpace
+/// @fn: _loggerParseSpec
 ///
-/// @details Is there space in the specified buffer for the message?
+/// @details Reads one printf conversion starting at "%".
 ///
-/// @param[in] 
-/// @param[in] 
-/// @param[in] 
-/// @param[in] 
+/// @param[in]  fmt    Points at the '%'.
+/// @param[out] spec   The conversion, ready for snprintf() with one
+///                    argument once any "*" is filled in ("L" is taken
+///                    out).
+/// @param[out] type
+/// @param[out] stars  How many "*" widths/precisions it has; each takes
+///                    an int argument ahead of the value.
 ///
-/// @returns 
+/// @returns Where the conversion ends.
 ///
-/// @tracereq(@req{xxxxxxx}}
+static const char *_loggerParseSpec(const char *fmt, char *spec, loggerArgTypeEnum *type, uint32_t *stars)
+{
+    const char *                ret = fmt + 1;
+    uint32_t                    len = 0;
+    char                        lengthMod = 0;
+    bool                        longLong = false;
+
+    *type = LOGGER_ARG_NONE;
+    *stars = 0;
+    spec[len++] = '%';
+
+    if (*ret == '%')
+    {
+        spec[len++] = '%';
+        ret++;
+    }
+    else
+    {
+        // Flags, width and precision
+        while ( (*ret) && (strchr("-+ #0123456789.*'", *ret) != NULL) )
+        {
+            if (*ret == '*')
+            {
+                (*stars)++;
+            }
+            if (len < (LOGGER_MAX_SPEC_LEN - 4U))
+            {
+                spec[len++] = *ret;
+            }
+            ret++;
+        }
+
+        // Length modifier
+        if ( (*ret) && (strchr("hlzjtL", *ret) != NULL) )
+        {
+            lengthMod = *ret;
+            if (*ret != 'L')
+            {
+                spec[len++] = *ret;
+            }
+            ret++;
+
+            if ( (*ret == lengthMod) && ( (lengthMod == 'h') || (lengthMod == 'l') ) )
+            {
+                longLong = (lengthMod == 'l');
+                spec[len++] = *ret;
+                ret++;
+            }
+        }
+
+        if (*ret)
+        {
+            spec[len++] = *ret;
+
+            switch (*ret)
+            {
+                case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                    switch (lengthMod)
+                    {
+                        case 'l':   *type = (longLong) ? LOGGER_ARG_LLONG : LOGGER_ARG_LONG; break;
+                        case 'z':   *type = LOGGER_ARG_SIZE; break;
+                        case 'j':   *type = LOGGER_ARG_INTMAX; break;
+                        case 't':   *type = LOGGER_ARG_PTRDIFF; break;
+                        default:    *type = LOGGER_ARG_INT; break;
+                    }
+                    break;
+
+                case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                    *type = (lengthMod == 'L') ? LOGGER_ARG_LDOUBLE : LOGGER_ARG_DOUBLE;
+                    break;
+
+                case 'p':
+                    *type = LOGGER_ARG_PTR;
+                    break;
+
+                case 's':
+                    *type = LOGGER_ARG_STRING;
+                    break;
+
+                case 'n':
+                    *type = LOGGER_ARG_SKIP;
+                    break;
+
+                default:
+                    break;
+            }
+            ret++;
+        }
+    }
+
+    spec[len] = '\0';
+
+    return (ret);
+}
+
+///
+/// @fn: _loggerExpandStars
+///
+/// @details Writes a conversion with each "*" replaced by its value, as
+///          printf() would take it: a negative width means "-" (left
+///          align), a negative precision means none.
+///
+/// @param[in]  spec    From _loggerParseSpec().
+/// @param[in]  values  The "*" values, in order (at most 2).
+/// @param[out] dest    LOGGER_MAX_SPEC_LEN * 2 long.
+///
+/// @returns
+///
+static void _loggerExpandStars(const char *spec, const int *values, char *dest)
+{
+    uint32_t                    len = 0;
+    uint32_t                    star = 0;
+
+    while (*spec)
+    {
+        if ( (*spec == '*') && (star < 2U) )
+        {
+            long long           value = values[star++];
+            bool                precision = ( (len > 0) && (dest[len - 1U] == '.') );
+
+            if ( (precision) && (value < 0) )
+            {
+                len--;
+            }
+            else
+            {
+                len += (uint32_t)snprintf(&dest[len],
+                                          (LOGGER_MAX_SPEC_LEN * 2U) - len,
+                                          "%s%lld",
+                                          ( (!precision) && (value < 0) ) ? "-" : "",
+                                          (value < 0) ? -value : value);
+            }
+        }
+        else
+        if (*spec != '*')
+        {
+            dest[len++] = *spec;
+        }
+        spec++;
+    }
+    dest[len] = '\0';
+
+    return;
+}
+
+///
+/// @fn: _loggerPackArgs
+///
+/// @details Copies the arguments into an entry.  Integers and pointers
+///          are stored at their own size, floating point as a double,
+///          and a string as a length byte followed by its characters
+///          (cut short if the entry is nearly full).
+///
+/// @param[in]  info
+/// @param[in]  args
+/// @param[out] dest  LOGGER_MAX_ARG_BYTES long.
+///
+/// @returns Bytes used.
+///
+static uint32_t _loggerPackArgs(const loggerFormatInfoStruct *info, va_list args, uint8_t *dest)
+{
+    uint32_t                    ret = 0;
+    uint32_t                    index;
+
+    for (index = 0; index < info->argCount; index++)
+    {
+        uint8_t                 value[sizeof(long double) > 8 ? sizeof(long double) : 8];
+        uint32_t                size = 0;
+
+        switch (info->argTypes[index])
+        {
+            case LOGGER_ARG_INT:     { int v = va_arg(args, int); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_LONG:    { long v = va_arg(args, long); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_LLONG:   { long long v = va_arg(args, long long); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_SIZE:    { size_t v = va_arg(args, size_t); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_INTMAX:  { intmax_t v = va_arg(args, intmax_t); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_PTRDIFF: { ptrdiff_t v = va_arg(args, ptrdiff_t); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_DOUBLE:  { double v = va_arg(args, double); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_LDOUBLE: { double v = (double)va_arg(args, long double); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_PTR:     { void *v = va_arg(args, void *); memcpy(value, &v, sizeof(v)); size = sizeof(v); break; }
+            case LOGGER_ARG_SKIP:    { (void)va_arg(args, void *); break; }
+
+            case LOGGER_ARG_STRING:
+            {
+                const char *    str = va_arg(args, const char *);
+                size_t          len;
+
+                if (str == NULL)
+                {
+                    str = "(null)";
+                }
+                len = strlen(str);
+                if (len > 255U)
+                {
+                    len = 255U;
+                }
+                if ((ret + 1U + len) > LOGGER_MAX_ARG_BYTES)
+                {
+                    len = (ret + 1U < LOGGER_MAX_ARG_BYTES) ? (LOGGER_MAX_ARG_BYTES - ret - 1U) : 0;
+                }
+                if (ret < LOGGER_MAX_ARG_BYTES)
+                {
+                    dest[ret++] = (uint8_t)len;
+                    memcpy(&dest[ret], str, len);
+                    ret += (uint32_t)len;
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        if (size > 0)
+        {
+            if ((ret + size) > LOGGER_MAX_ARG_BYTES)
+            {
+                // Out of room: the rest show as "<?>"
+                break;
+            }
+            memcpy(&dest[ret], value, size);
+            ret += size;
+        }
+    }
+
+    return (ret);
+}
+
+///
+/// @fn: _loggerRender
+///
+/// @details Formats an entry's arguments with its format string.
+///
+/// @param[in]  fmt
+/// @param[in]  args
+/// @param[in]  argBytes
+/// @param[out] dest
+/// @param[in]  destSize
+///
+/// @returns
+///
+static void _loggerRender(const char *fmt, const uint8_t *args, uint32_t argBytes, char *dest, size_t destSize)
+{
+    size_t                      len = 0;
+    uint32_t                    used = 0;
+
+    dest[0] = '\0';
+
+    while ( (*fmt) && (len + 1U < destSize) )
+    {
+        char                    spec[LOGGER_MAX_SPEC_LEN * 2U];
+        char                    starSpec[LOGGER_MAX_SPEC_LEN * 2U];
+        int                     starValues[2] = {0, 0};
+        loggerArgTypeEnum       type;
+        uint32_t                stars;
+        int                     written = 0;
+        uint32_t                size = 0;
+
+        if (*fmt != '%')
+        {
+            dest[len++] = *fmt++;
+            dest[len] = '\0';
+            continue;
+        }
+
+        fmt = _loggerParseSpec(fmt, spec, &type, &stars);
+
+        // Fill in "*" widths/precisions from the ints stored ahead of the value
+        if ( (stars > 0) && (type != LOGGER_ARG_NONE) && (type != LOGGER_ARG_SKIP) )
+        {
+            uint32_t            index;
+
+            for (index = 0; index < stars; index++)
+            {
+                if ((used + sizeof(int)) <= argBytes)
+                {
+                    if (index < 2U)
+                    {
+                        memcpy(&starValues[index], &args[used], sizeof(int));
+                    }
+                    used += sizeof(int);
+                }
+                else
+                {
+                    used = argBytes;
+                }
+            }
+
+            _loggerExpandStars(spec, starValues, starSpec);
+            snprintf(spec, sizeof(spec), "%s", starSpec);
+        }
+
+        switch (type)
+        {
+            case LOGGER_ARG_INT:     size = sizeof(int); break;
+            case LOGGER_ARG_LONG:    size = sizeof(long); break;
+            case LOGGER_ARG_LLONG:   size = sizeof(long long); break;
+            case LOGGER_ARG_SIZE:    size = sizeof(size_t); break;
+            case LOGGER_ARG_INTMAX:  size = sizeof(intmax_t); break;
+            case LOGGER_ARG_PTRDIFF: size = sizeof(ptrdiff_t); break;
+            case LOGGER_ARG_DOUBLE:
+            case LOGGER_ARG_LDOUBLE: size = sizeof(double); break;
+            case LOGGER_ARG_PTR:     size = sizeof(void *); break;
+            case LOGGER_ARG_STRING:  size = (used < argBytes) ? (1U + args[used]) : 1U; break;
+            default:                 size = 0; break;
+        }
+
+        if ( (type == LOGGER_ARG_NONE) || (type == LOGGER_ARG_SKIP) )
+        {
+            written = (spec[1] == '%') ? snprintf(&dest[len], destSize - len, "%%") : 0;
+        }
+        else if ((used + size) > argBytes)
+        {
+            written = snprintf(&dest[len], destSize - len, "<?>");
+        }
+        else
+        {
+            const uint8_t *     value = &args[used];
+
+            switch (type)
+            {
+                case LOGGER_ARG_INT:     { int v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+                case LOGGER_ARG_LONG:    { long v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+                case LOGGER_ARG_LLONG:   { long long v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+                case LOGGER_ARG_SIZE:    { size_t v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+                case LOGGER_ARG_INTMAX:  { intmax_t v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+                case LOGGER_ARG_PTRDIFF: { ptrdiff_t v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+                case LOGGER_ARG_DOUBLE:
+                case LOGGER_ARG_LDOUBLE: { double v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+                case LOGGER_ARG_PTR:     { void *v; memcpy(&v, value, sizeof(v)); written = snprintf(&dest[len], destSize - len, spec, v); break; }
+
+                case LOGGER_ARG_STRING:
+                {
+                    char        str[256];
+
+                    memcpy(str, &value[1], value[0]);
+                    str[value[0]] = '\0';
+                    written = snprintf(&dest[len], destSize - len, spec, str);
+                    break;
+                }
+
+                default:
+                    break;
+            }
+            used += size;
+        }
+
+        if (written > 0)
+        {
+            len += (size_t)written;
+            if (len >= destSize)
+            {
+                len = destSize - 1U;
+            }
+        }
+    }
+
+    return;
+}
+
+///
+/// @fn: _loggerPrintEntry
+///
+/// @details Writes one entry as a text line: seconds since the log
+///          started, level, thread and message.
+///
+/// @param[in] out
+/// @param[in] fmt       NULL if the format is unknown.
+/// @param[in] header
+/// @param[in] args
+/// @param[in] originUS  When the log started.
+///
+/// @returns
+///
+static void _loggerPrintEntry(FILE *out, const char *fmt, const loggerRecordHeaderStruct *header, const uint8_t *args, uint64_t originUS)
+{
+    char                        line[LOGGER_MAX_LINE_LEN];
+    uint64_t                    sinceUS = (header->timestampUS > originUS) ? (header->timestampUS - originUS) : 0;
+
+    if (fmt)
+    {
+        _loggerRender(fmt, args, header->argBytes, line, sizeof(line));
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "<unknown format %u>", (unsigned)header->formatId);
+    }
+
+    fprintf(out, "%6u.%06u %-5s T%-3u %s\n",
+            (unsigned)(sinceUS / 1000000U),
+            (unsigned)(sinceUS % 1000000U),
+            levelNames[header->level],
+            (unsigned)header->threadId,
+            line);
+
+    return;
+}
+
+///
+/// @fn: _loggerDrainThread
+///
+/// @details Empties the rings whenever there is something in them,
+///          sleeping LOGGER_DRAIN_PERIOD_MS otherwise.  Once stopping,
+///          keeps going until the rings are empty.
+///
+/// @param[in] arg  Unused.
+///
+/// @returns NULL
+///
+static void *_loggerDrainThread(void *arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        bool                    stopping = __atomic_load_n(&loggerStopping, __ATOMIC_ACQUIRE);
+        uint32_t                drained = _loggerDrain();
+
+        _loggerReportDrops();
+
+        if (drained == 0)
+        {
+            if (stopping)
+            {
+                break;
+            }
+            fflush(loggerOutput);
+            TIMER_SleepUS((uint64_t)LOGGER_DRAIN_PERIOD_MS * 1000U);
+        }
+    }
+
+    fflush(loggerOutput);
+
+    return (NULL);
+}
+
+///
+/// @fn: _loggerDrain
+///
+/// @details Takes every entry that is ready off the rings, oldest first
+///          across levels, and writes it out.
 ///
-static bool hasSpace(logBufferStruct* buffer, uint32_t needed) 
+/// @returns How many entries were written.
+///
+static uint32_t _loggerDrain(void)
 {
-    uint32_t            available;
+    uint32_t                    ret = 0;
 
-    if (buffer->writeIndex >= buffer->readIndex) 
+    for (;;)
     {
-        available = LOG_BUFFER_SIZE - buffer->write_index;
+        loggerSlotStruct *      oldest = NULL;
+        loggerRingStruct *      oldestRing = NULL;
+        uint32_t                level;
+
+        for (level = 0; level < LOG_LEVEL_COUNT; level++)
+        {
+            loggerRingStruct *  ring = &rings[level];
+            loggerSlotStruct *  slot = &ring->slots[ring->dequeuePos & LOGGER_RING_MASK];
+
+            if (
+                   (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == ring->dequeuePos + 1U) &&
+                   ( (oldest == NULL) || (slot->header.timestampUS < oldest->header.timestampUS) )
+               )
+            {
+                oldest = slot;
+                oldestRing = ring;
+            }
+        }
 
-        if (buffer->readIndex > 0) 
+        if (oldest == NULL)
         {
-            available += buffer->readIndex - 1;
+            break;
         }
-    } 
-    else 
+
+        if (loggerOutputMode == LOGGER_OUTPUT_BINARY)
+        {
+            uint16_t            id = oldest->header.formatId;
+
+            if (!formatWritten[id])
+            {
+                uint16_t        len = (uint16_t)strlen(formatTable[id].text);
+
+                fputc(LOGGER_RECORD_FORMAT, loggerOutput);
+                fwrite(&id, sizeof(id), 1, loggerOutput);
+                fwrite(&len, sizeof(len), 1, loggerOutput);
+                fwrite(formatTable[id].text, 1, len, loggerOutput);
+                formatWritten[id] = true;
+            }
+
+            fputc(LOGGER_RECORD_ENTRY, loggerOutput);
+            fwrite(&oldest->header, sizeof(oldest->header), 1, loggerOutput);
+            fwrite(oldest->args, 1, oldest->header.argBytes, loggerOutput);
+        }
+        else
+        {
+            _loggerPrintEntry(loggerOutput, formatTable[oldest->header.formatId].text, &oldest->header, oldest->args, loggerStartUS);
+        }
+
+        // Hand the slot back to the producers, one lap on
+        __atomic_store_n(&oldest->sequence, oldestRing->dequeuePos + LOGGER_RING_ENTRIES, __ATOMIC_RELEASE);
+        oldestRing->dequeuePos++;
+        ret++;
+    }
+
+    return (ret);
+}
+
+///
+/// @fn: _loggerReportDrops
+///
+/// @details Notes in the output how many entries each level has lost
+///          since the last report.
+///
+/// @returns
+///
+static void _loggerReportDrops(void)
+{
+    uint32_t                    level;
+
+    for (level = 0; level < LOG_LEVEL_COUNT; level++)
     {
-        available = buffer->readIndex - buffer->writeIndex - 1;
+        loggerRingStruct *      ring = &rings[level];
+        uint32_t                dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        uint32_t                count = dropped - ring->reportedDropped;
+
+        if (count > 0)
+        {
+            if (loggerOutputMode == LOGGER_OUTPUT_BINARY)
+            {
+                uint8_t         levelByte = (uint8_t)level;
+
+                fputc(LOGGER_RECORD_DROPPED, loggerOutput);
+                fwrite(&levelByte, sizeof(levelByte), 1, loggerOutput);
+                fwrite(&count, sizeof(count), 1, loggerOutput);
+            }
+            else
+            {
+                fprintf(loggerOutput, "*** %u %s entries dropped ***\n", count, levelNames[level]);
+            }
+            ring->reportedDropped = dropped;
+        }
     }
-    
-    return available >= needed;
-}
\ No newline at end of file
+
+    return;
+}
@@ -0,0 +1,704 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: net_impair.c
+**
+** DESCRIPTION: Network impairment shim.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "net_impair.h"
+
+/*
+** One queued message.
+**
+*/
+typedef struct
+{
+    bool                            used;
+    uint16_t                        len;
+    uint32_t                        order;
+    uint64_t                        dueUS;
+    uint8_t *                       data;
+}netImpairSlotStruct;
+
+/*
+** One direction of a link.
+**
+*/
+struct netImpairStruct
+{
+    bool                            inUse;
+    netImpairProfileStruct          profile;
+    netImpairStatsStruct            stats;
+    uint16_t                        maxLen;
+    uint64_t                        rng;
+    uint64_t                        linkFreeUS;
+    uint64_t                        lastDueUS;
+    uint32_t                        order;
+    netImpairSlotStruct             slots[NET_IMPAIR_QUEUE_LEN];
+    netImpairSlotStruct *           handedOut;
+    uint8_t *                       storage;
+};
+
+/*
+** Named starting points for netImpairParseProfile().
+**
+**   lossy:   A noisy harness: a little of everything.
+**   harness: A long, busy vehicle harness: slower and jittery.
+**   slow:    A 1Mbit/s link with 5mS each way.
+**
+*/
+typedef struct
+{
+    const char *                    name;
+    const char *                    text;
+}netImpairPresetStruct;
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          INTERNAL SUPPORT PROTOTYPES
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+static bool _netImpairApply(const char *text, netImpairProfileStruct *profile, bool allowPresets);
+static bool _netImpairParsePercent(const char *value, uint32_t *ppm);
+static bool _netImpairParseU32(const char *value, uint32_t *result);
+static uint32_t _netImpairRandom(netImpairStruct *impair);
+static bool _netImpairChance(netImpairStruct *impair, uint32_t ppm);
+static netImpairSlotStruct *_netImpairFreeSlot(netImpairStruct *impair);
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          LOCAL DATA
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+static netImpairStruct              impairPool[NET_IMPAIR_MAX_INSTANCES];
+static pthread_mutex_t              impairPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const netImpairPresetStruct  impairPresets[] =
+{
+    { "lossy",      "latency=200,jitter=100,loss=2,dup=0.5,reorder=1" },
+    { "harness",    "latency=1000,jitter=800,loss=0.5,dup=0.1,reorder=0.5,rate=20000" },
+    { "slow",       "latency=5000,rate=1000" },
+};
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          EXPORTED FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: netImpairParseProfile
+**
+** DESCRIPTION: Reads a profile from text.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool netImpairParseProfile(const char *text, netImpairProfileStruct *profile)
+{
+    bool                            ret = false;
+
+    if ( (text) && (profile) )
+    {
+        memset(profile, 0, sizeof(*profile));
+        profile->reorderUS = NET_IMPAIR_DEFAULT_REORDER_US;
+        profile->seed = NET_IMPAIR_DEFAULT_SEED;
+
+        ret = _netImpairApply(text, profile, true);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: netImpairCreate
+**
+** DESCRIPTION: Sets up one direction.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+netImpairStruct *netImpairCreate(const netImpairProfileStruct *profile, uint16_t maxLen)
+{
+    netImpairStruct *               ret = NULL;
+    uint32_t                        index;
+
+    pthread_mutex_lock(&impairPoolLock);
+
+    for (index = 0; (profile) && (maxLen > 0) && (index < NET_IMPAIR_MAX_INSTANCES); index++)
+    {
+        if (!impairPool[index].inUse)
+        {
+            netImpairStruct *       impair = &impairPool[index];
+
+            memset(impair, 0, sizeof(*impair));
+            impair->storage = (uint8_t *)malloc((size_t)NET_IMPAIR_QUEUE_LEN * maxLen);
+            if (impair->storage)
+            {
+                uint32_t            slot;
+
+                for (slot = 0; slot < NET_IMPAIR_QUEUE_LEN; slot++)
+                {
+                    impair->slots[slot].data = &impair->storage[(size_t)slot * maxLen];
+                }
+                impair->profile = *profile;
+                impair->maxLen = maxLen;
+
+                // splitmix64 of the seed, so small seeds still start well mixed
+                impair->rng = (uint64_t)profile->seed + 0x9E3779B97F4A7C15ULL;
+                impair->rng = (impair->rng ^ (impair->rng >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                impair->rng = (impair->rng ^ (impair->rng >> 27)) * 0x94D049BB133111EBULL;
+                impair->rng ^= (impair->rng >> 31);
+                if (impair->rng == 0)
+                {
+                    impair->rng = 1;
+                }
+
+                impair->inUse = true;
+                ret = impair;
+            }
+            else
+            {
+                printf("\r\n Out of memory for the impairment queue!");
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&impairPoolLock);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: netImpairDestroy
+**
+** DESCRIPTION: Frees an instance and anything still queued in it.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void netImpairDestroy(netImpairStruct *impair)
+{
+    if ( (impair) && (impair->inUse) )
+    {
+        free(impair->storage);
+        impair->storage = NULL;
+
+        pthread_mutex_lock(&impairPoolLock);
+        impair->inUse = false;
+        pthread_mutex_unlock(&impairPoolLock);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: netImpairSubmit
+**
+** DESCRIPTION: Hands a message to the link.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Each copy first waits for the link (rateKbps), then takes
+**           the latency plus its jitter.  Copies that aren't reordered
+**           are never due before the one submitted ahead of them.
+**
+*/
+uint32_t netImpairSubmit(netImpairStruct *impair, const uint8_t *msg, uint16_t len, uint64_t nowUS)
+{
+    uint32_t                        ret = 0;
+
+    if (
+           (impair) &&
+           (impair->inUse) &&
+           (msg) &&
+           (len > 0) &&
+           (len <= impair->maxLen)
+       )
+    {
+        const netImpairProfileStruct *  profile = &impair->profile;
+        uint32_t                    copies = 1;
+        uint32_t                    copy;
+
+        impair->stats.submitted++;
+
+        if (_netImpairChance(impair, profile->lossPPM))
+        {
+            impair->stats.lost++;
+            copies = 0;
+        }
+        else
+        if (_netImpairChance(impair, profile->duplicatePPM))
+        {
+            impair->stats.duplicated++;
+            copies = 2;
+        }
+
+        for (copy = 0; copy < copies; copy++)
+        {
+            netImpairSlotStruct *   slot = _netImpairFreeSlot(impair);
+            uint64_t                dueUS;
+
+            if (slot == NULL)
+            {
+                impair->stats.overflowed++;
+                continue;
+            }
+
+            if (impair->linkFreeUS < nowUS)
+            {
+                impair->linkFreeUS = nowUS;
+            }
+            if (profile->rateKbps > 0)
+            {
+                impair->linkFreeUS += (((uint64_t)len * 8U * 1000U) + profile->rateKbps - 1U) / profile->rateKbps;
+            }
+
+            dueUS = impair->linkFreeUS + profile->latencyUS;
+            if (profile->jitterUS > 0)
+            {
+                uint32_t            spread = _netImpairRandom(impair) % ((2U * profile->jitterUS) + 1U);
+
+                if (spread >= profile->jitterUS)
+                {
+                    dueUS += spread - profile->jitterUS;
+                }
+                else
+                if ((dueUS - impair->linkFreeUS) > (profile->jitterUS - spread))
+                {
+                    dueUS -= profile->jitterUS - spread;
+                }
+                else
+                {
+                    dueUS = impair->linkFreeUS;
+                }
+            }
+
+            if (_netImpairChance(impair, profile->reorderPPM))
+            {
+                impair->stats.reordered++;
+                dueUS += profile->reorderUS;
+            }
+            else
+            {
+                if (dueUS < impair->lastDueUS)
+                {
+                    dueUS = impair->lastDueUS;
+                }
+                impair->lastDueUS = dueUS;
+            }
+
+            memcpy(slot->data, msg, len);
+            slot->len = len;
+            slot->dueUS = dueUS;
+            slot->order = impair->order++;
+            slot->used = true;
+            ret++;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: netImpairNext
+**
+** DESCRIPTION: The next message whose time is up.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Due messages come out earliest first, ties in the order
+**           they were submitted.
+**
+*/
+const uint8_t *netImpairNext(netImpairStruct *impair, uint64_t nowUS, uint16_t *len)
+{
+    const uint8_t *                 ret = NULL;
+
+    if ( (impair) && (impair->inUse) && (len) )
+    {
+        netImpairSlotStruct *       best = NULL;
+        uint32_t                    index;
+
+        *len = 0;
+
+        if (impair->handedOut)
+        {
+            impair->handedOut->used = false;
+            impair->handedOut = NULL;
+        }
+
+        for (index = 0; index < NET_IMPAIR_QUEUE_LEN; index++)
+        {
+            netImpairSlotStruct *   slot = &impair->slots[index];
+
+            if (
+                   (slot->used) &&
+                   (slot->dueUS <= nowUS) &&
+                   (
+                       (best == NULL) ||
+                       (slot->dueUS < best->dueUS) ||
+                       ( (slot->dueUS == best->dueUS) && ((int32_t)(slot->order - best->order) < 0) )
+                   )
+               )
+            {
+                best = slot;
+            }
+        }
+
+        if (best)
+        {
+            impair->handedOut = best;
+            impair->stats.delivered++;
+            *len = best->len;
+            ret = best->data;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: netImpairNextDue
+**
+** DESCRIPTION: When the next queued message is due.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The message last handed out doesn't count.
+**
+*/
+bool netImpairNextDue(netImpairStruct *impair, uint64_t *dueUS)
+{
+    bool                            ret = false;
+
+    if ( (impair) && (impair->inUse) && (dueUS) )
+    {
+        uint32_t                    index;
+
+        for (index = 0; index < NET_IMPAIR_QUEUE_LEN; index++)
+        {
+            netImpairSlotStruct *   slot = &impair->slots[index];
+
+            if (
+                   (slot->used) &&
+                   (slot != impair->handedOut) &&
+                   ( (!ret) || (slot->dueUS < *dueUS) )
+               )
+            {
+                *dueUS = slot->dueUS;
+                ret = true;
+            }
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: netImpairGetStats
+**
+** DESCRIPTION: Copies out the counters.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void netImpairGetStats(netImpairStruct *impair, netImpairStatsStruct *stats)
+{
+    if (stats)
+    {
+        memset(stats, 0, sizeof(*stats));
+        if ( (impair) && (impair->inUse) )
+        {
+            *stats = impair->stats;
+        }
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _netImpairApply
+**
+** DESCRIPTION: Applies "name" and "key=value" items to a profile.
+**
+** PARAMETERS: allowPresets: false while applying a preset, so presets
+**                           can't name each other.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _netImpairApply(const char *text, netImpairProfileStruct *profile, bool allowPresets)
+{
+    bool                            ret = true;
+
+    while ( (ret) && (*text) )
+    {
+        char                        item[64];
+        size_t                      len = strcspn(text, ",");
+        char *                      value;
+
+        if (len >= sizeof(item))
+        {
+            ret = false;
+            break;
+        }
+        memcpy(item, text, len);
+        item[len] = 0;
+        text += len;
+        if (*text == ',')
+        {
+            text++;
+        }
+
+        value = strchr(item, '=');
+        if (value == NULL)
+        {
+            uint32_t                index;
+
+            ret = false;
+            for (index = 0; (allowPresets) && (index < (sizeof(impairPresets) / sizeof(impairPresets[0]))); index++)
+            {
+                if (strcmp(item, impairPresets[index].name) == 0)
+                {
+                    ret = _netImpairApply(impairPresets[index].text, profile, false);
+                    break;
+                }
+            }
+        }
+        else
+        {
+            *value++ = 0;
+
+            if (strcmp(item, "latency") == 0)
+            {
+                ret = _netImpairParseU32(value, &profile->latencyUS);
+            }
+            else
+            if (strcmp(item, "jitter") == 0)
+            {
+                ret = _netImpairParseU32(value, &profile->jitterUS);
+            }
+            else
+            if (strcmp(item, "reorder-gap") == 0)
+            {
+                ret = _netImpairParseU32(value, &profile->reorderUS);
+            }
+            else
+            if (strcmp(item, "loss") == 0)
+            {
+                ret = _netImpairParsePercent(value, &profile->lossPPM);
+            }
+            else
+            if (strcmp(item, "dup") == 0)
+            {
+                ret = _netImpairParsePercent(value, &profile->duplicatePPM);
+            }
+            else
+            if (strcmp(item, "reorder") == 0)
+            {
+                ret = _netImpairParsePercent(value, &profile->reorderPPM);
+            }
+            else
+            if (strcmp(item, "rate") == 0)
+            {
+                ret = _netImpairParseU32(value, &profile->rateKbps);
+            }
+            else
+            if (strcmp(item, "seed") == 0)
+            {
+                ret = _netImpairParseU32(value, &profile->seed);
+            }
+            else
+            {
+                ret = false;
+            }
+        }
+
+        if (!ret)
+        {
+            if (value)
+            {
+                value[-1] = '=';
+            }
+            printf("\r\n Bad impairment setting [%s]!", item);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _netImpairParsePercent
+**
+** DESCRIPTION: "0.5" (percent) into parts per million.
+**
+** PARAMETERS:
+**
+** RETURNS: false unless it's a number from 0 to 100.
+**
+** COMMENTS:
+**
+*/
+static bool _netImpairParsePercent(const char *value, uint32_t *ppm)
+{
+    bool                            ret = false;
+    char *                          end = NULL;
+    double                          percent = strtod(value, &end);
+
+    if ( (end != value) && (*end == 0) && (percent >= 0.0) && (percent <= 100.0) )
+    {
+        *ppm = (uint32_t)((percent * 10000.0) + 0.5);
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _netImpairParseU32
+**
+** DESCRIPTION: A whole number.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _netImpairParseU32(const char *value, uint32_t *result)
+{
+    bool                            ret = false;
+    char *                          end = NULL;
+    unsigned long                   number = strtoul(value, &end, 0);
+
+    if ( (end != value) && (*end == 0) && (number <= UINT32_MAX) )
+    {
+        *result = (uint32_t)number;
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _netImpairRandom
+**
+** DESCRIPTION: xorshift64* step.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _netImpairRandom(netImpairStruct *impair)
+{
+    impair->rng ^= impair->rng >> 12;
+    impair->rng ^= impair->rng << 25;
+    impair->rng ^= impair->rng >> 27;
+
+    return ((uint32_t)((impair->rng * 0x2545F4914F6CDD1DULL) >> 32));
+}
+
+/*!
+** FUNCTION: _netImpairChance
+**
+** DESCRIPTION: true "ppm" times in a million.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Draws nothing for a 0 probability.
+**
+*/
+static bool _netImpairChance(netImpairStruct *impair, uint32_t ppm)
+{
+    bool                            ret = false;
+
+    if (ppm > 0)
+    {
+        ret = ((_netImpairRandom(impair) % 1000000U) < ppm);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _netImpairFreeSlot
+**
+** DESCRIPTION: An unused queue slot.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if the queue is full.
+**
+** COMMENTS: The slot last handed out by netImpairNext() is still in
+**           use by the caller.
+**
+*/
+static netImpairSlotStruct *_netImpairFreeSlot(netImpairStruct *impair)
+{
+    netImpairSlotStruct *           ret = NULL;
+    uint32_t                        index;
+
+    for (index = 0; index < NET_IMPAIR_QUEUE_LEN; index++)
+    {
+        if (!impair->slots[index].used)
+        {
+            ret = &impair->slots[index];
+            break;
+        }
+    }
+
+    return (ret);
+}
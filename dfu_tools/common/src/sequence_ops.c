@@ -36,6 +36,8 @@
 #include "sequence_ops.h"
 #include "dfu_client_crypto.h"
 #include "image_xfer.h"
+#include "xfer_rtt.h"
+#include "iface_link.h"
 
 #define SO_TRANSACTION_TIMEOUT_MS               (1000)
 
@@ -47,6 +49,7 @@
 **
 */
 static bool _imageIndexMustBeEncrypted(uint8_t imageIndex);
+static bool _sequenceInstallImage(dfuClientEnvStruct * dfuClient, char *dest);
 #define SHOULD_IMAGE_BE_ENCRYPTED(imageIndex) _imageIndexMustBeEncrypted(imageIndex)
 
 
@@ -94,11 +97,18 @@ bool sequenceBeginSession(dfuClientEnvStruct * dfuClient,
     if ( (dfuClient) && (dest) )
     {
         uint32_t                    challengePW;
+        uint64_t                    txStartUS;
+
+        // Image transfers in this session size their window by device type
+        xferSetDeviceType(dfuClient, devType);
 
         /*
-        ** Do a BEGIN_SESSION transaction.
+        ** Do a BEGIN_SESSION transaction.  Its timeout stays fixed (the
+        ** device may not have been seen yet), but a good answer is the
+        ** first RTT sample for it.
         **
         */
+        txStartUS = TIMER_GetMicroseconds();
         challengePW = dfuClientTransaction_CMD_BEGIN_SESSION(dfuClient,
                                                              devType,
                                                              devVariant,
@@ -106,9 +116,12 @@ bool sequenceBeginSession(dfuClientEnvStruct * dfuClient,
                                                              dest);
         if (challengePW != 0)
         {
-            uint8_t *               encryptedChallenge = NULL;
+            uint8_t                 challengeResponse[MAX_CHALLENGE_RESPONSE_LEN];
+            uint32_t                responseLen;
             uint16_t                linkMTU = dfuClientGetInternalMTU(dfuClient);
 
+            xferRttEndForDevice(dest, txStartUS, SO_TRANSACTION_TIMEOUT_MS);
+
             /*
             ** When we have sent a BEGIN_SESSION that results in success,
             ** we can now determine the MTU to use.  Use the value
@@ -119,29 +132,33 @@ bool sequenceBeginSession(dfuClientEnvStruct * dfuClient,
 
             /*
             ** Now that we have the challenge password from the target,
-            ** encrypt it to a file.
+            ** sign (or encrypt) it.  It stays in memory: nothing is
+            ** written to disk, so parallel sessions can't collide.
             **
             */
-            encryptedChallenge = HANDLE_CHALLENGE(&challengePW, challengeKeyFilename);
-            if (encryptedChallenge != NULL)
+            responseLen = HANDLE_CHALLENGE_TO_BUFFER(&challengePW,
+                                                     challengeKeyFilename,
+                                                     challengeResponse,
+                                                     sizeof(challengeResponse));
+            if (responseLen > 0)
             {
                 /*
                 ** Transfer the image and if that succeeeds, tell
                 ** the target to "insall" it.
                 **
                 */
-                if (sequenceTransferAndInstallImage(dfuClient,
-                                                    SIGNATURE_FILENAME,
-                                                    IMAGE_INDEX_SESSION_PASSWORD,
-                                                    0,
-                                                    dest))
+                if (sequenceTransferAndInstallBuffer(dfuClient,
+                                                     challengeResponse,
+                                                     responseLen,
+                                                     "(challenge response)",
+                                                     IMAGE_INDEX_SESSION_PASSWORD,
+                                                     0,
+                                                     dest))
                 {
                     //
-                    // Successfully sent the encrypted challenge key. Delete
-                    // its file and send the INSTALL_IMAGE command.  If that
-                    // succeeds, the session has been established.
+                    // Successfully sent and installed the challenge
+                    // response: the session has been established.
                     //
-                    DELETE_CHALLENGE();
 
                     // Set the Session state to ACTIVE
                     dfuSetSessionActive(dfuClientGetDFU(dfuClient));
@@ -219,23 +236,48 @@ bool sequenceTransferAndInstallImage(dfuClientEnvStruct * dfuClient,
                       SHOULD_IMAGE_BE_ENCRYPTED(imageIndex),
                       dfuClient))
         {
-            printf("\r\n Installing image...");
+            ret = _sequenceInstallImage(dfuClient, dest);
+        }
+    }
 
-            // Perform the "INSTALL_IMAGE" transaction.
-            if (dfuClientTransaction_CMD_INSTALL_IMAGE(dfuClient,
-                                                       SO_TRANSACTION_TIMEOUT_MS,
-                                                       dest))
-            {
-                // Image installed successfully!
-                ret = true;
-                printf("Success!");
-            }
-            else
-            {
-                printf("Failed!");
-            }
+    return (ret);
+}
 
-            printf("\r\n\r\n");
+/*!
+** FUNCTION: sequenceTransferAndInstallBuffer
+**
+** DESCRIPTION: Sends an image held in memory to the target and then
+**              instructs it to be installed.
+**
+** PARAMETERS: nameStr: Only used in the transfer report.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool sequenceTransferAndInstallBuffer(dfuClientEnvStruct * dfuClient,
+                                      const uint8_t *data,
+                                      uint32_t length,
+                                      char *nameStr,
+                                      uint8_t imageIndex,
+                                      uint32_t imageAddress,
+                                      char *dest)
+{
+    bool                            ret = false;
+
+    if ( (dfuClient) && (data) && (length > 0) && (dest) && (imageIndex > 0) )
+    {
+        if (xferBuffer(data,
+                       length,
+                       nameStr,
+                       dest,
+                       imageIndex,
+                       imageAddress,
+                       SHOULD_IMAGE_BE_ENCRYPTED(imageIndex),
+                       dfuClient))
+        {
+            ret = _sequenceInstallImage(dfuClient, dest);
         }
     }
 
@@ -253,7 +295,12 @@ bool sequenceTransferAndInstallImage(dfuClientEnvStruct * dfuClient,
 **
 ** RETURNS:
 **
-** COMMENTS:
+** COMMENTS: On Ethernet, the interface's real MTU (up to a jumbo frame)
+**           is offered first; on CAN, the largest message ISO-TP can
+**           carry.  A target that can't go that big answers
+**           with its own limit; one that doesn't answer at all gets the
+**           caller's linkMTU instead, and isn't offered the same size
+**           again while the tool remembers the device.
 **
 */
 uint16_t sequenceNegotiateMTU(dfuClientEnvStruct* dfuClient,
@@ -264,16 +311,52 @@ uint16_t sequenceNegotiateMTU(dfuClientEnvStruct* dfuClient,
 
     if ( (dfuClient) && (dest) && (linkMTU) )
     {
-        uint16_t            localMTU;
+        uint16_t            localMTU = 0;
+        uint16_t            interfaceMTU;
+        uint16_t            defaultMTU = 0;
+        xferRttStruct       rtt;
 
+        xferRttGet(dest, &rtt);
         dfuClientSetDestination(dfuClient, dest);
 
-        localMTU = dfuClientTransaction_CMD_NEGOTIATE_MTU(dfuClient,
-                                                          SO_TRANSACTION_TIMEOUT_MS,
-                                                          dest,
-                                                          linkMTU);
+        interfaceMTU = ifaceLinkGetMaxMTU(dfuClientGetDFU(dfuClient), &defaultMTU);
+        if (
+               (interfaceMTU > linkMTU) &&
+               ( (rtt.probedMTU != interfaceMTU) || (rtt.probeReply > 0) )
+           )
+        {
+            // A lost jumbo probe says nothing about the RTT; don't sample it.
+            localMTU = dfuClientTransaction_CMD_NEGOTIATE_MTU(dfuClient,
+                                                              xferRttTimeoutMS(&rtt),
+                                                              dest,
+                                                              interfaceMTU);
+            rtt.probedMTU = interfaceMTU;
+            rtt.probeReply = localMTU;
+            xferRttPut(dest, &rtt);
+        }
+
+        if (localMTU == 0)
+        {
+            uint64_t                txStartUS;
+            uint32_t                timeoutMS = xferRttTimeoutMS(&rtt);
+
+            txStartUS = TIMER_GetMicroseconds();
+            localMTU = dfuClientTransaction_CMD_NEGOTIATE_MTU(dfuClient,
+                                                              timeoutMS,
+                                                              dest,
+                                                              linkMTU);
+            xferRttEnd(&rtt, txStartUS, timeoutMS);
+            xferRttPut(dest, &rtt);
+        }
+
         if (localMTU > 0)
         {
+            // Past the interface's default, the engine must be told too.
+            if ( (interfaceMTU > 0) && (localMTU > defaultMTU) )
+            {
+                dfuSetMTU(dfuClientGetDFU(dfuClient), localMTU);
+            }
+
             // Set the internal MTU
             dfuClientSetInternalMTU(dfuClient, localMTU);
 
@@ -414,3 +497,40 @@ static bool _imageIndexMustBeEncrypted(uint8_t imageIndex)
 
     return (ret);
 }
+
+/*!
+** FUNCTION: _sequenceInstallImage
+**
+** DESCRIPTION: The INSTALL_IMAGE step that follows a transfer.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _sequenceInstallImage(dfuClientEnvStruct * dfuClient, char *dest)
+{
+    bool                        ret = false;
+
+    printf("\r\n Installing image...");
+
+    // Perform the "INSTALL_IMAGE" transaction.
+    if (dfuClientTransaction_CMD_INSTALL_IMAGE(dfuClient,
+                                               SO_TRANSACTION_TIMEOUT_MS,
+                                               dest))
+    {
+        // Image installed successfully!
+        ret = true;
+        printf("Success!");
+    }
+    else
+    {
+        printf("Failed!");
+    }
+
+    printf("\r\n\r\n");
+
+    return (ret);
+}
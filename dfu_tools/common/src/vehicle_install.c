@@ -0,0 +1,717 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+//
+/// @file vehicle_install.c
+/// @brief Updates every board on a vehicle from a vehicle manifest.
+///
+/// @details Boards are matched to discovered devices by TYPE & VARIANT
+///          (taken from each board manifest), then updated in parallel.
+///          Each worker thread owns one client on the interface and
+///          pulls boards off a shared job list until it is empty, so
+///          at most "maxConcurrent" sessions are open at once.
+///
+/// @copyright 2024,2025 Glydways, Inc
+/// @copyright https://glydways.com
+//
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "vehicle_install.h"
+#include "async_timer.h"
+#include "file_kvp.h"
+#include "fw_manifest.h"
+#include "general_utils.h"
+#include "image_xfer.h"
+#include "path_utils.h"
+#include "device_registry.h"
+#include "event_loop.h"
+#include "iface_link.h"
+
+//
+// Format strings for the per-board keys in the vehicle manifest.
+//
+#define VEHICLE_MANIFEST_BOARD_PATH_FORMAT      "board_%d_manifest"
+#define VEHICLE_MANIFEST_BOARD_COPIES_FORMAT    "board_%d_count"
+
+/*
+** Per-board results from the last run, and the next one a worker
+** should pick up.
+**
+*/
+static vehicleBoardResultStruct     boards[VEHICLE_MAX_BOARDS];
+static uint32_t                     boardCount = 0;
+static uint32_t                     nextJob = 0;
+static pthread_mutex_t              jobLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+** Worker clients.  The client library has no way to release a client,
+** so they are created once and kept for the interface they were made on.
+**
+*/
+static dfuClientEnvStruct*          workerClients[VEHICLE_MAX_CONCURRENT_PER_INTERFACE];
+static uint32_t                     workerClientCount = 0;
+static interfaceTypeEnum            workerIfaceType = INTERFACE_TYPE_NONE;
+static char                         workerIfaceName[MAX_IFACE_NAME_LEN];
+
+/*
+** Discovery progress, handed to the registry callback.
+**
+*/
+typedef struct
+{
+    dfuClientAPI*                   apiHandle;
+    eventLoopStruct*                loop;
+    uint32_t                        timeoutMS;
+    int                             quietTimer;
+    uint32_t                        found;
+}vehicleDiscoveryStruct;
+
+static dfuClientAPI*                lastDiscoveryHandle = NULL;
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static bool _vehicleLoadManifest(char* manifestPath);
+static uint32_t _vehicleDiscover(dfuClientAPI* apiHandle, uint32_t listenTimeoutMS);
+static void _vehicleDiscoverDrive(eventLoopStruct* loop, void* ctx);
+static void _vehicleDiscoverSocket(eventLoopStruct* loop, int fd, void* ctx);
+static void _vehicleDiscoverQuiet(eventLoopStruct* loop, int timerId, void* ctx);
+static void _vehicleDeviceEvent(void* ctx, deviceRegistryEventEnum event, const deviceInfoStruct* device);
+static uint32_t _vehicleGetWorkerClients(interfaceTypeEnum ifaceType, char* ifaceName, uint32_t wanted);
+static vehicleBoardResultStruct* _vehicleNextJob(void);
+static void* _vehicleWorker(void* arg);
+
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                            PUBLIC API FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+///
+/// @fn: vehicleInstallRun
+///
+/// @details Reads the vehicle manifest, listens for DFU-mode devices
+///          until every expected board has been heard from (or no new
+///          device shows up for listenTimeoutMS), then updates the
+///          boards that were found, up to maxConcurrent at a time.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+apiErrorCodeEnum vehicleInstallRun(dfuClientAPI* apiHandle,
+                                   interfaceTypeEnum ifaceType,
+                                   char* ifaceName,
+                                   char* manifestPath,
+                                   uint32_t listenTimeoutMS,
+                                   uint32_t maxConcurrent)
+{
+    apiErrorCodeEnum                    ret = API_ERR_UNKNOWN;
+
+    boardCount = 0;
+
+    if (
+           (apiHandle) &&
+           (
+              (ifaceType == INTERFACE_TYPE_ETHERNET) ||
+              (ifaceType == INTERFACE_TYPE_CAN)
+           ) &&
+           (ifaceName) &&
+           (strlen(ifaceName) > 0) &&
+           (manifestPath) &&
+           (strlen(manifestPath) > 0)
+       )
+    {
+        if (_vehicleLoadManifest(manifestPath))
+        {
+            uint32_t            foundCount;
+
+            printf("\r\n Vehicle manifest lists %u board(s). Listening for devices...", boardCount);
+            foundCount = _vehicleDiscover(apiHandle, listenTimeoutMS);
+            printf("\r\n Found %u of %u board(s).", foundCount, boardCount);
+
+            if (foundCount > 0)
+            {
+                pthread_t       threads[VEHICLE_MAX_CONCURRENT_PER_INTERFACE];
+                uint32_t        workerCount;
+                uint32_t        started = 0;
+                uint32_t        index;
+
+                if (
+                       (maxConcurrent == 0) ||
+                       (maxConcurrent > VEHICLE_MAX_CONCURRENT_PER_INTERFACE)
+                   )
+                {
+                    maxConcurrent = VEHICLE_MAX_CONCURRENT_PER_INTERFACE;
+                }
+                if (maxConcurrent > foundCount)
+                {
+                    maxConcurrent = foundCount;
+                }
+
+                workerCount = _vehicleGetWorkerClients(ifaceType, ifaceName, maxConcurrent);
+                if (workerCount > 0)
+                {
+                    printf("\r\n Updating with %u concurrent session(s)...", workerCount);
+
+                    nextJob = 0;
+                    for (index = 0; index < workerCount; index++)
+                    {
+                        if (pthread_create(&threads[started], NULL, _vehicleWorker, workerClients[index]) == 0)
+                        {
+                            started++;
+                        }
+                    }
+
+                    //
+                    // Couldn't start any threads: do the whole
+                    // job list one board at a time right here.
+                    //
+                    if (started == 0)
+                    {
+                        _vehicleWorker(workerClients[0]);
+                    }
+
+                    for (index = 0; index < started; index++)
+                    {
+                        pthread_join(threads[index], NULL);
+                    }
+
+                    // Overall result: the first board that didn't make it.
+                    ret = API_ERR_NONE;
+                    for (index = 0; index < boardCount; index++)
+                    {
+                        if (!boards[index].found)
+                        {
+                            ret = API_ERR_UNKNOWN;
+                            break;
+                        }
+                        if (boards[index].result != API_ERR_NONE)
+                        {
+                            ret = boards[index].result;
+                            break;
+                        }
+                    }
+                }
+                else
+                {
+                    printf("\r\n Could not open a client on %s for the vehicle install!", ifaceName);
+                }
+            }
+        }
+        else
+        {
+            ret = API_ERR_FW_MANIFEST;
+        }
+    }
+    else
+    {
+        ret = API_ERR_INVALID_PARAMS;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: vehicleInstallResultCount
+///
+/// @details
+///
+/// @returns How many boards the last vehicleInstallRun() expected.
+///
+uint32_t vehicleInstallResultCount(void)
+{
+    return boardCount;
+}
+
+///
+/// @fn: vehicleInstallGetResult
+///
+/// @details
+///
+/// @param[in] index: 0 .. vehicleInstallResultCount()-1
+///
+/// @returns NULL if out of range.
+///
+const vehicleBoardResultStruct* vehicleInstallGetResult(uint32_t index)
+{
+    const vehicleBoardResultStruct*     ret = NULL;
+
+    if (index < boardCount)
+    {
+        ret = &boards[index];
+    }
+
+    return ret;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+///
+/// @fn: _vehicleLoadManifest
+///
+/// @details Fills in one "boards" entry per board the vehicle manifest
+///          expects, with the TYPE & VARIANT from its board manifest.
+///
+/// @param[in]
+///
+/// @returns true if at least one board is expected.
+///
+static bool _vehicleLoadManifest(char* manifestPath)
+{
+    bool                        ret = false;
+    fkvpStruct                  vkvp;
+
+    memset(boards, 0, sizeof(boards));
+    boardCount = 0;
+
+    if (fkvpBegin(manifestPath, &vkvp) != NULL)
+    {
+        char*                   valStr = fkvpFind(&vkvp, VEHICLE_MANIFEST_BOARD_COUNT_KEY, true);
+        uint32_t                manifestCount = 0;
+        uint32_t                index;
+
+        if (valStr)
+        {
+            manifestCount = strtoul(valStr, NULL, 10);
+        }
+        if (manifestCount > VEHICLE_MAX_BOARD_MANIFESTS)
+        {
+            printf("\r\n Vehicle manifest lists %u board manifests; only the first %u are used!",
+                   manifestCount,
+                   VEHICLE_MAX_BOARD_MANIFESTS);
+            manifestCount = VEHICLE_MAX_BOARD_MANIFESTS;
+        }
+
+        for (index = 1; index <= manifestCount; index++)
+        {
+            char                keyBuf[64];
+            char                boardPath[MAX_PATH_LEN];
+            uint32_t            copies = 1;
+            fwManifestStruct*   boardManifest;
+
+            // How many boards use this manifest?
+            snprintf(keyBuf, sizeof(keyBuf), VEHICLE_MANIFEST_BOARD_COPIES_FORMAT, index);
+            valStr = fkvpFind(&vkvp, keyBuf, true);
+            if (valStr)
+            {
+                copies = strtoul(valStr, NULL, 10);
+            }
+
+            // Build the path to the board manifest
+            snprintf(keyBuf, sizeof(keyBuf), VEHICLE_MANIFEST_BOARD_PATH_FORMAT, index);
+            valStr = fkvpFind(&vkvp, keyBuf, true);
+            if (valStr == NULL)
+            {
+                printf("\r\n Vehicle manifest has no \"%s\"!", keyBuf);
+                continue;
+            }
+
+            valStr = dfuToolStripQuotes(valStr);
+            if (isAbsolutePath(valStr))
+            {
+                snprintf(boardPath, sizeof(boardPath), "%s", valStr);
+            }
+            else
+            {
+                snprintf(boardPath, sizeof(boardPath), "%s", manifestPath);
+                dfuToolExtractPath(boardPath);
+                strncat(boardPath, valStr, sizeof(boardPath) - strlen(boardPath) - 1);
+            }
+
+            // Boards that share a manifest load it once
+            boardManifest = loadFWManifest(boardPath);
+            if (boardManifest != NULL)
+            {
+                uint8_t         devType = (uint8_t)FWMAN_DEV_TYPE(boardManifest);
+                uint8_t         devVariant = FWMAN_DEV_VARIANT(boardManifest);
+
+                if (lookupFWManifestValue(boardManifest, FW_MANIFEST_DEVICE_TYPE_ID_KEY) != NULL)
+                {
+
+                    while ( (copies > 0) && (boardCount < VEHICLE_MAX_BOARDS) )
+                    {
+                        vehicleBoardResultStruct*   board = &boards[boardCount++];
+
+                        snprintf(board->manifestPath, sizeof(board->manifestPath), "%s", boardPath);
+                        board->deviceType = devType;
+                        board->deviceVariant = devVariant;
+                        board->result = API_ERR_UNKNOWN;
+                        copies--;
+                    }
+
+                    if (copies > 0)
+                    {
+                        printf("\r\n Too many boards in the vehicle manifest (max %u)!", VEHICLE_MAX_BOARDS);
+                    }
+                }
+                else
+                {
+                    printf("\r\n Board manifest %s has no device type!", boardPath);
+                }
+
+                releaseFWManifest(boardManifest);
+            }
+            else
+            {
+                printf("\r\n Could not open board manifest %s!", boardPath);
+            }
+        }
+
+        fkvpEnd(&vkvp);
+        ret = (boardCount > 0);
+    }
+    else
+    {
+        printf("\r\n Could not open vehicle manifest %s!", manifestPath);
+    }
+
+    return ret;
+}
+
+///
+/// @fn: _vehicleDiscover
+///
+/// @details Assigns each device that appears in the registry to the
+///          first unassigned board with the same TYPE & VARIANT.  Stops
+///          once every board has a device, or when nothing new is heard
+///          for listenTimeoutMS.
+///
+/// @param[in]
+/// @param[in]
+///
+/// @returns How many boards have a device.
+///
+/// @note Devices the registry already knows count straight away,
+///       unless they were heard through a different API handle.
+///
+static uint32_t _vehicleDiscover(dfuClientAPI* apiHandle, uint32_t listenTimeoutMS)
+{
+    uint32_t                    ret = 0;
+    vehicleDiscoveryStruct      discovery;
+
+    memset(&discovery, 0, sizeof(discovery));
+    discovery.apiHandle = apiHandle;
+    discovery.timeoutMS = listenTimeoutMS;
+    discovery.loop = eventLoopCreate();
+
+    if (apiHandle != lastDiscoveryHandle)
+    {
+        deviceRegistryClear();
+        lastDiscoveryHandle = apiHandle;
+    }
+
+    if (discovery.loop)
+    {
+        /*
+        ** Wake on a frame (where the socket is a descriptor) and
+        ** at least every EVENT_LOOP_IDLE_PERIOD_MS otherwise.
+        **
+        */
+        ifaceLinkWatchAll(discovery.loop, _vehicleDiscoverSocket, &discovery);
+        eventLoopAddIdle(discovery.loop, _vehicleDiscoverDrive, &discovery);
+        discovery.quietTimer = eventLoopAddTimer(discovery.loop, listenTimeoutMS, 0, _vehicleDiscoverQuiet, &discovery);
+
+        if (
+               (discovery.quietTimer >= 0) &&
+               (deviceRegistrySubscribe(_vehicleDeviceEvent, &discovery, true))
+           )
+        {
+            // Devices the registry already knew may have been enough
+            if (discovery.found < boardCount)
+            {
+                eventLoopRun(discovery.loop, 0);
+            }
+            deviceRegistryUnsubscribe(_vehicleDeviceEvent, &discovery);
+        }
+
+        eventLoopDestroy(discovery.loop);
+    }
+    else
+    {
+        printf("\r\n Could not create the event loop!");
+    }
+
+    ret = discovery.found;
+
+    return ret;
+}
+
+///
+/// @fn: _vehicleDiscoverDrive
+///
+/// @details Lets the client process what has arrived, then takes any
+///          new discovery records into the registry (which reports
+///          them to _vehicleDeviceEvent).
+///
+/// @param[in]
+/// @param[in] ctx: The vehicleDiscoveryStruct.
+///
+/// @returns
+///
+static void _vehicleDiscoverDrive(eventLoopStruct* loop, void* ctx)
+{
+    vehicleDiscoveryStruct*     discovery = (vehicleDiscoveryStruct*)ctx;
+
+    (void)loop;
+
+    dfuClientAPI_LL_IdleDrive(discovery->apiHandle);
+    deviceRegistryCollect(discovery->apiHandle);
+
+    return;
+}
+
+///
+/// @fn: _vehicleDiscoverSocket
+///
+/// @details A frame is waiting on an interface socket.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in] ctx: The vehicleDiscoveryStruct.
+///
+/// @returns
+///
+static void _vehicleDiscoverSocket(eventLoopStruct* loop, int fd, void* ctx)
+{
+    (void)fd;
+
+    _vehicleDiscoverDrive(loop, ctx);
+
+    return;
+}
+
+///
+/// @fn: _vehicleDiscoverQuiet
+///
+/// @details No new board has been found for the listen timeout.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+static void _vehicleDiscoverQuiet(eventLoopStruct* loop, int timerId, void* ctx)
+{
+    (void)timerId;
+    (void)ctx;
+
+    eventLoopStop(loop);
+
+    return;
+}
+
+///
+/// @fn: _vehicleDeviceEvent
+///
+/// @details Registry callback for discovery: gives a device that has
+///          just appeared to a board that needs one.
+///
+/// @param[in] ctx: The vehicleDiscoveryStruct.
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+static void _vehicleDeviceEvent(void* ctx, deviceRegistryEventEnum event, const deviceInfoStruct* device)
+{
+    vehicleDiscoveryStruct*     discovery = (vehicleDiscoveryStruct*)ctx;
+
+    if (event == DEVICE_EVENT_APPEARED)
+    {
+        vehicleBoardResultStruct*   match = NULL;
+        bool                        known = false;
+        uint32_t                    index;
+
+        for (index = 0; index < boardCount; index++)
+        {
+            if (
+                   (boards[index].found) &&
+                   (memcmp(boards[index].mac, device->physicalID, MAX_INTERFACE_MAC_LEN) == 0)
+               )
+            {
+                known = true;
+                break;
+            }
+
+            if (
+                   (match == NULL) &&
+                   (!boards[index].found) &&
+                   (boards[index].deviceType == device->deviceType) &&
+                   (boards[index].deviceVariant == device->deviceVariant)
+               )
+            {
+                match = &boards[index];
+            }
+        }
+
+        if ( (!known) && (match) )
+        {
+            char            devAddrStr[64];
+
+            memcpy(match->mac, device->physicalID, MAX_INTERFACE_MAC_LEN);
+            match->found = true;
+            discovery->found++;
+
+            dfuClientAPIMacBytesToString(discovery->apiHandle,
+                                         match->mac,
+                                         MAX_INTERFACE_MAC_LEN,
+                                         devAddrStr,
+                                         sizeof(devAddrStr));
+            printf("\r\n    Found TYPE %d VARIANT %d at %s",
+                   (int)match->deviceType,
+                   (int)match->deviceVariant,
+                   devAddrStr);
+
+            // Stop once every board has a device, else restart the listen timeout
+            if (discovery->found >= boardCount)
+            {
+                eventLoopStop(discovery->loop);
+            }
+            else
+            {
+                eventLoopCancelTimer(discovery->loop, discovery->quietTimer);
+                discovery->quietTimer = eventLoopAddTimer(discovery->loop,
+                                                          discovery->timeoutMS,
+                                                          0,
+                                                          _vehicleDiscoverQuiet,
+                                                          discovery);
+            }
+        }
+    }
+
+    return;
+}
+
+///
+/// @fn: _vehicleGetWorkerClients
+///
+/// @details Makes sure there are up to "wanted" clients open on the
+///          interface, reusing the ones from an earlier run.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns How many worker clients are usable.
+///
+static uint32_t _vehicleGetWorkerClients(interfaceTypeEnum ifaceType, char* ifaceName, uint32_t wanted)
+{
+    uint32_t                    ret;
+
+    if (
+           (workerIfaceType != ifaceType) ||
+           (strncmp(workerIfaceName, ifaceName, sizeof(workerIfaceName)) != 0)
+       )
+    {
+        workerClientCount = 0;
+        workerIfaceType = ifaceType;
+        snprintf(workerIfaceName, sizeof(workerIfaceName), "%s", ifaceName);
+    }
+
+    while (workerClientCount < wanted)
+    {
+        dfuClientEnvStruct*     dfuClient;
+
+        dfuClient = dfuClientInit((ifaceType == INTERFACE_TYPE_CAN) ? DFUCLIENT_INTERFACE_CAN : DFUCLIENT_INTERFACE_ETHERNET,
+                                  ifaceName);
+        if (dfuClient == NULL)
+        {
+            break;
+        }
+
+        //
+        // Claim this client's device-type slot now, from this
+        // thread, so the workers only ever update their own.
+        //
+        xferSetDeviceType(dfuClient, 0);
+        workerClients[workerClientCount++] = dfuClient;
+    }
+
+    ret = (workerClientCount < wanted) ? workerClientCount : wanted;
+
+    return ret;
+}
+
+///
+/// @fn: _vehicleNextJob
+///
+/// @details
+///
+/// @returns The next found board that no worker has taken, or NULL.
+///
+static vehicleBoardResultStruct* _vehicleNextJob(void)
+{
+    vehicleBoardResultStruct*   ret = NULL;
+
+    pthread_mutex_lock(&jobLock);
+    while ( (ret == NULL) && (nextJob < boardCount) )
+    {
+        if (boards[nextJob].found)
+        {
+            ret = &boards[nextJob];
+        }
+        nextJob++;
+    }
+    pthread_mutex_unlock(&jobLock);
+
+    return ret;
+}
+
+///
+/// @fn: _vehicleWorker
+///
+/// @details Runs a full manifest update for one board after another
+///          on its own client until the job list is empty.
+///
+/// @param[in] arg: The worker's dfuClientEnvStruct.
+///
+/// @returns
+///
+static void* _vehicleWorker(void* arg)
+{
+    dfuClientEnvStruct*         dfuClient = (dfuClientEnvStruct*)arg;
+    vehicleBoardResultStruct*   board;
+
+    while ((board = _vehicleNextJob()) != NULL)
+    {
+        ASYNC_TIMER_STRUCT      timer;
+
+        //
+        // Only this board's traffic reaches this client; the other
+        // workers' boards are answering on the same link.
+        //
+        if (!ifaceLinkSetRxSources(dfuClientGetDFU(dfuClient), board->mac, MAX_INTERFACE_MAC_LEN, 1))
+        {
+            printf("\r\n Could not filter RX to one board; relying on the destination filter.");
+        }
+
+        TIMER_Start(&timer);
+        board->result = fwupdProcessFWManifestForDevice(dfuClient,
+                                                        board->mac,
+                                                        MAX_INTERFACE_MAC_LEN,
+                                                        board->manifestPath);
+        board->elapsedMS = (uint32_t)TIMER_GetElapsedMillisecs(&timer, NULL);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,775 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_multicast.c
+**
+** DESCRIPTION: One-to-many image transfer for boards that take the same
+**              image.
+**
+**   Every chunk goes out once to the whole group.  Each member acks with
+**   a cumulative seq plus a bitmap of what it holds past that, and the
+**   engine keeps a full received-chunk bitmap per member.  The stream
+**   never runs more than the transport's window ahead of the slowest
+**   member still acking.  As xfer_window does, a gap an ack reveals is
+**   resent to that member once straight away.  Once the stream is done,
+**   whatever a member is still missing is resent to it alone, a window
+**   at a time.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xfer_multicast.h"
+#include "image_xfer.h"
+#include "image_source.h"
+#include "xfer_progress.h"
+
+
+#define XFER_MCAST_TRANSACTION_TIMEOUT_MS       (5000)
+
+/*
+** What the engine knows about each member while a transfer runs.
+**
+**   joined:    Active when the run started (and its bitmap allocated).
+**   lagging:   Stopped acking during the stream; the stream no longer
+**              waits for it and the repair pass catches it up.
+**   gapResent: Gaps below this have already had their one resend.
+**
+*/
+typedef struct
+{
+    bool                            joined;
+    uint8_t *                       received;
+    uint32_t                        receivedCount;
+    uint32_t                        cumulativeSeq;
+    uint32_t                        gapResent;
+    bool                            lagging;
+    int                             progress;
+}xferMemberStateStruct;
+
+/*
+** One run of the data phase.
+**
+*/
+typedef struct
+{
+    const uint8_t *                 image;
+    uint32_t                        imageSize;
+    uint16_t                        chunkLen;
+    uint32_t                        chunkCount;
+    uint32_t                        window;
+    xferGroupMemberStruct *         members;
+    xferMemberStateStruct *         states;
+    uint32_t                        memberCount;
+    const xferGroupTransportOps *   group;
+}xferMcastRunStruct;
+
+#define XFER_MCAST_HAS(state, seq)      ((state)->received[(seq) >> 3] & (1U << ((seq) & 7)))
+#define XFER_MCAST_SET(state, seq)      ((state)->received[(seq) >> 3] |= (uint8_t)(1U << ((seq) & 7)))
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static bool _xferMcastStream(xferMcastRunStruct *run);
+static void _xferMcastRepair(xferMcastRunStruct *run, uint32_t index);
+static void _xferMcastWaitForWindow(xferMcastRunStruct *run, uint32_t seq);
+static bool _xferMcastTakeAck(xferMcastRunStruct *run, uint32_t index, const xferGroupAckStruct *ack);
+static void _xferMcastCollectAcks(xferMcastRunStruct *run, uint32_t timeoutMS);
+static bool _xferMcastSendRepair(xferMcastRunStruct *run, uint32_t index, uint32_t seq);
+static uint32_t _xferMcastWindow(const xferGroupTransportOps *group);
+static void _xferMcastPublish(const xferMcastRunStruct *run, uint32_t streamed);
+
+
+/*!
+** FUNCTION: xferImageMulticast
+**
+** DESCRIPTION: Transfers one image to every member of a group.  The image
+**              is streamed once through the group transport; each
+**              member's gaps are then repaired with unicast resends.
+**
+** PARAMETERS: members:  Sessions must already be open with each one.
+**             group:    NULL (or fewer than two members) sends the
+**                       image to each member in turn with xferImage().
+**
+** RETURNS: true if every member got the whole image.  Per-member
+**          results are in members[].ok.
+**
+** COMMENTS: A member that NAKs BEGIN_RCV, rejects data or never fills
+**           its gaps is dropped; the rest of the group carries on.
+**
+*/
+bool xferImageMulticast(char *filenameStr,
+                        uint8_t imageIndex,
+                        uint32_t imageAddress,
+                        bool isEncrypted,
+                        xferGroupMemberStruct *members,
+                        uint32_t memberCount,
+                        const xferGroupTransportOps *group)
+{
+    bool                            ret = false;
+    uint32_t                        index;
+
+    if (
+           (filenameStr) &&
+           (members) &&
+           (memberCount > 0)
+       )
+    {
+        for (index = 0; index < memberCount; index++)
+        {
+            members[index].active = false;
+            members[index].ok = false;
+            members[index].repairs = 0;
+        }
+
+        if (
+               (group == NULL) ||
+               (group->sendChunk == NULL) ||
+               (group->sendRepair == NULL) ||
+               (group->pollAck == NULL) ||
+               (memberCount < 2)
+           )
+        {
+            /*
+            ** No group transport: one ordinary transfer per member.
+            **
+            */
+            ret = true;
+            for (index = 0; index < memberCount; index++)
+            {
+                members[index].ok = xferImage(filenameStr,
+                                              members[index].destStr,
+                                              imageIndex,
+                                              imageAddress,
+                                              isEncrypted,
+                                              members[index].dfuClient);
+                ret = (ret && members[index].ok);
+            }
+        }
+        else
+        {
+            uint16_t                    chunkLen = XFER_MAX_CHUNK_LEN;
+            imageSourceStruct *         source = imageSourceOpen(filenameStr);
+            uint32_t                    activeCount = 0;
+
+            // Every member must be able to take the chunk size.
+            for (index = 0; index < memberCount; index++)
+            {
+                uint16_t            mtu = dfuClientGetInternalMTU(members[index].dfuClient);
+
+                if ( (mtu > 3) && ((uint16_t)(mtu - 3) < chunkLen) )
+                {
+                    chunkLen = mtu - 3;
+                }
+            }
+
+            printf("\r\n *** MULTICAST IMAGE TRANSFER ***");
+            printf("\r\n Members       : %u", memberCount);
+            printf("\r\n Sending       : %s", filenameStr);
+            printf("\r\n File size     : %u bytes", (source) ? source->size : 0);
+            printf("\r\n Image Index   : %d", imageIndex);
+            printf("\r\n FLASH Address : 0x%08X", imageAddress);
+            printf("\r\n Encrypted     : %s", isEncrypted ? "yes" : "no");
+            fflush(stdout);
+
+            if (source)
+            {
+                /*
+                ** Start the transfer on every member.
+                **
+                */
+                for (index = 0; index < memberCount; index++)
+                {
+                    if (dfuClientTransaction_CMD_BEGIN_RCV(members[index].dfuClient,
+                                                           XFER_MCAST_TRANSACTION_TIMEOUT_MS,
+                                                           members[index].destStr,
+                                                           imageIndex,
+                                                           source->size,
+                                                           imageAddress,
+                                                           isEncrypted))
+                    {
+                        members[index].active = true;
+                        activeCount++;
+                    }
+                    else
+                    {
+                        printf("\r\n %s did not accept BEGIN_RCV command!", members[index].destStr);
+                    }
+                }
+
+                ret = (activeCount == memberCount);
+                if (activeCount > 0)
+                {
+                    ret = (xferMulticastRun(source->data, source->size, chunkLen, members, memberCount, group) && ret);
+                }
+
+                /*
+                ** Finish up on every member that has the whole image.
+                **
+                */
+                for (index = 0; index < memberCount; index++)
+                {
+                    if (members[index].ok)
+                    {
+                        members[index].ok = dfuClientTransaction_CMD_RCV_COMPLETE(members[index].dfuClient,
+                                                                                  XFER_MCAST_TRANSACTION_TIMEOUT_MS,
+                                                                                  members[index].destStr,
+                                                                                  source->size);
+                        if (!members[index].ok)
+                        {
+                            printf("\r\n %s did not accept RCV_COMPLETE command!", members[index].destStr);
+                        }
+                    }
+
+                    printf("\r\n    %-20s %s  (repairs: %u)",
+                           members[index].destStr,
+                           members[index].ok ? "OK    " : "FAILED",
+                           members[index].repairs);
+
+                    ret = (ret && members[index].ok);
+                }
+            }
+            else
+            {
+                printf("\r\n Failed to open [%s]!", filenameStr);
+            }
+
+            imageSourceClose(source);
+        }
+    }
+    else
+    {
+        printf("\r\n Invalid or missing parameters!");
+    }
+
+    printf("\r\n");
+    fflush(stdout);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferMulticastRun
+**
+** DESCRIPTION: The data phase on its own: streams the image once to the
+**              group, then repairs each active member's gaps.
+**
+** PARAMETERS: members:  Only "active" ones take part; each must already
+**                       have accepted BEGIN_RCV.
+**
+** RETURNS: true if every active member got every chunk.  members[].ok
+**          says which did.
+**
+** COMMENTS: For callers that run the control transactions themselves,
+**           as dfu_bench does against the simulator.
+**
+*/
+bool xferMulticastRun(const uint8_t *image,
+                      uint32_t imageSize,
+                      uint16_t chunkLen,
+                      xferGroupMemberStruct *members,
+                      uint32_t memberCount,
+                      const xferGroupTransportOps *group)
+{
+    bool                            ret = false;
+    xferMcastRunStruct              run;
+    uint32_t                        index;
+
+    memset(&run, 0, sizeof(run));
+
+    if (
+           (image) &&
+           (imageSize > 0) &&
+           (chunkLen > 0) &&
+           (members) &&
+           (group) &&
+           (group->sendChunk) &&
+           (group->sendRepair) &&
+           (group->pollAck)
+       )
+    {
+        run.image = image;
+        run.imageSize = imageSize;
+        run.chunkLen = chunkLen;
+        run.chunkCount = (imageSize + chunkLen - 1) / chunkLen;
+        run.window = _xferMcastWindow(group);
+        run.members = members;
+        run.memberCount = memberCount;
+        run.group = group;
+        run.states = (xferMemberStateStruct *)calloc(memberCount, sizeof(xferMemberStateStruct));
+    }
+
+    if (run.states)
+    {
+        ret = true;
+
+        for (index = 0; index < memberCount; index++)
+        {
+            xferMemberStateStruct * state = &run.states[index];
+
+            members[index].ok = false;
+            members[index].repairs = 0;
+            state->progress = XFER_PROGRESS_NONE;
+
+            if (members[index].active)
+            {
+                state->received = (uint8_t *)calloc((run.chunkCount + 7) / 8, 1);
+                if (state->received == NULL)
+                {
+                    printf("\r\n Out of memory for %s's chunk bitmap!", members[index].destStr);
+                    members[index].active = false;
+                    ret = false;
+                }
+                else
+                {
+                    state->joined = true;
+                    state->progress = xferProgressOpen(members[index].destStr, imageSize, 0);
+                }
+            }
+        }
+
+        ret = (_xferMcastStream(&run) && ret);
+
+        for (index = 0; index < memberCount; index++)
+        {
+            if (members[index].active)
+            {
+                _xferMcastRepair(&run, index);
+            }
+        }
+        _xferMcastPublish(&run, run.chunkCount);
+
+        for (index = 0; index < memberCount; index++)
+        {
+            xferMemberStateStruct * state = &run.states[index];
+
+            if (state->joined)
+            {
+                members[index].ok = ( (members[index].active) && (state->receivedCount == run.chunkCount) );
+                if (!members[index].ok)
+                {
+                    printf("\r\n %s is still missing %u chunk(s)!",
+                           members[index].destStr,
+                           run.chunkCount - state->receivedCount);
+                    ret = false;
+                }
+
+                xferProgressClose(state->progress, members[index].ok);
+            }
+            free(state->received);
+        }
+
+        free(run.states);
+    }
+
+    return (ret);
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _xferMcastStream
+**
+** DESCRIPTION: The stream pass: every chunk once, to everyone.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the group send failed.
+**
+** COMMENTS: Ends by letting every member drain what it was sent.
+**
+*/
+static bool _xferMcastStream(xferMcastRunStruct *run)
+{
+    bool                            ret = true;
+    const xferGroupTransportOps *   group = run->group;
+    uint32_t                        burst = (group->maxBurst > 0) ? group->maxBurst : XFER_MULTICAST_BURST;
+    uint32_t                        inBurst = 0;
+    uint32_t                        seq;
+
+    for (seq = 0; seq < run->chunkCount; seq++)
+    {
+        uint32_t                    offset = seq * run->chunkLen;
+        uint32_t                    len = run->imageSize - offset;
+
+        _xferMcastWaitForWindow(run, seq);
+
+        if (!group->sendChunk(group->ctx, seq, offset, &run->image[offset], (len < run->chunkLen) ? (uint16_t)len : run->chunkLen))
+        {
+            printf("\r\n Multicast send failed at chunk #%u!", seq);
+            ret = false;
+            break;
+        }
+
+        if ( (++inBurst >= burst) || (seq + 1 == run->chunkCount) )
+        {
+            inBurst = 0;
+            if (group->flush)
+            {
+                group->flush(group->ctx);
+            }
+            _xferMcastCollectAcks(run, 0);
+            _xferMcastPublish(run, seq + 1);
+        }
+    }
+
+    _xferMcastCollectAcks(run, XFER_ACK_TIMEOUT_MS);
+    _xferMcastPublish(run, run->chunkCount);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferMcastRepair
+**
+** DESCRIPTION: Resends one member's missing chunks to it alone, a window
+**              at a time.
+**
+** PARAMETERS: index: The member's number on the group transport.
+**
+** RETURNS:
+**
+** COMMENTS: Gives up (and drops the member) after XFER_MAX_RETRANSMITS
+**           windows in a row that moved nothing on.
+**
+*/
+static void _xferMcastRepair(xferMcastRunStruct *run, uint32_t index)
+{
+    xferGroupMemberStruct *         member = &run->members[index];
+    xferMemberStateStruct *         state = &run->states[index];
+    uint32_t                        stalled = 0;
+
+    while (
+              (member->active) &&
+              (state->receivedCount < run->chunkCount) &&
+              (stalled <= XFER_MAX_RETRANSMITS)
+          )
+    {
+        uint32_t                    before = state->receivedCount;
+        uint32_t                    seq;
+        xferGroupAckStruct          ack;
+
+        for (seq = state->cumulativeSeq; (seq < run->chunkCount) && (seq < state->cumulativeSeq + run->window); seq++)
+        {
+            if ( (!XFER_MCAST_HAS(state, seq)) && (!_xferMcastSendRepair(run, index, seq)) )
+            {
+                break;
+            }
+        }
+        state->gapResent = seq;
+
+        if (run->group->flush)
+        {
+            run->group->flush(run->group->ctx);
+        }
+
+        // Let the member work through everything sent before resending.
+        while (
+                  (member->active) &&
+                  (state->receivedCount < run->chunkCount) &&
+                  (run->group->pollAck(run->group->ctx, index, &ack, XFER_ACK_TIMEOUT_MS))
+              )
+        {
+            _xferMcastTakeAck(run, index, &ack);
+        }
+
+        stalled = (state->receivedCount > before) ? 0 : (stalled + 1);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferMcastWaitForWindow
+**
+** DESCRIPTION: Holds the stream back until every member still keeping
+**              up has room for chunk "seq".
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A member that sends nothing for a whole ack timeout is
+**           marked lagging and no longer waited for.
+**
+*/
+static void _xferMcastWaitForWindow(xferMcastRunStruct *run, uint32_t seq)
+{
+    uint32_t                        index;
+
+    for (index = 0; index < run->memberCount; index++)
+    {
+        xferMemberStateStruct *     state = &run->states[index];
+        xferGroupAckStruct          ack;
+
+        while (
+                  (run->members[index].active) &&
+                  (!state->lagging) &&
+                  (seq >= state->cumulativeSeq + run->window)
+              )
+        {
+            if (run->group->pollAck(run->group->ctx, index, &ack, XFER_ACK_TIMEOUT_MS))
+            {
+                _xferMcastTakeAck(run, index, &ack);
+            }
+            else
+            {
+                state->lagging = true;
+            }
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferMcastTakeAck
+**
+** DESCRIPTION: Marks every chunk one member's ack covers, and resends
+**              the gaps it shows to that member.
+**
+** PARAMETERS:
+**
+** RETURNS: true if the ack told the engine anything new.
+**
+** COMMENTS: A rejected ack drops the member from the group.  New
+**           information also clears "lagging".  Each gap is resent
+**           only once this way; after that it waits for the repair
+**           pass.
+**
+*/
+static bool _xferMcastTakeAck(xferMcastRunStruct *run, uint32_t index, const xferGroupAckStruct *ack)
+{
+    xferGroupMemberStruct *         member = &run->members[index];
+    xferMemberStateStruct *         state = &run->states[index];
+    uint32_t                        before = state->receivedCount;
+    uint32_t                        highest = ack->cumulativeSeq;
+    uint32_t                        seq;
+    uint32_t                        bit;
+
+    if (ack->rejected)
+    {
+        printf("\r\n %s rejected the data!", member->destStr);
+        member->active = false;
+    }
+    else
+    {
+        for (seq = state->cumulativeSeq; (seq < ack->cumulativeSeq) && (seq < run->chunkCount); seq++)
+        {
+            if (!XFER_MCAST_HAS(state, seq))
+            {
+                XFER_MCAST_SET(state, seq);
+                state->receivedCount++;
+            }
+        }
+
+        for (bit = 0; bit < (XFER_GROUP_ACK_BITMAP_WORDS * 32); bit++)
+        {
+            seq = ack->bitmapBase + bit;
+
+            if (
+                   (seq < run->chunkCount) &&
+                   (ack->bitmap[bit >> 5] & (1UL << (bit & 31)))
+               )
+            {
+                highest = seq;
+                if (!XFER_MCAST_HAS(state, seq))
+                {
+                    XFER_MCAST_SET(state, seq);
+                    state->receivedCount++;
+                }
+            }
+        }
+
+        // Move the cumulative point past everything now held.
+        while (
+                  (state->cumulativeSeq < run->chunkCount) &&
+                  (XFER_MCAST_HAS(state, state->cumulativeSeq))
+              )
+        {
+            state->cumulativeSeq++;
+        }
+
+        //
+        // Anything still missing below the highest chunk acked was lost.
+        //
+        if (state->gapResent < state->cumulativeSeq)
+        {
+            state->gapResent = state->cumulativeSeq;
+        }
+        for (seq = state->gapResent; seq < highest; seq++)
+        {
+            if ( (!XFER_MCAST_HAS(state, seq)) && (!_xferMcastSendRepair(run, index, seq)) )
+            {
+                break;
+            }
+        }
+        if (seq > state->gapResent)
+        {
+            state->gapResent = seq;
+            if (run->group->flush)
+            {
+                run->group->flush(run->group->ctx);
+            }
+        }
+
+        if (state->receivedCount > before)
+        {
+            state->lagging = false;
+        }
+    }
+
+    return (state->receivedCount > before);
+}
+
+/*!
+** FUNCTION: _xferMcastCollectAcks
+**
+** DESCRIPTION: Drains the acks waiting from every active member.
+**
+** PARAMETERS: timeoutMS: How long to wait for each ack.  0 only takes
+**                        what is already there.
+**
+** RETURNS:
+**
+** COMMENTS: With a timeout, a member is done once it has everything or
+**           goes quiet for that long, so nothing it still has queued is
+**           mistaken for a gap.
+**
+*/
+static void _xferMcastCollectAcks(xferMcastRunStruct *run, uint32_t timeoutMS)
+{
+    uint32_t                        index;
+
+    for (index = 0; index < run->memberCount; index++)
+    {
+        xferGroupAckStruct          ack;
+
+        while (
+                  (run->members[index].active) &&
+                  (run->states[index].receivedCount < run->chunkCount) &&
+                  (run->group->pollAck(run->group->ctx, index, &ack, timeoutMS))
+              )
+        {
+            _xferMcastTakeAck(run, index, &ack);
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferMcastSendRepair
+**
+** DESCRIPTION: Resends one chunk to one member.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the send failed, which drops the member.
+**
+** COMMENTS:
+**
+*/
+static bool _xferMcastSendRepair(xferMcastRunStruct *run, uint32_t index, uint32_t seq)
+{
+    xferGroupMemberStruct *         member = &run->members[index];
+    uint32_t                        offset = seq * run->chunkLen;
+    uint32_t                        len = run->imageSize - offset;
+    bool                            ret;
+
+    ret = run->group->sendRepair(run->group->ctx,
+                                 index,
+                                 seq,
+                                 offset,
+                                 &run->image[offset],
+                                 (len < run->chunkLen) ? (uint16_t)len : run->chunkLen);
+    if (ret)
+    {
+        member->repairs++;
+    }
+    else
+    {
+        printf("\r\n Repair send to %s failed at chunk #%u!", member->destStr, seq);
+        member->active = false;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferMcastWindow
+**
+** DESCRIPTION: Chunks a member may be sent past its cumulative point.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _xferMcastWindow(const xferGroupTransportOps *group)
+{
+    uint32_t                        ret = group->maxWindow;
+
+    if (ret == 0)
+    {
+        ret = (group->maxBurst > 0) ? group->maxBurst : XFER_MULTICAST_BURST;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferMcastPublish
+**
+** DESCRIPTION: Publishes every active member's counters to the progress
+**              table.
+**
+** PARAMETERS: streamed: Chunks sent to the whole group so far.
+**
+** RETURNS:
+**
+** COMMENTS: Repairs count as both chunks sent and retries.
+**
+*/
+static void _xferMcastPublish(const xferMcastRunStruct *run, uint32_t streamed)
+{
+    uint32_t                        index;
+
+    for (index = 0; index < run->memberCount; index++)
+    {
+        const xferGroupMemberStruct *   member = &run->members[index];
+        const xferMemberStateStruct *   state = &run->states[index];
+
+        if (
+               (member->active) &&
+               (state->progress != XFER_PROGRESS_NONE)
+           )
+        {
+            uint64_t                bytes = (uint64_t)state->receivedCount * run->chunkLen;
+
+            xferProgressUpdate(state->progress,
+                               (bytes > run->imageSize) ? run->imageSize : (uint32_t)bytes,
+                               streamed + member->repairs,
+                               member->repairs,
+                               0);
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,785 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_progress.c
+**
+** DESCRIPTION: Transfer progress table and its renderer.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <windows.h>
+    #include <io.h>
+    #define XFER_PROGRESS_ISATTY(f)     _isatty(_fileno(f))
+    #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+        #define ENABLE_VIRTUAL_TERMINAL_PROCESSING  (0x0004)
+    #endif
+#else
+    #include <unistd.h>
+    #define XFER_PROGRESS_ISATTY(f)     isatty(fileno(f))
+#endif
+
+#include "xfer_progress.h"
+#include "async_timer.h"
+
+/*
+** Width of the bar in a finished session's row, and of the whole status
+** line (so it never wraps, which would defeat the "\r" redraw).
+**
+*/
+#define XFER_PROGRESS_BAR_WIDTH     (20U)
+#define XFER_PROGRESS_LINE_WIDTH    (79U)
+
+/*
+** Weight of the newest sample in the smoothed rate, in percent.
+**
+*/
+#define XFER_PROGRESS_RATE_WEIGHT   (30U)
+
+/*
+** Session states.  FREE -> RUNNING -> ENDED -> FREE; the renderer frees
+** an ENDED slot once it has drawn it.
+**
+*/
+typedef enum
+{
+    XFER_PROGRESS_SLOT_FREE = 0,
+    XFER_PROGRESS_SLOT_RUNNING,
+    XFER_PROGRESS_SLOT_ENDED
+}xferProgressSlotStateEnum;
+
+/*
+** One session.  The counters are written by the session's owner and
+** read by the renderer; everything else is under progressLock.
+**
+*/
+typedef struct
+{
+    xferProgressSlotStateEnum   state;
+    bool                        ok;
+    char                        name[XFER_PROGRESS_NAME_LEN];
+    uint32_t                    totalBytes;
+    uint32_t                    startBytes;
+    uint64_t                    startUS;
+    uint64_t                    endUS;
+
+    // Published by xferProgressUpdate().
+    uint32_t                    bytes;
+    uint32_t                    chunks;
+    uint32_t                    retries;
+    uint32_t                    timeouts;
+
+    // Renderer's own.
+    uint32_t                    sampleBytes;
+    uint64_t                    sampleUS;
+    double                      rateBps;
+}xferProgressSlotStruct;
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          INTERNAL SUPPORT PROTOTYPES
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+static void *_xferProgressThread(void *arg);
+static void _xferProgressRender(void);
+static void _xferProgressSample(xferProgressSlotStruct *slot, uint64_t nowUS);
+static void _xferProgressTtyRow(xferProgressSlotStruct *slot);
+static void _xferProgressTtyStatus(void);
+static void _xferProgressTtyClear(void);
+static bool _xferProgressTtyInit(void);
+static void _xferProgressJsonEvent(int session, const char *event, xferProgressSlotStruct *slot, uint64_t nowUS);
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          LOCAL DATA
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+static xferProgressSlotStruct       slots[XFER_PROGRESS_MAX_SESSIONS];
+static pthread_mutex_t              progressLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t                    renderThread;
+static bool                         renderRunning = false;
+static bool                         renderStopping = false;
+static xferProgressModeEnum         renderMode = XFER_PROGRESS_QUIET;
+static FILE *                       renderOutput = NULL;
+static uint32_t                     drawnWidth = 0;
+static bool                         ttyAnsi = false;
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          EXPORTED FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: xferProgressDefaultMode
+**
+** DESCRIPTION: TTY when stdout is a terminal, QUIET otherwise.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+xferProgressModeEnum xferProgressDefaultMode(void)
+{
+    return (XFER_PROGRESS_ISATTY(stdout) ? XFER_PROGRESS_TTY : XFER_PROGRESS_QUIET);
+}
+
+/*!
+** FUNCTION: xferProgressStart
+**
+** DESCRIPTION: Starts the renderer.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool xferProgressStart(xferProgressModeEnum mode, const char *path)
+{
+    bool                            ret = false;
+
+    pthread_mutex_lock(&progressLock);
+
+    if (!renderRunning)
+    {
+        if (mode == XFER_PROGRESS_NDJSON)
+        {
+            renderOutput = (path) ? fopen(path, "w") : stderr;
+        }
+        else
+        {
+            renderOutput = stdout;
+        }
+
+        if (renderOutput)
+        {
+            renderMode = mode;
+            renderStopping = false;
+            drawnWidth = 0;
+
+            if (mode == XFER_PROGRESS_TTY)
+            {
+                ttyAnsi = _xferProgressTtyInit();
+            }
+
+            if (mode == XFER_PROGRESS_QUIET)
+            {
+                // Nothing to draw, so no thread: ended sessions are freed
+                // as they close.
+                ret = true;
+            }
+            else
+            if (pthread_create(&renderThread, NULL, _xferProgressThread, NULL) == 0)
+            {
+                renderRunning = true;
+                ret = true;
+            }
+            else
+            {
+                printf("\r\n Could not start the progress thread!");
+            }
+        }
+        else
+        {
+            printf("\r\n Could not open progress file [%s]!", path);
+        }
+
+        if ( (!ret) && (renderOutput) && (renderOutput != stdout) && (renderOutput != stderr) )
+        {
+            fclose(renderOutput);
+        }
+        if (!ret)
+        {
+            renderOutput = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&progressLock);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferProgressStop
+**
+** DESCRIPTION: Draws a last sample and stops the renderer.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferProgressStop(void)
+{
+    bool                            wasRunning;
+
+    pthread_mutex_lock(&progressLock);
+    wasRunning = renderRunning;
+    renderStopping = true;
+    pthread_mutex_unlock(&progressLock);
+
+    if (wasRunning)
+    {
+        pthread_join(renderThread, NULL);
+    }
+
+    pthread_mutex_lock(&progressLock);
+
+    if (wasRunning)
+    {
+        _xferProgressRender();
+        if (renderMode == XFER_PROGRESS_TTY)
+        {
+            _xferProgressTtyClear();
+            fflush(renderOutput);
+        }
+    }
+    renderRunning = false;
+    drawnWidth = 0;
+
+    if ( (renderOutput) && (renderOutput != stdout) && (renderOutput != stderr) )
+    {
+        fclose(renderOutput);
+    }
+    renderOutput = NULL;
+    renderMode = XFER_PROGRESS_QUIET;
+
+    pthread_mutex_unlock(&progressLock);
+
+    return;
+}
+
+/*!
+** FUNCTION: xferProgressOpen
+**
+** DESCRIPTION: Adds a session to the table.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+int xferProgressOpen(const char *name, uint32_t totalBytes, uint32_t startBytes)
+{
+    int                             ret = XFER_PROGRESS_NONE;
+    uint32_t                        index;
+
+    pthread_mutex_lock(&progressLock);
+
+    for (index = 0; index < XFER_PROGRESS_MAX_SESSIONS; index++)
+    {
+        if (slots[index].state == XFER_PROGRESS_SLOT_FREE)
+        {
+            xferProgressSlotStruct *    slot = &slots[index];
+
+            memset(slot, 0, sizeof(*slot));
+            snprintf(slot->name, sizeof(slot->name), "%s", name ? name : "");
+            slot->totalBytes = totalBytes;
+            slot->startBytes = startBytes;
+            slot->bytes = startBytes;
+            slot->sampleBytes = startBytes;
+            slot->startUS = TIMER_GetMicroseconds();
+            slot->sampleUS = slot->startUS;
+            slot->state = XFER_PROGRESS_SLOT_RUNNING;
+
+            ret = (int)index;
+
+            if ( (renderRunning) && (renderMode == XFER_PROGRESS_NDJSON) )
+            {
+                _xferProgressJsonEvent(ret, "start", slot, slot->startUS);
+                fflush(renderOutput);
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&progressLock);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferProgressUpdate
+**
+** DESCRIPTION: Publishes a session's counters.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferProgressUpdate(int session,
+                        uint32_t bytes,
+                        uint32_t chunks,
+                        uint32_t retries,
+                        uint32_t timeouts)
+{
+    if ( (session >= 0) && (session < (int)XFER_PROGRESS_MAX_SESSIONS) )
+    {
+        xferProgressSlotStruct *    slot = &slots[session];
+
+        __atomic_store_n(&slot->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->chunks, chunks, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->retries, retries, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->timeouts, timeouts, __ATOMIC_RELAXED);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: xferProgressClose
+**
+** DESCRIPTION: Ends a session.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferProgressClose(int session, bool ok)
+{
+    if ( (session >= 0) && (session < (int)XFER_PROGRESS_MAX_SESSIONS) )
+    {
+        pthread_mutex_lock(&progressLock);
+
+        if (slots[session].state == XFER_PROGRESS_SLOT_RUNNING)
+        {
+            slots[session].ok = ok;
+            slots[session].endUS = TIMER_GetMicroseconds();
+            slots[session].state = XFER_PROGRESS_SLOT_ENDED;
+
+            if (renderRunning)
+            {
+                _xferProgressRender();
+            }
+            else
+            {
+                slots[session].state = XFER_PROGRESS_SLOT_FREE;
+            }
+        }
+
+        pthread_mutex_unlock(&progressLock);
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _xferProgressThread
+**
+** DESCRIPTION: Samples and draws the table XFER_PROGRESS_RATE_HZ times a
+**              second until stopped.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void *_xferProgressThread(void *arg)
+{
+    bool                            stopping = false;
+
+    (void)arg;
+
+    while (!stopping)
+    {
+        TIMER_SleepUS(1000000U / XFER_PROGRESS_RATE_HZ);
+
+        pthread_mutex_lock(&progressLock);
+        stopping = renderStopping;
+        if (!stopping)
+        {
+            _xferProgressRender();
+        }
+        pthread_mutex_unlock(&progressLock);
+    }
+
+    return (NULL);
+}
+
+/*!
+** FUNCTION: _xferProgressRender
+**
+** DESCRIPTION: Draws every session once, and frees the ended ones.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Call with progressLock held.
+**
+**           On a terminal only the current line is ever rewritten: the
+**           running sessions share one status line, redrawn with "\r".
+**           An ended session replaces it with its final row, which then
+**           stays, and the status line carries on below.  The cursor is
+**           never moved up, so output from other threads scrolls away
+**           normally; only the line the cursor is on can be redrawn.
+**
+*/
+static void _xferProgressRender(void)
+{
+    uint64_t                        nowUS = TIMER_GetMicroseconds();
+    uint32_t                        index;
+
+    if (renderMode == XFER_PROGRESS_TTY)
+    {
+        for (index = 0; index < XFER_PROGRESS_MAX_SESSIONS; index++)
+        {
+            if (slots[index].state == XFER_PROGRESS_SLOT_ENDED)
+            {
+                _xferProgressSample(&slots[index], slots[index].endUS);
+                _xferProgressTtyClear();
+                _xferProgressTtyRow(&slots[index]);
+                slots[index].state = XFER_PROGRESS_SLOT_FREE;
+            }
+            else
+            if (slots[index].state == XFER_PROGRESS_SLOT_RUNNING)
+            {
+                _xferProgressSample(&slots[index], nowUS);
+            }
+        }
+
+        _xferProgressTtyStatus();
+    }
+    else
+    {
+        for (index = 0; index < XFER_PROGRESS_MAX_SESSIONS; index++)
+        {
+            if (slots[index].state == XFER_PROGRESS_SLOT_RUNNING)
+            {
+                _xferProgressSample(&slots[index], nowUS);
+                _xferProgressJsonEvent((int)index, "progress", &slots[index], nowUS);
+            }
+            else
+            if (slots[index].state == XFER_PROGRESS_SLOT_ENDED)
+            {
+                _xferProgressSample(&slots[index], slots[index].endUS);
+                _xferProgressJsonEvent((int)index, "end", &slots[index], slots[index].endUS);
+                slots[index].state = XFER_PROGRESS_SLOT_FREE;
+            }
+        }
+    }
+
+    fflush(renderOutput);
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferProgressSample
+**
+** DESCRIPTION: Folds the bytes moved since the last sample into the
+**              session's smoothed rate.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _xferProgressSample(xferProgressSlotStruct *slot, uint64_t nowUS)
+{
+    uint32_t                        bytes = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+
+    if (nowUS > slot->sampleUS)
+    {
+        double                      rate = (double)(bytes - slot->sampleBytes) * 1000000.0 / (double)(nowUS - slot->sampleUS);
+
+        if (slot->rateBps == 0.0)
+        {
+            slot->rateBps = rate;
+        }
+        else
+        {
+            slot->rateBps = ( (rate * XFER_PROGRESS_RATE_WEIGHT) +
+                              (slot->rateBps * (100U - XFER_PROGRESS_RATE_WEIGHT)) ) / 100.0;
+        }
+
+        slot->sampleBytes = bytes;
+        slot->sampleUS = nowUS;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferProgressTtyRow
+**
+** DESCRIPTION: The final row of an ended session, on a line of its own.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Shows the average rate rather than the smoothed one.
+**
+*/
+static void _xferProgressTtyRow(xferProgressSlotStruct *slot)
+{
+    char                            bar[XFER_PROGRESS_BAR_WIDTH + 1];
+    uint32_t                        bytes = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+    uint32_t                        percent = (slot->totalBytes > 0) ? (uint32_t)(((uint64_t)bytes * 100U) / slot->totalBytes) : 0;
+    uint32_t                        filled = (percent > 100U ? 100U : percent) * XFER_PROGRESS_BAR_WIDTH / 100U;
+    double                          rate = slot->rateBps;
+
+    memset(bar, ' ', XFER_PROGRESS_BAR_WIDTH);
+    memset(bar, '#', filled);
+    bar[XFER_PROGRESS_BAR_WIDTH] = '\0';
+
+    if (slot->endUS > slot->startUS)
+    {
+        rate = (double)(bytes - slot->startBytes) * 1000000.0 / (double)(slot->endUS - slot->startUS);
+    }
+
+    fprintf(renderOutput,
+            " >> %-20.20s [%s] %3u%% %8.1f KB/s  chunks %u  retries %u  timeouts %u  %s\n",
+            slot->name,
+            bar,
+            percent,
+            rate / 1024.0,
+            __atomic_load_n(&slot->chunks, __ATOMIC_RELAXED),
+            __atomic_load_n(&slot->retries, __ATOMIC_RELAXED),
+            __atomic_load_n(&slot->timeouts, __ATOMIC_RELAXED),
+            slot->ok ? "done" : "FAILED");
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferProgressTtyStatus
+**
+** DESCRIPTION: Redraws the status line: percent and rate of every
+**              running session, as many as fit.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Without ANSI support the rest of the last line drawn is
+**           blanked with spaces instead of "ESC[K".
+**
+*/
+static void _xferProgressTtyStatus(void)
+{
+    char                            line[XFER_PROGRESS_LINE_WIDTH + 1];
+    uint32_t                        length = 0;
+    uint32_t                        shown = 0;
+    uint32_t                        running = 0;
+    uint32_t                        index;
+
+    line[0] = '\0';
+
+    for (index = 0; index < XFER_PROGRESS_MAX_SESSIONS; index++)
+    {
+        if (slots[index].state == XFER_PROGRESS_SLOT_RUNNING)
+        {
+            xferProgressSlotStruct *    slot = &slots[index];
+            uint32_t                    bytes = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+            uint32_t                    percent = (slot->totalBytes > 0) ? (uint32_t)(((uint64_t)bytes * 100U) / slot->totalBytes) : 0;
+            char                        item[XFER_PROGRESS_LINE_WIDTH + 1];
+            int                         itemLength;
+
+            running++;
+            itemLength = snprintf(item,
+                                  sizeof(item),
+                                  "%s %.12s %u%% %.0fKB/s",
+                                  (shown > 0) ? " |" : " >>",
+                                  slot->name,
+                                  percent,
+                                  slot->rateBps / 1024.0);
+
+            // Leave room for the "+N" of the ones that don't fit
+            if ( (itemLength > 0) && ((length + (uint32_t)itemLength + 5U) <= XFER_PROGRESS_LINE_WIDTH) )
+            {
+                memcpy(&line[length], item, (size_t)itemLength + 1U);
+                length += (uint32_t)itemLength;
+                shown++;
+            }
+        }
+    }
+
+    if (running > shown)
+    {
+        length += (uint32_t)snprintf(&line[length], sizeof(line) - length, " +%u", running - shown);
+    }
+
+    if ( (length > 0) || (drawnWidth > 0) )
+    {
+        fprintf(renderOutput, "\r%s", line);
+        if (ttyAnsi)
+        {
+            fprintf(renderOutput, "\x1b[K");
+        }
+        else
+        {
+            for (index = length; index < drawnWidth; index++)
+            {
+                fputc(' ', renderOutput);
+            }
+        }
+        drawnWidth = length;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferProgressTtyClear
+**
+** DESCRIPTION: Blanks the status line and puts the cursor back at its
+**              start.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _xferProgressTtyClear(void)
+{
+    uint32_t                        index;
+
+    if (drawnWidth > 0)
+    {
+        if (ttyAnsi)
+        {
+            fprintf(renderOutput, "\r\x1b[K");
+        }
+        else
+        {
+            fputc('\r', renderOutput);
+            for (index = 0; index < drawnWidth; index++)
+            {
+                fputc(' ', renderOutput);
+            }
+            fputc('\r', renderOutput);
+        }
+        drawnWidth = 0;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _xferProgressTtyInit
+**
+** DESCRIPTION: Can the terminal take ANSI escapes?
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A Windows console only takes them once virtual terminal
+**           processing is switched on, which older ones refuse.
+**
+*/
+static bool _xferProgressTtyInit(void)
+{
+    bool                            ret = true;
+
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE                          console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD                           consoleMode = 0;
+
+    ret = false;
+    if (
+           (console != INVALID_HANDLE_VALUE) &&
+           (GetConsoleMode(console, &consoleMode))
+       )
+    {
+        ret = (SetConsoleMode(console, consoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING) != 0);
+    }
+#endif
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferProgressJsonEvent
+**
+** DESCRIPTION: One NDJSON line.
+**
+** PARAMETERS: event: "start", "progress" or "end".
+**
+** RETURNS:
+**
+** COMMENTS: Names are destinations (addresses and device names), but
+**           quotes, backslashes and control characters are escaped
+**           anyway.
+**
+*/
+static void _xferProgressJsonEvent(int session, const char *event, xferProgressSlotStruct *slot, uint64_t nowUS)
+{
+    const char *                    c;
+    uint32_t                        bytes = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+
+    fprintf(renderOutput, "{\"event\":\"%s\",\"session\":%d,\"name\":\"", event, session);
+    for (c = slot->name; *c; c++)
+    {
+        if ( (*c == '"') || (*c == '\\') )
+        {
+            fprintf(renderOutput, "\\%c", *c);
+        }
+        else
+        if ((unsigned char)*c < 0x20)
+        {
+            fprintf(renderOutput, "\\u%04x", (unsigned char)*c);
+        }
+        else
+        {
+            fputc(*c, renderOutput);
+        }
+    }
+    fprintf(renderOutput,
+            "\",\"bytes\":%u,\"total\":%u,\"chunks\":%u,\"retries\":%u,\"timeouts\":%u,\"rate_bps\":%.0f,\"elapsed_ms\":%llu",
+            bytes,
+            slot->totalBytes,
+            __atomic_load_n(&slot->chunks, __ATOMIC_RELAXED),
+            __atomic_load_n(&slot->retries, __ATOMIC_RELAXED),
+            __atomic_load_n(&slot->timeouts, __ATOMIC_RELAXED),
+            slot->rateBps,
+            (unsigned long long)((nowUS - slot->startUS) / 1000U));
+    if (slot->state == XFER_PROGRESS_SLOT_ENDED)
+    {
+        fprintf(renderOutput, ",\"ok\":%s", slot->ok ? "true" : "false");
+    }
+    fprintf(renderOutput, "}\n");
+
+    return;
+}
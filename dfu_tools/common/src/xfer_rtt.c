@@ -0,0 +1,419 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_rtt.c
+**
+** DESCRIPTION: Per-device round-trip time estimator, used to size
+**              transaction and ack timeouts.
+**
+**   RTO = SRTT + 4 * RTTVAR, clamped to [XFER_RTT_MIN_TIMEOUT_MS,
+**   XFER_RTT_MAX_TIMEOUT_MS].  Each timeout doubles it until the next
+**   good sample.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "xfer_rtt.h"
+
+#define XFER_RTT_MAX_BACKOFF_SHIFT              (6U)
+
+/*
+** One device's estimator.
+**
+*/
+typedef struct
+{
+    char                            destStr[24];
+    bool                            inUse;
+    xferRttStruct                   rtt;
+}xferRttEntryStruct;
+
+static xferRttEntryStruct           rttEntries[XFER_RTT_MAX_DEVICES];
+static uint32_t                     nextRttEntry = 0;
+static pthread_mutex_t              rttLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static xferRttEntryStruct *_xferRttFindLocked(const char *destStr);
+static void _xferRttInit(xferRttStruct *rtt);
+
+
+/*!
+** FUNCTION: xferRttGet
+**
+** DESCRIPTION: Copies out a device's estimator, starting a new one (at
+**              XFER_RTT_INITIAL_TIMEOUT_MS) the first time the device
+**              is seen.
+**
+** PARAMETERS: rtt: [OUT] The caller's copy, to sample into and hand
+**                  back with xferRttPut().
+**
+** RETURNS: false only if destStr or rtt is NULL.
+**
+** COMMENTS: Once the table is full the oldest device is forgotten;
+**           a copy already handed out isn't affected.
+**
+*/
+bool xferRttGet(const char *destStr, xferRttStruct *rtt)
+{
+    bool                            ret = false;
+
+    if ( (destStr) && (rtt) )
+    {
+        pthread_mutex_lock(&rttLock);
+        *rtt = _xferRttFindLocked(destStr)->rtt;
+        pthread_mutex_unlock(&rttLock);
+
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferRttPut
+**
+** DESCRIPTION: Stores a copy taken with xferRttGet() back as the
+**              device's estimator.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A device forgotten in the meantime is added again.
+**
+*/
+void xferRttPut(const char *destStr, const xferRttStruct *rtt)
+{
+    if ( (destStr) && (rtt) )
+    {
+        pthread_mutex_lock(&rttLock);
+        _xferRttFindLocked(destStr)->rtt = *rtt;
+        pthread_mutex_unlock(&rttLock);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: xferRttEndForDevice
+**
+** DESCRIPTION: xferRttEnd() on a device's stored estimator, for a
+**              single transaction outside a transfer.
+**
+** PARAMETERS:
+**
+** RETURNS: true if the transaction timed out.
+**
+** COMMENTS:
+**
+*/
+bool xferRttEndForDevice(const char *destStr, uint64_t startUS, uint32_t timeoutMS)
+{
+    bool                            ret = false;
+
+    if (destStr)
+    {
+        pthread_mutex_lock(&rttLock);
+        ret = xferRttEnd(&_xferRttFindLocked(destStr)->rtt, startUS, timeoutMS);
+        pthread_mutex_unlock(&rttLock);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferRttTimeoutMS
+**
+** DESCRIPTION: The timeout to use for the next transaction: the RTO,
+**              doubled for each back-off since the last good sample.
+**
+** PARAMETERS: rtt: NULL gives XFER_RTT_INITIAL_TIMEOUT_MS.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint32_t xferRttTimeoutMS(const xferRttStruct *rtt)
+{
+    uint32_t                        ret = XFER_RTT_INITIAL_TIMEOUT_MS;
+
+    if (rtt)
+    {
+        ret = rtt->rtoMS << rtt->backoffShift;
+        if (ret > XFER_RTT_MAX_TIMEOUT_MS)
+        {
+            ret = XFER_RTT_MAX_TIMEOUT_MS;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferRttDataTimeoutMS
+**
+** DESCRIPTION: The timeout for a data chunk: xferRttTimeoutMS(), but
+**              never below XFER_RTT_DATA_MIN_TIMEOUT_MS.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint32_t xferRttDataTimeoutMS(const xferRttStruct *rtt)
+{
+    uint32_t                        ret = xferRttTimeoutMS(rtt);
+
+    if (ret < XFER_RTT_DATA_MIN_TIMEOUT_MS)
+    {
+        ret = XFER_RTT_DATA_MIN_TIMEOUT_MS;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferRttEnd
+**
+** DESCRIPTION: Accounts for one finished transaction.  If it came back
+**              before its timeout, the elapsed time is a new sample;
+**              otherwise the timeout backs off.
+**
+** PARAMETERS: startUS:   TIMER_GetMicroseconds() just before the
+**                        transaction.
+**             timeoutMS: What the transaction was given.
+**
+** RETURNS: true if the transaction timed out.
+**
+** COMMENTS: A NAK still counts as an answer.
+**
+*/
+bool xferRttEnd(xferRttStruct *rtt, uint64_t startUS, uint32_t timeoutMS)
+{
+    bool                            ret = false;
+    uint64_t                        elapsedUS = TIMER_GetMicroseconds() - startUS;
+
+    if (elapsedUS >= ((uint64_t)timeoutMS * 1000U))
+    {
+        xferRttBackoff(rtt);
+        ret = true;
+    }
+    else
+    {
+        xferRttSample(rtt, (uint32_t)elapsedUS);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferRttSample
+**
+** DESCRIPTION: Folds one measured round trip into the estimate.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Gains are 1/8 for SRTT and 1/4 for RTTVAR.  The first
+**           sample sets SRTT = R and RTTVAR = R/2.  Clears any back-off.
+**
+*/
+void xferRttSample(xferRttStruct *rtt, uint32_t measuredUS)
+{
+    uint32_t                        rto;
+
+    if (rtt)
+    {
+        // Anything past the largest timeout is as good as that
+        if (measuredUS > (XFER_RTT_MAX_TIMEOUT_MS * 1000U))
+        {
+            measuredUS = XFER_RTT_MAX_TIMEOUT_MS * 1000U;
+        }
+
+        if (rtt->samples == 0)
+        {
+            rtt->srttUS8 = measuredUS << 3;
+            rtt->rttvarUS4 = measuredUS << 1;
+        }
+        else
+        {
+            int32_t                     delta = (int32_t)measuredUS - (int32_t)(rtt->srttUS8 >> 3);
+
+            rtt->srttUS8 = (uint32_t)((int32_t)rtt->srttUS8 + delta);
+            if (delta < 0)
+            {
+                delta = -delta;
+            }
+            rtt->rttvarUS4 = (uint32_t)((int32_t)rtt->rttvarUS4 + delta - (int32_t)(rtt->rttvarUS4 >> 2));
+        }
+
+        // RTO = SRTT + 4*RTTVAR, with at least 1 mS of variance, in whole mS
+        rto = (rtt->srttUS8 >> 3) + ((rtt->rttvarUS4 > 1000U) ? rtt->rttvarUS4 : 1000U);
+        rto = (rto + 999U) / 1000U;
+        if (rto < XFER_RTT_MIN_TIMEOUT_MS)
+        {
+            rto = XFER_RTT_MIN_TIMEOUT_MS;
+        }
+        if (rto > XFER_RTT_MAX_TIMEOUT_MS)
+        {
+            rto = XFER_RTT_MAX_TIMEOUT_MS;
+        }
+
+        rtt->rtoMS = rto;
+        rtt->backoffShift = 0;
+        rtt->samples++;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: xferRttBackoff
+**
+** DESCRIPTION: Something timed out: double the timeout until the next
+**              good sample.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferRttBackoff(xferRttStruct *rtt)
+{
+    if (rtt)
+    {
+        if (rtt->backoffShift < XFER_RTT_MAX_BACKOFF_SHIFT)
+        {
+            rtt->backoffShift++;
+        }
+        rtt->backoffs++;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: xferRttPrint
+**
+** DESCRIPTION: One-line summary of the estimator for a transfer report.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferRttPrint(const xferRttStruct *rtt)
+{
+    if (rtt)
+    {
+        printf("\r\n RTT (mS)      : srtt %u.%03u  rttvar %u.%03u  timeout %u  (samples: %u, back-offs: %u)",
+               (rtt->srttUS8 >> 3) / 1000U, (rtt->srttUS8 >> 3) % 1000U,
+               (rtt->rttvarUS4 >> 2) / 1000U, (rtt->rttvarUS4 >> 2) % 1000U,
+               xferRttTimeoutMS(rtt),
+               rtt->samples,
+               rtt->backoffs);
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _xferRttFindLocked
+**
+** DESCRIPTION: Finds a device's entry, starting a new one the first
+**              time the device is seen.
+**
+** PARAMETERS:
+**
+** RETURNS: Never NULL.
+**
+** COMMENTS: rttLock must be held.  Once the table is full the entries
+**           are reused round-robin.
+**
+*/
+static xferRttEntryStruct *_xferRttFindLocked(const char *destStr)
+{
+    xferRttEntryStruct *            ret = NULL;
+    xferRttEntryStruct *            freeEntry = NULL;
+    uint32_t                        index;
+
+    for (index = 0; index < XFER_RTT_MAX_DEVICES; index++)
+    {
+        if (
+               (rttEntries[index].inUse) &&
+               (strncmp(rttEntries[index].destStr, destStr, sizeof(rttEntries[index].destStr)) == 0)
+           )
+        {
+            ret = &rttEntries[index];
+            break;
+        }
+
+        if ( (freeEntry == NULL) && (!rttEntries[index].inUse) )
+        {
+            freeEntry = &rttEntries[index];
+        }
+    }
+
+    if (ret == NULL)
+    {
+        if (freeEntry == NULL)
+        {
+            freeEntry = &rttEntries[nextRttEntry];
+            nextRttEntry = (nextRttEntry + 1) % XFER_RTT_MAX_DEVICES;
+        }
+
+        snprintf(freeEntry->destStr, sizeof(freeEntry->destStr), "%s", destStr);
+        freeEntry->inUse = true;
+        _xferRttInit(&freeEntry->rtt);
+        ret = freeEntry;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferRttInit
+**
+** DESCRIPTION: No samples yet: use the configured initial timeout.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _xferRttInit(xferRttStruct *rtt)
+{
+    memset(rtt, 0, sizeof(xferRttStruct));
+    rtt->rtoMS = XFER_RTT_INITIAL_TIMEOUT_MS;
+
+    return;
+}
@@ -0,0 +1,489 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: xfer_window.c
+**
+** DESCRIPTION: Sliding-window engine for image data transfers.
+**
+**   Chunks are numbered (seq) in file order.  Up to "window" of them
+**   are outstanding at once.  The target answers with a cumulative seq
+**   plus a selective-ack bitmap for anything received past a gap, so
+**   only the missing chunks are ever sent again.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xfer_window.h"
+#include "logger.h"
+
+/*
+** Window sizes for specific device types.
+**
+*/
+typedef struct
+{
+    uint16_t                deviceType;
+    uint16_t                windowSize;
+}xferWindowByTypeStruct;
+
+#define XFER_DEVICE_TYPE_END                (0xFFFFU)
+
+static const xferWindowByTypeStruct windowByType[] =
+{
+    XFER_WINDOW_BY_DEVICE_TYPE
+    { XFER_DEVICE_TYPE_END, 0 }
+};
+
+#define XFER_SLOT(window, seq)      (&(window)->slots[(seq) % (window)->slotCount])
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static bool _xferSendSlot(const xferTransportOps *transport, xferWindowSlotStruct *slot);
+static void _xferApplyAck(xferWindowStruct *window, const xferAckStruct *ack);
+
+
+/*!
+** FUNCTION: xferWindowCreate
+**
+** DESCRIPTION: Allocates engine state for up to "windowSize" chunks in
+**              flight.
+**
+** PARAMETERS: windowSize: 0 is taken as 1; more than
+**                         XFER_MAX_WINDOW_SIZE as that.
+**
+** RETURNS: NULL if out of memory.
+**
+** COMMENTS:
+**
+*/
+xferWindowStruct *xferWindowCreate(uint16_t windowSize)
+{
+    xferWindowStruct *              ret;
+
+    if (windowSize == 0)
+    {
+        windowSize = 1;
+    }
+    if (windowSize > XFER_MAX_WINDOW_SIZE)
+    {
+        windowSize = XFER_MAX_WINDOW_SIZE;
+    }
+
+    ret = (xferWindowStruct *)calloc(1, sizeof(xferWindowStruct) + (windowSize * sizeof(xferWindowSlotStruct)));
+    if (ret)
+    {
+        ret->slotCount = windowSize;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferWindowDestroy
+**
+** DESCRIPTION: Frees engine state from xferWindowCreate().
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void xferWindowDestroy(xferWindowStruct *window)
+{
+    free(window);
+
+    return;
+}
+
+/*!
+** FUNCTION: xferWindowRun
+**
+** DESCRIPTION: Sends everything "readChunk" produces, keeping up to
+**              windowSize chunks in flight and retransmitting only the
+**              ones that were not acknowledged.
+**
+** PARAMETERS: window: From xferWindowCreate(), owned by the caller.
+**             stats:  OPTIONAL.
+**
+** RETURNS: true if every chunk was acknowledged.
+**
+** COMMENTS: A selectively-acked gap is resent once straight away;
+**           anything else is only resent when its ack timer expires.
+**
+*/
+bool xferWindowRun(xferWindowStruct *window,
+                   const xferWindowParamsStruct *params,
+                   xferWindowStatsStruct *stats)
+{
+    bool                            ret = false;
+    xferWindowStatsStruct           localStats;
+
+    memset(&localStats, 0, sizeof(localStats));
+
+    if (
+           (window) &&
+           (params) &&
+           (params->transport) &&
+           (params->transport->sendChunk) &&
+           (params->transport->pollAck) &&
+           ((params->readChunk) || (params->image)) &&
+           (params->chunkLen > 0) &&
+           (params->chunkLen <= XFER_MAX_CHUNK_LEN)
+       )
+    {
+        const xferTransportOps *    transport = params->transport;
+        uint32_t                    windowSize = params->windowSize;
+        bool                        failed = false;
+        uint32_t                    seq;
+
+        // Effective window: the smallest of what everyone allows.
+        if (windowSize == 0)
+        {
+            windowSize = 1;
+        }
+        if ( (transport->maxWindow > 0) && (windowSize > transport->maxWindow) )
+        {
+            windowSize = transport->maxWindow;
+        }
+        if (windowSize > window->slotCount)
+        {
+            windowSize = window->slotCount;
+        }
+
+        memset(window->slots, 0, window->slotCount * sizeof(xferWindowSlotStruct));
+        window->baseSeq = 0;
+        window->nextSeq = 0;
+        window->endOfData = false;
+        window->nextOffset = params->startOffset;
+
+        while (!failed)
+        {
+            xferAckStruct               ack;
+            uint32_t                    sentThisPass = 0;
+            uint32_t                    ackTimeoutMS = (params->rtt) ? xferRttDataTimeoutMS(params->rtt) : params->ackTimeoutMS;
+
+            /*
+            ** Fill the window with new chunks.
+            **
+            */
+            while (
+                      (!window->endOfData) &&
+                      ((window->nextSeq - window->baseSeq) < windowSize)
+                  )
+            {
+                xferWindowSlotStruct *  slot = XFER_SLOT(window, window->nextSeq);
+                uint32_t                len;
+
+                if (params->image)
+                {
+                    len = 0;
+                    if (window->nextOffset < params->imageSize)
+                    {
+                        len = params->imageSize - window->nextOffset;
+                        if (len > params->chunkLen)
+                        {
+                            len = params->chunkLen;
+                        }
+                    }
+                    slot->chunk = &params->image[window->nextOffset];
+                }
+                else
+                {
+                    len = params->readChunk(params->readCtx, slot->data, params->chunkLen);
+                    slot->chunk = slot->data;
+                }
+
+                if (len == 0)
+                {
+                    window->endOfData = true;
+                    break;
+                }
+
+                slot->seq = window->nextSeq;
+                slot->offset = window->nextOffset;
+                slot->len = (uint16_t)len;
+                slot->inUse = true;
+                slot->acked = false;
+                slot->retries = 0;
+
+                if (!_xferSendSlot(transport, slot))
+                {
+                    failed = true;
+                    break;
+                }
+
+                window->nextSeq++;
+                window->nextOffset += len;
+                localStats.chunksSent++;
+                sentThisPass++;
+            }
+
+            if ( (sentThisPass > 0) && (transport->flush) )
+            {
+                transport->flush(transport->ctx);
+            }
+
+            if (failed)
+            {
+                break;
+            }
+
+            // Nothing outstanding and nothing left to read: done.
+            if (window->baseSeq == window->nextSeq)
+            {
+                ret = window->endOfData;
+                break;
+            }
+
+            /*
+            ** Collect acknowledgements.
+            **
+            */
+            memset(&ack, 0, sizeof(ack));
+            if (transport->pollAck(transport->ctx, &ack, ackTimeoutMS))
+            {
+                if (ack.rejected)
+                {
+                    printf("\r\n Target rejected data chunk #%u!", ack.cumulativeSeq);
+                    LOG_ERROR("xfer: target rejected chunk #%u", ack.cumulativeSeq);
+                    failed = true;
+                    break;
+                }
+
+                _xferApplyAck(window, &ack);
+
+                while (
+                          (window->baseSeq < window->nextSeq) &&
+                          (XFER_SLOT(window, window->baseSeq)->acked)
+                      )
+                {
+                    xferWindowSlotStruct *  slot = XFER_SLOT(window, window->baseSeq);
+
+                    // Only never-resent chunks give a clean RTT sample.
+                    if ( (params->rtt) && (slot->retries == 0) && (window->baseSeq + 1 == ack.cumulativeSeq) )
+                    {
+                        xferRttSample(params->rtt, (uint32_t)(TIMER_GetMicroseconds() - slot->sentUS));
+                    }
+
+                    localStats.bytesAcked += slot->len;
+                    slot->inUse = false;
+                    window->baseSeq++;
+                }
+
+                //
+                // A selective ack means everything between the base and
+                // the highest acked chunk that is still missing was lost.
+                // Resend those once now rather than waiting out the timer.
+                //
+                if (ack.selectiveMask != 0)
+                {
+                    uint32_t            highest = ack.cumulativeSeq;
+                    uint32_t            bit;
+
+                    for (bit = 0; bit < 32; bit++)
+                    {
+                        if (ack.selectiveMask & (1UL << bit))
+                        {
+                            highest = ack.cumulativeSeq + 1 + bit;
+                        }
+                    }
+
+                    sentThisPass = 0;
+                    for (seq = window->baseSeq; (seq < highest) && (seq < window->nextSeq); seq++)
+                    {
+                        xferWindowSlotStruct *  slot = XFER_SLOT(window, seq);
+
+                        if ( (!slot->acked) && (slot->retries == 0) )
+                        {
+                            LOG_DEBUG("xfer: gap resend #%u (offset %u), sack 0x%08X", slot->seq, slot->offset, ack.selectiveMask);
+                            slot->retries++;
+                            localStats.retransmits++;
+                            sentThisPass++;
+                            if (!_xferSendSlot(transport, slot))
+                            {
+                                failed = true;
+                                break;
+                            }
+                        }
+                    }
+
+                    if ( (sentThisPass > 0) && (transport->flush) )
+                    {
+                        transport->flush(transport->ctx);
+                    }
+                }
+            }
+            else
+            {
+                localStats.timeouts++;
+                LOG_DEBUG("xfer: no ack in %u ms, window #%u..#%u", ackTimeoutMS, window->baseSeq, window->nextSeq);
+            }
+
+            /*
+            ** Resend whatever has waited too long.
+            **
+            */
+            sentThisPass = 0;
+            for (seq = window->baseSeq; (!failed) && (seq < window->nextSeq); seq++)
+            {
+                xferWindowSlotStruct *  slot = XFER_SLOT(window, seq);
+
+                if (
+                       (!slot->acked) &&
+                       (TIMER_Finished(&slot->sentTimer, ackTimeoutMS))
+                   )
+                {
+                    if (slot->retries >= params->maxRetransmits)
+                    {
+                        printf("\r\n Data chunk #%u (offset %u) was never acknowledged!", slot->seq, slot->offset);
+                        LOG_ERROR("xfer: chunk #%u (offset %u) never acknowledged", slot->seq, slot->offset);
+                        failed = true;
+                        break;
+                    }
+
+                    LOG_DEBUG("xfer: timeout resend #%u (offset %u), retry %u", slot->seq, slot->offset, slot->retries + 1U);
+                    slot->retries++;
+                    localStats.retransmits++;
+                    sentThisPass++;
+                    if (!_xferSendSlot(transport, slot))
+                    {
+                        failed = true;
+                    }
+                }
+            }
+
+            if (sentThisPass > 0)
+            {
+                xferRttBackoff(params->rtt);
+                if (transport->flush)
+                {
+                    transport->flush(transport->ctx);
+                }
+            }
+
+            if (params->progress)
+            {
+                params->progress(params->progressCtx, &localStats);
+            }
+        }
+    }
+
+    if (stats)
+    {
+        *stats = localStats;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: xferWindowSizeForDeviceType
+**
+** DESCRIPTION: Looks up the configured window size for a device type.
+**
+** PARAMETERS:
+**
+** RETURNS: The entry from XFER_WINDOW_BY_DEVICE_TYPE, or
+**          XFER_DEFAULT_WINDOW_SIZE if there isn't one.
+**
+** COMMENTS:
+**
+*/
+uint16_t xferWindowSizeForDeviceType(uint8_t deviceType)
+{
+    uint16_t                        ret = XFER_DEFAULT_WINDOW_SIZE;
+    uint32_t                        index;
+
+    for (index = 0; windowByType[index].deviceType != XFER_DEVICE_TYPE_END; index++)
+    {
+        if (windowByType[index].deviceType == deviceType)
+        {
+            ret = windowByType[index].windowSize;
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _xferSendSlot
+**
+** DESCRIPTION: (Re)sends one slot and restarts its ack timer.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _xferSendSlot(const xferTransportOps *transport, xferWindowSlotStruct *slot)
+{
+    bool                            ret;
+
+    TIMER_Start(&slot->sentTimer);
+    slot->sentUS = TIMER_GetMicroseconds();
+    ret = transport->sendChunk(transport->ctx, slot->seq, slot->offset, slot->chunk, slot->len);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _xferApplyAck
+**
+** DESCRIPTION: Marks every outstanding slot the ack covers.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Acks for chunks outside the window (late duplicates) are
+**           ignored.
+**
+*/
+static void _xferApplyAck(xferWindowStruct *window, const xferAckStruct *ack)
+{
+    uint32_t                        seq;
+
+    for (seq = window->baseSeq; seq < window->nextSeq; seq++)
+    {
+        xferWindowSlotStruct *      slot = XFER_SLOT(window, seq);
+
+        if (seq < ack->cumulativeSeq)
+        {
+            slot->acked = true;
+        }
+        else
+        if (
+               (seq > ack->cumulativeSeq) &&
+               ((seq - ack->cumulativeSeq - 1) < 32) &&
+               (ack->selectiveMask & (1UL << (seq - ack->cumulativeSeq - 1)))
+           )
+        {
+            slot->acked = true;
+        }
+    }
+
+    return;
+}
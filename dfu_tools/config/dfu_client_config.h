@@ -15,11 +15,27 @@
 //#############################################################################
 #pragma once
 
+/*
+** Vehicle install: how many boards on ONE interface may be updated at
+** the same time.  Each concurrent session needs its own client (and so
+** its own interface instance and protocol instance).
+**
+*/
+#define VEHICLE_MAX_CONCURRENT_PER_INTERFACE                         (4U)
+
+/*
+** Vehicle install: max board manifests in a vehicle manifest, and max
+** boards (devices) one vehicle install will update.
+**
+*/
+#define VEHICLE_MAX_BOARD_MANIFESTS                                  (32U)
+#define VEHICLE_MAX_BOARDS                                           (32U)
+
 /*
 ** Set this to the max active Ethernet interfaces
 **
 */
-#define MAX_ETHERNET_INTERFACES                                      (2U)
+#define MAX_ETHERNET_INTERFACES                                      (2U + VEHICLE_MAX_CONCURRENT_PER_INTERFACE)
 
 /*
 ** How big of an Ethernet frame can we send?
@@ -27,11 +43,35 @@
 */
 #define MAX_ETHERNET_MSG_LEN                                         (384+3U)
 
+/*
+** Largest link MTU we will use on a jumbo-capable interface.  The
+** interface's real MTU (read from the OS) may lower this further.
+**
+*/
+#define ENET_MAX_LINK_MTU                                            (9000U)
+
+/*
+** EtherType used by the "EtherType" framing mode, where a 2-byte length
+** field sits in front of the DFU message.  0x88B5 is the IEEE 802 local
+** experimental EtherType.
+**
+*/
+#define ENET_DFU_ETHERTYPE                                           (0x88B5U)
+
+/*
+** Framing for messages that fit in a legacy 802.3 frame:
+**   0 = 802.3 length field (what legacy targets expect)
+**   1 = DFU EtherType + in-payload length
+** Messages over 1500 bytes always use the EtherType framing.
+**
+*/
+#define ENET_DEFAULT_FRAME_MODE                                      (0U)
+
 /*
 ** Set this to the max CAN interfaces
 **
 */
-#define MAX_CAN_INTERFACES                                           (3U)
+#define MAX_CAN_INTERFACES                                           (3U + VEHICLE_MAX_CONCURRENT_PER_INTERFACE)
 
 /*
 ** What is the maximum size of an interface name?
@@ -39,6 +79,337 @@
 */
 #define MAX_IFACE_NAME_LEN                                           (32U)
 
+/*
+** LINUX ONLY: Set to "1" to receive Ethernet frames through a memory-mapped
+** PACKET_MMAP (TPACKET_V2) ring instead of one recvfrom() per frame.
+** Frames are handed to the protocol straight out of the ring.
+**
+*/
+#define ENET_USE_RX_RING                                             (1U)
+
+/*
+** RX ring geometry.  Block size must be a multiple of the page size and
+** hold at least one frame slot; slots are sized from the link MTU.
+** Per-frame slots rather than TPACKET_V3 blocks: a V3 block only
+** reaches us when it fills or its retire timer (whole mS, and at
+** least a jiffy) runs out, which on this one-request-one-reply
+** protocol added ~2 mS to every round trip.
+**
+*/
+#define ENET_RX_RING_BLOCK_SIZE                                      (1U << 16)
+#define ENET_RX_RING_BLOCK_COUNT                                     (16U)
+
+/*
+** How long (mS) a receive call may sleep waiting for the kernel to
+** fill a frame slot before returning "nothing received".
+**
+*/
+#define ENET_RX_RING_POLL_TIMEOUT_MS                                 (1)
+
+/*
+** Max frames in one TX burst, and how many destinations keep a
+** pre-built frame header / sockaddr_ll.
+**
+*/
+#define ENET_TX_BATCH_MAX_FRAMES                                     (32U)
+#define ENET_TX_MAX_DESTINATIONS                                     (8U)
+
+/*
+** Set to "1" to attach a kernel packet filter that passes only
+** DFU-shaped frames (802.3 length field or the DFU EtherType, our MAC
+** or broadcast as the destination).  Everything else on the segment is dropped before it
+** is copied to us.
+**
+*/
+#define ENET_USE_RX_FILTER                                           (1U)
+
+/*
+** Set to "1" to also filter on the source MAC, using the active
+** destination as the only accepted source.  Vehicle install workers
+** each share the segment with other boards' sessions and rely on this
+** to hear only their own board.  Only frames sent to us are checked:
+** broadcasts (other boards' discovery) pass from any source, so the
+** device registry and "-d" keep seeing them.  A broadcast destination
+** (discovery) lifts the filter again.
+**
+*/
+#define ENET_RX_FILTER_BY_DEST                                       (1U)
+
+/*
+** Max source MACs one RX filter can accept.
+**
+*/
+#define ENET_RX_FILTER_MAX_SOURCES                                   (16U)
+
+/*
+** Image transfer window: how many RCV_DATA chunks may be in flight at
+** once.  The default applies to any device type not listed in
+** XFER_WINDOW_BY_DEVICE_TYPE.  Transports that can only carry one
+** chunk at a time cap the window at 1 regardless.
+**
+** The built-in transport is one of those: RCV_DATA carries no offset,
+** so it always runs at 1.  These sizes only take effect with a
+** transport passed to xferImageWithTransport() that numbers its
+** chunks.
+**
+*/
+#define XFER_DEFAULT_WINDOW_SIZE                                     (8U)
+#define XFER_MAX_WINDOW_SIZE                                         (32U)
+
+/*
+** Per device type window sizes, as "{ deviceType, windowSize }," pairs.
+** Example: { 3, 16 }, { 5, 1 },
+**
+** Empty until a device type has a windowed transport (see above).
+**
+*/
+#define XFER_WINDOW_BY_DEVICE_TYPE
+
+/*
+** How long (mS) a data chunk waits for its ack before it is resent, and
+** how many times it is resent before the transfer is abandoned.  Once a
+** device's round trip has been measured (XFER_RTT_* below), unicast
+** transfers use that instead, floored at XFER_RTT_DATA_MIN_TIMEOUT_MS;
+** multicast ack collection always uses this.
+**
+*/
+#define XFER_ACK_TIMEOUT_MS                                          (250U)
+#define XFER_MAX_RETRANSMITS                                         (5U)
+
+/*
+** Multicast transfers: chunks streamed to the group between ack
+** collections (unless the group transport says otherwise).
+**
+*/
+#define XFER_MULTICAST_BURST                                         (16U)
+
+/*
+** Resumable transfers: images at least this big get a checkpoint of
+** how far the device got, so a failed transfer can continue from there
+** after the session is re-opened.  XFER_MAX_CHECKPOINTS devices/images
+** are remembered at once; XFER_RESUME_MAX_ATTEMPTS is how many times
+** an image is retried.
+**
+*/
+#define XFER_RESUME_MIN_IMAGE_SIZE                                   (64U * 1024U)
+#define XFER_MAX_CHECKPOINTS                                         (16U)
+#define XFER_RESUME_MAX_ATTEMPTS                                     (3U)
+
+/*
+** IMAGE_STATUS flag a target sets when it keeps a partly received image
+** across sessions and reports how many bytes of it it holds.  A transfer
+** only resumes on a target that reports it; anything else starts the
+** image over.  An RCV_DATA that timed out is likewise only sent again
+** after IMAGE_STATUS shows it didn't land, so it needs this too.  0 (no
+** target known to do this) never resumes or resends.  dfu_sim reports
+** DFU_SIM_STATUS_PARTIAL_KEPT.
+**
+*/
+#define XFER_STATUS_PARTIAL_KEPT                                     (0U)
+
+/*
+** Adaptive timeouts.  Each device's round-trip time is measured (in
+** uS) on every short transaction and the timeout set to SRTT +
+** 4*RTTVAR, kept within [MIN, MAX] and doubled on each timeout.
+** INITIAL is used until the first measurement.  Data chunks never get
+** less than DATA_MIN: a chunk can start a flash erase on the target
+** (an MCU flash sector takes 1-2 S), and no RTT sample predicts that.
+** Transactions where the target does real work (BEGIN_RCV, install)
+** keep their fixed timeouts.
+**
+*/
+#define XFER_RTT_INITIAL_TIMEOUT_MS                                  (1000U)
+#define XFER_RTT_MIN_TIMEOUT_MS                                      (20U)
+#define XFER_RTT_DATA_MIN_TIMEOUT_MS                                 (2000U)
+#define XFER_RTT_MAX_TIMEOUT_MS                                      (5000U)
+#define XFER_RTT_MAX_DEVICES                                         (16U)
+
+/*
+** Image files open at once (memory-mapped on Linux, read into memory on
+** Windows).  Sessions sending the same file share one mapping.  Sized
+** so every concurrent board session can hold two (the image it is
+** sending and the next one), plus one for the foreground command.
+**
+*/
+#define IMAGE_SOURCE_MAX_OPEN                                        ((2U * VEHICLE_MAX_CONCURRENT_PER_INTERFACE) + 1U)
+
+/*
+** Set to "1" to read the next core image of a manifest into memory on a
+** background thread while the current one is sent and installed.
+**
+*/
+#define FWUPD_STAGE_NEXT_IMAGE                                       (1U)
+
+/*
+** Device registry.  Devices are indexed by MAC (HASH_BUCKETS, a power of
+** 2) and by TYPE/VARIANT (TYPE_BUCKETS, a power of 2).  One not heard
+** for TTL_SECS is dropped.  MAX_DEVICES must stay below 65535.
+**
+*/
+#define DEVICE_REGISTRY_MAX_DEVICES                                  (512U)
+#define DEVICE_REGISTRY_HASH_BUCKETS                                 (1024U)
+#define DEVICE_REGISTRY_TYPE_BUCKETS                                 (64U)
+#define DEVICE_REGISTRY_TTL_SECS                                     (30U)
+#define DEVICE_REGISTRY_MAX_LISTENERS                                (4U)
+
+/*
+** Event loop.  MAX_SOURCES covers descriptors, timers and the keyboard
+** together.  Idle hooks run at least every IDLE_PERIOD_MS.  Where there
+** is no epoll the loop sleeps FALLBACK_SLEEP_MS between checks.
+**
+*/
+#define EVENT_LOOP_MAX_SOURCES                                       (16U)
+#define EVENT_LOOP_MAX_IDLE                                          (4U)
+#define EVENT_LOOP_IDLE_PERIOD_MS                                    (50U)
+#define EVENT_LOOP_FALLBACK_SLEEP_MS                                 (5U)
+
+/*
+** Timer wheel.  LEVELS wheels of 2^SLOT_BITS slots, each TICK_US wide at
+** the bottom level, so the wheel spans TICK_US * 2^(SLOT_BITS * LEVELS)
+** (about 28 minutes with the values below).  Timers further out are
+** parked in the top level and re-filed as it turns.
+**
+*/
+#define TIMER_WHEEL_TICK_US                                          (100U)
+#define TIMER_WHEEL_SLOT_BITS                                        (6U)
+#define TIMER_WHEEL_LEVELS                                           (4U)
+
+/*
+** Logger.  Each level has a ring of RING_ENTRIES (a power of 2) entries
+** of up to MAX_ARG_BYTES of arguments (MAX_ARGS of them).  Up to
+** MAX_FORMATS distinct call sites.  The drain thread sleeps
+** DRAIN_PERIOD_MS when the rings are empty.
+**
+*/
+#define LOGGER_RING_ENTRIES                                          (1024U)
+#define LOGGER_MAX_ARG_BYTES                                         (112U)
+#define LOGGER_MAX_ARGS                                              (16U)
+#define LOGGER_MAX_FORMATS                                           (1024U)
+#define LOGGER_DRAIN_PERIOD_MS                                       (10U)
+#define LOGGER_DEFAULT_LEVEL                                         (LOG_LEVEL_DEBUG)
+
+/*
+** Transfer progress.  Up to MAX_SESSIONS transfers at once, each named
+** by up to NAME_LEN - 1 characters.  The renderer samples RATE_HZ times
+** a second.
+**
+*/
+#define XFER_PROGRESS_MAX_SESSIONS                                   (32U)
+#define XFER_PROGRESS_NAME_LEN                                       (32U)
+#define XFER_PROGRESS_RATE_HZ                                        (4U)
+
+/*
+** Simulated DFU target.  Up to MAX_DEVICES at once, each holding up to
+** MAX_IMAGES images.  The DEFAULT_xxx values are what
+** dfuSimDefaultConfig() gives: a 4MB part with 4KB sectors, quick
+** enough that a benchmark measures the host rather than the "flash".
+**
+*/
+#define DFU_SIM_MAX_DEVICES                                          (8U)
+#define DFU_SIM_MAX_IMAGES                                           (8U)
+#define DFU_SIM_DEFAULT_FLASH_SIZE                                   (4U * 1024U * 1024U)
+#define DFU_SIM_DEFAULT_SECTOR_SIZE                                  (4096U)
+#define DFU_SIM_DEFAULT_ERASE_US                                     (1000U)
+#define DFU_SIM_DEFAULT_WRITE_US_PER_KB                              (50U)
+#define DFU_SIM_DEFAULT_INSTALL_US                                   (50000U)
+#define DFU_SIM_DEFAULT_LATENCY_US                                   (100U)
+#define DFU_SIM_DEFAULT_RX_WINDOW                                    (32U)
+#define DFU_SIM_DEFAULT_ACK_EVERY                                    (4U)
+
+/*
+** Set to "1" to build the impairment shim into the Ethernet interface
+** (dfuClientEthernetSetImpairment() and the tool's "--impair" flag).
+** Test builds only: a release tool must not be able to drop frames on a
+** real install.  dfu_bench has its own shim and doesn't need this.
+**
+*/
+#define ENET_USE_IMPAIRMENT                                          (0U)
+
+/*
+** Network impairment shim (net_impair).  Enough instances for a pair
+** on every Ethernet interface and every simulated device; each holds
+** up to QUEUE_LEN messages in flight.  A reordered message is held back
+** DEFAULT_REORDER_US unless the profile says otherwise.
+**
+*/
+#define NET_IMPAIR_MAX_INSTANCES                                     ((2U * MAX_ETHERNET_INTERFACES) + (2U * DFU_SIM_MAX_DEVICES))
+#define NET_IMPAIR_QUEUE_LEN                                         (256U)
+#define NET_IMPAIR_DEFAULT_REORDER_US                                (2000U)
+#define NET_IMPAIR_DEFAULT_SEED                                      (1U)
+
+/*
+** LINUX ONLY: SocketCAN interface.  DFU messages are carried ISO-TP
+** style (ISO 15765-2 framing, segmented in user space).  Set USE_FD to
+** "1" to send CAN-FD frames (up to 64 bytes, with bit rate switching
+** if FD_USE_BRS is "1") when the interface supports them; otherwise
+** classic 8-byte frames are used.
+**
+*/
+#define CAN_USE_FD                                                   (1U)
+#define CAN_FD_USE_BRS                                               (1U)
+
+/*
+** How big a DFU message the protocol engine hands the CAN interface
+** before the MTU is negotiated.  ISO-TP segments it, so this isn't
+** tied to the frame size.
+**
+*/
+#define MAX_CAN_MSG_LEN                                              (384+3U)
+
+/*
+** CAN addressing.  A target is known by the ID it listens on; it
+** answers on that ID plus RESPONSE_ID_OFFSET (0x7E0 -> 0x7E8, as UDS
+** does).  Messages to every target go to FUNCTIONAL_ID.  Until a
+** destination is picked, the kernel filter passes RX_ACCEPT_ID under
+** RX_ACCEPT_MASK (every response ID of the 0x7E0 block).  IDs above
+** 0x7FF are sent as 29-bit extended IDs.
+**
+*/
+#define CAN_RESPONSE_ID_OFFSET                                       (0x08U)
+#define CAN_FUNCTIONAL_ID                                            (0x7DFU)
+#define CAN_RX_ACCEPT_ID                                             (0x7E8U)
+#define CAN_RX_ACCEPT_MASK                                           (0x7F8U)
+
+/*
+** Set to "1" to attach a kernel CAN_RAW_FILTER, so frames that aren't
+** DFU traffic never reach us.  With FILTER_BY_DEST also "1", picking a
+** destination narrows the filter to that target's response ID, as on
+** Ethernet; the functional ID (discovery) lifts it again.  Up to
+** RX_FILTER_MAX_SOURCES IDs can be listed explicitly.
+**
+*/
+#define CAN_USE_RX_FILTER                                            (1U)
+#define CAN_RX_FILTER_BY_DEST                                        (1U)
+#define CAN_RX_FILTER_MAX_SOURCES                                    (16U)
+
+/*
+** Max frames in one sendmmsg()/recvmmsg() burst.  How long (mS) a
+** receive may sleep waiting for a frame, and how long a send keeps
+** retrying while the interface's TX queue is full.
+**
+*/
+#define CAN_BATCH_MAX_FRAMES                                         (64U)
+#define CAN_RX_POLL_TIMEOUT_MS                                       (1U)
+#define CAN_TX_TIMEOUT_MS                                            (100U)
+
+/*
+** ISO-TP parameters.  BLOCK_SIZE and STMIN are what we ask of a sender
+** in our flow control frames (0 = no limit / no gap).  FC_TIMEOUT_MS
+** is how long a send waits for the target's flow control (N_Bs);
+** CF_TIMEOUT_MS is how long a half-received message may sit without a
+** new frame before it is dropped (N_Cr).  MAX_WAIT_FRAMES caps the
+** "wait" flow control frames a target may send before we give up.
+** Up to RX_CONTEXTS targets can be mid-message at once.
+**
+*/
+#define CAN_ISOTP_PAD_BYTE                                           (0xCCU)
+#define CAN_ISOTP_BLOCK_SIZE                                         (0U)
+#define CAN_ISOTP_STMIN                                              (0U)
+#define CAN_ISOTP_FC_TIMEOUT_MS                                      (1000U)
+#define CAN_ISOTP_CF_TIMEOUT_MS                                      (1000U)
+#define CAN_ISOTP_MAX_WAIT_FRAMES                                    (10U)
+#define CAN_ISOTP_RX_CONTEXTS                                        (4U)
+
 
 
 #if defined(__cplusplus)
@@ -15,11 +15,16 @@
 //#############################################################################
 #pragma once
 
+#include "dfu_client_config.h"
+
 /*
 ** HOW MANY SIMULTANEOUS INSTANCES OF THE PROTOCL WILL THERE BE?
 **
+** One per client.  A vehicle install opens one extra client per
+** concurrent board session (VEHICLE_MAX_CONCURRENT_PER_INTERFACE).
+**
 */
-#define MAX_PROTOCOL_INSTANCES                  (2)
+#define MAX_PROTOCOL_INSTANCES                  (2 + VEHICLE_MAX_CONCURRENT_PER_INTERFACE)
 
 /*
 ** The default MTU (in bytes)
@@ -44,10 +49,11 @@
 /*
 ** Default maximum message size This is determined by
 ** the constraints of the physical interface such as
-** CAN, Ethernet, etc.
+** CAN, Ethernet, etc.  Sized for a 9000 byte jumbo
+** Ethernet frame, less the 2-byte length field.
 **
 */
-#define MAX_MSG_LEN                             (1500)
+#define MAX_MSG_LEN                             (9000-2)
 
 /*
 ** DEFINES HOW MANY PERIODIC COMMANDS CAN BE RUNNING
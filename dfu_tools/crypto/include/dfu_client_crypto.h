@@ -35,6 +35,9 @@
 #define DEFAULT_ENCRYPTED_CHALLENGE_FILENAME            ("./encrypted_chal.bin")
 #define DEFAULT_SIGNED_CHALLENGE_FILENAME               ("./signed_chal.bin")
 
+// Big enough for an RSA-4096 signature or ciphertext
+#define MAX_CHALLENGE_RESPONSE_LEN                      (512)
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -111,6 +114,48 @@ uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
                                      bool saveToFile,
                                      const char* outputFile);
 
+///
+/// @fn: signChallengeToBuffer
+///
+/// @details Signs the challenge straight into the caller's buffer.
+///
+/// @param[in] privateKeyFile: Path to the PEM-encoded private key file
+/// @param[in] challenge: The 32-bit challenge value to sign
+/// @param[out] output: Receives the signature
+/// @param[in] outputLen: Size of "output"
+///
+/// @returns Length of the signature, or 0 on any failure (including a
+///          signature that doesn't fit).
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint32_t signChallengeToBuffer(const char* privateKeyFile,
+                               uint32_t* challenge,
+                               uint8_t* output,
+                               uint32_t outputLen);
+
+///
+/// @fn: encryptWithPublicKeyToBuffer
+///
+/// @details Encrypts a value straight into the caller's buffer.
+///
+/// @param[in] pubkeyFilename: Path to the PEM-encoded public key file
+/// @param[in] valueToEncrypt
+/// @param[in] encryptLength
+/// @param[out] output: Receives the encrypted value
+/// @param[in] outputLen: Size of "output"
+///
+/// @returns Length of the encrypted value, or 0 on any failure
+///          (including a result that doesn't fit).
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint32_t encryptWithPublicKeyToBuffer(const char* pubkeyFilename,
+                                      void* valueToEncrypt,
+                                      uint32_t encryptLength,
+                                      uint8_t* output,
+                                      uint32_t outputLen);
+
 
 #define SIGN_CHALLENGE(challenge, key_filename) signChallengeWithPrivateKey(key_filename, challenge, true, DEFAULT_SIGNED_CHALLENGE_FILENAME);
 #define DELETE_SIGNED_CHALLENGE()               (remove((const char*)DEFAULT_SIGNED_CHALLENGE_FILENAME))
@@ -118,13 +163,18 @@ uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
 #define ENCRYPT_CHALLENGE(challenge, pubkey_filename)  encryptWithPublicKey(pubkey_filename, challenge, 4, true, DEFAULT_ENCRYPTED_CHALLENGE_FILENAME)
 #define DELETE_ENCRYPTED_CHALLENGE()            (remove((const char *)DEFAULT_ENCRYPTED_CHALLENGE_FILENAME))
 
+#define SIGN_CHALLENGE_TO_BUFFER(challenge, key_filename, buf, len)         signChallengeToBuffer(key_filename, challenge, buf, len)
+#define ENCRYPT_CHALLENGE_TO_BUFFER(challenge, pubkey_filename, buf, len)   encryptWithPublicKeyToBuffer(pubkey_filename, challenge, 4, buf, len)
+
 
 #if (CHALLENGE_HANDLING==CHALLENGE_SIGNED)
     #define HANDLE_CHALLENGE(a, b)      SIGN_CHALLENGE(a, b)
+    #define HANDLE_CHALLENGE_TO_BUFFER(a, b, c, d)  SIGN_CHALLENGE_TO_BUFFER(a, b, c, d)
     #define DELETE_CHALLENGE            DELETE_SIGNED_CHALLENGE
     #define SIGNATURE_FILENAME          DEFAULT_SIGNED_CHALLENGE_FILENAME
 #elif (CHALLENGE_HANDLING==CHALLENGE_ENCRYPTED)
     #define HANDLE_CHALLENGE(a, b)      ENCRYPT_CHALLENGE(a, b)
+    #define HANDLE_CHALLENGE_TO_BUFFER(a, b, c, d)  ENCRYPT_CHALLENGE_TO_BUFFER(a, b, c, d)
     #define DELETE_CHALLENGE            DELETE_ENCRYPTED_CHALLENGE
     #define SIGNATURE_FILENAME          DEFAULT_ENCRYPTED_CHALLENGE_FILENAME
 #endif
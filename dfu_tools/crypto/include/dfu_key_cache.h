@@ -0,0 +1,106 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: dfu_key_cache.h
+**
+** DESCRIPTION: Parsed keys, kept across sessions.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <openssl/evp.h>
+
+/*
+** How many key files are kept parsed.  Least recently used goes first.
+**
+*/
+#define KEY_CACHE_MAX_KEYS                              (8)
+
+#define KEY_CACHE_MAX_PATH_LEN                          (512)
+#define KEY_CACHE_MAX_AES_KEY_LEN                       (32)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+///
+/// @fn: keyCacheGetPrivateKey
+///
+/// @details Gets the parsed private key from a PEM file.
+///
+/// @param[in] path
+///
+/// @returns The key (release with EVP_PKEY_free), or NULL if the file
+///          can't be read.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+EVP_PKEY* keyCacheGetPrivateKey(const char* path);
+
+///
+/// @fn: keyCacheGetPublicKey
+///
+/// @details Gets the parsed public key from a PEM file.
+///
+/// @param[in] path
+///
+/// @returns The key (release with EVP_PKEY_free), or NULL if the file
+///          can't be read.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+EVP_PKEY* keyCacheGetPublicKey(const char* path);
+
+///
+/// @fn: keyCacheNewSignContext
+///
+/// @details Gets a SHA-256 signing context for a private key, already
+///          through EVP_DigestSignInit().  Copied from a template kept
+///          with the key.
+///
+/// @param[in] path: PEM-encoded private key file
+///
+/// @returns The context (release with EVP_MD_CTX_free), or NULL.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+EVP_MD_CTX* keyCacheNewSignContext(const char* path);
+
+///
+/// @fn: keyCacheGetAESKey
+///
+/// @details Gets the first keyLen bytes of a raw AES key file.
+///
+/// @param[in] path
+/// @param[out] key
+/// @param[in] keyLen: At most KEY_CACHE_MAX_AES_KEY_LEN
+///
+/// @returns false if the file is missing or too short.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool keyCacheGetAESKey(const char* path, uint8_t* key, uint32_t keyLen);
+
+///
+/// @fn: keyCacheFlush
+///
+/// @details Forgets every cached key.
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void keyCacheFlush(void);
+
+#if defined(__cplusplus)
+}
+#endif
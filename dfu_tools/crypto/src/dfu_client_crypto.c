@@ -21,6 +21,7 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include "dfu_client_crypto.h"
+#include "dfu_key_cache.h"
 #include "image_metadata.h"
 
 /* Platform-specific includes and definitions */
@@ -256,31 +257,25 @@ AppImageHeaderStruct* getDecryptedImageHeader(char* imageFilename,
 
     if (keyFilename)
     {
-        FILE*           handle = fopen(keyFilename, "rb");
-        if (handle)
+        uint8_t         keyBuf[32];
+
+        if (keyCacheGetAESKey(keyFilename, keyBuf, 16))
         {
-            uint8_t         keyBuf[32];
+            int         outputLen = headerLen;
 
-            if (fread(keyBuf, 1, 16, handle) == 16)
+            if (decryptFileAES_GCM(imageFilename, keyBuf, 16, headerBuf, &outputLen))
             {
-                int         outputLen = headerLen;
+                ret = (AppImageHeaderStruct*)headerBuf;
 
-                if (decryptFileAES_GCM(imageFilename, keyBuf, 16, headerBuf, &outputLen))
+                // Now make sure it looks ok
+                if (
+                       (ret->headSignature != APP_IMAGE_HEAD_SIGNATURE) ||
+                       (ret->tailSignature != APP_IMAGE_TAIL_SIGNATURE)
+                   )
                 {
-                    ret = (AppImageHeaderStruct*)headerBuf;
-
-                    // Now make sure it looks ok
-                    if (
-                           (ret->headSignature != APP_IMAGE_HEAD_SIGNATURE) ||
-                           (ret->tailSignature != APP_IMAGE_TAIL_SIGNATURE)
-                       )
-                    {
-                        ret = NULL;
-                    }
+                    ret = NULL;
                 }
             }
-
-            fclose(handle);
         }
     }
 
@@ -320,7 +315,6 @@ uint8_t * encryptWithPublicKey(const char *pubkeyFilename,
     uint8_t                 *ret = NULL;
     EVP_PKEY                *pkey = NULL;
     EVP_PKEY_CTX            *ctx = NULL;
-    BIO                     *bio = NULL;
     unsigned char           *encrypted_data = NULL;
     size_t                   encrypted_len = 0;
 
@@ -334,18 +328,14 @@ uint8_t * encryptWithPublicKey(const char *pubkeyFilename,
         // Initialize openSSL
         OPENSSL_init_crypto(0, NULL);
 
-        // Read in the public key
-        bio = BIO_new_file(pubkeyFilename, "r");
-        if (!bio)
+        // Get the (cached) public key
+        pkey = keyCacheGetPublicKey(pubkeyFilename);
+        if (!pkey)
         {
-            printf("\r\n Error creating BIO object!");
+            printf("\r\n Error reading public key!");
             goto cleanup;
         }
 
-        // Read the public key into an EVP_PKEY structure
-        pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
-        ERR_clear_error();
-
         // Create a context for encryption
         ctx = EVP_PKEY_CTX_new(pkey, NULL);
         if (!ctx)
@@ -401,7 +391,6 @@ uint8_t * encryptWithPublicKey(const char *pubkeyFilename,
     }
 
 cleanup:
-    if (bio) BIO_free(bio);
     if (pkey) EVP_PKEY_free(pkey);
     if (ctx) EVP_PKEY_CTX_free(ctx);
     if (encrypted_data)
@@ -418,42 +407,33 @@ cleanup:
         }
     }
 
-    EVP_cleanup();
-    ERR_free_strings();
-
-
     return(ret);
 }
 
 ///
-/// @fn: signChallengeWithPrivateKey
+/// @fn: signChallengeBytes
 ///
-/// @details
+/// @details Signs the challenge (SHA-256) with the private key.
 ///
 /// @param[in] privateKeyFile: Path to the PEM-encoded private key file
 /// @param[in] challenge: The 32-bit challenge value to sign
-/// @param[in] saveToFile: Boolean flag indicating whether to save the signature to a file
-/// @param[in] outputFile: If saveToFile is 1, the path to save the signature to
+/// @param[out] signatureLen: Length of the signature
 ///
-/// @returns If saveToFile is 0, returns pointer to the signature buffer.
-///          If saveToFile is 1, returns NULL after saving signature to file.
-///         Returns NULL on any failure.
+/// @returns The signature (free with OPENSSL_free), or NULL on any
+///          failure.
 ///
 /// @tracereq(@req{xxxxxxx}}
 ///
-uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
-                                     uint32_t* challenge,
-                                     bool saveToFile,
-                                     const char* outputFile)
+static unsigned char* signChallengeBytes(const char* privateKeyFile,
+                                         uint32_t* challenge,
+                                         size_t* signatureLen)
 {
-    FILE*           keyFile = NULL;
-    EVP_PKEY*       pkey = NULL;
     EVP_MD_CTX*     mdCtx = NULL;
     unsigned char   challengeBytes[4];
     unsigned char*  signature = NULL;
-    size_t          signatureLen = 0;
-    uint8_t*        ret = NULL;
-    FILE*           outFile = NULL;
+    unsigned char*  ret = NULL;
+
+    *signatureLen = 0;
 
     /* Initialize OpenSSL */
     OpenSSL_add_all_algorithms();
@@ -465,37 +445,11 @@ uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
     challengeBytes[1] = (unsigned char)((*challenge >> 8) & 0xFF);
     challengeBytes[0] = (unsigned char)(*challenge & 0xFF);
 
-    /* Try an alternative method to load the key */
-    BIO *keyBio = BIO_new_file(privateKeyFile, "r");
-    if (!keyBio)
-    {
-        fprintf(stderr, "Error creating key BIO\n");
-        goto cleanup;
-    }
-
-    pkey = PEM_read_bio_PrivateKey(keyBio, NULL, NULL, NULL);
-    BIO_free(keyBio);
-
-    if (!pkey)
-    {
-        fprintf(stderr, "Error reading private key\n");
-        ERR_print_errors_fp(stderr);
-        goto cleanup;
-    }
-
-    /* Create signature context */
-    mdCtx = EVP_MD_CTX_new();
+    /* Signature context, already initialised with the (cached) key */
+    mdCtx = keyCacheNewSignContext(privateKeyFile);
     if (!mdCtx)
     {
-        fprintf(stderr, "Error creating message digest context\n");
-        goto cleanup;
-    }
-
-    /* Initialize the signature operation */
-    if (EVP_DigestSignInit(mdCtx, NULL, EVP_sha256(), NULL, pkey) != 1)
-    {
-        fprintf(stderr, "Error initializing signature operation\n");
-        ERR_print_errors_fp(stderr);
+        fprintf(stderr, "Error creating signature context\n");
         goto cleanup;
     }
 
@@ -508,7 +462,7 @@ uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
     }
 
     /* Get signature length */
-    if (EVP_DigestSignFinal(mdCtx, NULL, &signatureLen) != 1)
+    if (EVP_DigestSignFinal(mdCtx, NULL, signatureLen) != 1)
     {
         fprintf(stderr, "Error determining signature length\n");
         ERR_print_errors_fp(stderr);
@@ -516,7 +470,7 @@ uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
     }
 
     /* Allocate memory for signature */
-    signature = (unsigned char*)OPENSSL_malloc(signatureLen);
+    signature = (unsigned char*)OPENSSL_malloc(*signatureLen);
     if (!signature)
     {
         fprintf(stderr, "Error allocating memory for signature\n");
@@ -524,13 +478,56 @@ uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
     }
 
     /* Get the signature */
-    if (EVP_DigestSignFinal(mdCtx, signature, &signatureLen) != 1)
+    if (EVP_DigestSignFinal(mdCtx, signature, signatureLen) != 1)
     {
         fprintf(stderr, "Error creating signature\n");
         ERR_print_errors_fp(stderr);
         goto cleanup;
     }
 
+    ret = signature;
+    signature = NULL; /* Prevent signature from being freed */
+
+cleanup:
+    /* Clean up resources */
+    if (mdCtx) EVP_MD_CTX_free(mdCtx);
+    if (signature) OPENSSL_free(signature);
+
+    return ret;
+}
+
+///
+/// @fn: signChallengeWithPrivateKey
+///
+/// @details
+///
+/// @param[in] privateKeyFile: Path to the PEM-encoded private key file
+/// @param[in] challenge: The 32-bit challenge value to sign
+/// @param[in] saveToFile: Boolean flag indicating whether to save the signature to a file
+/// @param[in] outputFile: If saveToFile is 1, the path to save the signature to
+///
+/// @returns If saveToFile is 0, returns pointer to the signature buffer.
+///          If saveToFile is 1, returns NULL after saving signature to file.
+///         Returns NULL on any failure.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
+                                     uint32_t* challenge,
+                                     bool saveToFile,
+                                     const char* outputFile)
+{
+    unsigned char*  signature = NULL;
+    size_t          signatureLen = 0;
+    uint8_t*        ret = NULL;
+    FILE*           outFile = NULL;
+
+    signature = signChallengeBytes(privateKeyFile, challenge, &signatureLen);
+    if (!signature)
+    {
+        goto cleanup;
+    }
+
     /* If requested, save signature to file */
     if (saveToFile)
     {
@@ -559,12 +556,124 @@ uint8_t* signChallengeWithPrivateKey(const char* privateKeyFile,
 
 cleanup:
     /* Clean up resources */
-    if (mdCtx) EVP_MD_CTX_free(mdCtx);
-    if (pkey) EVP_PKEY_free(pkey);
-    if (keyFile) fclose(keyFile);
     if (outFile) fclose(outFile);
     if (signature) OPENSSL_free(signature);
 
     return ret;
 }
 
+///
+/// @fn: signChallengeToBuffer
+///
+/// @details Signs the challenge straight into the caller's buffer.
+///
+/// @param[in] privateKeyFile: Path to the PEM-encoded private key file
+/// @param[in] challenge: The 32-bit challenge value to sign
+/// @param[out] output: Receives the signature
+/// @param[in] outputLen: Size of "output"
+///
+/// @returns Length of the signature, or 0 on any failure (including a
+///          signature that doesn't fit).
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint32_t signChallengeToBuffer(const char* privateKeyFile,
+                               uint32_t* challenge,
+                               uint8_t* output,
+                               uint32_t outputLen)
+{
+    uint32_t        ret = 0;
+    size_t          signatureLen = 0;
+    unsigned char*  signature = NULL;
+
+    if ( (privateKeyFile) && (challenge) && (output) )
+    {
+        signature = signChallengeBytes(privateKeyFile, challenge, &signatureLen);
+        if (signature)
+        {
+            if (signatureLen <= outputLen)
+            {
+                memcpy(output, signature, signatureLen);
+                ret = (uint32_t)signatureLen;
+            }
+            else
+            {
+                fprintf(stderr, "Signature too long for its buffer (%u bytes)\n", (uint32_t)signatureLen);
+            }
+            OPENSSL_free(signature);
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: encryptWithPublicKeyToBuffer
+///
+/// @details Encrypts a value straight into the caller's buffer.
+///
+/// @param[in] pubkeyFilename: Path to the PEM-encoded public key file
+/// @param[in] valueToEncrypt
+/// @param[in] encryptLength
+/// @param[out] output: Receives the encrypted value
+/// @param[in] outputLen: Size of "output"
+///
+/// @returns Length of the encrypted value, or 0 on any failure
+///          (including a result that doesn't fit).
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint32_t encryptWithPublicKeyToBuffer(const char* pubkeyFilename,
+                                      void* valueToEncrypt,
+                                      uint32_t encryptLength,
+                                      uint8_t* output,
+                                      uint32_t outputLen)
+{
+    uint32_t        ret = 0;
+    EVP_PKEY*       pkey = NULL;
+    EVP_PKEY_CTX*   ctx = NULL;
+    size_t          encryptedLen = 0;
+
+    if ( (pubkeyFilename) && (valueToEncrypt) && (encryptLength) && (output) )
+    {
+        OPENSSL_init_crypto(0, NULL);
+
+        pkey = keyCacheGetPublicKey(pubkeyFilename);
+        if (!pkey)
+        {
+            printf("\r\n Error reading public key!");
+            goto cleanup;
+        }
+
+        ctx = EVP_PKEY_CTX_new(pkey, NULL);
+        if ( (!ctx) || (EVP_PKEY_encrypt_init(ctx) <= 0) )
+        {
+            fprintf(stderr, "\r\n Error: Failed to initialize encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+            goto cleanup;
+        }
+
+        // Make sure the result will fit before encrypting into it
+        if (
+               (EVP_PKEY_encrypt(ctx, NULL, &encryptedLen, (unsigned char *)valueToEncrypt, encryptLength) <= 0) ||
+               (encryptedLen > outputLen)
+           )
+        {
+            fprintf(stderr, "\r\n Error: Encrypted value won't fit its buffer: %s\n", ERR_error_string(ERR_get_error(), NULL));
+            goto cleanup;
+        }
+
+        if (EVP_PKEY_encrypt(ctx, output, &encryptedLen, (unsigned char *)valueToEncrypt, encryptLength) <= 0)
+        {
+            fprintf(stderr, "\r\n Error: Encryption failed: %s\n", ERR_error_string(ERR_get_error(), NULL));
+            goto cleanup;
+        }
+
+        ret = (uint32_t)encryptedLen;
+    }
+
+cleanup:
+    if (pkey) EVP_PKEY_free(pkey);
+    if (ctx) EVP_PKEY_CTX_free(ctx);
+
+    return ret;
+}
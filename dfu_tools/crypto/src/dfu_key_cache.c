@@ -0,0 +1,429 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: dfu_key_cache.c
+**
+** DESCRIPTION: Parsed keys, kept across sessions.  Entries are keyed by
+**              path, kind and modification time, so a key file that is
+**              replaced on disk is re-read.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+#include "dfu_key_cache.h"
+
+typedef enum
+{
+    KEY_KIND_PRIVATE = 0,
+    KEY_KIND_PUBLIC,
+    KEY_KIND_AES
+}keyKindEnum;
+
+/*
+** What a key file looked like on disk when it was loaded.  Any
+** difference means it was rewritten or replaced.
+**
+*/
+typedef struct
+{
+    int64_t         seconds;
+    int64_t         nanoseconds;
+    int64_t         size;
+    uint64_t        inode;
+}keyCacheStampStruct;
+
+typedef struct
+{
+    bool            inUse;
+    keyKindEnum     kind;
+    char            path[KEY_CACHE_MAX_PATH_LEN];
+    keyCacheStampStruct stamp;
+    uint32_t        lastUsed;
+    EVP_PKEY*       pkey;
+    EVP_MD_CTX*     signTemplate;
+    uint8_t         aesKey[KEY_CACHE_MAX_AES_KEY_LEN];
+    uint32_t        aesKeyLen;
+}keyCacheEntryStruct;
+
+static keyCacheEntryStruct  keyCache[KEY_CACHE_MAX_KEYS];
+static uint32_t             keyCacheClock = 0;
+static pthread_mutex_t      keyCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static keyCacheEntryStruct* findEntry(const char* path, keyKindEnum kind);
+static void fileStamp(const struct stat* info, keyCacheStampStruct* stamp);
+static bool loadEntry(keyCacheEntryStruct* entry);
+static void releaseEntry(keyCacheEntryStruct* entry);
+
+///
+/// @fn: keyCacheGetPrivateKey
+///
+/// @details Gets the parsed private key from a PEM file.
+///
+/// @param[in] path
+///
+/// @returns The key (release with EVP_PKEY_free), or NULL if the file
+///          can't be read.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+EVP_PKEY* keyCacheGetPrivateKey(const char* path)
+{
+    EVP_PKEY*               ret = NULL;
+    keyCacheEntryStruct*    entry;
+
+    pthread_mutex_lock(&keyCacheLock);
+    entry = findEntry(path, KEY_KIND_PRIVATE);
+    if ( (entry) && (EVP_PKEY_up_ref(entry->pkey) == 1) )
+    {
+        ret = entry->pkey;
+    }
+    pthread_mutex_unlock(&keyCacheLock);
+
+    return ret;
+}
+
+///
+/// @fn: keyCacheGetPublicKey
+///
+/// @details Gets the parsed public key from a PEM file.
+///
+/// @param[in] path
+///
+/// @returns The key (release with EVP_PKEY_free), or NULL if the file
+///          can't be read.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+EVP_PKEY* keyCacheGetPublicKey(const char* path)
+{
+    EVP_PKEY*               ret = NULL;
+    keyCacheEntryStruct*    entry;
+
+    pthread_mutex_lock(&keyCacheLock);
+    entry = findEntry(path, KEY_KIND_PUBLIC);
+    if ( (entry) && (EVP_PKEY_up_ref(entry->pkey) == 1) )
+    {
+        ret = entry->pkey;
+    }
+    pthread_mutex_unlock(&keyCacheLock);
+
+    return ret;
+}
+
+///
+/// @fn: keyCacheNewSignContext
+///
+/// @details Gets a SHA-256 signing context for a private key, already
+///          through EVP_DigestSignInit().  Copied from a template kept
+///          with the key.
+///
+/// @param[in] path: PEM-encoded private key file
+///
+/// @returns The context (release with EVP_MD_CTX_free), or NULL.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+EVP_MD_CTX* keyCacheNewSignContext(const char* path)
+{
+    EVP_MD_CTX*             ret = NULL;
+    keyCacheEntryStruct*    entry;
+
+    pthread_mutex_lock(&keyCacheLock);
+    entry = findEntry(path, KEY_KIND_PRIVATE);
+    if ( (entry) && (entry->signTemplate) )
+    {
+        ret = EVP_MD_CTX_new();
+        if ( (ret) && (EVP_MD_CTX_copy_ex(ret, entry->signTemplate) != 1) )
+        {
+            EVP_MD_CTX_free(ret);
+            ret = NULL;
+        }
+    }
+    pthread_mutex_unlock(&keyCacheLock);
+
+    return ret;
+}
+
+///
+/// @fn: keyCacheGetAESKey
+///
+/// @details Gets the first keyLen bytes of a raw AES key file.
+///
+/// @param[in] path
+/// @param[out] key
+/// @param[in] keyLen: At most KEY_CACHE_MAX_AES_KEY_LEN
+///
+/// @returns false if the file is missing or too short.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool keyCacheGetAESKey(const char* path, uint8_t* key, uint32_t keyLen)
+{
+    bool                    ret = false;
+    keyCacheEntryStruct*    entry;
+
+    if ( (key) && (keyLen <= KEY_CACHE_MAX_AES_KEY_LEN) )
+    {
+        pthread_mutex_lock(&keyCacheLock);
+        entry = findEntry(path, KEY_KIND_AES);
+        if ( (entry) && (entry->aesKeyLen >= keyLen) )
+        {
+            memcpy(key, entry->aesKey, keyLen);
+            ret = true;
+        }
+        pthread_mutex_unlock(&keyCacheLock);
+    }
+
+    return ret;
+}
+
+///
+/// @fn: keyCacheFlush
+///
+/// @details Forgets every cached key.
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void keyCacheFlush(void)
+{
+    uint32_t                index;
+
+    pthread_mutex_lock(&keyCacheLock);
+    for (index = 0; index < KEY_CACHE_MAX_KEYS; index++)
+    {
+        releaseEntry(&keyCache[index]);
+    }
+    pthread_mutex_unlock(&keyCacheLock);
+
+    return;
+}
+
+///
+/// @fn: findEntry
+///
+/// @details Finds (or loads) the entry for a key file.  Called with
+///          keyCacheLock held.
+///
+/// @param[in] path
+/// @param[in] kind
+///
+/// @returns NULL if the file can't be read.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static keyCacheEntryStruct* findEntry(const char* path, keyKindEnum kind)
+{
+    keyCacheEntryStruct*    ret = NULL;
+    keyCacheEntryStruct*    victim = NULL;
+    struct stat             info;
+    keyCacheStampStruct     stamp;
+    uint32_t                index;
+
+    if (
+           (path) &&
+           (strlen(path) < KEY_CACHE_MAX_PATH_LEN) &&
+           (stat(path, &info) == 0)
+       )
+    {
+        fileStamp(&info, &stamp);
+
+        for (index = 0; index < KEY_CACHE_MAX_KEYS; index++)
+        {
+            keyCacheEntryStruct*    entry = &keyCache[index];
+
+            if (
+                   (entry->inUse) &&
+                   (entry->kind == kind) &&
+                   (strcmp(entry->path, path) == 0)
+               )
+            {
+                if (memcmp(&entry->stamp, &stamp, sizeof(stamp)) == 0)
+                {
+                    ret = entry;
+                }
+                else
+                {
+                    // Replaced on disk
+                    releaseEntry(entry);
+                    victim = entry;
+                }
+                break;
+            }
+
+            if (
+                   (victim == NULL) ||
+                   ((victim->inUse) && ((!entry->inUse) || (entry->lastUsed < victim->lastUsed)))
+               )
+            {
+                victim = entry;
+            }
+        }
+
+        if (ret == NULL)
+        {
+            releaseEntry(victim);
+            victim->kind = kind;
+            victim->stamp = stamp;
+            snprintf(victim->path, sizeof(victim->path), "%s", path);
+
+            if (loadEntry(victim))
+            {
+                victim->inUse = true;
+                ret = victim;
+            }
+            else
+            {
+                releaseEntry(victim);
+            }
+        }
+
+        if (ret)
+        {
+            ret->lastUsed = ++keyCacheClock;
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: fileStamp
+///
+/// @details Takes the modification time (to the nanosecond), size and
+///          inode from a stat(), so a key rewritten within the same
+///          second, or replaced by a rename, still reads as changed.
+///
+/// @param[in] info
+/// @param[out] stamp
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static void fileStamp(const struct stat* info, keyCacheStampStruct* stamp)
+{
+    memset(stamp, 0, sizeof(keyCacheStampStruct));
+    stamp->seconds = (int64_t)info->st_mtime;
+    stamp->size = (int64_t)info->st_size;
+
+#if defined(_WIN32) || defined(_WIN64)
+    // Whole seconds only, and st_ino is always 0: time and size it is.
+#elif defined(__APPLE__)
+    stamp->nanoseconds = (int64_t)info->st_mtimespec.tv_nsec;
+    stamp->inode = (uint64_t)info->st_ino;
+#else
+    stamp->nanoseconds = (int64_t)info->st_mtim.tv_nsec;
+    stamp->inode = (uint64_t)info->st_ino;
+#endif // defined
+
+    return;
+}
+
+///
+/// @fn: loadEntry
+///
+/// @details Reads and parses the key file named in the entry.
+///
+/// @param[in] entry
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static bool loadEntry(keyCacheEntryStruct* entry)
+{
+    bool                    ret = false;
+
+    if (entry->kind == KEY_KIND_AES)
+    {
+        FILE*               handle = fopen(entry->path, "rb");
+
+        if (handle)
+        {
+            entry->aesKeyLen = (uint32_t)fread(entry->aesKey, 1, sizeof(entry->aesKey), handle);
+            ret = (entry->aesKeyLen > 0);
+            fclose(handle);
+        }
+    }
+    else
+    {
+        BIO*                bio = BIO_new_file(entry->path, "r");
+
+        if (bio)
+        {
+            if (entry->kind == KEY_KIND_PRIVATE)
+            {
+                entry->pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+            }
+            else
+            {
+                entry->pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+            }
+            BIO_free(bio);
+        }
+
+        if (entry->pkey == NULL)
+        {
+            fprintf(stderr, "Error reading key [%s]\n", entry->path);
+            ERR_print_errors_fp(stderr);
+        }
+        else
+        if (entry->kind == KEY_KIND_PRIVATE)
+        {
+            // Every challenge signature starts from the same initialised state
+            entry->signTemplate = EVP_MD_CTX_new();
+            if (
+                   (entry->signTemplate) &&
+                   (EVP_DigestSignInit(entry->signTemplate, NULL, EVP_sha256(), NULL, entry->pkey) == 1)
+               )
+            {
+                ret = true;
+            }
+            else
+            {
+                fprintf(stderr, "Error initializing signature operation\n");
+                ERR_print_errors_fp(stderr);
+            }
+        }
+        else
+        {
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: releaseEntry
+///
+/// @details Frees whatever the entry holds.  Keys handed out earlier
+///          stay valid until their holders free them.
+///
+/// @param[in] entry
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static void releaseEntry(keyCacheEntryStruct* entry)
+{
+    if (entry->signTemplate) EVP_MD_CTX_free(entry->signTemplate);
+    if (entry->pkey) EVP_PKEY_free(entry->pkey);
+    memset(entry, 0, sizeof(keyCacheEntryStruct));
+
+    return;
+}
@@ -54,11 +54,18 @@
 #include "image_xfer.h"
 #include "general_utils.h"
 #include "sequence_ops.h"
+#include "vehicle_install.h"
 
 #include "dfu_client_api.h"
 #include "file_kvp.h"
 #include "dfu_client_crypto.h"
 #include "path_utils.h"
+#include "event_loop.h"
+#include "device_registry.h"
+#include "iface_enet.h"
+#include "iface_link.h"
+#include "logger.h"
+#include "xfer_progress.h"
 
 #define APPLICATION_NAME                    ("Glydways Firmware Update Manager")
 
@@ -149,6 +156,19 @@ static cmdlineDispatchStruct cmdlineHandlers [] =
     {NULL, NULL, NULL, NULL, NULL}
 };
 
+/*
+** State shared by the "-d" event loop callbacks.
+**
+*/
+typedef struct
+{
+    dfuClientAPI *              apiHandle;
+    eventLoopStruct *           loop;
+    uint32_t                    timeoutMS;
+    int                         quietTimer;
+    uint32_t                    index;
+}listDevicesStruct;
+
 /*
 ** Where we keep our INI filename
 **
@@ -175,11 +195,22 @@ static char* getDesiredArgumentValue(int argc,
                                      bool shouldSave);
 
 static helpTypeEnum _getHelpType(int argc, char **argv, char **cmdForHelp);
+
 static void _allCommandsHelp(void);
 static void printApplicationBanner(int argc, char** argv);
 static char *getApplicationNameAndVersion(char* srcBuffer, size_t bufferSize);
 static cmdlineHelpHandler _getHelpHandler(char *cmd);
 static bool mainHelpHandler(int argc, char **argv);
+static bool decodeLogHandler(int argc, char **argv);
+static void startProgress(int argc, char **argv);
+#if (ENET_USE_IMPAIRMENT==1)
+static void startImpairment(int argc, char **argv);
+#endif
+static void keyhitEventHandler(eventLoopStruct *loop, void *ctx);
+static void listDevicesDrive(eventLoopStruct *loop, void *ctx);
+static void listDevicesSocketHandler(eventLoopStruct *loop, int fd, void *ctx);
+static void listDevicesQuietHandler(eventLoopStruct *loop, int timerId, void *ctx);
+static void listDevicesRegistryHandler(void *ctx, deviceRegistryEventEnum event, const deviceInfoStruct *device);
 
 
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
@@ -208,6 +239,7 @@ int main(int argc, char **argv)
 {
     char*                    paramVal = NULL;
     ASYNC_TIMER_STRUCT       keyhitTimer;
+    eventLoopStruct*         keyhitLoop;
 
     initINI();
 
@@ -225,13 +257,28 @@ int main(int argc, char **argv)
         bool                            done = false;
 
         /*
-        ** Checks to see if the caller wants help.  If not,
-        ** try to handle standard command-line args.
+        ** Checks to see if the caller wants help (or a log decoded).
+        ** If not, try to handle standard command-line args.
         **
         */
-        if (!mainHelpHandler(argc, argv))
+        if (
+               (!mainHelpHandler(argc, argv)) &&
+               (!decodeLogHandler(argc, argv))
+           )
         {
-            dfuClientAPI*                   apiHandle = getClientAPIHandle(argc, argv);
+            dfuClientAPI*                   apiHandle;
+
+            // "--log <file>" records a binary log for "--decode-log"
+            if (flag_srch(argc, argv, "--log", 1, &paramVal))
+            {
+                loggerStart(paramVal, LOGGER_OUTPUT_BINARY, LOGGER_DEFAULT_LEVEL);
+            }
+            startProgress(argc, argv);
+        #if (ENET_USE_IMPAIRMENT==1)
+            startImpairment(argc, argv);
+        #endif
+
+            apiHandle = getClientAPIHandle(argc, argv);
 
             /*
             ** Look for parameters that are required for ALL uses
@@ -268,15 +315,31 @@ int main(int argc, char **argv)
                 FlushConsoleInputBuffer(GetStdHandle(STD_INPUT_HANDLE));
                 printf("\r\n\r\n Press a key...");
 
-                TIMER_Start(&keyhitTimer);
-                do
+                keyhitLoop = eventLoopCreate();
+                if (
+                       (keyhitLoop) &&
+                       (eventLoopWatchKeyboard(keyhitLoop, keyhitEventHandler, NULL))
+                   )
                 {
-                } while ( (!_kbhit()) && (!TIMER_Finished(&keyhitTimer, KEYHIT_DELAY_MS)) );
+                    // Sleeps in the kernel until a key or the timeout
+                    eventLoopRun(keyhitLoop, KEYHIT_DELAY_MS);
+                }
+                else
+                {
+                    TIMER_Start(&keyhitTimer);
+                    do
+                    {
+                    } while ( (!_kbhit()) && (!TIMER_Finished(&keyhitTimer, KEYHIT_DELAY_MS)) );
+                }
+                eventLoopDestroy(keyhitLoop);
                 FlushConsoleInputBuffer(GetStdHandle(STD_INPUT_HANDLE));
 
                 // Put the API handle back
                 dfuClientAPIPut(apiHandle);
             }
+
+            xferProgressStop();
+            loggerStop();
         }
     }
     else
@@ -520,60 +583,184 @@ static bool cmdlineHandlerListDevices(int argc, char **argv, char *paramVal, dfu
 
         if (timeoutMS > 0)
         {
-            ASYNC_TIMER_STRUCT          timer;
-            deviceInfoStruct*           deviceRecord;
-            bool                        first = true;
-            uint32_t                    index = 1;
+            listDevicesStruct           list;
+
+            memset(&list, 0, sizeof(list));
+            list.apiHandle = apiHandle;
+            list.timeoutMS = timeoutMS;
+            list.index = 1;
+            list.loop = eventLoopCreate();
 
             printf("\r\n Listening for DFU-mode devices...");
-            TIMER_Start(&timer);
-            do
+
+            if (list.loop)
             {
-                if (first)
-                {
-                    deviceRecord = dfuClientAPI_LL_GetFirstDevice(apiHandle);
-                    if (deviceRecord)
-                    {
-                        printf("\r                                         ");
-                        first = false;
-                    }
-                }
-                else
+                /*
+                ** Wake on a frame (where the socket is a descriptor) and
+                ** at least every EVENT_LOOP_IDLE_PERIOD_MS otherwise.
+                ** Stop once nothing new has been heard for timeoutMS.
+                **
+                */
+                ifaceLinkWatchAll(list.loop, listDevicesSocketHandler, &list);
+                eventLoopAddIdle(list.loop, listDevicesDrive, &list);
+                list.quietTimer = eventLoopAddTimer(list.loop, timeoutMS, 0, listDevicesQuietHandler, &list);
+
+                if (
+                       (list.quietTimer >= 0) &&
+                       (deviceRegistrySubscribe(listDevicesRegistryHandler, &list, true))
+                   )
                 {
-                    deviceRecord = dfuClientAPI_LL_GetNextDevice(apiHandle);
+                    eventLoopRun(list.loop, 0);
+                    deviceRegistryUnsubscribe(listDevicesRegistryHandler, &list);
                 }
 
-                if (deviceRecord)
-                {
-                    char                devAddrStr[64];
+                eventLoopDestroy(list.loop);
+            }
+            else
+            {
+                printf("\r\n Could not create the event loop!");
+            }
+        }
+    }
 
-                    dfuClientAPIMacBytesToString(apiHandle,
-                                                 deviceRecord->physicalID,
-                                                 MAX_INTERFACE_MAC_LEN,
-                                                 devAddrStr,
-                                                 sizeof(devAddrStr));
+    return ret;
+}
 
-                    printf("\r\n    ::: DEVICE (%2d) DESCRIPTION :::\r\n", index++);
-                    printf("\r\n         Device MAC: %s", devAddrStr);
-                    printf("\r\n        Device TYPE: %d", (int)deviceRecord->deviceType);
-                    printf("\r\n     Device VARIANT: %d", (int)deviceRecord->deviceVariant);
-                    printf("\r\n        Status Bits: 0x%02X", deviceRecord->statusBits);
-                    printf("\r\n    Core Image Mask: 0x%02X", deviceRecord->coreImageMask);
-                    printf("\r\n Bootloader Version: %d.%d.%d",
-                           deviceRecord->blVersionMajor,
-                           deviceRecord->blVersionMinor,
-                           deviceRecord->blVersionPatch);
-                    printf("\r\n       Last Update: %s", ctime(&deviceRecord->timestamp));
-                    printf("\r\n");
-
-                    // Refresh the timer
-                    TIMER_Start(&timer);
-                }
-            } while (!TIMER_Finished(&timer, timeoutMS));
+///
+/// @fn: listDevicesDrive
+///
+/// @details Lets the client process what has arrived, then takes
+///          any new discovery records into the registry (which
+///          reports them to listDevicesRegistryHandler).
+///
+/// @param[in] loop
+/// @param[in] ctx   listDevicesStruct
+///
+/// @returns
+///
+static void listDevicesDrive(eventLoopStruct *loop, void *ctx)
+{
+    listDevicesStruct *         list = (listDevicesStruct *)ctx;
+
+    (void)loop;
+
+    dfuClientAPI_LL_IdleDrive(list->apiHandle);
+    deviceRegistryCollect(list->apiHandle);
+
+    return;
+}
+
+///
+/// @fn: listDevicesSocketHandler
+///
+/// @details A frame is waiting on an interface socket.
+///
+/// @param[in] loop
+/// @param[in] fd
+/// @param[in] ctx   listDevicesStruct
+///
+/// @returns
+///
+static void listDevicesSocketHandler(eventLoopStruct *loop, int fd, void *ctx)
+{
+    (void)fd;
+
+    listDevicesDrive(loop, ctx);
+
+    return;
+}
+
+///
+/// @fn: listDevicesQuietHandler
+///
+/// @details Nothing new has been heard for the listen timeout.
+///
+/// @param[in] loop
+/// @param[in] timerId
+/// @param[in] ctx   listDevicesStruct
+///
+/// @returns
+///
+static void listDevicesQuietHandler(eventLoopStruct *loop, int timerId, void *ctx)
+{
+    (void)timerId;
+    (void)ctx;
+
+    eventLoopStop(loop);
+
+    return;
+}
+
+///
+/// @fn: listDevicesRegistryHandler
+///
+/// @details Displays each device as it appears and restarts the
+///          listen timeout.
+///
+/// @param[in] ctx     listDevicesStruct
+/// @param[in] event
+/// @param[in] device
+///
+/// @returns
+///
+static void listDevicesRegistryHandler(void *ctx, deviceRegistryEventEnum event, const deviceInfoStruct *device)
+{
+    listDevicesStruct *         list = (listDevicesStruct *)ctx;
+
+    if (event == DEVICE_EVENT_APPEARED)
+    {
+        char                    devAddrStr[64];
+        time_t                  timestamp = device->timestamp;
+
+        if (list->index == 1)
+        {
+            printf("\r                                         ");
         }
+
+        dfuClientAPIMacBytesToString(list->apiHandle,
+                                     (uint8_t *)device->physicalID,
+                                     MAX_INTERFACE_MAC_LEN,
+                                     devAddrStr,
+                                     sizeof(devAddrStr));
+
+        printf("\r\n    ::: DEVICE (%2d) DESCRIPTION :::\r\n", (int)list->index++);
+        printf("\r\n         Device MAC: %s", devAddrStr);
+        printf("\r\n        Device TYPE: %d", (int)device->deviceType);
+        printf("\r\n     Device VARIANT: %d", (int)device->deviceVariant);
+        printf("\r\n        Status Bits: 0x%02X", device->statusBits);
+        printf("\r\n    Core Image Mask: 0x%02X", device->coreImageMask);
+        printf("\r\n Bootloader Version: %d.%d.%d",
+               device->blVersionMajor,
+               device->blVersionMinor,
+               device->blVersionPatch);
+        printf("\r\n       Last Update: %s", ctime(&timestamp));
+        printf("\r\n");
+
+        // Refresh the listen timeout
+        eventLoopCancelTimer(list->loop, list->quietTimer);
+        list->quietTimer = eventLoopAddTimer(list->loop, list->timeoutMS, 0, listDevicesQuietHandler, list);
     }
 
-    return ret;
+    return;
+}
+
+///
+/// @fn: keyhitEventHandler
+///
+/// @details Ends the "Press a key..." wait.
+///
+/// @param[in] loop
+/// @param[in] ctx
+///
+/// @returns
+///
+static void keyhitEventHandler(eventLoopStruct *loop, void *ctx)
+{
+    (void)ctx;
+
+    eventLoopStop(loop);
+
+    return;
 }
 
 static void listDevicesHelpHandler(char *arg)
@@ -588,15 +775,183 @@ static void listDevicesHelpHandler(char *arg)
 }
 
 
+///
+/// @fn: cmdlineHandlerInstallVehicle
+///
+/// @details Updates every board listed in a vehicle manifest,
+///          several boards at a time.
+///
+///          "-v <vehicle manifest file name>"
+///
+///          Needs command-line values (or INI-saved values):
+///
+///          1. "-t <timeout in mS">   <<-- Optional. How long to wait
+///                                         for the next board to show up.
+///          2. "-j <sessions>"        <<-- Optional. Max boards updated
+///                                         at the same time.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
 static bool cmdlineHandlerInstallVehicle(int argc, char **argv, char *paramVal, dfuClientAPI* apiHandle)
 {
     bool                ret = true;
 
+    if (
+           (argc > 0) &&
+           (argv) &&
+           (paramVal) &&
+           (strlen(paramVal) > 0) &&
+           (apiHandle)
+       )
+    {
+        char                timeoutStr[24];
+        uint32_t            timeoutMS = DEFAULT_DEVICE_LISTEN_TIMEOUT_MS;
+        char                concurrentStr[16];
+        uint32_t            maxConcurrent = 0;
+        char                interfaceName[64];
+        apiErrorCodeEnum    err;
+
+        // See if there was a timeout value
+        if (getDesiredArgumentValue(argc,
+                                    argv,
+                                    "-t",
+                                    "INSTALL_VEHICLE",
+                                    "listen_timeout_ms",
+                                    timeoutStr,
+                                    sizeof(timeoutStr),
+                                    true))
+        {
+            timeoutMS = strtoul(timeoutStr, NULL, 10);
+        }
+
+        // How many boards at once?
+        if (getDesiredArgumentValue(argc,
+                                    argv,
+                                    "-j",
+                                    "INSTALL_VEHICLE",
+                                    "max_concurrent",
+                                    concurrentStr,
+                                    sizeof(concurrentStr),
+                                    true))
+        {
+            maxConcurrent = strtoul(concurrentStr, NULL, 10);
+        }
+
+        // The workers open their own clients on the same interface
+        if (!getDesiredArgumentValue(argc,
+                                     argv,
+                                     "-n",
+                                     "SYSTEM",
+                                     "interface_name",
+                                     interfaceName,
+                                     sizeof(interfaceName),
+                                     false))
+        {
+            interfaceName[0] = '\0';
+        }
+
+        if (!isAbsolutePath(paramVal))
+        {
+            snprintf(scratch1, sizeof(scratch1), "%s/%s", getCWD(scratch2, sizeof(scratch2)), paramVal);
+        }
+        else
+        {
+            snprintf(scratch1, sizeof(scratch1), "%s", paramVal);
+        }
+
+        err = vehicleInstallRun(apiHandle,
+                                getInterfaceType(argc, argv),
+                                interfaceName,
+                                scratch1,
+                                timeoutMS,
+                                maxConcurrent);
+
+        /*
+        ** Per-board report.
+        **
+        */
+        if (vehicleInstallResultCount() > 0)
+        {
+            uint32_t            index;
+
+            printf("\r\n\r\n    ::: VEHICLE INSTALL RESULTS :::\r\n");
+            for (index = 0; index < vehicleInstallResultCount(); index++)
+            {
+                const vehicleBoardResultStruct*     board = vehicleInstallGetResult(index);
+                char                                devAddrStr[64] = "-";
+
+                if (board->found)
+                {
+                    dfuClientAPIMacBytesToString(apiHandle,
+                                                 (uint8_t*)board->mac,
+                                                 MAX_INTERFACE_MAC_LEN,
+                                                 devAddrStr,
+                                                 sizeof(devAddrStr));
+                }
+
+                printf("\r\n %2u) TYPE %3d VARIANT %3d  %-20s  ",
+                       index + 1,
+                       (int)board->deviceType,
+                       (int)board->deviceVariant,
+                       devAddrStr);
+
+                if (!board->found)
+                {
+                    printf("NOT FOUND");
+                }
+                else
+                if (board->result == API_ERR_NONE)
+                {
+                    printf("OK      (%u.%03u s)", board->elapsedMS / 1000, board->elapsedMS % 1000);
+                }
+                else
+                {
+                    printf("FAILED [%d] (%u.%03u s)", board->result, board->elapsedMS / 1000, board->elapsedMS % 1000);
+                }
+            }
+        }
+
+        if (err != API_ERR_NONE)
+        {
+            printf("\r\n\r\n Vehicle Installation Failure: [%d]", err);
+        }
+    }
+
     return ret;
 }
 
+///
+/// @fn: installVehicleHelpHandler
+/// @details Provides the help for whole-vehicle installation.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
 static void installVehicleHelpHandler(char *arg)
 {
+    printf("\r\n");
+    printf("\r\n    Installs firmware on every board listed in a vehicle");
+    printf("\r\n    manifest.  Each entry names a board-level manifest;");
+    printf("\r\n    boards are matched to DFU-mode devices by TYPE and");
+    printf("\r\n    VARIANT and several are updated at the same time.");
+    printf("\r\n");
+    printf("\r\n      -t <mS>       How long to wait for the next board.");
+    printf("\r\n      -j <count>    Max boards updated at once.");
+    printf("\r\n");
+    printf("\r\n      Example: 'dfutool -v ./vehicle_manifest.yaml -j 4'");
+
+    printf("\r\n");
     return;
 }
 
@@ -1233,6 +1588,137 @@ static helpTypeEnum _getHelpType(int argc, char **argv, char **cmdForHelp)
 }
 
 
+///
+/// @fn: decodeLogHandler
+///
+/// @details "--decode-log <file>": prints a log recorded with
+///          "--log <file>".
+///
+/// @param[in] argc
+/// @param[in] argv
+///
+/// @returns true if "--decode-log" was given (nothing else is done).
+///
+static bool decodeLogHandler(int argc, char **argv)
+{
+    bool                    ret = false;
+    char*                   paramVal = NULL;
+
+    if (flag_srch(argc, argv, "--decode-log", 1, &paramVal))
+    {
+        FILE *              logFile = (paramVal) ? fopen(paramVal, "rb") : NULL;
+
+        ret = true;
+        if (logFile)
+        {
+            printf("\r\n");
+            loggerDecode(logFile, stdout);
+            fclose(logFile);
+        }
+        else
+        {
+            printf("\r\n Failed to open log [%s]!", paramVal ? paramVal : "");
+        }
+    }
+
+    return (ret);
+}
+
+///
+/// @fn: startProgress
+///
+/// @details "--progress <tty|quiet|ndjson>" picks how transfer progress
+///          is shown (a terminal gets "tty", anything else "quiet", if
+///          it isn't given).  "--progress-file <file>" sends the NDJSON
+///          stream to a file instead of stderr.
+///
+/// @param[in] argc
+/// @param[in] argv
+///
+/// @returns
+///
+static void startProgress(int argc, char **argv)
+{
+    xferProgressModeEnum    mode = xferProgressDefaultMode();
+    char*                   paramVal = NULL;
+    char*                   pathVal = NULL;
+
+    if ( (flag_srch(argc, argv, "--progress", 1, &paramVal)) && (paramVal) )
+    {
+        if (strcmp(paramVal, "tty") == 0)
+        {
+            mode = XFER_PROGRESS_TTY;
+        }
+        else
+        if (strcmp(paramVal, "quiet") == 0)
+        {
+            mode = XFER_PROGRESS_QUIET;
+        }
+        else
+        if (strcmp(paramVal, "ndjson") == 0)
+        {
+            mode = XFER_PROGRESS_NDJSON;
+        }
+        else
+        {
+            printf("\r\n Unknown progress mode [%s], using the default.", paramVal);
+        }
+    }
+    flag_srch(argc, argv, "--progress-file", 1, &pathVal);
+
+    xferProgressStart(mode, pathVal);
+
+    return;
+}
+
+#if (ENET_USE_IMPAIRMENT==1)
+///
+/// @fn: startImpairment
+///
+/// @details "--impair <profile>" runs every Ethernet link through the
+///          impairment shim (see netImpairParseProfile() for the
+///          profile text), both ways.  The receive side uses the next
+///          seed up, so the two directions don't lose the same frames.
+///          For testing the tools against a bad link; never for a real
+///          install.
+///
+/// @param[in] argc
+/// @param[in] argv
+///
+/// @returns
+///
+static void startImpairment(int argc, char **argv)
+{
+    char*                   paramVal = NULL;
+    netImpairProfileStruct  tx;
+    netImpairProfileStruct  rx;
+
+    if ( (flag_srch(argc, argv, "--impair", 1, &paramVal)) && (paramVal) )
+    {
+        if (netImpairParseProfile(paramVal, &tx))
+        {
+            rx = tx;
+            rx.seed++;
+            dfuClientEthernetSetDefaultImpairment(&tx, &rx);
+            printf("\r\n Impairing the link: latency %uuS, jitter %uuS, loss %u.%04u%%, dup %u.%04u%%, reorder %u.%04u%%, rate %ukbit/s, seed %u",
+                   tx.latencyUS,
+                   tx.jitterUS,
+                   tx.lossPPM / 10000U, tx.lossPPM % 10000U,
+                   tx.duplicatePPM / 10000U, tx.duplicatePPM % 10000U,
+                   tx.reorderPPM / 10000U, tx.reorderPPM % 10000U,
+                   tx.rateKbps,
+                   tx.seed);
+        }
+        else
+        {
+            printf("\r\n Unknown impairment profile [%s], the link is left alone.", paramVal);
+        }
+    }
+
+    return;
+}
+#endif
+
 /*!
 ** FUNCTION: _allCommandsHelp
 **
@@ -1263,6 +1749,14 @@ static void _allCommandsHelp(void)
         printf("%s", helpText);
         ++index;
     }
+    printf("\r\n\r\n '--log <file>'          : Record a binary log of this run.");
+    printf("\r\n '--decode-log <file>'   : Print a log recorded with '--log'.");
+    printf("\r\n '--progress <mode>'     : Transfer progress: 'tty', 'quiet' or 'ndjson'.");
+    printf("\r\n '--progress-file <file>': Write the 'ndjson' progress stream to a file (else stderr).");
+#if (ENET_USE_IMPAIRMENT==1)
+    printf("\r\n '--impair <profile>'    : Test only: impair the link, e.g. 'lossy,seed=7' or");
+    printf("\r\n                           'latency=500,jitter=200,loss=1,dup=0.1,reorder=0.5,rate=10000'.");
+#endif
     printf("\r\n\r\n");
     fflush(stdout);
 }
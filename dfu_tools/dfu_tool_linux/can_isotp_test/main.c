@@ -0,0 +1,564 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: main.c (can_isotp_test)
+**
+** DESCRIPTION: Checks the ISO-TP segmentation and flow control in
+**              can_isotp.c over an in-memory CAN bus.
+**
+** Two ISO-TP instances sit on either end of the bus: the tester, on
+** the tool's IDs, and a target that echoes every message it gets back.
+** Each case sends messages of every interesting length (single frame
+** edges, the 4095 byte first frame edge, MAX_MSG_LEN) and checks the
+** echo byte for byte:
+**
+**   fd / classic          64 or 8 byte frames, no flow limits
+**   fd-bs3 / classic-bs3  The target asks for blocks of 3 frames,
+**                         200 uS apart (STmin 0xF2)
+**   fd-drop / classic-drop Every 37th frame is lost on the bus.  Lost
+**                         messages must time out; nothing may come
+**                         back corrupted, and the link must recover.
+**
+** plus a functional send too long for one frame, which must be refused.
+** This program stands in for can_sockets.c, so it is built from
+** can_isotp.c directly rather than linked against libdfu_lib.
+**
+**   can_isotp_test [--case name]
+**
+** Exits non-zero if any case failed.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dfu_client_config.h"
+#include "async_timer.h"
+#include "can_sockets.h"
+#include "can_isotp.h"
+
+/*
+** The bus: what one end sends lands in the other end's queue.
+**
+*/
+#define TEST_BUS_QUEUE_LEN              (4096U)
+#define TEST_TESTER                     (0U)
+#define TEST_TARGET                     (1U)
+
+/*
+** The target listens on TEST_TARGET_ID and answers on its response ID.
+**
+*/
+#define TEST_TARGET_ID                  (0x7E0U)
+#define TEST_RESPONSE_ID                (TEST_TARGET_ID + CAN_RESPONSE_ID_OFFSET)
+
+/*
+** How long the tester waits for an echo.
+**
+*/
+#define TEST_ECHO_TIMEOUT_MS            (3000U)
+
+typedef struct
+{
+    uint32_t                    canId;
+    uint8_t                     len;
+    uint8_t                     data[CAN_FD_MAX_DATA];
+}testFrameStruct;
+
+typedef struct
+{
+    testFrameStruct             frames[TEST_BUS_QUEUE_LEN];
+    uint32_t                    head;
+    uint32_t                    tail;
+    pthread_mutex_t             lock;
+    pthread_cond_t              ready;
+}testQueueStruct;
+
+/*
+** One test case.
+**
+*/
+typedef struct
+{
+    const char *                name;
+    bool                        fdFrames;
+    uint8_t                     blockSize;
+    uint8_t                     stMin;
+    uint32_t                    dropEvery;
+}testCaseStruct;
+
+static const testCaseStruct     testCases[] =
+{
+    { "fd",             true,   0, 0x00,  0 },
+    { "classic",        false,  0, 0x00,  0 },
+    { "fd-bs3",         true,   3, 0xF2,  0 },
+    { "classic-bs3",    false,  3, 0xF2,  0 },
+    { "fd-drop",        true,   0, 0x00, 37 },
+    { "classic-drop",   false,  0, 0x00, 37 },
+};
+
+static const uint32_t           testSizes[] =
+{
+    1, 6, 7, 8, 11, 62, 63, 64, 100, 126, 127, 1000, 4095, 4096, 4097, 8000, MAX_MSG_LEN
+};
+
+static dfu_can_sock_t           testSocks[2];
+static testQueueStruct          testQueues[2];
+static testFrameStruct          testPending[2][CAN_BATCH_MAX_FRAMES];
+static uint32_t                 testPendingCount[2];
+static testFrameStruct          testCurrent[2];
+static uint32_t                 testDropEvery;
+static uint32_t                 testFramesOnBus;
+
+static canIsoTpStruct           testerTp;
+static canIsoTpStruct           targetTp;
+static volatile bool            targetStop;
+static uint8_t                  testMsg[MAX_MSG_LEN];
+static uint8_t                  targetEcho[MAX_MSG_LEN];
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static uint32_t _testSockIndex(dfu_can_sock_t *socketHandle);
+static void _testBusReset(bool fdFrames, uint32_t dropEvery);
+static void *_testTargetThread(void *arg);
+static bool _testRunCase(const testCaseStruct *testCase);
+static bool _testFunctionalTooLong(void);
+
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                 IN-MEMORY STAND-INS FOR can_sockets.c
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+uint8_t get_can_max_data(dfu_can_sock_t * socketHandle)
+{
+    return (socketHandle->maxData);
+}
+
+uint8_t get_can_frame_len(uint8_t len)
+{
+    static const uint8_t        fdLens[] = {8, 12, 16, 20, 24, 32, 48, 64};
+    uint8_t                     ret = CAN_FD_MAX_DATA;
+    uint32_t                    index;
+
+    for (index = 0; index < (sizeof(fdLens) / sizeof(fdLens[0])); index++)
+    {
+        if (len <= fdLens[index])
+        {
+            ret = fdLens[index];
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+bool queue_can_frame(dfu_can_sock_t * socketHandle, uint32_t canId, const uint8_t *data, uint8_t len)
+{
+    bool                        ret = false;
+    uint32_t                    sock = _testSockIndex(socketHandle);
+
+    if (len <= socketHandle->maxData)
+    {
+        testFrameStruct *       frame;
+
+        if (testPendingCount[sock] >= CAN_BATCH_MAX_FRAMES)
+        {
+            flush_can_frames(socketHandle);
+        }
+
+        frame = &testPending[sock][testPendingCount[sock]++];
+        frame->canId = canId;
+        frame->len = (socketHandle->fdFrames) ? get_can_frame_len(len) : CAN_CLASSIC_MAX_DATA;
+        memcpy(frame->data, data, len);
+        memset(&frame->data[len], CAN_ISOTP_PAD_BYTE, frame->len - len);
+        ret = true;
+    }
+
+    return (ret);
+}
+
+uint32_t flush_can_frames(dfu_can_sock_t * socketHandle)
+{
+    uint32_t                    sock = _testSockIndex(socketHandle);
+    testQueueStruct *           queue = &testQueues[1U - sock];
+    uint32_t                    ret = testPendingCount[sock];
+    uint32_t                    index;
+
+    pthread_mutex_lock(&queue->lock);
+    for (index = 0; index < ret; index++)
+    {
+        testFramesOnBus++;
+        if ( (testDropEvery > 0) && ((testFramesOnBus % testDropEvery) == 0) )
+        {
+            continue;
+        }
+
+        if ((queue->tail - queue->head) < TEST_BUS_QUEUE_LEN)
+        {
+            queue->frames[queue->tail % TEST_BUS_QUEUE_LEN] = testPending[sock][index];
+            queue->tail++;
+        }
+    }
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+
+    testPendingCount[sock] = 0;
+
+    return (ret);
+}
+
+bool set_can_rx_filter(dfu_can_sock_t * socketHandle,
+                       const uint32_t *ids,
+                       const uint32_t *masks,
+                       uint32_t count)
+{
+    (void)socketHandle;
+    (void)ids;
+    (void)masks;
+    (void)count;
+
+    return (true);
+}
+
+bool receive_can_frame(dfu_can_sock_t * socketHandle,
+                       uint32_t timeoutMS,
+                       uint32_t *canId,
+                       const uint8_t **data,
+                       uint8_t *len)
+{
+    bool                        ret = false;
+    uint32_t                    sock = _testSockIndex(socketHandle);
+    testQueueStruct *           queue = &testQueues[sock];
+    struct timespec             until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += (long)timeoutMS * 1000000L;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&queue->lock);
+    while (
+              (queue->head == queue->tail) &&
+              (timeoutMS > 0) &&
+              (pthread_cond_timedwait(&queue->ready, &queue->lock, &until) != ETIMEDOUT)
+          )
+    {
+    }
+
+    if (queue->head != queue->tail)
+    {
+        testCurrent[sock] = queue->frames[queue->head % TEST_BUS_QUEUE_LEN];
+        queue->head++;
+
+        *canId = testCurrent[sock].canId;
+        *data = testCurrent[sock].data;
+        *len = testCurrent[sock].len;
+        ret = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return (ret);
+}
+
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                                    MAIN
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+int main(int argc, char **argv)
+{
+    const char *                only = NULL;
+    uint32_t                    failed = 0;
+    uint32_t                    index;
+
+    if ( (argc > 2) && (strcmp(argv[1], "--case") == 0) )
+    {
+        only = argv[2];
+    }
+
+    TIMER_initMSTimer();
+    for (index = 0; index < 2; index++)
+    {
+        pthread_mutex_init(&testQueues[index].lock, NULL);
+        pthread_cond_init(&testQueues[index].ready, NULL);
+    }
+
+    for (index = 0; index < (sizeof(testCases) / sizeof(testCases[0])); index++)
+    {
+        if ( (only == NULL) || (strcmp(only, testCases[index].name) == 0) )
+        {
+            if (!_testRunCase(&testCases[index]))
+            {
+                failed++;
+            }
+        }
+    }
+
+    if ( (only == NULL) || (strcmp(only, "functional") == 0) )
+    {
+        if (!_testFunctionalTooLong())
+        {
+            failed++;
+        }
+    }
+
+    printf("\r\n %s (%u failed)\r\n", (failed == 0) ? "PASS" : "FAIL", failed);
+
+    return ((failed == 0) ? 0 : 1);
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _testSockIndex
+**
+** DESCRIPTION: Which end of the bus a socket is.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _testSockIndex(dfu_can_sock_t *socketHandle)
+{
+    return ((socketHandle == &testSocks[TEST_TARGET]) ? TEST_TARGET : TEST_TESTER);
+}
+
+/*!
+** FUNCTION: _testBusReset
+**
+** DESCRIPTION: Empties the bus and sets both ends up for a case.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _testBusReset(bool fdFrames, uint32_t dropEvery)
+{
+    uint32_t                    index;
+
+    for (index = 0; index < 2; index++)
+    {
+        pthread_mutex_lock(&testQueues[index].lock);
+        testQueues[index].head = 0;
+        testQueues[index].tail = 0;
+        pthread_mutex_unlock(&testQueues[index].lock);
+
+        testPendingCount[index] = 0;
+        testSocks[index].fdFrames = fdFrames;
+        testSocks[index].maxData = (uint8_t)((fdFrames) ? CAN_FD_MAX_DATA : CAN_CLASSIC_MAX_DATA);
+    }
+
+    testDropEvery = dropEvery;
+    testFramesOnBus = 0;
+
+    return;
+}
+
+/*!
+** FUNCTION: _testTargetThread
+**
+** DESCRIPTION: The target: echoes every message back on its response
+**              ID until told to stop.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void *_testTargetThread(void *arg)
+{
+    const uint8_t *             msg;
+    uint32_t                    canId = 0;
+    uint16_t                    len = 0;
+
+    (void)arg;
+
+    while (!targetStop)
+    {
+        msg = canIsoTpReceive(&targetTp, 5, &canId, &len);
+        if ( (msg) && (canId == TEST_TARGET_ID) )
+        {
+            memcpy(targetEcho, msg, len);
+            canIsoTpSend(&targetTp, TEST_RESPONSE_ID, TEST_TARGET_ID, targetEcho, len);
+        }
+    }
+
+    return (NULL);
+}
+
+/*!
+** FUNCTION: _testRunCase
+**
+** DESCRIPTION: Sends every test size through the target and checks
+**              what comes back.
+**
+** PARAMETERS:
+**
+** RETURNS: true if the case passed.
+**
+** COMMENTS: Without drops every echo must come back intact.  With
+**           drops an echo may be missing, but one that does come back
+**           must be intact, and the last message (sent after a pause
+**           with the drops turned off) must get through.
+**
+*/
+static bool _testRunCase(const testCaseStruct *testCase)
+{
+    bool                        ret = true;
+    pthread_t                   target;
+    canIsoTpStatsStruct         testerStats;
+    canIsoTpStatsStruct         targetStats;
+    uint32_t                    lost = 0;
+    uint32_t                    index;
+    uint64_t                    startUS = TIMER_GetMicroseconds();
+
+    _testBusReset(testCase->fdFrames, testCase->dropEvery);
+
+    // The target's flow control goes back to whatever it received on,
+    // plus the response offset.
+    canIsoTpInit(&testerTp, &testSocks[TEST_TESTER], CAN_RESPONSE_ID_OFFSET);
+    canIsoTpInit(&targetTp, &testSocks[TEST_TARGET], 0U - CAN_RESPONSE_ID_OFFSET);
+    targetTp.blockSize = testCase->blockSize;
+    targetTp.stMin = testCase->stMin;
+
+    targetStop = false;
+    pthread_create(&target, NULL, _testTargetThread, NULL);
+
+    for (index = 0; index <= (sizeof(testSizes) / sizeof(testSizes[0])); index++)
+    {
+        const uint8_t *         echo = NULL;
+        uint32_t                len;
+        uint32_t                canId = 0;
+        uint16_t                echoLen = 0;
+        uint32_t                byte;
+        bool                    sent;
+        ASYNC_TIMER_STRUCT      timer;
+
+        if (index == (sizeof(testSizes) / sizeof(testSizes[0])))
+        {
+            // Recovery: a clean bus, once everything in flight has
+            // timed out on both ends.
+            if (testCase->dropEvery == 0)
+            {
+                break;
+            }
+            TIMER_SleepUS((uint64_t)(CAN_ISOTP_FC_TIMEOUT_MS + CAN_ISOTP_CF_TIMEOUT_MS) * 1000U);
+            testDropEvery = 0;
+            len = MAX_MSG_LEN;
+        }
+        else
+        {
+            len = testSizes[index];
+        }
+
+        for (byte = 0; byte < len; byte++)
+        {
+            testMsg[byte] = (uint8_t)((byte * 7U) + index);
+        }
+
+        sent = canIsoTpSend(&testerTp, TEST_TARGET_ID, TEST_RESPONSE_ID, testMsg, len);
+
+        TIMER_Start(&timer);
+        while ( (sent) && (echo == NULL) && (!TIMER_Finished(&timer, TEST_ECHO_TIMEOUT_MS)) )
+        {
+            echo = canIsoTpReceive(&testerTp, 10, &canId, &echoLen);
+        }
+
+        if (echo == NULL)
+        {
+            lost++;
+            if ( (testCase->dropEvery == 0) || (testDropEvery == 0) )
+            {
+                printf("\r\n   %s: no echo for %u bytes (sent: %s)", testCase->name, len, sent ? "yes" : "no");
+                ret = false;
+            }
+        }
+        else
+        if (
+               (canId != TEST_RESPONSE_ID) ||
+               (echoLen != len) ||
+               (memcmp(echo, testMsg, len) != 0)
+           )
+        {
+            printf("\r\n   %s: bad echo for %u bytes (%u bytes on %X)", testCase->name, len, echoLen, canId);
+            ret = false;
+        }
+    }
+
+    targetStop = true;
+    pthread_join(target, NULL);
+
+    canIsoTpGetStats(&testerTp, &testerStats);
+    canIsoTpGetStats(&targetTp, &targetStats);
+    printf("\r\n %-13s %s  %7.1f mS  lost %2u  tester: sent %u rcvd %u frames %u timeouts %u errors %u"
+           "  target: sent %u rcvd %u frames %u timeouts %u errors %u",
+           testCase->name,
+           ret ? "ok  " : "FAIL",
+           (double)(TIMER_GetMicroseconds() - startUS) / 1000.0,
+           lost,
+           testerStats.messagesSent, testerStats.messagesReceived, testerStats.framesSent,
+           testerStats.timeouts, testerStats.errors,
+           targetStats.messagesSent, targetStats.messagesReceived, targetStats.framesSent,
+           targetStats.timeouts, targetStats.errors);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testFunctionalTooLong
+**
+** DESCRIPTION: A functional (many-target) send gets no flow control,
+**              so one that needs more than a frame must be refused.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it was.
+**
+** COMMENTS:
+**
+*/
+static bool _testFunctionalTooLong(void)
+{
+    bool                        ret;
+
+    _testBusReset(true, 0);
+    canIsoTpInit(&testerTp, &testSocks[TEST_TESTER], CAN_RESPONSE_ID_OFFSET);
+
+    memset(testMsg, 0, 100);
+    ret = !canIsoTpSend(&testerTp, CAN_FUNCTIONAL_ID, 0, testMsg, 100);
+
+    printf("\r\n %-13s %s", "functional", ret ? "ok  " : "FAIL");
+
+    return (ret);
+}
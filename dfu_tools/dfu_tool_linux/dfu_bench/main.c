@@ -0,0 +1,1181 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: main.c (dfu_bench)
+**
+** DESCRIPTION: End-to-end transfer benchmark.
+**
+** Runs the install sequence the tools send (BEGIN_SESSION, the
+** challenge response, BEGIN_RCV, the data transfer, RCV_COMPLETE,
+** INSTALL_IMAGE) against simulated targets (dfu_sim), for every
+** combination of image size, MTU and concurrency asked for, and writes
+** the results as JSON.  The commands go straight to the simulator and
+** the data through the window engine (xferWindowRun), not through the
+** protocol library.
+**
+** By default the window is XFER_BLOCKING_WINDOW_SIZE, the one the tools
+** run at against a real board.  A larger "--window" or "--multicast"
+** measures the engine alone, on a path the shipped tools don't take;
+** those results carry "tool_path": false and must not be compared with
+** a tool's.
+**
+**   dfu_bench [--sizes 65536,1048576] [--mtus 512,1400,8192]
+**             [--concurrency 1,4] [--window 1] [--repeat 3]
+**             [--erase-us N] [--write-us-per-kb N] [--latency-us N]
+**             [--impair profile] [--multicast] [--out results.json]
+**
+** "--impair" runs every transfer's chunks and acks through the
+** impairment shim (net_impair), e.g. "--impair lossy,seed=7".  Each
+** device gets its own seeds, so a run is repeatable.
+**
+** "--multicast" sends each point's image once to all its devices
+** through the multicast engine (xfer_multicast) and the simulator's
+** broadcast group, instead of once per device.  "wire_chunks" counts
+** the chunks sent in either mode, for comparing air time.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "dfu_client_config.h"
+#include "async_timer.h"
+#include "xfer_window.h"
+#include "xfer_rtt.h"
+#include "image_xfer.h"
+#include "xfer_multicast.h"
+#include "dfu_sim.h"
+#include "net_impair.h"
+
+/*
+** Longest list a sweep option takes.
+**
+*/
+#define BENCH_MAX_LIST                  (16U)
+
+/*
+** Sends remembered per device for RTT timing (a power of 2, bigger than
+** any window).
+**
+*/
+#define BENCH_SEND_HISTORY              (256U)
+
+/*
+** Image index the benchmark installs to.
+**
+*/
+#define BENCH_IMAGE_INDEX               (1)
+
+/*
+** A chunk held by the impairment: sequence number and offset, then the
+** data.
+**
+*/
+#define BENCH_IMPAIR_HEADER_LEN         (8U)
+
+/*
+** Sweep settings.
+**
+*/
+typedef struct
+{
+    uint32_t                sizes[BENCH_MAX_LIST];
+    uint32_t                sizeCount;
+    uint32_t                mtus[BENCH_MAX_LIST];
+    uint32_t                mtuCount;
+    uint32_t                concurrency[BENCH_MAX_LIST];
+    uint32_t                concurrencyCount;
+    uint32_t                window;
+    uint32_t                repeat;
+    dfuSimConfigStruct      sim;
+    const char *            impairText;
+    netImpairProfileStruct  impair;
+    bool                    multicast;
+    const char *            outPath;
+}benchOptionsStruct;
+
+/*
+** Growable list of RTT samples, in uS.
+**
+*/
+typedef struct
+{
+    uint32_t *              values;
+    uint32_t                count;
+    uint32_t                size;
+}benchSamplesStruct;
+
+/*
+** One device's transfer: the simulator's transport, wrapped so every
+** chunk's send-to-ack time is recorded.
+**
+*/
+typedef struct
+{
+    dfuSimDeviceStruct *    sim;
+    xferTransportOps        inner;
+    const uint8_t *         image;
+    uint32_t                imageSize;
+    uint16_t                mtu;
+    uint16_t                window;
+
+    uint64_t                sentUS[BENCH_SEND_HISTORY];
+    uint32_t                sentSeq[BENCH_SEND_HISTORY];
+    bool                    sampled[BENCH_SEND_HISTORY];
+    uint32_t                ackedSeq;
+    benchSamplesStruct      rtt;
+
+    netImpairStruct *       txImpair;
+    netImpairStruct *       rxImpair;
+    uint8_t                 impairStage[BENCH_IMPAIR_HEADER_LEN + XFER_MAX_CHUNK_LEN];
+
+    bool                    ok;
+    bool                    verified;
+    xferWindowStatsStruct   stats;
+    uint64_t                dataStartUS;
+    uint64_t                dataEndUS;
+}benchSessionStruct;
+
+/*
+** Internal prototypes.
+**
+*/
+static bool _benchParseArgs(int argc, char **argv, benchOptionsStruct *options);
+static uint32_t _benchParseList(const char *text, uint32_t *list);
+static bool _benchRun(FILE *out, const benchOptionsStruct *options, uint32_t size, uint32_t mtu, uint32_t concurrency, uint32_t repeat, bool first);
+static void *_benchSessionThread(void *arg);
+static uint64_t _benchMulticast(benchSessionStruct *sessions, uint32_t count);
+static bool _benchStartImage(benchSessionStruct *session, uint16_t *mtu);
+static void _benchFinishImage(benchSessionStruct *session);
+static bool _benchSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len);
+static bool _benchPollAck(void *ctx, xferAckStruct *ack, uint32_t timeoutMS);
+static bool _benchImpairPollAck(benchSessionStruct *session, xferAckStruct *ack, uint32_t timeoutMS);
+static void _benchImpairSend(benchSessionStruct *session);
+static void _benchSampleSeq(benchSessionStruct *session, uint32_t seq, uint64_t nowUS);
+static void _benchAddSample(benchSamplesStruct *samples, uint32_t value);
+static uint32_t _benchPercentile(const benchSamplesStruct *samples, uint32_t perMille);
+static int _benchCompare(const void *a, const void *b);
+static uint64_t _benchCpuUS(void);
+
+/*!
+** FUNCTION: main
+**
+** DESCRIPTION: Runs the sweep and writes the JSON report.
+**
+** PARAMETERS:
+**
+** RETURNS: 0 if every transfer succeeded and verified.
+**
+** COMMENTS:
+**
+*/
+int main(int argc, char **argv)
+{
+    int                     ret = 1;
+    benchOptionsStruct      options;
+
+    if (_benchParseArgs(argc, argv, &options))
+    {
+        FILE *              out = (options.outPath) ? fopen(options.outPath, "w") : stdout;
+
+        if (out)
+        {
+            uint32_t        sizeIndex;
+            uint32_t        mtuIndex;
+            uint32_t        concurrencyIndex;
+            uint32_t        repeat;
+            bool            first = true;
+
+            fprintf(out, "{\n  \"tool\": \"dfu_bench\",\n");
+            fprintf(out,
+                    "  \"target\": {\"erase_us_per_sector\": %u, \"sector_size\": %u, \"write_us_per_kb\": %u, "
+                    "\"install_us\": %u, \"latency_us\": %u, \"rx_window\": %u, \"ack_every\": %u},\n",
+                    options.sim.eraseUSPerSector,
+                    options.sim.sectorSize,
+                    options.sim.writeUSPerKB,
+                    options.sim.installUS,
+                    options.sim.latencyUS,
+                    options.sim.rxWindow,
+                    options.sim.ackEvery);
+            if (options.impairText)
+            {
+                fprintf(out,
+                        "  \"impair\": {\"profile\": \"%s\", \"latency_us\": %u, \"jitter_us\": %u, \"loss_ppm\": %u, "
+                        "\"duplicate_ppm\": %u, \"reorder_ppm\": %u, \"reorder_us\": %u, \"rate_kbps\": %u, \"seed\": %u},\n",
+                        options.impairText,
+                        options.impair.latencyUS,
+                        options.impair.jitterUS,
+                        options.impair.lossPPM,
+                        options.impair.duplicatePPM,
+                        options.impair.reorderPPM,
+                        options.impair.reorderUS,
+                        options.impair.rateKbps,
+                        options.impair.seed);
+            }
+            fprintf(out, "  \"runs\": [");
+
+            ret = 0;
+            for (sizeIndex = 0; sizeIndex < options.sizeCount; sizeIndex++)
+            {
+                for (mtuIndex = 0; mtuIndex < options.mtuCount; mtuIndex++)
+                {
+                    for (concurrencyIndex = 0; concurrencyIndex < options.concurrencyCount; concurrencyIndex++)
+                    {
+                        for (repeat = 0; repeat < options.repeat; repeat++)
+                        {
+                            if (!_benchRun(out,
+                                           &options,
+                                           options.sizes[sizeIndex],
+                                           options.mtus[mtuIndex],
+                                           options.concurrency[concurrencyIndex],
+                                           repeat,
+                                           first))
+                            {
+                                ret = 1;
+                            }
+                            first = false;
+                        }
+                    }
+                }
+            }
+
+            fprintf(out, "\n  ]\n}\n");
+            if (out != stdout)
+            {
+                fclose(out);
+                printf("\r\n Results written to [%s]\r\n", options.outPath);
+            }
+        }
+        else
+        {
+            printf("\r\n Could not open [%s]!\r\n", options.outPath);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchParseArgs
+**
+** DESCRIPTION: Fills in the options, starting from the defaults.
+**
+** PARAMETERS:
+**
+** RETURNS: false (after printing the usage) on a bad argument.
+**
+** COMMENTS:
+**
+*/
+static bool _benchParseArgs(int argc, char **argv, benchOptionsStruct *options)
+{
+    bool                    ret = true;
+    int                     index;
+
+    memset(options, 0, sizeof(*options));
+    options->sizes[0] = 64U * 1024U;
+    options->sizes[1] = 1024U * 1024U;
+    options->sizeCount = 2;
+    options->mtus[0] = 512;
+    options->mtus[1] = 1400;
+    options->mtus[2] = 8192;
+    options->mtuCount = 3;
+    options->concurrency[0] = 1;
+    options->concurrency[1] = 4;
+    options->concurrencyCount = 2;
+    options->window = XFER_BLOCKING_WINDOW_SIZE;
+    options->repeat = 3;
+    dfuSimDefaultConfig(&options->sim);
+
+    for (index = 1; (ret) && (index < argc); index++)
+    {
+        const char *        value = (index + 1 < argc) ? argv[index + 1] : NULL;
+
+        if (strcmp(argv[index], "--multicast") == 0)
+        {
+            options->multicast = true;
+            continue;
+        }
+
+        if (value == NULL)
+        {
+            ret = false;
+        }
+        else
+        if (strcmp(argv[index], "--sizes") == 0)
+        {
+            options->sizeCount = _benchParseList(value, options->sizes);
+        }
+        else
+        if (strcmp(argv[index], "--mtus") == 0)
+        {
+            options->mtuCount = _benchParseList(value, options->mtus);
+        }
+        else
+        if (strcmp(argv[index], "--concurrency") == 0)
+        {
+            options->concurrencyCount = _benchParseList(value, options->concurrency);
+        }
+        else
+        if (strcmp(argv[index], "--window") == 0)
+        {
+            options->window = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--repeat") == 0)
+        {
+            options->repeat = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--erase-us") == 0)
+        {
+            options->sim.eraseUSPerSector = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--write-us-per-kb") == 0)
+        {
+            options->sim.writeUSPerKB = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--latency-us") == 0)
+        {
+            options->sim.latencyUS = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--impair") == 0)
+        {
+            options->impairText = value;
+            ret = netImpairParseProfile(value, &options->impair);
+        }
+        else
+        if (strcmp(argv[index], "--out") == 0)
+        {
+            options->outPath = value;
+        }
+        else
+        {
+            ret = false;
+        }
+        index++;
+    }
+
+    if (
+           (options->sizeCount == 0) ||
+           (options->mtuCount == 0) ||
+           (options->concurrencyCount == 0) ||
+           (options->window == 0) ||
+           (options->repeat == 0) ||
+           ( (options->multicast) && (options->impairText) )
+       )
+    {
+        ret = false;
+    }
+
+    if (!ret)
+    {
+        printf("\r\n Usage: dfu_bench [--sizes a,b,..] [--mtus a,b,..] [--concurrency a,b,..]");
+        printf("\r\n                  [--window N] [--repeat N] [--erase-us N] [--write-us-per-kb N]");
+        printf("\r\n                  [--latency-us N] [--impair profile] [--multicast] [--out file.json]");
+        printf("\r\n   Concurrency is capped at %u simulated devices.", DFU_SIM_MAX_DEVICES);
+        printf("\r\n   --multicast and --impair don't go together.\r\n");
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchParseList
+**
+** DESCRIPTION: "a,b,c" into a list.
+**
+** PARAMETERS:
+**
+** RETURNS: How many values were read (0 values are skipped).
+**
+** COMMENTS:
+**
+*/
+static uint32_t _benchParseList(const char *text, uint32_t *list)
+{
+    uint32_t                ret = 0;
+    char *                  end = NULL;
+
+    while ( (text) && (*text) && (ret < BENCH_MAX_LIST) )
+    {
+        uint32_t            value = (uint32_t)strtoul(text, &end, 0);
+
+        if (end == text)
+        {
+            break;
+        }
+        if (value > 0)
+        {
+            list[ret++] = value;
+        }
+        text = (*end == ',') ? end + 1 : end;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchRun
+**
+** DESCRIPTION: One point of the sweep: "concurrency" devices, each
+**              installing the same image at the same time.
+**
+** PARAMETERS: first: No comma before this run's JSON object.
+**
+** RETURNS: true if every device got (and verified) the image.
+**
+** COMMENTS: Throughput is the data phase only (from the first chunk to
+**           the last ack); "elapsed_ms" covers the whole sequence,
+**           including the erase and install.  CPU time is the whole
+**           process, simulator threads included.  With --multicast the
+**           devices share one transfer, run on this thread.
+**
+*/
+static bool _benchRun(FILE *out, const benchOptionsStruct *options, uint32_t size, uint32_t mtu, uint32_t concurrency, uint32_t repeat, bool first)
+{
+    bool                    ret = false;
+    benchSessionStruct *    sessions;
+    pthread_t               threads[DFU_SIM_MAX_DEVICES];
+    uint8_t *               image = (uint8_t *)malloc(size);
+    uint32_t                index;
+    uint32_t                started = 0;
+
+    if (concurrency > DFU_SIM_MAX_DEVICES)
+    {
+        concurrency = DFU_SIM_MAX_DEVICES;
+    }
+    sessions = (benchSessionStruct *)calloc(concurrency, sizeof(benchSessionStruct));
+
+    if ( (image) && (sessions) )
+    {
+        benchSamplesStruct  rtt = {NULL, 0, 0};
+        uint64_t            bytes = 0;
+        uint64_t            chunks = 0;
+        uint64_t            wireChunks = 0;
+        bool                multicast = ( (options->multicast) && (concurrency > 1) );
+        bool                toolPath = ( (!multicast) && (options->window == XFER_BLOCKING_WINDOW_SIZE) );
+        uint32_t            retransmits = 0;
+        uint32_t            timeouts = 0;
+        netImpairStatsStruct chunkImpair;
+        netImpairStatsStruct ackImpair;
+        bool                ok = true;
+        uint64_t            startUS;
+        uint64_t            elapsedUS;
+        uint64_t            dataStartUS = UINT64_MAX;
+        uint64_t            dataEndUS = 0;
+        uint64_t            cpuUS;
+        double              seconds;
+
+        memset(&chunkImpair, 0, sizeof(chunkImpair));
+        memset(&ackImpair, 0, sizeof(ackImpair));
+
+        srand(size ^ mtu);
+        for (index = 0; index < size; index++)
+        {
+            image[index] = (uint8_t)rand();
+        }
+
+        for (index = 0; index < concurrency; index++)
+        {
+            dfuSimConfigStruct  config = options->sim;
+
+            config.mac[5] = (uint8_t)(index + 1);
+            sessions[index].sim = dfuSimCreate(&config);
+            sessions[index].image = image;
+            sessions[index].imageSize = size;
+            sessions[index].mtu = (uint16_t)mtu;
+            sessions[index].window = (uint16_t)options->window;
+
+            if ( (sessions[index].sim) && (options->impairText) )
+            {
+                netImpairProfileStruct  profile = options->impair;
+
+                profile.seed = options->impair.seed + (2 * index);
+                sessions[index].txImpair = netImpairCreate(&profile, (uint16_t)(BENCH_IMPAIR_HEADER_LEN + XFER_MAX_CHUNK_LEN));
+                profile.seed++;
+                sessions[index].rxImpair = netImpairCreate(&profile, (uint16_t)sizeof(xferAckStruct));
+
+                if (
+                       (sessions[index].txImpair == NULL) ||
+                       (sessions[index].rxImpair == NULL)
+                   )
+                {
+                    printf("\r\n No impairment for device %u!", index);
+                    dfuSimDestroy(sessions[index].sim);
+                    sessions[index].sim = NULL;
+                }
+            }
+        }
+
+        cpuUS = _benchCpuUS();
+        startUS = TIMER_GetMicroseconds();
+
+        if (multicast)
+        {
+            wireChunks = _benchMulticast(sessions, concurrency);
+        }
+        else
+        {
+            for (index = 0; index < concurrency; index++)
+            {
+                if (
+                       (sessions[index].sim) &&
+                       (pthread_create(&threads[index], NULL, _benchSessionThread, &sessions[index]) == 0)
+                   )
+                {
+                    started |= (1U << index);
+                }
+            }
+            for (index = 0; index < concurrency; index++)
+            {
+                if (started & (1U << index))
+                {
+                    pthread_join(threads[index], NULL);
+                }
+            }
+        }
+
+        elapsedUS = TIMER_GetMicroseconds() - startUS;
+        cpuUS = _benchCpuUS() - cpuUS;
+
+        for (index = 0; index < concurrency; index++)
+        {
+            uint32_t        sample;
+            netImpairStatsStruct impairStats;
+
+            if (sessions[index].dataEndUS > 0)
+            {
+                dataStartUS = (sessions[index].dataStartUS < dataStartUS) ? sessions[index].dataStartUS : dataStartUS;
+                dataEndUS = (sessions[index].dataEndUS > dataEndUS) ? sessions[index].dataEndUS : dataEndUS;
+            }
+            ok = (ok && (sessions[index].ok) && (sessions[index].verified));
+            bytes += sessions[index].stats.bytesAcked;
+            chunks += sessions[index].stats.chunksSent;
+            retransmits += sessions[index].stats.retransmits;
+            timeouts += sessions[index].stats.timeouts;
+            for (sample = 0; sample < sessions[index].rtt.count; sample++)
+            {
+                _benchAddSample(&rtt, sessions[index].rtt.values[sample]);
+            }
+            netImpairGetStats(sessions[index].txImpair, &impairStats);
+            chunkImpair.lost += impairStats.lost + impairStats.overflowed;
+            chunkImpair.duplicated += impairStats.duplicated;
+            chunkImpair.reordered += impairStats.reordered;
+            netImpairGetStats(sessions[index].rxImpair, &impairStats);
+            ackImpair.lost += impairStats.lost + impairStats.overflowed;
+            ackImpair.duplicated += impairStats.duplicated;
+            ackImpair.reordered += impairStats.reordered;
+
+            free(sessions[index].rtt.values);
+            netImpairDestroy(sessions[index].txImpair);
+            netImpairDestroy(sessions[index].rxImpair);
+            dfuSimDestroy(sessions[index].sim);
+        }
+
+        if (!multicast)
+        {
+            wireChunks = chunks;
+        }
+
+        if (rtt.count > 0)
+        {
+            qsort(rtt.values, rtt.count, sizeof(uint32_t), _benchCompare);
+        }
+        seconds = (dataEndUS > dataStartUS) ? (double)(dataEndUS - dataStartUS) / 1000000.0 : 1.0;
+
+        fprintf(out,
+                "%s\n    {\"image_size\": %u, \"mtu\": %u, \"concurrency\": %u, \"window\": %u, \"repeat\": %u, "
+                "\"mode\": \"%s\", \"tool_path\": %s, \"ok\": %s, \"bytes\": %llu, \"wire_chunks\": %llu, \"elapsed_ms\": %.3f, \"bytes_per_sec\": %.0f, "
+                "\"transactions_per_sec\": %.0f, \"retransmits\": %u, \"timeouts\": %u, "
+                "\"rtt_us\": {\"samples\": %u, \"p50\": %u, \"p99\": %u, \"p999\": %u}, "
+                "\"impaired\": {\"chunks_lost\": %u, \"chunks_duplicated\": %u, \"chunks_reordered\": %u, "
+                "\"acks_lost\": %u, \"acks_duplicated\": %u, \"acks_reordered\": %u}, "
+                "\"cpu_ms_per_mb\": %.3f}",
+                first ? "" : ",",
+                size,
+                mtu,
+                concurrency,
+                options->window,
+                repeat,
+                multicast ? "multicast" : "unicast",
+                toolPath ? "true" : "false",
+                ok ? "true" : "false",
+                (unsigned long long)bytes,
+                (unsigned long long)wireChunks,
+                (double)elapsedUS / 1000.0,
+                (double)bytes / seconds,
+                (double)wireChunks / seconds,
+                retransmits,
+                timeouts,
+                rtt.count,
+                _benchPercentile(&rtt, 500),
+                _benchPercentile(&rtt, 990),
+                _benchPercentile(&rtt, 999),
+                chunkImpair.lost,
+                chunkImpair.duplicated,
+                chunkImpair.reordered,
+                ackImpair.lost,
+                ackImpair.duplicated,
+                ackImpair.reordered,
+                (bytes > 0) ? ((double)cpuUS / 1000.0) / ((double)bytes / (1024.0 * 1024.0)) : 0.0);
+        fflush(out);
+
+        printf("\r\n %8u bytes  MTU %5u  x%u%s  #%u : %s  %10.0f B/s  %llu chunks sent%s",
+               size,
+               mtu,
+               concurrency,
+               multicast ? " multicast" : "",
+               repeat,
+               ok ? "ok    " : "FAILED",
+               (double)bytes / seconds,
+               (unsigned long long)wireChunks,
+               toolPath ? "" : "  (engine only)");
+        fflush(stdout);
+
+        free(rtt.values);
+        ret = ok;
+    }
+    else
+    {
+        printf("\r\n Out of memory for a %u byte image!", size);
+    }
+
+    free(sessions);
+    free(image);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchSessionThread
+**
+** DESCRIPTION: One device's install sequence, as sequence_ops and
+**              image_xfer run it.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void *_benchSessionThread(void *arg)
+{
+    benchSessionStruct *    session = (benchSessionStruct *)arg;
+    dfuSimDeviceStruct *    sim = session->sim;
+    xferTransportOps        ops;
+    xferWindowParamsStruct  params;
+    xferWindowStruct *      window = xferWindowCreate(session->window);
+    uint16_t                mtu;
+    xferRttStruct           rtt;
+
+    if (
+           (window) &&
+           (_benchStartImage(session, &mtu))
+       )
+    {
+        dfuSimTransportOps(sim, &session->inner);
+
+        memset(&ops, 0, sizeof(ops));
+        ops.ctx = session;
+        ops.sendChunk = _benchSendChunk;
+        ops.pollAck = _benchPollAck;
+        ops.flush = NULL;
+        ops.maxWindow = session->inner.maxWindow;
+
+        memset(&params, 0, sizeof(params));
+        params.transport = &ops;
+        params.image = session->image;
+        params.imageSize = session->imageSize;
+        params.chunkLen = (uint16_t)(mtu - 3);
+        params.windowSize = session->window;
+        params.ackTimeoutMS = XFER_ACK_TIMEOUT_MS;
+        params.maxRetransmits = XFER_MAX_RETRANSMITS;
+        xferRttGet(dfuSimMACString(sim), &rtt);
+        params.rtt = &rtt;
+
+        session->dataStartUS = TIMER_GetMicroseconds();
+        session->ok = xferWindowRun(window, &params, &session->stats);
+        session->dataEndUS = TIMER_GetMicroseconds();
+        xferRttPut(dfuSimMACString(sim), &rtt);
+
+        _benchFinishImage(session);
+    }
+
+    xferWindowDestroy(window);
+
+    return (NULL);
+}
+
+/*!
+** FUNCTION: _benchMulticast
+**
+** DESCRIPTION: Every device's install sequence, with one multicast data
+**              transfer shared by all of them.
+**
+** PARAMETERS:
+**
+** RETURNS: Chunks sent: the broadcasts plus every repair.
+**
+** COMMENTS: The control commands go to each device in turn, as
+**           xferImageMulticast() sends them.  Chunks are the smallest
+**           MTU's, and the window is --window or the tightest device's.
+**           A device's "bytes acked" is its image once it has all of
+**           it, and its retransmits are its repairs.
+**
+*/
+static uint64_t _benchMulticast(benchSessionStruct *sessions, uint32_t count)
+{
+    xferGroupMemberStruct   members[DFU_SIM_MAX_DEVICES];
+    dfuSimGroupStruct       group;
+    xferGroupTransportOps   ops;
+    uint16_t                chunkLen = UINT16_MAX;
+    uint64_t                startUS;
+    uint64_t                endUS;
+    uint32_t                index;
+
+    memset(members, 0, sizeof(members));
+    memset(&group, 0, sizeof(group));
+
+    for (index = 0; index < count; index++)
+    {
+        uint16_t            mtu;
+
+        members[index].destStr = (char *)dfuSimMACString(sessions[index].sim);
+        group.members[group.count++] = sessions[index].sim;
+
+        if ( (sessions[index].sim) && (_benchStartImage(&sessions[index], &mtu)) )
+        {
+            members[index].active = true;
+            if ((uint16_t)(mtu - 3) < chunkLen)
+            {
+                chunkLen = (uint16_t)(mtu - 3);
+            }
+        }
+    }
+
+    dfuSimGroupTransportOps(&group, &ops);
+    if (sessions[0].window < ops.maxWindow)
+    {
+        ops.maxWindow = sessions[0].window;
+    }
+
+    startUS = TIMER_GetMicroseconds();
+    (void)xferMulticastRun(sessions[0].image, sessions[0].imageSize, chunkLen, members, count, &ops);
+    endUS = TIMER_GetMicroseconds();
+
+    for (index = 0; index < count; index++)
+    {
+        sessions[index].ok = members[index].ok;
+        sessions[index].dataStartUS = startUS;
+        sessions[index].dataEndUS = endUS;
+        sessions[index].stats.bytesAcked = (members[index].ok) ? sessions[index].imageSize : 0;
+        sessions[index].stats.retransmits = members[index].repairs;
+
+        _benchFinishImage(&sessions[index]);
+    }
+
+    return ((uint64_t)group.broadcasts + group.unicasts);
+}
+
+/*!
+** FUNCTION: _benchStartImage
+**
+** DESCRIPTION: A device's sequence up to the image transfer: session,
+**              MTU, challenge response, BEGIN_RCV.
+**
+** PARAMETERS: mtu: The MTU agreed.
+**
+** RETURNS: false if any step failed.
+**
+** COMMENTS:
+**
+*/
+static bool _benchStartImage(benchSessionStruct *session, uint16_t *mtu)
+{
+    dfuSimDeviceStruct *    sim = session->sim;
+    static const uint8_t    response[64] = {0};
+
+    return (
+               (dfuSimBeginSession(sim, 0, 0) != 0) &&
+               ((*mtu = dfuSimNegotiateMTU(sim, session->mtu)) > 3) &&
+               (dfuSimBeginRcv(sim, DFU_SIM_SESSION_IMAGE_INDEX, sizeof(response), 0, false)) &&
+               (dfuSimRcvData(sim, response, sizeof(response))) &&
+               (dfuSimRcvComplete(sim, sizeof(response))) &&
+               (dfuSimInstallImage(sim)) &&
+               (dfuSimBeginRcv(sim, BENCH_IMAGE_INDEX, session->imageSize, 0, false))
+           );
+}
+
+/*!
+** FUNCTION: _benchFinishImage
+**
+** DESCRIPTION: After a good transfer: checks what the device holds
+**              against the image, then RCV_COMPLETE and INSTALL_IMAGE.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _benchFinishImage(benchSessionStruct *session)
+{
+    dfuSimDeviceStruct *    sim = session->sim;
+
+    if (session->ok)
+    {
+        uint32_t            received = 0;
+        const uint8_t *     data = dfuSimImageData(sim, BENCH_IMAGE_INDEX, &received);
+
+        session->verified = ( (data) &&
+                              (received == session->imageSize) &&
+                              (memcmp(data, session->image, received) == 0) );
+        session->ok = ( (dfuSimRcvComplete(sim, session->imageSize)) &&
+                        (dfuSimInstallImage(sim)) );
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _benchSendChunk
+**
+** DESCRIPTION: Notes when a chunk went out, then sends it.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A resent chunk's RTT runs from the resend.  When impaired,
+**           the chunk is handed to the link and "sent" even if the link
+**           then loses it, as a socket would.
+**
+*/
+static bool _benchSendChunk(void *ctx, uint32_t seq, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+    benchSessionStruct *    session = (benchSessionStruct *)ctx;
+    uint32_t                slot = seq % BENCH_SEND_HISTORY;
+    bool                    ret = false;
+
+    session->sentSeq[slot] = seq;
+    session->sentUS[slot] = TIMER_GetMicroseconds();
+    session->sampled[slot] = false;
+
+    if (session->txImpair)
+    {
+        if (len <= XFER_MAX_CHUNK_LEN)
+        {
+            memcpy(&session->impairStage[0], &seq, sizeof(seq));
+            memcpy(&session->impairStage[4], &offset, sizeof(offset));
+            memcpy(&session->impairStage[BENCH_IMPAIR_HEADER_LEN], data, len);
+            (void)netImpairSubmit(session->txImpair,
+                                  session->impairStage,
+                                  (uint16_t)(BENCH_IMPAIR_HEADER_LEN + len),
+                                  session->sentUS[slot]);
+            _benchImpairSend(session);
+            ret = true;
+        }
+    }
+    else
+    {
+        ret = session->inner.sendChunk(session->inner.ctx, seq, offset, data, len);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchImpairSend
+**
+** DESCRIPTION: Passes every chunk whose time is up on to the simulator.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _benchImpairSend(benchSessionStruct *session)
+{
+    const uint8_t *         msg;
+    uint16_t                len;
+    uint32_t                seq;
+    uint32_t                offset;
+
+    while ((msg = netImpairNext(session->txImpair, TIMER_GetMicroseconds(), &len)) != NULL)
+    {
+        memcpy(&seq, &msg[0], sizeof(seq));
+        memcpy(&offset, &msg[4], sizeof(offset));
+        (void)session->inner.sendChunk(session->inner.ctx,
+                                       seq,
+                                       offset,
+                                       &msg[BENCH_IMPAIR_HEADER_LEN],
+                                       (uint16_t)(len - BENCH_IMPAIR_HEADER_LEN));
+    }
+}
+
+/*!
+** FUNCTION: _benchImpairPollAck
+**
+** DESCRIPTION: Waits for an ack to come through the impaired link,
+**              delivering held-back chunks while it waits.
+**
+** PARAMETERS:
+**
+** RETURNS: false if nothing came through in "timeoutMS".
+**
+** COMMENTS: Sleeps in the simulator's pollAck until whichever is first:
+**           the timeout or the next held message falling due.  Under a
+**           millisecond it spins.
+**
+*/
+static bool _benchImpairPollAck(benchSessionStruct *session, xferAckStruct *ack, uint32_t timeoutMS)
+{
+    uint64_t                nowUS = TIMER_GetMicroseconds();
+    uint64_t                deadlineUS = nowUS + ((uint64_t)timeoutMS * 1000U);
+    bool                    ret = false;
+
+    while ( (!ret) && (nowUS <= deadlineUS) )
+    {
+        const uint8_t *     msg;
+        uint16_t            len;
+
+        _benchImpairSend(session);
+
+        msg = netImpairNext(session->rxImpair, nowUS, &len);
+        if (
+               (msg) &&
+               (len == sizeof(xferAckStruct))
+           )
+        {
+            memcpy(ack, msg, sizeof(xferAckStruct));
+            ret = true;
+        }
+        else
+        if (msg == NULL)
+        {
+            uint64_t        waitUS = deadlineUS;
+            uint64_t        dueUS;
+            xferAckStruct   inner;
+
+            if ( (netImpairNextDue(session->rxImpair, &dueUS)) && (dueUS < waitUS) )
+            {
+                waitUS = dueUS;
+            }
+            if ( (netImpairNextDue(session->txImpair, &dueUS)) && (dueUS < waitUS) )
+            {
+                waitUS = dueUS;
+            }
+            waitUS = (waitUS > nowUS) ? (waitUS - nowUS) : 0;
+
+            if (session->inner.pollAck(session->inner.ctx, &inner, (uint32_t)(waitUS / 1000U)))
+            {
+                (void)netImpairSubmit(session->rxImpair,
+                                      (const uint8_t *)&inner,
+                                      (uint16_t)sizeof(inner),
+                                      TIMER_GetMicroseconds());
+            }
+        }
+        nowUS = TIMER_GetMicroseconds();
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchPollAck
+**
+** DESCRIPTION: Waits for an ack (through the impaired link, if there
+**              is one), then takes an RTT sample for every chunk it newly
+**              covers.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _benchPollAck(void *ctx, xferAckStruct *ack, uint32_t timeoutMS)
+{
+    benchSessionStruct *    session = (benchSessionStruct *)ctx;
+    bool                    ret;
+
+    if (session->rxImpair)
+    {
+        ret = _benchImpairPollAck(session, ack, timeoutMS);
+    }
+    else
+    {
+        ret = session->inner.pollAck(session->inner.ctx, ack, timeoutMS);
+    }
+
+    if ( (ret) && (!ack->rejected) )
+    {
+        uint64_t            nowUS = TIMER_GetMicroseconds();
+        uint32_t            bit;
+
+        for (; session->ackedSeq < ack->cumulativeSeq; session->ackedSeq++)
+        {
+            _benchSampleSeq(session, session->ackedSeq, nowUS);
+        }
+        for (bit = 0; bit < 32; bit++)
+        {
+            if (ack->selectiveMask & (1UL << bit))
+            {
+                _benchSampleSeq(session, ack->cumulativeSeq + 1 + bit, nowUS);
+            }
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchSampleSeq
+**
+** DESCRIPTION: Records one chunk's RTT, once.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _benchSampleSeq(benchSessionStruct *session, uint32_t seq, uint64_t nowUS)
+{
+    uint32_t                slot = seq % BENCH_SEND_HISTORY;
+
+    if ( (session->sentSeq[slot] == seq) && (!session->sampled[slot]) )
+    {
+        session->sampled[slot] = true;
+        _benchAddSample(&session->rtt, (uint32_t)(nowUS - session->sentUS[slot]));
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _benchAddSample
+**
+** DESCRIPTION: Appends a sample, growing the list as needed.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A sample is dropped if memory runs out.
+**
+*/
+static void _benchAddSample(benchSamplesStruct *samples, uint32_t value)
+{
+    if (samples->count == samples->size)
+    {
+        uint32_t            newSize = (samples->size > 0) ? (samples->size * 2U) : 1024U;
+        uint32_t *          values = (uint32_t *)realloc(samples->values, newSize * sizeof(uint32_t));
+
+        if (values)
+        {
+            samples->values = values;
+            samples->size = newSize;
+        }
+    }
+
+    if (samples->count < samples->size)
+    {
+        samples->values[samples->count++] = value;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _benchPercentile
+**
+** DESCRIPTION: Nearest-rank percentile of sorted samples.
+**
+** PARAMETERS: perMille: 500 for p50, 999 for p99.9.
+**
+** RETURNS: 0 with no samples.
+**
+** COMMENTS:
+**
+*/
+static uint32_t _benchPercentile(const benchSamplesStruct *samples, uint32_t perMille)
+{
+    uint32_t                ret = 0;
+
+    if (samples->count > 0)
+    {
+        uint64_t            rank = (((uint64_t)samples->count * perMille) + 999U) / 1000U;
+
+        ret = samples->values[(rank > 0) ? (rank - 1) : 0];
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchCompare
+**
+** DESCRIPTION: qsort() order for samples.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static int _benchCompare(const void *a, const void *b)
+{
+    uint32_t                left = *(const uint32_t *)a;
+    uint32_t                right = *(const uint32_t *)b;
+
+    return ( (left > right) - (left < right) );
+}
+
+/*!
+** FUNCTION: _benchCpuUS
+**
+** DESCRIPTION: User plus system CPU time used by the process so far.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint64_t _benchCpuUS(void)
+{
+    struct rusage           usage;
+    uint64_t                ret = 0;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        ret = ((uint64_t)usage.ru_utime.tv_sec * 1000000U) + (uint64_t)usage.ru_utime.tv_usec +
+              ((uint64_t)usage.ru_stime.tv_sec * 1000000U) + (uint64_t)usage.ru_stime.tv_usec;
+    }
+
+    return (ret);
+}
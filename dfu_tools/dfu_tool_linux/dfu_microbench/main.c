@@ -0,0 +1,1224 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: main.c (dfu_microbench)
+**
+** DESCRIPTION: Microbenchmarks for the tools' hot helpers, each run on
+**              its own.
+**
+** Every case is warmed up, then timed over several samples on one
+** pinned CPU.  For each case the JSON report gives ns/op (median, min
+** and max over the samples), heap allocations per op, and cycles per
+** byte of input.
+**
+**   dfu_microbench [--cases a,b,..] [--samples N] [--sample-ms N]
+**                  [--warmup-ms N] [--cpu N] [--key private.pem]
+**                  [--image file.img --aes-key key.bin] [--out file.json]
+**
+** sign_challenge needs --key, image_header needs --image and --aes-key;
+** without them those cases are reported as skipped.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define BENCH_HAVE_TSC              (1)
+#else
+    #define BENCH_HAVE_TSC              (0)
+#endif
+
+#include "dfu_client_config.h"
+#include "kvparse.h"
+#include "file_kvp.h"
+#include "miniyaml.h"
+#include "minIni.h"
+#include "iface_enet.h"
+#include "ethernet_sockets.h"
+#include "dfu_client_crypto.h"
+#include "logger.h"
+
+/*
+** Most samples taken per case.
+**
+*/
+#define BENCH_MAX_SAMPLES               (64U)
+
+/*
+** Keys in the generated KVP and INI files.  The one looked up is last,
+** so every lookup reads the whole file.
+**
+*/
+#define BENCH_FILE_KEYS                 (48U)
+
+/*
+** Payload of a benchmarked Ethernet frame.
+**
+*/
+#define BENCH_FRAME_PAYLOAD             (1024U)
+
+/*
+** Settings.
+**
+*/
+typedef struct
+{
+    char                    cases[256];
+    uint32_t                samples;
+    uint32_t                sampleMS;
+    uint32_t                warmupMS;
+    int                     cpu;
+    const char *            keyPath;
+    const char *            imagePath;
+    const char *            aesKeyPath;
+    const char *            outPath;
+}benchOptionsStruct;
+
+/*
+** Everything the cases work on, set up before timing starts.
+**
+*/
+typedef struct
+{
+    const benchOptionsStruct *  options;
+
+    char                    kvpMessage[MAX_KVP_STRING_LEN];
+    char                    kvpBuffer[MAX_KVP_STRING_LEN];
+    PARSED_KVP              kvp;
+
+    char                    kvpPath[64];
+    fkvpStruct              fkvp;
+    char                    lastKey[32];
+
+    char                    yaml[1024];
+    yamlParserStruct        yamlParser;
+
+    char                    iniPath[64];
+    char                    iniValue[64];
+
+    char                    macString[24];
+    uint8_t                 mac[6];
+
+    uint32_t                challenge;
+    AppImageHeaderStruct    header;
+
+    dfu_sock_t *            sock;
+    uint8_t                 destMAC[6];
+    uint8_t                 payload[BENCH_FRAME_PAYLOAD];
+}benchContextStruct;
+
+/*
+** One benchmark.  setup() says how many bytes of input one op handles;
+** it returns false if the case can't run here.  op() returns false on a
+** failure, which stops the case.  teardown() (optional) only runs if
+** setup() succeeded.
+**
+*/
+typedef struct
+{
+    const char *            name;
+    const char *            target;
+    bool                    (*setup)(benchContextStruct *context, uint32_t *bytesPerOp);
+    bool                    (*op)(benchContextStruct *context);
+    void                    (*teardown)(benchContextStruct *context);
+}benchCaseStruct;
+
+/*
+** One case's numbers.
+**
+*/
+typedef struct
+{
+    uint64_t                opsPerSample;
+    uint32_t                samples;
+    double                  nsPerOp[BENCH_MAX_SAMPLES];
+    double                  cyclesPerOp[BENCH_MAX_SAMPLES];
+    uint64_t                allocs;
+    uint64_t                allocBytes;
+    uint64_t                ops;
+}benchResultStruct;
+
+/*
+** Internal prototypes.
+**
+*/
+static bool _benchParseArgs(int argc, char **argv, benchOptionsStruct *options);
+static bool _benchSelected(const benchOptionsStruct *options, const char *name);
+static bool _benchPin(int cpu);
+static bool _benchMeasure(const benchCaseStruct *benchCase, benchContextStruct *context, benchResultStruct *result);
+static uint64_t _benchNowNS(void);
+static uint64_t _benchCycles(void);
+static int _benchCompare(const void *a, const void *b);
+static double _benchMedian(double *values, uint32_t count);
+static bool _benchTempFile(char *path, size_t pathLen, const char *text);
+
+static bool _benchKvparseSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchKvparseOp(benchContextStruct *context);
+static bool _benchFkvpSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchFkvpOp(benchContextStruct *context);
+static void _benchFkvpTeardown(benchContextStruct *context);
+static bool _benchYamlSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchYamlOp(benchContextStruct *context);
+static bool _benchIniSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchIniOp(benchContextStruct *context);
+static void _benchIniTeardown(benchContextStruct *context);
+static bool _benchMACSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchMACToBytesOp(benchContextStruct *context);
+static bool _benchMACToStringSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchMACToStringOp(benchContextStruct *context);
+static bool _benchSignSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchSignOp(benchContextStruct *context);
+static bool _benchHeaderSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchHeaderOp(benchContextStruct *context);
+static bool _benchLoggerSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchLoggerOp(benchContextStruct *context);
+static void _benchLoggerTeardown(benchContextStruct *context);
+static bool _benchFrameSetup(benchContextStruct *context, uint32_t *bytesPerOp);
+static bool _benchFrameOp(benchContextStruct *context);
+static void _benchFrameTeardown(benchContextStruct *context);
+
+/*
+** The cases, in the order they run.
+**
+*/
+static const benchCaseStruct _benchCases[] =
+{
+    { "kvparse",        "MKVPARSE_parseKVP",                _benchKvparseSetup,     _benchKvparseOp,        NULL },
+    { "fkvp_find",      "fkvpFind",                         _benchFkvpSetup,        _benchFkvpOp,           _benchFkvpTeardown },
+    { "yaml_parse",     "yamlParse",                        _benchYamlSetup,        _benchYamlOp,           NULL },
+    { "ini_gets",       "ini_gets",                         _benchIniSetup,         _benchIniOp,            _benchIniTeardown },
+    { "mac_to_bytes",   "ifaceEthernetMACStringToBytes",    _benchMACSetup,         _benchMACToBytesOp,     NULL },
+    { "mac_to_string",  "ifaceEthernetMACBytesToString",    _benchMACToStringSetup, _benchMACToStringOp,    NULL },
+    { "sign_challenge", "signChallengeWithPrivateKey",      _benchSignSetup,        _benchSignOp,           NULL },
+    { "image_header",   "getDecryptedImageHeader",          _benchHeaderSetup,      _benchHeaderOp,         NULL },
+    { "logger_write",   "loggerWrite",                      _benchLoggerSetup,      _benchLoggerOp,         _benchLoggerTeardown },
+    { "enet_frame",     "queue_ethernet_message",           _benchFrameSetup,       _benchFrameOp,          _benchFrameTeardown },
+};
+
+/*
+** Heap use while a sample is being timed.
+**
+*/
+static volatile bool        _benchCounting = false;
+static uint64_t             _benchAllocs = 0;
+static uint64_t             _benchAllocBytes = 0;
+
+/*
+** The CPUs we were allowed on before pinning.
+**
+*/
+static cpu_set_t            _benchStartCPUs;
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                          ALLOCATION COUNTING
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+#if defined(__GLIBC__)
+/*
+** The executable's malloc() family is used by everything it loads
+** (dfu_lib and OpenSSL included), so these see every allocation.
+**
+*/
+#define BENCH_HAVE_ALLOC_COUNT          (1)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static inline void _benchCountAlloc(size_t size)
+{
+    if (_benchCounting)
+    {
+        __atomic_add_fetch(&_benchAllocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&_benchAllocBytes, size, __ATOMIC_RELAXED);
+    }
+}
+
+void *malloc(size_t size)
+{
+    _benchCountAlloc(size);
+    return (__libc_malloc(size));
+}
+
+void *calloc(size_t count, size_t size)
+{
+    _benchCountAlloc(count * size);
+    return (__libc_calloc(count, size));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    _benchCountAlloc(size);
+    return (__libc_realloc(ptr, size));
+}
+#else
+#define BENCH_HAVE_ALLOC_COUNT          (0)
+#endif
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                               HARNESS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: main
+**
+** DESCRIPTION: Runs the selected cases and writes the JSON report.
+**
+** PARAMETERS:
+**
+** RETURNS: 0 unless a case that could run failed.
+**
+*/
+int main(int argc, char **argv)
+{
+    int                     ret = 1;
+    benchOptionsStruct      options;
+    static benchContextStruct context;
+
+    if (_benchParseArgs(argc, argv, &options))
+    {
+        FILE *              out = (options.outPath) ? fopen(options.outPath, "w") : stdout;
+
+        if (out)
+        {
+            uint32_t        index;
+            bool            first = true;
+            bool            pinned;
+
+            CPU_ZERO(&_benchStartCPUs);
+            sched_getaffinity(0, sizeof(_benchStartCPUs), &_benchStartCPUs);
+            if (options.cpu < 0)
+            {
+                options.cpu = sched_getcpu();
+            }
+            pinned = _benchPin(options.cpu);
+
+            memset(&context, 0, sizeof(context));
+            context.options = &options;
+
+            fprintf(out, "{\n  \"tool\": \"dfu_microbench\",\n");
+            fprintf(out,
+                    "  \"cpu\": %d, \"pinned\": %s, \"samples\": %u, \"sample_ms\": %u, \"warmup_ms\": %u, "
+                    "\"cycles\": \"%s\", \"allocs_counted\": %s,\n",
+                    options.cpu,
+                    pinned ? "true" : "false",
+                    options.samples,
+                    options.sampleMS,
+                    options.warmupMS,
+                    BENCH_HAVE_TSC ? "tsc" : "none",
+                    BENCH_HAVE_ALLOC_COUNT ? "true" : "false");
+            fprintf(out, "  \"cases\": [");
+
+            ret = 0;
+            for (index = 0; index < (sizeof(_benchCases) / sizeof(_benchCases[0])); index++)
+            {
+                const benchCaseStruct * benchCase = &_benchCases[index];
+                static benchResultStruct result;
+                uint32_t    bytesPerOp = 0;
+
+                if (!_benchSelected(&options, benchCase->name))
+                {
+                    continue;
+                }
+
+                fprintf(out, "%s\n    {\"name\": \"%s\", \"target\": \"%s\", ", first ? "" : ",", benchCase->name, benchCase->target);
+                first = false;
+
+                if (!benchCase->setup(&context, &bytesPerOp))
+                {
+                    fprintf(out, "\"skipped\": true}");
+                    printf("\r\n %-16s skipped", benchCase->name);
+                }
+                else
+                if (!_benchMeasure(benchCase, &context, &result))
+                {
+                    fprintf(out, "\"ok\": false}");
+                    printf("\r\n %-16s FAILED", benchCase->name);
+                    ret = 1;
+                    if (benchCase->teardown)
+                    {
+                        benchCase->teardown(&context);
+                    }
+                }
+                else
+                {
+                    double  nsMedian = _benchMedian(result.nsPerOp, result.samples);
+                    double  cyclesMedian = _benchMedian(result.cyclesPerOp, result.samples);
+
+                    fprintf(out,
+                            "\"ok\": true, \"bytes_per_op\": %u, \"ops_per_sample\": %llu, "
+                            "\"ns_per_op\": {\"median\": %.1f, \"min\": %.1f, \"max\": %.1f}, "
+                            "\"allocs_per_op\": %.3f, \"alloc_bytes_per_op\": %.1f, ",
+                            bytesPerOp,
+                            (unsigned long long)result.opsPerSample,
+                            nsMedian,
+                            result.nsPerOp[0],
+                            result.nsPerOp[result.samples - 1],
+                            (double)result.allocs / (double)result.ops,
+                            (double)result.allocBytes / (double)result.ops);
+                    if ( (BENCH_HAVE_TSC) && (bytesPerOp > 0) )
+                    {
+                        fprintf(out, "\"cycles_per_byte\": %.3f}", cyclesMedian / (double)bytesPerOp);
+                    }
+                    else
+                    {
+                        fprintf(out, "\"cycles_per_byte\": null}");
+                    }
+
+                    printf("\r\n %-16s %12.1f ns/op  %8.3f allocs/op  %8.3f cycles/B",
+                           benchCase->name,
+                           nsMedian,
+                           (double)result.allocs / (double)result.ops,
+                           (bytesPerOp > 0) ? cyclesMedian / (double)bytesPerOp : 0.0);
+                    if (benchCase->teardown)
+                    {
+                        benchCase->teardown(&context);
+                    }
+                }
+                fflush(out);
+                fflush(stdout);
+            }
+
+            fprintf(out, "\n  ]\n}\n");
+            printf("\r\n");
+            if (out != stdout)
+            {
+                fclose(out);
+                printf("\r\n Results written to [%s]\r\n", options.outPath);
+            }
+        }
+        else
+        {
+            printf("\r\n Could not open [%s]!\r\n", options.outPath);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchParseArgs
+**
+** DESCRIPTION: Fills in the options, starting from the defaults.
+**
+** PARAMETERS:
+**
+** RETURNS: false (after printing the usage) on a bad argument.
+**
+** COMMENTS:
+**
+*/
+static bool _benchParseArgs(int argc, char **argv, benchOptionsStruct *options)
+{
+    bool                    ret = true;
+    int                     index;
+
+    memset(options, 0, sizeof(*options));
+    options->samples = 7;
+    options->sampleMS = 100;
+    options->warmupMS = 250;
+    options->cpu = -1;
+
+    for (index = 1; (ret) && (index < argc); index++)
+    {
+        const char *        value = (index + 1 < argc) ? argv[index + 1] : NULL;
+
+        if (value == NULL)
+        {
+            ret = false;
+        }
+        else
+        if (strcmp(argv[index], "--cases") == 0)
+        {
+            snprintf(options->cases, sizeof(options->cases), "%s", value);
+        }
+        else
+        if (strcmp(argv[index], "--samples") == 0)
+        {
+            options->samples = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--sample-ms") == 0)
+        {
+            options->sampleMS = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--warmup-ms") == 0)
+        {
+            options->warmupMS = (uint32_t)strtoul(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--cpu") == 0)
+        {
+            options->cpu = (int)strtol(value, NULL, 0);
+        }
+        else
+        if (strcmp(argv[index], "--key") == 0)
+        {
+            options->keyPath = value;
+        }
+        else
+        if (strcmp(argv[index], "--image") == 0)
+        {
+            options->imagePath = value;
+        }
+        else
+        if (strcmp(argv[index], "--aes-key") == 0)
+        {
+            options->aesKeyPath = value;
+        }
+        else
+        if (strcmp(argv[index], "--out") == 0)
+        {
+            options->outPath = value;
+        }
+        else
+        {
+            ret = false;
+        }
+        index++;
+    }
+
+    if (
+           (options->samples == 0) ||
+           (options->samples > BENCH_MAX_SAMPLES) ||
+           (options->sampleMS == 0)
+       )
+    {
+        ret = false;
+    }
+
+    if (!ret)
+    {
+        uint32_t            caseIndex;
+
+        printf("\r\n Usage: dfu_microbench [--cases a,b,..] [--samples N] [--sample-ms N] [--warmup-ms N]");
+        printf("\r\n                       [--cpu N] [--key private.pem] [--image file.img --aes-key key.bin]");
+        printf("\r\n                       [--out file.json]");
+        printf("\r\n   Samples: 1 to %u.  Cases:", BENCH_MAX_SAMPLES);
+        for (caseIndex = 0; caseIndex < (sizeof(_benchCases) / sizeof(_benchCases[0])); caseIndex++)
+        {
+            printf(" %s", _benchCases[caseIndex].name);
+        }
+        printf("\r\n");
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchSelected
+**
+** DESCRIPTION: Is a case in the --cases list?
+**
+** PARAMETERS:
+**
+** RETURNS: true for every case if no list was given.
+**
+** COMMENTS:
+**
+*/
+static bool _benchSelected(const benchOptionsStruct *options, const char *name)
+{
+    bool                    ret = (options->cases[0] == 0);
+    const char *            text = options->cases;
+    size_t                  nameLen = strlen(name);
+
+    while ( (!ret) && (*text) )
+    {
+        size_t              len = strcspn(text, ",");
+
+        ret = ( (len == nameLen) && (strncmp(text, name, len) == 0) );
+        text += len;
+        if (*text == ',')
+        {
+            text++;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchPin
+**
+** DESCRIPTION: Pins this thread (and any it starts) to one CPU, or
+**              unpins it with a negative "cpu".
+**
+** PARAMETERS:
+**
+** RETURNS: false if the CPU can't be used.
+**
+** COMMENTS:
+**
+*/
+static bool _benchPin(int cpu)
+{
+    bool                    ret = false;
+    cpu_set_t               cpus;
+
+    if (cpu < 0)
+    {
+        ret = (sched_setaffinity(0, sizeof(_benchStartCPUs), &_benchStartCPUs) == 0);
+    }
+    else
+    if (cpu < CPU_SETSIZE)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        ret = (sched_setaffinity(0, sizeof(cpus), &cpus) == 0);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchMeasure
+**
+** DESCRIPTION: Warms a case up, then times it.
+**
+** PARAMETERS:
+**
+** RETURNS: false if an op failed.
+**
+** COMMENTS: The warm-up runs for warmupMS (at least one op) and also
+**           works out how many ops fill sampleMS.  Each sample then
+**           runs that many ops back to back; the per-sample ns/op and
+**           cycles/op come back sorted.
+**
+*/
+static bool _benchMeasure(const benchCaseStruct *benchCase, benchContextStruct *context, benchResultStruct *result)
+{
+    bool                    ret = true;
+    const benchOptionsStruct *options = context->options;
+    uint64_t                warmupNS = (uint64_t)options->warmupMS * 1000000U;
+    uint64_t                sampleNS = (uint64_t)options->sampleMS * 1000000U;
+    uint64_t                startNS;
+    uint64_t                elapsedNS;
+    uint64_t                count = 0;
+    uint32_t                sample;
+
+    memset(result, 0, sizeof(*result));
+
+    startNS = _benchNowNS();
+    do
+    {
+        ret = benchCase->op(context);
+        count++;
+        elapsedNS = _benchNowNS() - startNS;
+    } while ( (ret) && (elapsedNS < warmupNS) );
+
+    if (ret)
+    {
+        uint64_t            perOpNS = (elapsedNS / count) + 1U;
+
+        result->opsPerSample = (sampleNS / perOpNS) + 1U;
+    }
+
+    for (sample = 0; (ret) && (sample < options->samples); sample++)
+    {
+        uint64_t            startCycles;
+        uint64_t            op;
+
+        __atomic_store_n(&_benchAllocs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&_benchAllocBytes, 0, __ATOMIC_RELAXED);
+        _benchCounting = true;
+
+        startNS = _benchNowNS();
+        startCycles = _benchCycles();
+        for (op = 0; (ret) && (op < result->opsPerSample); op++)
+        {
+            ret = benchCase->op(context);
+        }
+        result->cyclesPerOp[sample] = (double)(_benchCycles() - startCycles) / (double)result->opsPerSample;
+        result->nsPerOp[sample] = (double)(_benchNowNS() - startNS) / (double)result->opsPerSample;
+
+        _benchCounting = false;
+        result->allocs += __atomic_load_n(&_benchAllocs, __ATOMIC_RELAXED);
+        result->allocBytes += __atomic_load_n(&_benchAllocBytes, __ATOMIC_RELAXED);
+        result->ops += result->opsPerSample;
+        result->samples++;
+    }
+
+    qsort(result->nsPerOp, result->samples, sizeof(double), _benchCompare);
+    qsort(result->cyclesPerOp, result->samples, sizeof(double), _benchCompare);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchNowNS
+**
+** DESCRIPTION: Monotonic time.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint64_t _benchNowNS(void)
+{
+    struct timespec         now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (((uint64_t)now.tv_sec * 1000000000U) + (uint64_t)now.tv_nsec);
+}
+
+/*!
+** FUNCTION: _benchCycles
+**
+** DESCRIPTION: The time stamp counter.
+**
+** PARAMETERS:
+**
+** RETURNS: 0 where there isn't one.
+**
+** COMMENTS: On current x86 parts the TSC ticks at a fixed rate, which
+**           is close to (but not exactly) core cycles under turbo.
+**
+*/
+static uint64_t _benchCycles(void)
+{
+    uint64_t                ret = 0;
+
+#if (BENCH_HAVE_TSC == 1)
+    ret = __rdtsc();
+#endif
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchCompare
+**
+** DESCRIPTION: qsort() order for samples.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static int _benchCompare(const void *a, const void *b)
+{
+    double                  left = *(const double *)a;
+    double                  right = *(const double *)b;
+
+    return ( (left > right) - (left < right) );
+}
+
+/*!
+** FUNCTION: _benchMedian
+**
+** DESCRIPTION: Median of sorted samples.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static double _benchMedian(double *values, uint32_t count)
+{
+    double                  ret = 0.0;
+
+    if (count > 0)
+    {
+        ret = (count & 1U) ? values[count / 2] : (values[(count / 2) - 1] + values[count / 2]) / 2.0;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _benchTempFile
+**
+** DESCRIPTION: Writes "text" to a new file in /tmp.
+**
+** PARAMETERS: path: Receives the file's name.
+**
+** RETURNS:
+**
+** COMMENTS: The caller removes the file.
+**
+*/
+static bool _benchTempFile(char *path, size_t pathLen, const char *text)
+{
+    bool                    ret = false;
+    int                     fd;
+
+    snprintf(path, pathLen, "/tmp/dfu_microbench_XXXXXX");
+    fd = mkstemp(path);
+    if (fd >= 0)
+    {
+        size_t              len = strlen(text);
+
+        ret = (write(fd, text, len) == (ssize_t)len);
+        close(fd);
+        if (!ret)
+        {
+            unlink(path);
+        }
+    }
+
+    return (ret);
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                                 CASES
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _benchKvparseSetup / _benchKvparseOp
+**
+** DESCRIPTION: Parses a typical device message into a caller buffer,
+**              so the message itself is left intact for the next op.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _benchKvparseSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    snprintf(context->kvpMessage,
+             sizeof(context->kvpMessage),
+             "CMD=IMAGE_STATUS DEV=00:1a:2b:3c:4d:5e IMAGE=1 ADDR=0x08020000 SIZE=1048576 "
+             "FLAGS=0x03 RECEIVED=524288 CRC=0x1c291ca3 TYPE=4 VARIANT=2 BL=1.4.2 STATUS=OK");
+    *bytesPerOp = (uint32_t)strlen(context->kvpMessage);
+
+    return (true);
+}
+
+static bool _benchKvparseOp(benchContextStruct *context)
+{
+    uint8_t                 keyCount = 0;
+
+    return ( (KVPARSE_parseKVPBuf(context->kvpMessage,
+                                  (uint16_t)strlen(context->kvpMessage),
+                                  &context->kvp,
+                                  &keyCount,
+                                  context->kvpBuffer,
+                                  sizeof(context->kvpBuffer)) != NULL) &&
+             (keyCount > 0) );
+}
+
+/*!
+** FUNCTION: _benchFkvpSetup / _benchFkvpOp / _benchFkvpTeardown
+**
+** DESCRIPTION: Looks up the last key of a BENCH_FILE_KEYS line file,
+**              from the start each time.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _benchFkvpSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    bool                    ret = false;
+    char                    text[BENCH_FILE_KEYS * 64];
+    size_t                  len = 0;
+    uint32_t                index;
+
+    for (index = 0; index < BENCH_FILE_KEYS; index++)
+    {
+        len += snprintf(&text[len], sizeof(text) - len, "KEY_%02u=value_%u_0x%08x\n", index, index, index * 2654435761U);
+    }
+    snprintf(context->lastKey, sizeof(context->lastKey), "KEY_%02u", BENCH_FILE_KEYS - 1);
+
+    if (_benchTempFile(context->kvpPath, sizeof(context->kvpPath), text))
+    {
+        ret = (fkvpBegin(context->kvpPath, &context->fkvp) != NULL);
+        if (!ret)
+        {
+            unlink(context->kvpPath);
+        }
+    }
+    *bytesPerOp = (uint32_t)len;
+
+    return (ret);
+}
+
+static bool _benchFkvpOp(benchContextStruct *context)
+{
+    return (fkvpFind(&context->fkvp, context->lastKey, true) != NULL);
+}
+
+static void _benchFkvpTeardown(benchContextStruct *context)
+{
+    fkvpEnd(&context->fkvp);
+    unlink(context->kvpPath);
+
+    return;
+}
+
+/*!
+** FUNCTION: _benchYamlSetup / _benchYamlOp
+**
+** DESCRIPTION: Parses a manifest-sized YAML document.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _benchYamlSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    snprintf(context->yaml,
+             sizeof(context->yaml),
+             "vehicle: B2\n"
+             "release: 2.4.1\n"
+             "interface: eth0\n"
+             "devices:\n"
+             "  - name: primary\n"
+             "    type: 4\n"
+             "    image: primary_app.img\n"
+             "  - name: secondary\n"
+             "    type: 5\n"
+             "    image: secondary_app.img\n"
+             "  - name: motor\n"
+             "    type: 6\n"
+             "    image: motor_ctrl.img\n"
+             "options:\n"
+             "  reboot: true\n"
+             "  retries: 3\n"
+             "  window: 16\n");
+    *bytesPerOp = (uint32_t)strlen(context->yaml);
+
+    return (_benchYamlOp(context));
+}
+
+static bool _benchYamlOp(benchContextStruct *context)
+{
+    yamlNodeStruct *        root = NULL;
+
+    yamlParserInit(&context->yamlParser, context->yaml, (uint16_t)strlen(context->yaml));
+
+    return (yamlParse(&context->yamlParser, &root) == YAML_SUCCESS);
+}
+
+/*!
+** FUNCTION: _benchIniSetup / _benchIniOp / _benchIniTeardown
+**
+** DESCRIPTION: Reads the last key of the last section of an INI file.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: ini_gets() opens and scans the file on every call, so this
+**           includes the fopen().
+**
+*/
+static bool _benchIniSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    char                    text[BENCH_FILE_KEYS * 64];
+    size_t                  len = 0;
+    uint32_t                index;
+
+    for (index = 0; index < BENCH_FILE_KEYS; index++)
+    {
+        if ((index % 8) == 0)
+        {
+            len += snprintf(&text[len], sizeof(text) - len, "[SECTION_%u]\n", index / 8);
+        }
+        len += snprintf(&text[len], sizeof(text) - len, "key_%02u=value_%u\n", index, index);
+    }
+    *bytesPerOp = (uint32_t)len;
+
+    return (_benchTempFile(context->iniPath, sizeof(context->iniPath), text));
+}
+
+static bool _benchIniOp(benchContextStruct *context)
+{
+    char                    section[16];
+    char                    key[16];
+
+    snprintf(section, sizeof(section), "SECTION_%u", (BENCH_FILE_KEYS - 1) / 8);
+    snprintf(key, sizeof(key), "key_%02u", BENCH_FILE_KEYS - 1);
+
+    return (ini_gets(section, key, "", context->iniValue, sizeof(context->iniValue), context->iniPath) > 0);
+}
+
+static void _benchIniTeardown(benchContextStruct *context)
+{
+    unlink(context->iniPath);
+
+    return;
+}
+
+/*!
+** FUNCTION: _benchMACSetup / _benchMACToBytesOp
+**
+** DESCRIPTION: "xx:xx:xx:xx:xx:xx" to bytes.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _benchMACSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    snprintf(context->macString, sizeof(context->macString), "00:1a:2b:3c:4d:5e");
+    *bytesPerOp = (uint32_t)strlen(context->macString);
+
+    return (true);
+}
+
+static bool _benchMACToBytesOp(benchContextStruct *context)
+{
+    return (ifaceEthernetMACStringToBytes(context->macString, context->mac, sizeof(context->mac)) != NULL);
+}
+
+/*!
+** FUNCTION: _benchMACToStringSetup / _benchMACToStringOp
+**
+** DESCRIPTION: Bytes to "xx:xx:xx:xx:xx:xx".
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _benchMACToStringSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    static const uint8_t    mac[6] = { 0x00, 0x1a, 0x2b, 0x3c, 0x4d, 0x5e };
+
+    memcpy(context->mac, mac, sizeof(mac));
+    *bytesPerOp = sizeof(mac);
+
+    return (true);
+}
+
+static bool _benchMACToStringOp(benchContextStruct *context)
+{
+    return (ifaceEthernetMACBytesToString(context->mac,
+                                          sizeof(context->mac),
+                                          context->macString,
+                                          sizeof(context->macString)) != NULL);
+}
+
+/*!
+** FUNCTION: _benchSignSetup / _benchSignOp
+**
+** DESCRIPTION: Signs a fresh challenge each op, as a session start does.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Needs --key.  The signature is OPENSSL_malloc()ed, which is
+**           plain malloc() unless OpenSSL was built otherwise.
+**
+*/
+static bool _benchSignSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    context->challenge = 0x5eed1234;
+    *bytesPerOp = sizeof(context->challenge);
+
+    return (context->options->keyPath != NULL);
+}
+
+static bool _benchSignOp(benchContextStruct *context)
+{
+    uint8_t *               signature;
+
+    context->challenge++;
+    signature = signChallengeWithPrivateKey(context->options->keyPath, &context->challenge, false, NULL);
+    free(signature);
+
+    return (signature != NULL);
+}
+
+/*!
+** FUNCTION: _benchHeaderSetup / _benchHeaderOp
+**
+** DESCRIPTION: Decrypts an image's header.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Needs --image and --aes-key.  bytes/op is the image size,
+**           since the whole file is read and authenticated.
+**
+*/
+static bool _benchHeaderSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    bool                    ret = false;
+    struct stat             info;
+
+    if (
+           (context->options->imagePath) &&
+           (context->options->aesKeyPath) &&
+           (stat(context->options->imagePath, &info) == 0)
+       )
+    {
+        *bytesPerOp = (uint32_t)info.st_size;
+        ret = true;
+    }
+
+    return (ret);
+}
+
+static bool _benchHeaderOp(benchContextStruct *context)
+{
+    return (getDecryptedImageHeader((char *)context->options->imagePath,
+                                    (char *)context->options->aesKeyPath,
+                                    (uint8_t *)&context->header,
+                                    sizeof(context->header)) != NULL);
+}
+
+/*!
+** FUNCTION: _benchLoggerSetup / _benchLoggerOp / _benchLoggerTeardown
+**
+** DESCRIPTION: One LOG_INFO() with three arguments, draining in binary
+**              to /dev/null.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The drain thread is started unpinned so it doesn't share
+**           the benchmark's CPU.  A write into a full ring is a drop,
+**           which is cheaper; the count is printed.  bytes/op is the
+**           raw argument size.
+**
+*/
+static bool _benchLoggerSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    bool                    ret;
+
+    _benchPin(-1);
+    ret = loggerStart("/dev/null", LOGGER_OUTPUT_BINARY, LOG_LEVEL_DEBUG);
+    _benchPin(context->options->cpu);
+    *bytesPerOp = 3 * sizeof(uint32_t);
+
+    return (ret);
+}
+
+static bool _benchLoggerOp(benchContextStruct *context)
+{
+    context->challenge++;
+    LOG_INFO("chunk %u of %u acked after %u us", context->challenge, 4096U, 250U);
+
+    return (true);
+}
+
+static void _benchLoggerTeardown(benchContextStruct *context)
+{
+    printf("  (%u dropped)", loggerDropped());
+    loggerStop();
+
+    return;
+}
+
+/*!
+** FUNCTION: _benchFrameSetup / _benchFrameOp / _benchFrameTeardown
+**
+** DESCRIPTION: Builds one BENCH_FRAME_PAYLOAD frame the way
+**              send_ethernet_message() does, without sending it.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The handle is a stand-in for an open raw socket (sending
+**           needs CAP_NET_RAW and a link): "sockfd" is /dev/null, only
+**           to pass the open check, and the batch is emptied after
+**           each frame so it is never flushed.
+**
+*/
+static bool _benchFrameSetup(benchContextStruct *context, uint32_t *bytesPerOp)
+{
+    bool                    ret = false;
+    uint32_t                index;
+
+    context->sock = (dfu_sock_t *)calloc(1, sizeof(dfu_sock_t));
+    if (context->sock)
+    {
+        context->sock->sockfd = open("/dev/null", O_WRONLY);
+        context->sock->linkMTU = ENET_LEGACY_MAX_PAYLOAD;
+        set_ethernet_frame_mode(context->sock, ENET_FRAME_MODE_ETHERTYPE);
+        memcpy(context->sock->myMAC, "\x00\x1a\x2b\x00\x00\x01", 6);
+        memcpy(context->destMAC, "\x00\x1a\x2b\x3c\x4d\x5e", 6);
+        for (index = 0; index < sizeof(context->payload); index++)
+        {
+            context->payload[index] = (uint8_t)index;
+        }
+        ret = (context->sock->sockfd >= 0);
+        if (!ret)
+        {
+            free(context->sock);
+            context->sock = NULL;
+        }
+    }
+    *bytesPerOp = BENCH_FRAME_PAYLOAD;
+
+    return (ret);
+}
+
+static bool _benchFrameOp(benchContextStruct *context)
+{
+    bool                    ret = queue_ethernet_message(context->sock,
+                                                         context->destMAC,
+                                                         context->payload,
+                                                         BENCH_FRAME_PAYLOAD);
+
+    context->sock->txBatch.count = 0;
+
+    return (ret);
+}
+
+static void _benchFrameTeardown(benchContextStruct *context)
+{
+    if (context->sock)
+    {
+        if (context->sock->sockfd >= 0)
+        {
+            close(context->sock->sockfd);
+        }
+        free(context->sock);
+        context->sock = NULL;
+    }
+
+    return;
+}
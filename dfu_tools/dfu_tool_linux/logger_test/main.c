@@ -0,0 +1,597 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: main.c (logger_test)
+**
+** DESCRIPTION: Checks the logger's lock-free rings and its binary log
+**              round trip (loggerWrite() -> drain -> loggerDecode()).
+**
+** Every entry carries its producer and a sequence number, so the decoded
+** log shows exactly what arrived, twice, out of order or not at all:
+**
+**   wrap    One producer, LOGGER_RING_ENTRIES * 8 entries, retrying
+**           whenever the ring is full: all arrive, in order, after the
+**           ring has wrapped many times.
+**   full    One producer bursting LOGGER_RING_ENTRIES * 4 entries with
+**           no retry: the ring fills, every accepted entry arrives and
+**           every refused one is reported as dropped.
+**   multi   TEST_PRODUCERS threads at once, retrying: all arrive, each
+**           producer's in its own order, none twice.
+**   stop    Producers still writing flat out while loggerStop() runs:
+**           every write that returned true is in the log.
+**   format  "*" widths and precisions decode as printf() would print
+**           them.
+**
+** The logger is built in from logger.c, as in the tool.
+**
+**   logger_test [--case name]
+**
+** Exits non-zero if any case failed.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dfu_client_config.h"
+#include "async_timer.h"
+#include "logger.h"
+
+/*
+** Producers in the "multi" and "stop" cases, and the most entries one
+** producer writes in any case.
+**
+*/
+#define TEST_PRODUCERS                  (8U)
+#define TEST_STOP_PRODUCERS             (4U)
+#define TEST_MAX_SEQ                    (LOGGER_RING_ENTRIES * 8U)
+
+/*
+** How long the "stop" case lets its producers run before stopping.
+**
+*/
+#define TEST_STOP_AFTER_US              (20000U)
+
+/*
+** One producer thread.
+**
+*/
+typedef struct
+{
+    uint32_t                    producer;
+    uint32_t                    count;      // 0: until stopFlag
+    bool                        retry;      // Retry an entry the ring refused
+    bool *                      stopFlag;
+    uint32_t                    accepted;
+    uint32_t                    refused;
+}testProducerStruct;
+
+/*
+** What the decoded log held.
+**
+*/
+typedef struct
+{
+    bool                        decoded;
+    uint32_t                    entries[TEST_PRODUCERS];
+    uint32_t                    duplicates;
+    uint32_t                    outOfOrder;
+    uint32_t                    dropped;
+    bool                        found;
+}testResultStruct;
+
+/*
+** One test case.
+**
+*/
+typedef struct
+{
+    const char *                name;
+    bool                        (*run)(void);
+}testCaseStruct;
+
+static loggerFormatStruct       testEntryFormat = { "P%u N%u", 0 };
+static char                     testPath[256];
+static uint8_t                  testSeen[TEST_PRODUCERS][TEST_MAX_SEQ];
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static bool _testWrap(void);
+static bool _testFull(void);
+static bool _testMulti(void);
+static bool _testStop(void);
+static bool _testFormat(void);
+static void *_testProducerThread(void *arg);
+static bool _testRunProducers(testProducerStruct *producers, uint32_t count, bool stopWhileRunning);
+static bool _testDecode(testResultStruct *result, const char *expect);
+static bool _testCheckAll(const char *name, const testProducerStruct *producers, uint32_t count, const testResultStruct *result, bool ordered);
+
+static const testCaseStruct     testCases[] =
+{
+    { "wrap",   _testWrap },
+    { "full",   _testFull },
+    { "multi",  _testMulti },
+    { "stop",   _testStop },
+    { "format", _testFormat },
+};
+
+
+int main(int argc, char **argv)
+{
+    const char *                only = NULL;
+    const char *                tmpDir = getenv("TMPDIR");
+    uint32_t                    failed = 0;
+    uint32_t                    index;
+
+    if ( (argc > 2) && (strcmp(argv[1], "--case") == 0) )
+    {
+        only = argv[2];
+    }
+
+    TIMER_initMSTimer();
+    snprintf(testPath, sizeof(testPath), "%s/logger_test_%d.bin", (tmpDir) ? tmpDir : "/tmp", (int)getpid());
+
+    for (index = 0; index < (sizeof(testCases) / sizeof(testCases[0])); index++)
+    {
+        if ( (only == NULL) || (strcmp(only, testCases[index].name) == 0) )
+        {
+            if (!testCases[index].run())
+            {
+                failed++;
+            }
+        }
+    }
+
+    remove(testPath);
+    printf("\r\n %s (%u failed)\r\n", (failed == 0) ? "PASS" : "FAIL", failed);
+
+    return ((failed == 0) ? 0 : 1);
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _testWrap
+**
+** DESCRIPTION: One producer, many laps of the ring.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS:
+**
+*/
+static bool _testWrap(void)
+{
+    testProducerStruct          producer = { 0, LOGGER_RING_ENTRIES * 8U, true, NULL, 0, 0 };
+    testResultStruct            result;
+    bool                        ret;
+
+    ret = (
+              (_testRunProducers(&producer, 1, false)) &&
+              (_testDecode(&result, NULL)) &&
+              (_testCheckAll("wrap", &producer, 1, &result, true))
+          );
+
+    if ( (ret) && (result.entries[0] != producer.count) )
+    {
+        printf("\r\n wrap: %u of %u entries arrived", result.entries[0], producer.count);
+        ret = false;
+    }
+
+    printf("\r\n %-8s %s", "wrap", ret ? "PASS" : "FAIL");
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testFull
+**
+** DESCRIPTION: A burst faster than the drain thread: the ring must fill
+**              and refuse entries cleanly.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS:
+**
+*/
+static bool _testFull(void)
+{
+    testProducerStruct          producer = { 0, LOGGER_RING_ENTRIES * 4U, false, NULL, 0, 0 };
+    testResultStruct            result;
+    bool                        ret;
+
+    ret = (
+              (_testRunProducers(&producer, 1, false)) &&
+              (_testDecode(&result, NULL)) &&
+              (_testCheckAll("full", &producer, 1, &result, true))
+          );
+
+    if ( (ret) && (producer.refused == 0) )
+    {
+        printf("\r\n full: the ring never filled");
+        ret = false;
+    }
+    if ( (ret) && (result.dropped != producer.refused) )
+    {
+        printf("\r\n full: %u refused but %u reported dropped", producer.refused, result.dropped);
+        ret = false;
+    }
+
+    printf("\r\n %-8s %s (%u accepted, %u dropped)", "full", ret ? "PASS" : "FAIL", producer.accepted, producer.refused);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testMulti
+**
+** DESCRIPTION: TEST_PRODUCERS threads writing the same ring at once.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS:
+**
+*/
+static bool _testMulti(void)
+{
+    testProducerStruct          producers[TEST_PRODUCERS];
+    testResultStruct            result;
+    bool                        ret;
+    uint32_t                    index;
+
+    for (index = 0; index < TEST_PRODUCERS; index++)
+    {
+        testProducerStruct      producer = { index, LOGGER_RING_ENTRIES * 2U, true, NULL, 0, 0 };
+
+        producers[index] = producer;
+    }
+
+    ret = (
+              (_testRunProducers(producers, TEST_PRODUCERS, false)) &&
+              (_testDecode(&result, NULL)) &&
+              (_testCheckAll("multi", producers, TEST_PRODUCERS, &result, true))
+          );
+
+    for (index = 0; (ret) && (index < TEST_PRODUCERS); index++)
+    {
+        if (result.entries[index] != producers[index].count)
+        {
+            printf("\r\n multi: producer %u: %u of %u entries arrived", index, result.entries[index], producers[index].count);
+            ret = false;
+        }
+    }
+
+    printf("\r\n %-8s %s", "multi", ret ? "PASS" : "FAIL");
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testStop
+**
+** DESCRIPTION: loggerStop() with producers mid-write.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS: Writes after the stop are refused without counting as
+**           dropped, so only "accepted" is compared.
+**
+*/
+static bool _testStop(void)
+{
+    testProducerStruct          producers[TEST_STOP_PRODUCERS];
+    testResultStruct            result;
+    bool                        ret;
+    uint32_t                    index;
+
+    for (index = 0; index < TEST_STOP_PRODUCERS; index++)
+    {
+        testProducerStruct      producer = { index, 0, false, NULL, 0, 0 };
+
+        producers[index] = producer;
+    }
+
+    ret = (
+              (_testRunProducers(producers, TEST_STOP_PRODUCERS, true)) &&
+              (_testDecode(&result, NULL)) &&
+              (_testCheckAll("stop", producers, TEST_STOP_PRODUCERS, &result, true))
+          );
+
+    if ( (ret) && (result.dropped != loggerDropped()) )
+    {
+        printf("\r\n stop: %u dropped but %u reported", loggerDropped(), result.dropped);
+        ret = false;
+    }
+
+    printf("\r\n %-8s %s", "stop", ret ? "PASS" : "FAIL");
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testFormat
+**
+** DESCRIPTION: "*" widths and precisions, including negative ones.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS:
+**
+*/
+static bool _testFormat(void)
+{
+    static loggerFormatStruct   starFormat = { "[%*d|%-*s|%.*f|%*.*s|%*d|%.*d|%5.*x]", 0 };
+    char                        expect[128];
+    testResultStruct            result;
+    bool                        ret = false;
+
+    snprintf(expect, sizeof(expect), starFormat.text, 6, 42, 5, "ab", 2, 3.14159, 7, 2, "xyz", -4, 7, -1, 9, 3, 0xAB);
+
+    if (loggerStart(testPath, LOGGER_OUTPUT_BINARY, LOG_LEVEL_DEBUG))
+    {
+        loggerWrite(LOG_LEVEL_INFO, &starFormat, 6, 42, 5, "ab", 2, 3.14159, 7, 2, "xyz", -4, 7, -1, 9, 3, 0xAB);
+        loggerStop();
+
+        ret = ( (_testDecode(&result, expect)) && (result.found) );
+    }
+
+    printf("\r\n %-8s %s (%s)", "format", ret ? "PASS" : "FAIL", expect);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testProducerThread
+**
+** DESCRIPTION: Writes numbered entries.
+**
+** PARAMETERS: arg: testProducerStruct
+**
+** RETURNS:
+**
+** COMMENTS: Without retry a refused number is skipped, so the log has
+**           gaps but still only rising numbers.
+**
+*/
+static void *_testProducerThread(void *arg)
+{
+    testProducerStruct *        producer = (testProducerStruct *)arg;
+    uint32_t                    seq = 0;
+
+    while (
+              (seq < TEST_MAX_SEQ) &&
+              ( (producer->count == 0) || (seq < producer->count) ) &&
+              ( (producer->stopFlag == NULL) || (!__atomic_load_n(producer->stopFlag, __ATOMIC_ACQUIRE)) )
+          )
+    {
+        if (loggerWrite(LOG_LEVEL_INFO, &testEntryFormat, producer->producer, seq))
+        {
+            producer->accepted++;
+            seq++;
+        }
+        else
+        {
+            producer->refused++;
+            if (producer->retry)
+            {
+                TIMER_SleepUS(50U);
+            }
+            else
+            {
+                seq++;
+            }
+        }
+    }
+
+    return (NULL);
+}
+
+/*!
+** FUNCTION: _testRunProducers
+**
+** DESCRIPTION: Starts the logger and runs the producers.
+**
+** PARAMETERS: stopWhileRunning: Stop the logger TEST_STOP_AFTER_US in,
+**                               while they are still writing.
+**
+** RETURNS: false if the logger or a thread couldn't start.
+**
+** COMMENTS: The logger is stopped when this returns.
+**
+*/
+static bool _testRunProducers(testProducerStruct *producers, uint32_t count, bool stopWhileRunning)
+{
+    pthread_t                   threads[TEST_PRODUCERS];
+    bool                        stopFlag = false;
+    uint32_t                    started = 0;
+    bool                        ret = false;
+    uint32_t                    index;
+
+    if (loggerStart(testPath, LOGGER_OUTPUT_BINARY, LOG_LEVEL_DEBUG))
+    {
+        for (index = 0; index < count; index++)
+        {
+            producers[index].stopFlag = (stopWhileRunning) ? &stopFlag : NULL;
+            if (pthread_create(&threads[index], NULL, _testProducerThread, &producers[index]) == 0)
+            {
+                started++;
+            }
+        }
+
+        if (stopWhileRunning)
+        {
+            TIMER_SleepUS(TEST_STOP_AFTER_US);
+            loggerStop();
+            __atomic_store_n(&stopFlag, true, __ATOMIC_RELEASE);
+        }
+
+        for (index = 0; index < started; index++)
+        {
+            pthread_join(threads[index], NULL);
+        }
+
+        loggerStop();
+        ret = (started == count);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testDecode
+**
+** DESCRIPTION: Decodes the log and tallies its entries.
+**
+** PARAMETERS: expect: Text to look for in the messages, or NULL.
+**
+** RETURNS: false if the log couldn't be decoded.
+**
+** COMMENTS:
+**
+*/
+static bool _testDecode(testResultStruct *result, const char *expect)
+{
+    FILE *                      logFile = fopen(testPath, "rb");
+    FILE *                      text = tmpfile();
+    int32_t                     last[TEST_PRODUCERS];
+    char                        line[512];
+    uint32_t                    index;
+
+    memset(result, 0, sizeof(testResultStruct));
+    memset(testSeen, 0, sizeof(testSeen));
+    for (index = 0; index < TEST_PRODUCERS; index++)
+    {
+        last[index] = -1;
+    }
+
+    if ( (logFile) && (text) )
+    {
+        result->decoded = loggerDecode(logFile, text);
+        rewind(text);
+
+        while (fgets(line, sizeof(line), text) != NULL)
+        {
+            unsigned int        producer;
+            unsigned int        seq;
+            unsigned int        dropped;
+            const char *        message = strstr(line, " P");
+
+            if ( (message) && (sscanf(message, " P%u N%u", &producer, &seq) == 2) )
+            {
+                if ( (producer < TEST_PRODUCERS) && (seq < TEST_MAX_SEQ) )
+                {
+                    result->entries[producer]++;
+                    if (testSeen[producer][seq]++ > 0)
+                    {
+                        result->duplicates++;
+                    }
+                    if ((int32_t)seq <= last[producer])
+                    {
+                        result->outOfOrder++;
+                    }
+                    last[producer] = (int32_t)seq;
+                }
+            }
+            else
+            if (sscanf(line, "*** %u", &dropped) == 1)
+            {
+                result->dropped += dropped;
+            }
+
+            if ( (expect) && (strstr(line, expect) != NULL) )
+            {
+                result->found = true;
+            }
+        }
+    }
+
+    if (logFile)
+    {
+        fclose(logFile);
+    }
+    if (text)
+    {
+        fclose(text);
+    }
+
+    if (!result->decoded)
+    {
+        printf("\r\n Could not decode %s!", testPath);
+    }
+
+    return (result->decoded);
+}
+
+/*!
+** FUNCTION: _testCheckAll
+**
+** DESCRIPTION: Every accepted entry arrived once, and (if "ordered")
+**              each producer's in the order it wrote them.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool _testCheckAll(const char *name, const testProducerStruct *producers, uint32_t count, const testResultStruct *result, bool ordered)
+{
+    bool                        ret = true;
+    uint32_t                    index;
+
+    for (index = 0; index < count; index++)
+    {
+        if (result->entries[producers[index].producer] != producers[index].accepted)
+        {
+            printf("\r\n %s: producer %u: %u accepted but %u in the log",
+                   name,
+                   producers[index].producer,
+                   producers[index].accepted,
+                   result->entries[producers[index].producer]);
+            ret = false;
+        }
+    }
+
+    if (result->duplicates > 0)
+    {
+        printf("\r\n %s: %u entries logged twice", name, result->duplicates);
+        ret = false;
+    }
+
+    if ( (ordered) && (result->outOfOrder > 0) )
+    {
+        printf("\r\n %s: %u entries out of order", name, result->outOfOrder);
+        ret = false;
+    }
+
+    return (ret);
+}
@@ -0,0 +1,877 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: main.c (timer_wheel_test)
+**
+** DESCRIPTION: Checks the timer wheel, on a clock the test turns by hand,
+**              and the event loop's timers that run on it.
+**
+** Every timer records when it fired, so each case can tell a timer that
+** fired early, late, twice or not at all:
+**
+**   order     TEST_TIMERS timers spread over every level, the clock
+**             turned in uneven steps: each fires once, in expiry order,
+**             on the first turn that reaches its tick.
+**   cancel    Half of them cancelled before they're due: those never
+**             fire, the rest do, and cancelling twice is harmless.
+**   rearm     A timer that re-arms itself from its callback, one that
+**             re-arms for "now", and one that cancels another timer due
+**             on the same tick.
+**   far       Timers beyond the wheel's span, parked in the top level,
+**             still fire on time.
+**   deadline  timerWheelNextDeadline() is never later than the earliest
+**             timer, and sleeping until it repeatedly empties the wheel.
+**   loop      eventLoopAddTimer() one-shot, periodic and cancelled
+**             timers, plus an entry on eventLoopGetTimerWheel(), on a
+**             real clock; the loop sleeps between them.
+**
+** The wheel and the loop are built in from timer_wheel.c and
+** event_loop.c, as in the tool.
+**
+**   timer_wheel_test [--case name]
+**
+** Exits non-zero if any case failed.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+#include "async_timer.h"
+#include "timer_wheel.h"
+#include "event_loop.h"
+
+/*
+** Timers in the "order", "cancel" and "deadline" cases, and the furthest
+** out they're armed: into the top level but inside the span.
+**
+*/
+#define TEST_TIMERS                     (512U)
+#define TEST_MAX_DELAY_TICKS            (1U << (TIMER_WHEEL_SLOT_BITS * (TIMER_WHEEL_LEVELS - 1U) + 2U))
+
+/*
+** Where the hand-turned clock starts: far from 0, so nothing relies on
+** the wheel's origin being 0.
+**
+*/
+#define TEST_ORIGIN_US                  (123456789ULL)
+
+/*
+** The "loop" case's timers, in mS.
+**
+*/
+#define TEST_LOOP_ONESHOT_MS            (5U)
+#define TEST_LOOP_PERIOD_MS             (10U)
+#define TEST_LOOP_CANCELLED_MS          (20U)
+#define TEST_LOOP_ENTRY_MS              (30U)
+#define TEST_LOOP_STOP_MS               (105U)
+
+/*
+** One timer and what happened to it.
+**
+*/
+typedef struct testTimerStruct
+{
+    timerWheelEntryStruct       entry;      // Must stay first
+    uint64_t                    dueUS;      // When the tick it rounds up to starts
+    uint64_t                    firedUS;
+    uint64_t                    firedAfterUS;   // The turn before the one it fired on
+    uint64_t                    rearmUS;    // 0: one-shot
+    struct testTimerStruct *    cancels;    // Cancelled from the callback
+    uint32_t                    fired;
+    uint32_t                    order;
+    bool                        cancelled;
+}testTimerStruct;
+
+/*
+** The hand-turned clock, and where the wheel was last turned to before
+** the current turn (0: never).
+**
+*/
+typedef struct
+{
+    uint64_t                    nowUS;
+    uint64_t                    previousUS;
+    uint64_t                    turnedUS;
+    uint32_t                    firedCount;
+    bool                        outOfOrder;
+    uint64_t                    lastDueUS;
+}testClockStruct;
+
+/*
+** The "loop" case's record.
+**
+*/
+typedef struct
+{
+    uint64_t                    startUS;
+    uint64_t                    oneshotUS;
+    uint64_t                    entryUS;
+    uint32_t                    oneshot;
+    uint32_t                    periodic;
+    uint32_t                    cancelled;
+    uint32_t                    entry;
+    uint32_t                    wakeups;
+    int                         cancelId;
+}testLoopStruct;
+
+/*
+** One test case.
+**
+*/
+typedef struct
+{
+    const char *                name;
+    bool                        (*run)(void);
+}testCaseStruct;
+
+static timerWheelStruct         testWheel;
+static testTimerStruct          testTimers[TEST_TIMERS];
+static testClockStruct          testClock;
+static uint32_t                 testSeed = 12345U;
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static bool _testOrder(void);
+static bool _testCancel(void);
+static bool _testRearm(void);
+static bool _testFar(void);
+static bool _testDeadline(void);
+static bool _testLoop(void);
+static uint32_t _testRandom(void);
+static void _testStart(void);
+static void _testArm(testTimerStruct *timer, uint64_t delayUS);
+static void _testArmAll(void);
+static void _testTurn(uint64_t nowUS);
+static void _testFired(timerWheelStruct *wheel, timerWheelEntryStruct *entry, void *ctx);
+static bool _testCheckAll(const char *name, bool ordered);
+static void _testLoopOneshot(eventLoopStruct *loop, int timerId, void *ctx);
+static void _testLoopPeriodic(eventLoopStruct *loop, int timerId, void *ctx);
+static void _testLoopCancelled(eventLoopStruct *loop, int timerId, void *ctx);
+static void _testLoopStop(eventLoopStruct *loop, int timerId, void *ctx);
+static void _testLoopEntry(timerWheelStruct *wheel, timerWheelEntryStruct *entry, void *ctx);
+static void _testLoopIdle(eventLoopStruct *loop, void *ctx);
+
+static const testCaseStruct     testCases[] =
+{
+    { "order",    _testOrder },
+    { "cancel",   _testCancel },
+    { "rearm",    _testRearm },
+    { "far",      _testFar },
+    { "deadline", _testDeadline },
+    { "loop",     _testLoop },
+};
+
+
+int main(int argc, char **argv)
+{
+    const char *                only = NULL;
+    uint32_t                    failed = 0;
+    uint32_t                    index;
+
+    if ( (argc > 2) && (strcmp(argv[1], "--case") == 0) )
+    {
+        only = argv[2];
+    }
+
+    TIMER_initMSTimer();
+
+    for (index = 0; index < (sizeof(testCases) / sizeof(testCases[0])); index++)
+    {
+        if ( (only == NULL) || (strcmp(only, testCases[index].name) == 0) )
+        {
+            if (!testCases[index].run())
+            {
+                failed++;
+            }
+        }
+    }
+
+    printf("\r\n %s (%u failed)\r\n", (failed == 0) ? "PASS" : "FAIL", failed);
+
+    return ((failed == 0) ? 0 : 1);
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: _testOrder
+**
+** DESCRIPTION: Timers on every level, fired by uneven turns.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS: Turns are up to 3 ticks and a bit, so most land mid-tick and
+**           some ticks are skipped.
+**
+*/
+static bool _testOrder(void)
+{
+    bool                        ret;
+
+    _testStart();
+    _testArmAll();
+
+    while (testWheel.armedCount > 0)
+    {
+        _testTurn(testClock.nowUS + 1U + (_testRandom() % ((TIMER_WHEEL_TICK_US * 3U) + 7U)));
+    }
+
+    ret = _testCheckAll("order", true);
+
+    printf("\r\n %-8s %s", "order", ret ? "PASS" : "FAIL");
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testCancel
+**
+** DESCRIPTION: Cancels every other timer part way through.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS:
+**
+*/
+static bool _testCancel(void)
+{
+    bool                        ret = true;
+    uint32_t                    index;
+    uint32_t                    armed;
+
+    _testStart();
+    _testArmAll();
+
+    // Let some fire first, so cancels hit every level
+    _testTurn(testClock.nowUS + (TEST_MAX_DELAY_TICKS / 64U) * TIMER_WHEEL_TICK_US);
+
+    armed = testWheel.armedCount;
+    for (index = 0; index < TEST_TIMERS; index += 2U)
+    {
+        if (testTimers[index].fired == 0)
+        {
+            if (
+                   (!timerWheelCancel(&testWheel, &testTimers[index].entry)) ||
+                   (timerWheelCancel(&testWheel, &testTimers[index].entry)) ||
+                   (timerWheelIsArmed(&testTimers[index].entry))
+               )
+            {
+                printf("\r\n cancel: timer %u didn't cancel exactly once", index);
+                ret = false;
+            }
+            testTimers[index].cancelled = true;
+            armed--;
+        }
+    }
+
+    if (testWheel.armedCount != armed)
+    {
+        printf("\r\n cancel: %u armed, expected %u", testWheel.armedCount, armed);
+        ret = false;
+    }
+
+    while (testWheel.armedCount > 0)
+    {
+        _testTurn(testClock.nowUS + (_testRandom() % (TIMER_WHEEL_TICK_US * 50U)));
+    }
+
+    ret = ( (_testCheckAll("cancel", true)) && (ret) );
+
+    printf("\r\n %-8s %s", "cancel", ret ? "PASS" : "FAIL");
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testRearm
+**
+** DESCRIPTION: Callbacks that re-arm themselves or cancel a sibling.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS: testTimers[0] re-arms every 10 ticks, testTimers[1] re-arms
+**           1uS on (the same tick, so it must wait for the next) and
+**           testTimers[2] cancels testTimers[3], both due on one tick.
+**
+*/
+static bool _testRearm(void)
+{
+    bool                        ret = true;
+    uint32_t                    turn;
+    uint32_t                    fired;
+
+    _testStart();
+
+    for (turn = 0; turn < 4U; turn++)
+    {
+        timerWheelEntryInit(&testTimers[turn].entry, _testFired, NULL);
+    }
+    testTimers[0].rearmUS = TIMER_WHEEL_TICK_US * 10U;
+    testTimers[1].rearmUS = 1U;
+    testTimers[2].cancels = &testTimers[3];
+    testTimers[3].cancelled = true;
+    _testArm(&testTimers[0], TIMER_WHEEL_TICK_US * 10U);
+    _testArm(&testTimers[1], 0);
+    _testArm(&testTimers[2], TIMER_WHEEL_TICK_US * 5U);
+    _testArm(&testTimers[3], TIMER_WHEEL_TICK_US * 5U);
+
+    // Tick 0, then 1000 more, one tick per turn
+    _testTurn(testClock.nowUS);
+    for (turn = 0; turn < 1000U; turn++)
+    {
+        fired = testTimers[1].fired;
+        _testTurn(testClock.nowUS + TIMER_WHEEL_TICK_US);
+        if (testTimers[1].fired != fired + 1U)
+        {
+            printf("\r\n rearm: \"now\" timer fired %u times in one tick", testTimers[1].fired - fired);
+            ret = false;
+            break;
+        }
+    }
+
+    if (testTimers[0].fired != 1000U / 10U)
+    {
+        printf("\r\n rearm: periodic timer fired %u times, expected 100", testTimers[0].fired);
+        ret = false;
+    }
+    if ( (testTimers[2].fired != 1U) || (testTimers[3].fired != 0) )
+    {
+        printf("\r\n rearm: cancel from a callback: %u/%u fired", testTimers[2].fired, testTimers[3].fired);
+        ret = false;
+    }
+
+    timerWheelCancel(&testWheel, &testTimers[0].entry);
+    timerWheelCancel(&testWheel, &testTimers[1].entry);
+    if (testWheel.armedCount != 0)
+    {
+        printf("\r\n rearm: %u still armed", testWheel.armedCount);
+        ret = false;
+    }
+
+    printf("\r\n %-8s %s", "rearm", ret ? "PASS" : "FAIL");
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testFar
+**
+** DESCRIPTION: Timers one to four spans out.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS: Turned a second at a time, but each must still fire on the
+**           first turn that reaches its tick.
+**
+*/
+static bool _testFar(void)
+{
+    uint64_t                    spanUS = ((uint64_t)1U << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) * TIMER_WHEEL_TICK_US;
+    bool                        ret;
+    uint32_t                    index;
+
+    _testStart();
+
+    for (index = 0; index < 8U; index++)
+    {
+        timerWheelEntryInit(&testTimers[index].entry, _testFired, NULL);
+        _testArm(&testTimers[index], (spanUS * ((index / 2U) + 1U)) + (_testRandom() % 1000000U));
+    }
+
+    while (testWheel.armedCount > 0)
+    {
+        _testTurn(testClock.nowUS + 1000000U);
+    }
+
+    ret = _testCheckAll("far", true);
+
+    printf("\r\n %-8s %s", "far", ret ? "PASS" : "FAIL");
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testDeadline
+**
+** DESCRIPTION: Sleeps from deadline to deadline until the wheel is
+**              empty.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS: A deadline may be early (when a level cascades) but must
+**           never pass the earliest timer.  Each turn must fire something
+**           or move a level down, so the number of turns is bounded by
+**           the timers plus the cascades.
+**
+*/
+static bool _testDeadline(void)
+{
+    bool                        ret = true;
+    uint32_t                    turns = 0;
+    uint64_t                    deadlineUS;
+    uint64_t                    earliestUS;
+    uint32_t                    index;
+
+    _testStart();
+
+    if (timerWheelNextDeadline(&testWheel, testClock.nowUS) != TIMER_WHEEL_NEVER)
+    {
+        printf("\r\n deadline: an empty wheel has a deadline");
+        ret = false;
+    }
+
+    _testArmAll();
+
+    while ( (ret) && (testWheel.armedCount > 0) )
+    {
+        deadlineUS = timerWheelNextDeadline(&testWheel, testClock.nowUS);
+
+        earliestUS = UINT64_MAX;
+        for (index = 0; index < TEST_TIMERS; index++)
+        {
+            if ( (testTimers[index].fired == 0) && (testTimers[index].dueUS < earliestUS) )
+            {
+                earliestUS = testTimers[index].dueUS;
+            }
+        }
+
+        if (
+               (deadlineUS == TIMER_WHEEL_NEVER) ||
+               (testClock.nowUS + deadlineUS > earliestUS)
+           )
+        {
+            printf("\r\n deadline: %llu uS from %llu, but a timer is due at %llu",
+                   (unsigned long long)deadlineUS, (unsigned long long)testClock.nowUS, (unsigned long long)earliestUS);
+            ret = false;
+        }
+
+        _testTurn(testClock.nowUS + deadlineUS);
+
+        if (++turns > (TEST_TIMERS * 2U) + (TIMER_WHEEL_SLOTS * TIMER_WHEEL_LEVELS * 4U))
+        {
+            printf("\r\n deadline: still %u armed after %u turns", testWheel.armedCount, turns);
+            ret = false;
+        }
+    }
+
+    ret = ( (ret) && (_testCheckAll("deadline", true)) );
+
+    printf("\r\n %-8s %s (%u turns)", "deadline", ret ? "PASS" : "FAIL", turns);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testLoop
+**
+** DESCRIPTION: The event loop's own timers, on the real clock.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it passed.
+**
+** COMMENTS: The idle hook counts wake-ups: one per timer plus the odd
+**           early cascade, where a loop that polled would wake every
+**           millisecond or so.
+**
+*/
+static bool _testLoop(void)
+{
+    bool                        ret = false;
+    eventLoopStruct *           loop = eventLoopCreate();
+    testLoopStruct              record;
+    timerWheelEntryStruct       entry;
+
+    memset(&record, 0, sizeof(record));
+
+    if (loop)
+    {
+        record.startUS = TIMER_GetMicroseconds();
+
+        eventLoopAddTimer(loop, TEST_LOOP_ONESHOT_MS, 0, _testLoopOneshot, &record);
+        eventLoopAddTimer(loop, TEST_LOOP_PERIOD_MS, TEST_LOOP_PERIOD_MS, _testLoopPeriodic, &record);
+        record.cancelId = eventLoopAddTimer(loop, TEST_LOOP_CANCELLED_MS, 0, _testLoopCancelled, &record);
+        eventLoopAddTimer(loop, TEST_LOOP_STOP_MS, 0, _testLoopStop, &record);
+        eventLoopAddIdle(loop, _testLoopIdle, &record);
+
+        timerWheelEntryInit(&entry, _testLoopEntry, &record);
+        timerWheelArm(eventLoopGetTimerWheel(loop), &entry, record.startUS, TEST_LOOP_ENTRY_MS * 1000U);
+
+        ret = eventLoopRun(loop, 1000U);
+        if (!ret)
+        {
+            printf("\r\n loop: the stop timer never fired");
+        }
+
+        if (
+               (record.oneshot != 1U) ||
+               (record.oneshotUS - record.startUS < TEST_LOOP_ONESHOT_MS * 1000U)
+           )
+        {
+            printf("\r\n loop: one-shot fired %u times, after %llu uS",
+                   record.oneshot, (unsigned long long)(record.oneshotUS - record.startUS));
+            ret = false;
+        }
+        if ( (record.periodic < (TEST_LOOP_STOP_MS / TEST_LOOP_PERIOD_MS) - 2U) || (record.periodic > TEST_LOOP_STOP_MS / TEST_LOOP_PERIOD_MS) )
+        {
+            printf("\r\n loop: periodic fired %u times in %u mS", record.periodic, TEST_LOOP_STOP_MS);
+            ret = false;
+        }
+        if (record.cancelled != 0)
+        {
+            printf("\r\n loop: cancelled timer fired");
+            ret = false;
+        }
+        if (
+               (record.entry != 1U) ||
+               (record.entryUS - record.startUS < TEST_LOOP_ENTRY_MS * 1000U)
+           )
+        {
+            printf("\r\n loop: wheel entry fired %u times, after %llu uS",
+                   record.entry, (unsigned long long)(record.entryUS - record.startUS));
+            ret = false;
+        }
+        if (record.wakeups > 4U * (record.oneshot + record.periodic + record.entry + 1U))
+        {
+            printf("\r\n loop: %u wake-ups for %u timers", record.wakeups, record.oneshot + record.periodic + record.entry + 1U);
+            ret = false;
+        }
+
+        eventLoopDestroy(loop);
+    }
+
+    printf("\r\n %-8s %s (%u wake-ups)", "loop", ret ? "PASS" : "FAIL", record.wakeups);
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testRandom
+**
+** DESCRIPTION: Repeatable pseudo-random numbers.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _testRandom(void)
+{
+    testSeed = (testSeed * 1103515245U) + 12345U;
+
+    return (testSeed >> 1);
+}
+
+/*!
+** FUNCTION: _testStart
+**
+** DESCRIPTION: Empties the wheel, the timers and the clock.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _testStart(void)
+{
+    timerWheelInit(&testWheel, TEST_ORIGIN_US);
+    memset(testTimers, 0, sizeof(testTimers));
+    memset(&testClock, 0, sizeof(testClock));
+    testClock.nowUS = TEST_ORIGIN_US;
+
+    return;
+}
+
+/*!
+** FUNCTION: _testArm
+**
+** DESCRIPTION: Arms a timer "delayUS" from the clock's now.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Works out the tick the wheel should fire it on
+**           independently of the wheel.
+**
+*/
+static void _testArm(testTimerStruct *timer, uint64_t delayUS)
+{
+    uint64_t                    ticks = ((testClock.nowUS + delayUS - TEST_ORIGIN_US) + TIMER_WHEEL_TICK_US - 1U) / TIMER_WHEEL_TICK_US;
+
+    timer->dueUS = TEST_ORIGIN_US + (ticks * TIMER_WHEEL_TICK_US);
+    timerWheelArm(&testWheel, &timer->entry, testClock.nowUS, delayUS);
+
+    return;
+}
+
+/*!
+** FUNCTION: _testArmAll
+**
+** DESCRIPTION: Arms all TEST_TIMERS, spread evenly over the levels.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Some share a delay, to check same-tick order.
+**
+*/
+static void _testArmAll(void)
+{
+    uint32_t                    index;
+    uint64_t                    delayUS = 0;
+    uint32_t                    maxTicks;
+    uint32_t                    level;
+
+    for (index = 0; index < TEST_TIMERS; index++)
+    {
+        level = (index % TIMER_WHEEL_LEVELS) + 1U;
+        maxTicks = (level == TIMER_WHEEL_LEVELS) ? TEST_MAX_DELAY_TICKS : (1U << (TIMER_WHEEL_SLOT_BITS * level));
+
+        if ((index % 16U) != 15U)
+        {
+            delayUS = ((uint64_t)(_testRandom() % maxTicks) * TIMER_WHEEL_TICK_US) + (_testRandom() % TIMER_WHEEL_TICK_US);
+        }
+
+        timerWheelEntryInit(&testTimers[index].entry, _testFired, NULL);
+        _testArm(&testTimers[index], delayUS);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _testTurn
+**
+** DESCRIPTION: Moves the clock to "nowUS" and turns the wheel.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _testTurn(uint64_t nowUS)
+{
+    testClock.previousUS = testClock.turnedUS;
+    testClock.nowUS = nowUS;
+    timerWheelAdvance(&testWheel, nowUS);
+    testClock.turnedUS = nowUS;
+
+    return;
+}
+
+/*!
+** FUNCTION: _testFired
+**
+** DESCRIPTION: Wheel callback for the hand-clock cases.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Re-arms or cancels as the timer says.
+**
+*/
+static void _testFired(timerWheelStruct *wheel, timerWheelEntryStruct *entry, void *ctx)
+{
+    testTimerStruct *           timer = (testTimerStruct *)entry;
+
+    (void)ctx;
+    timer->fired++;
+    timer->firedUS = testClock.nowUS;
+    timer->firedAfterUS = testClock.previousUS;
+    timer->order = testClock.firedCount++;
+
+    if (timer->dueUS < testClock.lastDueUS)
+    {
+        testClock.outOfOrder = true;
+    }
+    testClock.lastDueUS = timer->dueUS;
+
+    if (timer->cancels)
+    {
+        timerWheelCancel(wheel, &timer->cancels->entry);
+    }
+    if (timer->rearmUS)
+    {
+        _testArm(timer, timer->rearmUS);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _testCheckAll
+**
+** DESCRIPTION: Every timer not cancelled fired once, neither early nor
+**              on a later turn than the one that reached its tick.
+**
+** PARAMETERS: ordered: Also check they fired in expiry order.
+**
+** RETURNS: true if they did.
+**
+** COMMENTS: "Late" is judged against the turn before the one it fired
+**           on: that turn must not already have reached its tick.
+**
+*/
+static bool _testCheckAll(const char *name, bool ordered)
+{
+    bool                        ret = true;
+    uint32_t                    early = 0;
+    uint32_t                    late = 0;
+    uint32_t                    wrong = 0;
+    uint32_t                    index;
+
+    for (index = 0; index < TEST_TIMERS; index++)
+    {
+        testTimerStruct *       timer = &testTimers[index];
+
+        if (timer->entry.callback == NULL)
+        {
+            continue;
+        }
+
+        if (timer->fired != ((timer->cancelled) ? 0U : 1U))
+        {
+            wrong++;
+        }
+        else
+        if (timer->fired)
+        {
+            if (timer->firedUS < timer->dueUS)
+            {
+                early++;
+            }
+            else
+            if (timer->dueUS <= timer->firedAfterUS)
+            {
+                late++;
+            }
+        }
+    }
+
+    if ( (early > 0) || (late > 0) || (wrong > 0) )
+    {
+        printf("\r\n %s: %u early, %u late, %u fired the wrong number of times", name, early, late, wrong);
+        ret = false;
+    }
+    if ( (ordered) && (testClock.outOfOrder) )
+    {
+        printf("\r\n %s: fired out of expiry order", name);
+        ret = false;
+    }
+    if (testWheel.armedCount != 0)
+    {
+        printf("\r\n %s: %u still armed", name, testWheel.armedCount);
+        ret = false;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _testLoopOneshot, _testLoopPeriodic, _testLoopCancelled,
+**           _testLoopStop, _testLoopEntry, _testLoopIdle
+**
+** DESCRIPTION: The "loop" case's callbacks.
+**
+** PARAMETERS: ctx: The testLoopStruct.
+**
+** RETURNS:
+**
+** COMMENTS: The one-shot cancels the timer due after it.
+**
+*/
+static void _testLoopOneshot(eventLoopStruct *loop, int timerId, void *ctx)
+{
+    testLoopStruct *            record = (testLoopStruct *)ctx;
+
+    (void)timerId;
+    record->oneshot++;
+    record->oneshotUS = TIMER_GetMicroseconds();
+    eventLoopCancelTimer(loop, record->cancelId);
+
+    return;
+}
+
+static void _testLoopPeriodic(eventLoopStruct *loop, int timerId, void *ctx)
+{
+    (void)loop;
+    (void)timerId;
+    ((testLoopStruct *)ctx)->periodic++;
+
+    return;
+}
+
+static void _testLoopCancelled(eventLoopStruct *loop, int timerId, void *ctx)
+{
+    (void)loop;
+    (void)timerId;
+    ((testLoopStruct *)ctx)->cancelled++;
+
+    return;
+}
+
+static void _testLoopStop(eventLoopStruct *loop, int timerId, void *ctx)
+{
+    (void)timerId;
+    (void)ctx;
+    eventLoopStop(loop);
+
+    return;
+}
+
+static void _testLoopEntry(timerWheelStruct *wheel, timerWheelEntryStruct *entry, void *ctx)
+{
+    testLoopStruct *            record = (testLoopStruct *)ctx;
+
+    (void)wheel;
+    (void)entry;
+    record->entry++;
+    record->entryUS = TIMER_GetMicroseconds();
+
+    return;
+}
+
+static void _testLoopIdle(eventLoopStruct *loop, void *ctx)
+{
+    (void)loop;
+    ((testLoopStruct *)ctx)->wakeups++;
+
+    return;
+}
@@ -0,0 +1,175 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: can_isotp.h
+**
+** DESCRIPTION: ISO-TP (ISO 15765-2) segmentation of DFU messages over a
+**              CAN socket.
+**
+** A message that fits one frame goes as a single frame; anything
+** bigger goes as a first frame, then consecutive frames in the blocks
+** the receiver's flow control frames allow.  CAN-FD frames carry up to
+** 64 bytes each, and first frames use the 32-bit length escape past
+** 4095 bytes, so a full MAX_MSG_LEN message fits.
+**
+** Frames for a message being sent go out a burst at a time with one
+** sendmmsg(); received frames come in a batch at a time with one
+** recvmmsg().  An instance isn't locked: use it from one thread.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+#include "dfu_proto_config.h"
+#include "can_sockets.h"
+
+/*
+** One message being received.  A finished message stays put until it
+** has been handed out and the next receive call comes in.
+**
+*/
+typedef struct
+{
+    bool                        active;
+    bool                        ready;
+    bool                        delivered;
+    uint32_t                    canId;
+    uint32_t                    length;
+    uint32_t                    received;
+    uint8_t                     nextSeq;
+    uint8_t                     blockLeft;
+    uint32_t                    order;
+    uint64_t                    lastUS;
+    uint8_t                     data[MAX_MSG_LEN];
+}canIsoTpRxStruct;
+
+/*
+** What happened so far.
+**
+**   overflows: Messages refused because they were too big or every
+**              receive context was busy.
+**   timeouts:  Sends with no flow control in time, plus receives that
+**              stalled part way.
+**   errors:    Out-of-sequence frames and refused sends.
+**
+*/
+typedef struct
+{
+    uint32_t                    messagesSent;
+    uint32_t                    messagesReceived;
+    uint32_t                    framesSent;
+    uint32_t                    overflows;
+    uint32_t                    timeouts;
+    uint32_t                    errors;
+}canIsoTpStatsStruct;
+
+/*
+** ISO-TP state for one socket.  blockSize and stMin are what our flow
+** control frames ask of a sender (CAN_ISOTP_BLOCK_SIZE and
+** CAN_ISOTP_STMIN unless changed after canIsoTpInit()).
+**
+*/
+typedef struct
+{
+    dfu_can_sock_t *            sock;
+    uint32_t                    flowOffset;
+    uint8_t                     blockSize;
+    uint8_t                     stMin;
+    canIsoTpRxStruct            rx[CAN_ISOTP_RX_CONTEXTS];
+    uint32_t                    rxOrder;
+    uint32_t                    pendingFrames;
+
+    uint32_t                    flowId;
+    bool                        flowValid;
+    uint8_t                     flowStatus;
+    uint8_t                     flowBlockSize;
+    uint8_t                     flowSTmin;
+
+    canIsoTpStatsStruct         stats;
+}canIsoTpStruct;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: canIsoTpInit
+**
+** DESCRIPTION: Sets up ISO-TP over an open CAN socket.
+**
+** PARAMETERS: flowOffset: Our flow control for a message received on
+**                         ID "x" goes to "x - flowOffset" (the
+**                         sender's request ID).
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void canIsoTpInit(canIsoTpStruct *tp, dfu_can_sock_t *sock, uint32_t flowOffset);
+
+/*!
+** FUNCTION: canIsoTpSend
+**
+** DESCRIPTION: Sends one message, segmenting it if it needs more than
+**              one frame.
+**
+** PARAMETERS: txId:   Where the frames go.
+**             flowId: Where the receiver's flow control comes from.
+**                     0 for a functional (many-target) send, which has
+**                     no flow control and so must fit one frame.
+**
+** RETURNS: false if it couldn't all be sent.
+**
+** COMMENTS: Blocks until the last frame is handed to the kernel.
+**           Frames received while waiting for flow control aren't
+**           lost; they go towards the next canIsoTpReceive().
+**
+*/
+bool canIsoTpSend(canIsoTpStruct *tp, uint32_t txId, uint32_t flowId, const uint8_t *msg, uint32_t len);
+
+/*!
+** FUNCTION: canIsoTpReceive
+**
+** DESCRIPTION: The next complete message, from whichever sender.
+**
+** PARAMETERS: timeoutMS: How long to wait for frames.
+**             canId: [OUT] The ID it came in on.
+**             len: [OUT]
+**
+** RETURNS: NULL if none was finished in time.  A message that is still
+**          coming in carries on with the next call.
+**
+** COMMENTS: The message stays valid until the next call.
+**
+*/
+const uint8_t *canIsoTpReceive(canIsoTpStruct *tp, uint32_t timeoutMS, uint32_t *canId, uint16_t *len);
+
+/*!
+** FUNCTION: canIsoTpGetStats
+**
+** DESCRIPTION: Copies out the counters.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void canIsoTpGetStats(canIsoTpStruct *tp, canIsoTpStatsStruct *stats);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,242 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: can_sockets.h
+**
+** DESCRIPTION: SocketCAN raw sockets library.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "dfu_client_config.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <unistd.h>
+    #include <net/if.h>
+    #include <sys/ioctl.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <linux/can.h>
+    #include <linux/can/raw.h>
+#endif
+
+
+/*
+** Largest data field of a classic and of a CAN-FD frame.
+**
+*/
+#define CAN_CLASSIC_MAX_DATA                (8U)
+#define CAN_FD_MAX_DATA                     (64U)
+
+/*
+** Set in a CAN ID to send (or say we received) a 29-bit extended ID.
+** Same bit SocketCAN uses.
+**
+*/
+#define CAN_ID_EXTENDED                     (0x80000000UL)
+
+#if !defined(_WIN32) && !defined(_WIN64)
+/*
+** Batched transmit state.  Frames are built in place and sent with a
+** single sendmmsg() per burst.
+**
+*/
+typedef struct
+{
+    struct canfd_frame          frames[CAN_BATCH_MAX_FRAMES];
+    struct iovec                iov[CAN_BATCH_MAX_FRAMES];
+    struct mmsghdr              msgs[CAN_BATCH_MAX_FRAMES];
+    uint32_t                    count;
+}dfu_can_tx_batch_t;
+
+/*
+** Batched receive state.  One recvmmsg() fills the batch; frames are
+** handed out of it one at a time.
+**
+*/
+typedef struct
+{
+    struct canfd_frame          frames[CAN_BATCH_MAX_FRAMES];
+    struct iovec                iov[CAN_BATCH_MAX_FRAMES];
+    struct mmsghdr              msgs[CAN_BATCH_MAX_FRAMES];
+    uint32_t                    count;
+    uint32_t                    next;
+}dfu_can_rx_batch_t;
+#endif
+
+/*
+** Portable CAN socket handle struct.
+**
+*/
+typedef struct
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    int                 sockfd;
+    int                 ifIndex;
+    dfu_can_tx_batch_t  txBatch;
+    dfu_can_rx_batch_t  rxBatch;
+#endif
+    bool                fdFrames;
+    uint8_t             maxData;
+}dfu_can_sock_t;
+
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: create_can_socket
+**
+** DESCRIPTION: Create a raw CAN socket and bind to an interface.
+**
+** PARAMETERS:
+**
+** RETURNS: The address of the socket handle, NULL on failure.
+**
+** COMMENTS: CAN-FD frames are switched on if CAN_USE_FD is "1" and the
+**           interface's MTU says it can carry them.  Not available on
+**           Windows (always NULL).
+**
+*/
+dfu_can_sock_t * create_can_socket(const char *interface_name, dfu_can_sock_t * socketHandle);
+
+/*!
+** FUNCTION: get_can_max_data
+**
+** DESCRIPTION: The largest data field this socket sends: 64 with
+**              CAN-FD on, 8 otherwise.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint8_t get_can_max_data(dfu_can_sock_t * socketHandle);
+
+/*!
+** FUNCTION: get_can_frame_len
+**
+** DESCRIPTION: The smallest frame length a CAN-FD DLC can describe that
+**              holds "len" bytes (past 8 they only come in steps).
+**
+** PARAMETERS:
+**
+** RETURNS: Never less than 8: short frames are padded out as they
+**          would be on classic CAN.
+**
+** COMMENTS: The gap is padded with CAN_ISOTP_PAD_BYTE.
+**
+*/
+uint8_t get_can_frame_len(uint8_t len);
+
+/*!
+** FUNCTION: queue_can_frame
+**
+** DESCRIPTION: Builds a frame into the socket's TX batch without sending
+**              it.  The frame goes out on the next flush.
+**
+** PARAMETERS: canId: Add CAN_ID_EXTENDED for a 29-bit ID.
+**             len: Up to get_can_max_data().  Frames are padded to a
+**                  valid length (a full 8 bytes for classic CAN).
+**
+** RETURNS: true if the frame was queued.
+**
+** COMMENTS: A full batch is flushed first.
+**
+*/
+bool queue_can_frame(dfu_can_sock_t * socketHandle, uint32_t canId, const uint8_t *data, uint8_t len);
+
+/*!
+** FUNCTION: flush_can_frames
+**
+** DESCRIPTION: Sends every queued frame with as few system calls as the
+**              platform allows.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of frames handed to the kernel.
+**
+** COMMENTS: Waits (up to CAN_TX_TIMEOUT_MS) while the interface's TX
+**           queue is full, rather than dropping frames the way a
+**           segmented message can't afford.
+**
+*/
+uint32_t flush_can_frames(dfu_can_sock_t * socketHandle);
+
+/*!
+** FUNCTION: set_can_rx_filter
+**
+** DESCRIPTION: Replaces the kernel CAN_RAW_FILTER on the socket.
+**
+** PARAMETERS: ids, masks: count entries each; a frame passes if
+**             (frame ID & mask) == (id & mask) for any entry.  Add
+**             CAN_ID_EXTENDED to an ID to match 29-bit frames.  NULL/0
+**             passes every frame.
+**
+** RETURNS: true if the filter was attached.
+**
+** COMMENTS: Call again whenever the set of active devices changes.
+**
+*/
+bool set_can_rx_filter(dfu_can_sock_t * socketHandle,
+                       const uint32_t *ids,
+                       const uint32_t *masks,
+                       uint32_t count);
+
+/*!
+** FUNCTION: receive_can_frame
+**
+** DESCRIPTION: Next received frame.
+**
+** PARAMETERS: timeoutMS: How long to wait if none is buffered.
+**             canId: [OUT] With CAN_ID_EXTENDED for a 29-bit ID.
+**             data: [OUT] Points at the frame's data.
+**             len: [OUT]
+**
+** RETURNS: false if nothing arrived in time.
+**
+** COMMENTS: Frames are read a batch at a time with recvmmsg().  "data"
+**           stays valid until the next receive call on this socket.
+**           Error and remote frames are skipped.
+**
+*/
+bool receive_can_frame(dfu_can_sock_t * socketHandle,
+                       uint32_t timeoutMS,
+                       uint32_t *canId,
+                       const uint8_t **data,
+                       uint8_t *len);
+
+/*!
+** FUNCTION: close_can_socket
+**
+** DESCRIPTION: Tears down the socket.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Anything still queued is dropped.
+**
+*/
+void close_can_socket(dfu_can_sock_t * socketHandle);
+
+#if defined(__cplusplus)
+}
+#endif
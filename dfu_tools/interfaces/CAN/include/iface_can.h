@@ -0,0 +1,204 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: iface_can.h
+**
+** DESCRIPTION: DFU tool CAN interface support header.
+**
+** A target's "physical ID" on CAN is the CAN ID it listens on, as four
+** big-endian bytes (the top bit set for a 29-bit ID).  As a string it
+** is hex: "7E0", or "18DA10F1" for a 29-bit ID.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include "dfu_proto_api.h"
+#include "can_sockets.h"
+#include "can_isotp.h"
+#include "event_loop.h"
+
+// Add your types, definitions, macros, etc. here
+
+/*
+** Opaque CAN ENV struct.
+**
+*/
+typedef struct ifaceCANEnvStruct ifaceCANEnvStruct;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: dfuClientCANInit
+**
+** DESCRIPTION: Initializes the CAN aspect of the tool.
+**
+** PARAMETERS: interfaceName: SocketCAN interface ("can0", "vcan0").
+**
+** RETURNS: NULL if the interface couldn't be opened (always, on
+**          Windows).
+**
+** COMMENTS:
+**
+*/
+ifaceCANEnvStruct * dfuClientCANInit(dfuProtocol **callerDFU, const char *interfaceName, void *userPtr);
+
+/*!
+** FUNCTION: dfuClientCANUnInit
+**
+** DESCRIPTION: Clean up CAN-specific items.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANUnInit(ifaceCANEnvStruct *env);
+
+/*!
+** FUNCTION: dfuClientCANSetDest
+**
+** DESCRIPTION: Set the destination CAN ID into the env.
+**
+** PARAMETERS: dest: As ifaceCANMACStringToBytes().  The Ethernet
+**                   broadcast address, or CAN_FUNCTIONAL_ID, means
+**                   every target.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANSetDest(ifaceCANEnvStruct * env, char *dest);
+
+/*!
+** FUNCTION: dfuClientCANSetRxSources
+**
+** DESCRIPTION: Rebuilds the kernel RX filter so only the listed
+**              targets get through.
+**
+** PARAMETERS: ids: The targets' CAN IDs (not their response IDs),
+**             count of them.  NULL/0 goes back to the default
+**             acceptance filter.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANSetRxSources(ifaceCANEnvStruct * env, const uint32_t *ids, uint32_t count);
+
+/*!
+** FUNCTION: dfuClientCANFindEnv
+**
+** DESCRIPTION: The CAN interface a protocol instance belongs to.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if "dfu" does not belong to a CAN interface.
+**
+** COMMENTS:
+**
+*/
+ifaceCANEnvStruct * dfuClientCANFindEnv(dfuProtocol *dfu);
+
+/*!
+** FUNCTION: dfuClientCANGetMaxMTU
+**
+** DESCRIPTION: The largest DFU message the CAN interface behind a
+**              protocol instance can carry.
+**
+** PARAMETERS:
+**
+** RETURNS: 0 if "dfu" does not belong to a CAN interface.
+**
+** COMMENTS: ISO-TP segmentation isn't bound by the frame size, so this
+**           is MAX_MSG_LEN.
+**
+*/
+uint16_t dfuClientCANGetMaxMTU(dfuProtocol *dfu);
+
+/*!
+** FUNCTION: dfuClientCANGetStats
+**
+** DESCRIPTION: What the interface's ISO-TP layer has done so far.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANGetStats(ifaceCANEnvStruct * env, canIsoTpStatsStruct *stats);
+
+/*!
+** FUNCTION: dfuClientCANWatchAll
+**
+** DESCRIPTION: Adds the socket of every open CAN interface to an event
+**              loop, so the loop wakes when a frame arrives.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of sockets added.
+**
+** COMMENTS: The callback should drive the protocol, whose RX callback
+**           reads the frames through ISO-TP.  Frames already batched
+**           in user space are left to the loop's idle callbacks.
+**
+*/
+uint32_t dfuClientCANWatchAll(eventLoopStruct *loop, eventLoopFdCallback callback, void *ctx);
+
+///
+/// @fn: ifaceCANMACBytesToString
+///
+/// @details Converts a CAN physical ID (4 big-endian bytes) to a C
+///          STRING, provided by the caller.
+///          This is one of the REQUIRED MAC conversion
+///          functions that each interface type (ETHERNET,
+///          CAN, UART, ETC) must provided.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+char* ifaceCANMACBytesToString(uint8_t* mac, uint8_t macLen, char* destStr, uint8_t destStrLen);
+
+///
+/// @fn: ifaceCANMACStringToBytes
+///
+/// @details Function to convert from a CAN ID STRING (hex, 11 or
+///          29 bit), to a 4 byte physical ID, provided by the caller.
+///          This is one of the REQUIRED MAC conversion functions that
+///          each interface type (ETHERNET, CAN, UART, ETC) must
+///          provide.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t* ifaceCANMACStringToBytes(char* macStr, uint8_t* mac, uint8_t macLen);
+
+#if defined(__cplusplus)
+}
+#endif
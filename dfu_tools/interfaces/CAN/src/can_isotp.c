@@ -0,0 +1,862 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: can_isotp.c
+**
+** DESCRIPTION: ISO-TP (ISO 15765-2) segmentation of DFU messages over a
+**              CAN socket.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stdio.h>
+#include <string.h>
+
+#include "can_isotp.h"
+#include "async_timer.h"
+
+/*
+** Protocol control information: the top nibble of a frame's first
+** byte.
+**
+*/
+#define ISOTP_PCI_SINGLE                (0x0U)
+#define ISOTP_PCI_FIRST                 (0x1U)
+#define ISOTP_PCI_CONSECUTIVE           (0x2U)
+#define ISOTP_PCI_FLOW                  (0x3U)
+
+/*
+** Flow status, the bottom nibble of a flow control frame's first byte.
+**
+*/
+#define ISOTP_FLOW_CTS                  (0x0U)
+#define ISOTP_FLOW_WAIT                 (0x1U)
+#define ISOTP_FLOW_OVERFLOW             (0x2U)
+
+/*
+** Largest single frame on classic CAN, and largest first frame length
+** the 12-bit field holds (past it, the 32-bit escape is used).
+**
+*/
+#define ISOTP_CLASSIC_SF_MAX            (7U)
+#define ISOTP_SHORT_FF_MAX              (4095U)
+
+/*
+** Internal prototypes.
+**
+*/
+static void _canIsoTpFrame(canIsoTpStruct *tp, uint32_t canId, const uint8_t *data, uint8_t len);
+static canIsoTpRxStruct *_canIsoTpRxAlloc(canIsoTpStruct *tp, uint32_t canId);
+static canIsoTpRxStruct *_canIsoTpRxFind(canIsoTpStruct *tp, uint32_t canId);
+static void _canIsoTpRxDone(canIsoTpStruct *tp, canIsoTpRxStruct *rx);
+static void _canIsoTpRxExpire(canIsoTpStruct *tp, uint64_t nowUS);
+static canIsoTpRxStruct *_canIsoTpRxNextReady(canIsoTpStruct *tp);
+static bool _canIsoTpSendFlow(canIsoTpStruct *tp, uint32_t canId, uint8_t status);
+static bool _canIsoTpWaitFlow(canIsoTpStruct *tp, uint8_t *blockSize, uint32_t *gapUS);
+static bool _canIsoTpQueue(canIsoTpStruct *tp, uint32_t canId, const uint8_t *frame, uint8_t len);
+static bool _canIsoTpFlush(canIsoTpStruct *tp);
+static uint32_t _canIsoTpSTminUS(uint8_t stMin);
+
+/*!
+** FUNCTION: canIsoTpInit
+**
+** DESCRIPTION: Sets up ISO-TP over an open CAN socket.
+**
+** PARAMETERS: flowOffset: Our flow control for a message received on
+**                         ID "x" goes to "x - flowOffset".
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void canIsoTpInit(canIsoTpStruct *tp, dfu_can_sock_t *sock, uint32_t flowOffset)
+{
+    if (tp)
+    {
+        memset(tp, 0, sizeof(canIsoTpStruct));
+        tp->sock = sock;
+        tp->flowOffset = flowOffset;
+        tp->blockSize = (uint8_t)CAN_ISOTP_BLOCK_SIZE;
+        tp->stMin = (uint8_t)CAN_ISOTP_STMIN;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: canIsoTpSend
+**
+** DESCRIPTION: Sends one message, segmenting it if it needs more than
+**              one frame.
+**
+** PARAMETERS: txId:   Where the frames go.
+**             flowId: Where the receiver's flow control comes from; 0
+**                     for a functional send (one frame only).
+**
+** RETURNS: false if it couldn't all be sent.
+**
+** COMMENTS: Frames are full-length except the last, as ISO-TP wants.
+**           With no separation time asked for, a whole block goes to
+**           the kernel in one burst; otherwise each frame goes out on
+**           its own, the asked-for gap apart.
+**
+*/
+bool canIsoTpSend(canIsoTpStruct *tp, uint32_t txId, uint32_t flowId, const uint8_t *msg, uint32_t len)
+{
+    bool                        ret = false;
+
+    if (
+           (tp) &&
+           (tp->sock) &&
+           (msg) &&
+           (len > 0) &&
+           (len <= MAX_MSG_LEN)
+       )
+    {
+        uint8_t                 frame[CAN_FD_MAX_DATA];
+        uint8_t                 maxData = get_can_max_data(tp->sock);
+        uint32_t                sfMax = (maxData > CAN_CLASSIC_MAX_DATA) ? (uint32_t)(maxData - 2U) : ISOTP_CLASSIC_SF_MAX;
+
+        tp->pendingFrames = 0;
+
+        if (len <= ISOTP_CLASSIC_SF_MAX)
+        {
+            frame[0] = (uint8_t)((ISOTP_PCI_SINGLE << 4) | len);
+            memcpy(&frame[1], msg, len);
+            ret = ( (_canIsoTpQueue(tp, txId, frame, (uint8_t)(1U + len))) &&
+                    (_canIsoTpFlush(tp)) );
+        }
+        else
+        if (len <= sfMax)
+        {
+            // CAN-FD single frame: the length moves to the second byte.
+            frame[0] = (uint8_t)(ISOTP_PCI_SINGLE << 4);
+            frame[1] = (uint8_t)len;
+            memcpy(&frame[2], msg, len);
+            ret = ( (_canIsoTpQueue(tp, txId, frame, (uint8_t)(2U + len))) &&
+                    (_canIsoTpFlush(tp)) );
+        }
+        else
+        if (flowId == 0)
+        {
+            printf("\r\n %u byte message is too long to send to every target!", len);
+            tp->stats.errors++;
+        }
+        else
+        {
+            uint32_t            headerLen;
+            uint32_t            sent;
+            uint8_t             seq = 1;
+
+            if (len <= ISOTP_SHORT_FF_MAX)
+            {
+                frame[0] = (uint8_t)((ISOTP_PCI_FIRST << 4) | (len >> 8));
+                frame[1] = (uint8_t)len;
+                headerLen = 2;
+            }
+            else
+            {
+                frame[0] = (uint8_t)(ISOTP_PCI_FIRST << 4);
+                frame[1] = 0;
+                frame[2] = (uint8_t)(len >> 24);
+                frame[3] = (uint8_t)(len >> 16);
+                frame[4] = (uint8_t)(len >> 8);
+                frame[5] = (uint8_t)len;
+                headerLen = 6;
+            }
+            sent = maxData - headerLen;
+            memcpy(&frame[headerLen], msg, sent);
+
+            // Only flow control sent after the first frame counts.
+            tp->flowId = flowId;
+            tp->flowValid = false;
+
+            ret = ( (_canIsoTpQueue(tp, txId, frame, maxData)) &&
+                    (_canIsoTpFlush(tp)) );
+
+            while ( (ret) && (sent < len) )
+            {
+                uint8_t         blockSize = 0;
+                uint32_t        gapUS = 0;
+                uint32_t        block = 0;
+
+                ret = _canIsoTpWaitFlow(tp, &blockSize, &gapUS);
+
+                while (
+                          (ret) &&
+                          (sent < len) &&
+                          ((blockSize == 0) || (block < blockSize))
+                      )
+                {
+                    uint32_t    chunk = len - sent;
+
+                    if (chunk > (uint32_t)(maxData - 1U))
+                    {
+                        chunk = maxData - 1U;
+                    }
+
+                    frame[0] = (uint8_t)((ISOTP_PCI_CONSECUTIVE << 4) | seq);
+                    memcpy(&frame[1], &msg[sent], chunk);
+                    ret = _canIsoTpQueue(tp, txId, frame, (uint8_t)(1U + chunk));
+
+                    seq = (uint8_t)((seq + 1U) & 0x0FU);
+                    sent += chunk;
+                    block++;
+
+                    if ( (ret) && (gapUS > 0) && (sent < len) )
+                    {
+                        ret = _canIsoTpFlush(tp);
+                        TIMER_SleepUS(gapUS);
+                    }
+                }
+
+                ret = ( (ret) && (_canIsoTpFlush(tp)) );
+            }
+
+            tp->flowId = 0;
+        }
+
+        if (ret)
+        {
+            tp->stats.messagesSent++;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: canIsoTpReceive
+**
+** DESCRIPTION: The next complete message, from whichever sender.
+**
+** PARAMETERS: timeoutMS: How long to wait for frames.
+**             canId: [OUT] The ID it came in on.
+**             len: [OUT]
+**
+** RETURNS: NULL if none was finished in time.
+**
+** COMMENTS: Buffered frames are worked through without waiting; the
+**           timeout only applies once the socket has nothing left.
+**           Messages finished while a send waited for flow control come
+**           out first, oldest first.
+**
+*/
+const uint8_t *canIsoTpReceive(canIsoTpStruct *tp, uint32_t timeoutMS, uint32_t *canId, uint16_t *len)
+{
+    const uint8_t *             ret = NULL;
+
+    if (
+           (tp) &&
+           (tp->sock) &&
+           (canId) &&
+           (len)
+       )
+    {
+        canIsoTpRxStruct *      rx;
+        uint64_t                nowUS = TIMER_GetMicroseconds();
+        uint64_t                deadlineUS = nowUS + ((uint64_t)timeoutMS * 1000U);
+        uint32_t                index;
+
+        *len = 0;
+
+        // The caller is done with whatever we handed it last time.
+        for (index = 0; index < CAN_ISOTP_RX_CONTEXTS; index++)
+        {
+            tp->rx[index].delivered = false;
+        }
+        _canIsoTpRxExpire(tp, nowUS);
+
+        rx = _canIsoTpRxNextReady(tp);
+        while (rx == NULL)
+        {
+            uint32_t            frameId;
+            const uint8_t *     data;
+            uint8_t             frameLen;
+            uint32_t            waitMS = 0;
+
+            nowUS = TIMER_GetMicroseconds();
+            if (deadlineUS > nowUS)
+            {
+                waitMS = (uint32_t)((deadlineUS - nowUS + 999U) / 1000U);
+            }
+
+            if (!receive_can_frame(tp->sock, waitMS, &frameId, &data, &frameLen))
+            {
+                break;
+            }
+
+            _canIsoTpFrame(tp, frameId, data, frameLen);
+            rx = _canIsoTpRxNextReady(tp);
+        }
+
+        if (rx)
+        {
+            rx->ready = false;
+            rx->delivered = true;
+            *canId = rx->canId;
+            *len = (uint16_t)rx->length;
+            ret = rx->data;
+
+            tp->stats.messagesReceived++;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: canIsoTpGetStats
+**
+** DESCRIPTION: Copies out the counters.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: All zero for a NULL instance.
+**
+*/
+void canIsoTpGetStats(canIsoTpStruct *tp, canIsoTpStatsStruct *stats)
+{
+    if (stats)
+    {
+        memset(stats, 0, sizeof(canIsoTpStatsStruct));
+        if (tp)
+        {
+            *stats = tp->stats;
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _canIsoTpFrame
+**
+** DESCRIPTION: Works one received frame into the receive contexts (or,
+**              for flow control, into the send state).
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Anything malformed is dropped; the DFU protocol retries a
+**           lost message on its own.
+**
+*/
+static void _canIsoTpFrame(canIsoTpStruct *tp, uint32_t canId, const uint8_t *data, uint8_t len)
+{
+    canIsoTpRxStruct *          rx;
+    uint32_t                    msgLen;
+    uint32_t                    headerLen;
+    uint32_t                    chunk;
+
+    if (len > 0)
+    {
+        switch (data[0] >> 4)
+        {
+            case ISOTP_PCI_SINGLE:
+            {
+                msgLen = data[0] & 0x0FU;
+                headerLen = 1;
+                if ( (msgLen == 0) && (len > CAN_CLASSIC_MAX_DATA) )
+                {
+                    msgLen = data[1];
+                    headerLen = 2;
+                }
+
+                if (
+                       (msgLen > 0) &&
+                       ((headerLen + msgLen) <= len) &&
+                       ((rx = _canIsoTpRxAlloc(tp, canId)) != NULL)
+                   )
+                {
+                    memcpy(rx->data, &data[headerLen], msgLen);
+                    rx->length = msgLen;
+                    rx->received = msgLen;
+                    _canIsoTpRxDone(tp, rx);
+                }
+                break;
+            }
+
+            case ISOTP_PCI_FIRST:
+            {
+                if (len >= CAN_CLASSIC_MAX_DATA)
+                {
+                    msgLen = ((uint32_t)(data[0] & 0x0FU) << 8) | data[1];
+                    headerLen = 2;
+                    if (msgLen == 0)
+                    {
+                        msgLen = ((uint32_t)data[2] << 24) |
+                                 ((uint32_t)data[3] << 16) |
+                                 ((uint32_t)data[4] << 8) |
+                                 (uint32_t)data[5];
+                        headerLen = 6;
+                    }
+
+                    rx = NULL;
+                    if (msgLen <= MAX_MSG_LEN)
+                    {
+                        rx = _canIsoTpRxAlloc(tp, canId);
+                    }
+
+                    if (rx == NULL)
+                    {
+                        // Too big for us, or nowhere to put it.
+                        tp->stats.overflows++;
+                        _canIsoTpSendFlow(tp, canId, ISOTP_FLOW_OVERFLOW);
+                    }
+                    else
+                    {
+                        chunk = len - headerLen;
+                        if (chunk > msgLen)
+                        {
+                            chunk = msgLen;
+                        }
+                        memcpy(rx->data, &data[headerLen], chunk);
+                        rx->length = msgLen;
+                        rx->received = chunk;
+                        rx->nextSeq = 1;
+                        rx->blockLeft = tp->blockSize;
+                        rx->active = true;
+                        rx->lastUS = TIMER_GetMicroseconds();
+
+                        if (rx->received >= rx->length)
+                        {
+                            _canIsoTpRxDone(tp, rx);
+                        }
+                        else
+                        {
+                            _canIsoTpSendFlow(tp, canId, ISOTP_FLOW_CTS);
+                        }
+                    }
+                }
+                break;
+            }
+
+            case ISOTP_PCI_CONSECUTIVE:
+            {
+                rx = _canIsoTpRxFind(tp, canId);
+                if (rx)
+                {
+                    if ((data[0] & 0x0FU) != rx->nextSeq)
+                    {
+                        // A frame went missing; the rest is useless.
+                        tp->stats.errors++;
+                        rx->active = false;
+                    }
+                    else
+                    {
+                        chunk = len - 1U;
+                        if (chunk > (rx->length - rx->received))
+                        {
+                            chunk = rx->length - rx->received;
+                        }
+                        memcpy(&rx->data[rx->received], &data[1], chunk);
+                        rx->received += chunk;
+                        rx->nextSeq = (uint8_t)((rx->nextSeq + 1U) & 0x0FU);
+                        rx->lastUS = TIMER_GetMicroseconds();
+
+                        if (rx->received >= rx->length)
+                        {
+                            _canIsoTpRxDone(tp, rx);
+                        }
+                        else
+                        if ( (tp->blockSize > 0) && (--rx->blockLeft == 0) )
+                        {
+                            rx->blockLeft = tp->blockSize;
+                            _canIsoTpSendFlow(tp, canId, ISOTP_FLOW_CTS);
+                        }
+                    }
+                }
+                break;
+            }
+
+            case ISOTP_PCI_FLOW:
+            {
+                if (
+                       (tp->flowId != 0) &&
+                       (canId == tp->flowId) &&
+                       (len >= 3)
+                   )
+                {
+                    tp->flowStatus = data[0] & 0x0FU;
+                    tp->flowBlockSize = data[1];
+                    tp->flowSTmin = data[2];
+                    tp->flowValid = true;
+                }
+                break;
+            }
+
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _canIsoTpRxAlloc
+**
+** DESCRIPTION: A receive context for a new message from "canId".
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if every context is busy.
+**
+** COMMENTS: A new message from a sender that was part way through
+**           another replaces it, as ISO-TP says.  A finished message
+**           that hasn't been handed out yet is never replaced.
+**
+*/
+static canIsoTpRxStruct *_canIsoTpRxAlloc(canIsoTpStruct *tp, uint32_t canId)
+{
+    canIsoTpRxStruct *          ret = _canIsoTpRxFind(tp, canId);
+    uint32_t                    index;
+
+    for (index = 0; (ret == NULL) && (index < CAN_ISOTP_RX_CONTEXTS); index++)
+    {
+        if (
+               (!tp->rx[index].active) &&
+               (!tp->rx[index].ready) &&
+               (!tp->rx[index].delivered)
+           )
+        {
+            ret = &tp->rx[index];
+        }
+    }
+
+    if (ret)
+    {
+        ret->active = false;
+        ret->ready = false;
+        ret->canId = canId;
+        ret->length = 0;
+        ret->received = 0;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _canIsoTpRxFind
+**
+** DESCRIPTION: The context of the message "canId" is part way through.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if there isn't one.
+**
+** COMMENTS:
+**
+*/
+static canIsoTpRxStruct *_canIsoTpRxFind(canIsoTpStruct *tp, uint32_t canId)
+{
+    canIsoTpRxStruct *          ret = NULL;
+    uint32_t                    index;
+
+    for (index = 0; index < CAN_ISOTP_RX_CONTEXTS; index++)
+    {
+        if (
+               (tp->rx[index].active) &&
+               (tp->rx[index].canId == canId)
+           )
+        {
+            ret = &tp->rx[index];
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _canIsoTpRxDone
+**
+** DESCRIPTION: Marks a message finished and ready to hand out.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _canIsoTpRxDone(canIsoTpStruct *tp, canIsoTpRxStruct *rx)
+{
+    rx->active = false;
+    rx->ready = true;
+    rx->order = tp->rxOrder++;
+
+    return;
+}
+
+/*!
+** FUNCTION: _canIsoTpRxExpire
+**
+** DESCRIPTION: Drops messages whose sender went quiet part way.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _canIsoTpRxExpire(canIsoTpStruct *tp, uint64_t nowUS)
+{
+    uint32_t                    index;
+
+    for (index = 0; index < CAN_ISOTP_RX_CONTEXTS; index++)
+    {
+        if (
+               (tp->rx[index].active) &&
+               ((nowUS - tp->rx[index].lastUS) > ((uint64_t)CAN_ISOTP_CF_TIMEOUT_MS * 1000U))
+           )
+        {
+            tp->rx[index].active = false;
+            tp->stats.timeouts++;
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _canIsoTpRxNextReady
+**
+** DESCRIPTION: The oldest finished message not yet handed out.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if there isn't one.
+**
+** COMMENTS: "order" wraps, so ages are compared by difference.
+**
+*/
+static canIsoTpRxStruct *_canIsoTpRxNextReady(canIsoTpStruct *tp)
+{
+    canIsoTpRxStruct *          ret = NULL;
+    uint32_t                    index;
+
+    for (index = 0; index < CAN_ISOTP_RX_CONTEXTS; index++)
+    {
+        if (
+               (tp->rx[index].ready) &&
+               (
+                  (ret == NULL) ||
+                  ((int32_t)(tp->rx[index].order - ret->order) < 0)
+               )
+           )
+        {
+            ret = &tp->rx[index];
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _canIsoTpSendFlow
+**
+** DESCRIPTION: Answers a sender's first frame (or finished block) with
+**              a flow control frame.
+**
+** PARAMETERS: canId: The ID the sender's frames came in on.
+**
+** RETURNS:
+**
+** COMMENTS: Goes out straight away, ahead of anything a send left
+**           queued.
+**
+*/
+static bool _canIsoTpSendFlow(canIsoTpStruct *tp, uint32_t canId, uint8_t status)
+{
+    uint8_t                     frame[3];
+    uint32_t                    flowId = (canId & ~CAN_ID_EXTENDED) - tp->flowOffset;
+
+    frame[0] = (uint8_t)((ISOTP_PCI_FLOW << 4) | status);
+    frame[1] = tp->blockSize;
+    frame[2] = tp->stMin;
+
+    return ( (_canIsoTpQueue(tp, flowId | (canId & CAN_ID_EXTENDED), frame, sizeof(frame))) &&
+             (_canIsoTpFlush(tp)) );
+}
+
+/*!
+** FUNCTION: _canIsoTpWaitFlow
+**
+** DESCRIPTION: Waits for the receiver's go-ahead for the next block.
+**
+** PARAMETERS: blockSize: [OUT] Frames in the block (0 = the rest).
+**             gapUS: [OUT] How far apart to send them.
+**
+** RETURNS: false on a timeout, an overflow, or too many waits.
+**
+** COMMENTS: Every other frame that turns up meanwhile is worked into
+**           the receive contexts.
+**
+*/
+static bool _canIsoTpWaitFlow(canIsoTpStruct *tp, uint8_t *blockSize, uint32_t *gapUS)
+{
+    bool                        ret = false;
+    bool                        done = false;
+    uint32_t                    waits = 0;
+    uint64_t                    deadlineUS = TIMER_GetMicroseconds() + ((uint64_t)CAN_ISOTP_FC_TIMEOUT_MS * 1000U);
+
+    while (!done)
+    {
+        uint64_t                nowUS = TIMER_GetMicroseconds();
+
+        if (tp->flowValid)
+        {
+            tp->flowValid = false;
+
+            if (tp->flowStatus == ISOTP_FLOW_CTS)
+            {
+                *blockSize = tp->flowBlockSize;
+                *gapUS = _canIsoTpSTminUS(tp->flowSTmin);
+                ret = true;
+                done = true;
+            }
+            else
+            if (
+                   (tp->flowStatus == ISOTP_FLOW_WAIT) &&
+                   (++waits <= CAN_ISOTP_MAX_WAIT_FRAMES)
+               )
+            {
+                deadlineUS = nowUS + ((uint64_t)CAN_ISOTP_FC_TIMEOUT_MS * 1000U);
+            }
+            else
+            {
+                printf("\r\n Target refused a segmented message (flow status %u)!", tp->flowStatus);
+                tp->stats.errors++;
+                done = true;
+            }
+        }
+        else
+        if (nowUS >= deadlineUS)
+        {
+            tp->stats.timeouts++;
+            done = true;
+        }
+        else
+        {
+            uint32_t            frameId;
+            const uint8_t *     data;
+            uint8_t             frameLen;
+
+            if (receive_can_frame(tp->sock,
+                                  (uint32_t)((deadlineUS - nowUS + 999U) / 1000U),
+                                  &frameId,
+                                  &data,
+                                  &frameLen))
+            {
+                _canIsoTpFrame(tp, frameId, data, frameLen);
+            }
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _canIsoTpQueue
+**
+** DESCRIPTION: Queues one frame, flushing first if the burst is full.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Flushing here (rather than letting the socket layer do it)
+**           keeps count of what actually went out.
+**
+*/
+static bool _canIsoTpQueue(canIsoTpStruct *tp, uint32_t canId, const uint8_t *frame, uint8_t len)
+{
+    bool                        ret = true;
+
+    if (tp->pendingFrames >= CAN_BATCH_MAX_FRAMES)
+    {
+        ret = _canIsoTpFlush(tp);
+    }
+
+    if (ret)
+    {
+        ret = queue_can_frame(tp->sock, canId, frame, len);
+        if (ret)
+        {
+            tp->pendingFrames++;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _canIsoTpFlush
+**
+** DESCRIPTION: Sends every queued frame.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the kernel didn't take them all.
+**
+** COMMENTS:
+**
+*/
+static bool _canIsoTpFlush(canIsoTpStruct *tp)
+{
+    uint32_t                    wanted = tp->pendingFrames;
+    uint32_t                    sent = 0;
+
+    if (wanted > 0)
+    {
+        sent = flush_can_frames(tp->sock);
+        tp->stats.framesSent += sent;
+    }
+    tp->pendingFrames = 0;
+
+    return (sent == wanted);
+}
+
+/*!
+** FUNCTION: _canIsoTpSTminUS
+**
+** DESCRIPTION: Decodes a flow control frame's separation time.
+**
+** PARAMETERS:
+**
+** RETURNS: uS between consecutive frames.
+**
+** COMMENTS: 0x00-0x7F are mS, 0xF1-0xF9 are 100-900 uS.  Reserved
+**           values mean the longest time, 127 mS.
+**
+*/
+static uint32_t _canIsoTpSTminUS(uint8_t stMin)
+{
+    uint32_t                    ret = 127000U;
+
+    if (stMin <= 0x7FU)
+    {
+        ret = (uint32_t)stMin * 1000U;
+    }
+    else
+    if ( (stMin >= 0xF1U) && (stMin <= 0xF9U) )
+    {
+        ret = (uint32_t)(stMin - 0xF0U) * 100U;
+    }
+
+    return (ret);
+}
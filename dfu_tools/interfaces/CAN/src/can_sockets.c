@@ -0,0 +1,648 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: can_sockets.c
+**
+** DESCRIPTION: SocketCAN raw sockets library.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include "can_sockets.h"
+#include "async_timer.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <errno.h>
+    #include <poll.h>
+#endif
+
+
+///
+/// @fn: get_can_max_data
+///
+/// @details The largest data field this socket sends.
+///
+/// @param[in] socketHandle
+///
+/// @returns 64 with CAN-FD frames on, 8 otherwise.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t get_can_max_data(dfu_can_sock_t * socketHandle)
+{
+    uint8_t             ret = CAN_CLASSIC_MAX_DATA;
+
+    if (socketHandle)
+    {
+        ret = socketHandle->maxData;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: get_can_frame_len
+///
+/// @details Rounds a data length up to one a CAN-FD DLC can describe:
+///          8, 12, 16, 20, 24, 32, 48 or 64.
+///
+/// @param[in] len
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t get_can_frame_len(uint8_t len)
+{
+    static const uint8_t    fdLengths[] = {8, 12, 16, 20, 24, 32, 48, 64};
+    uint8_t                 ret = CAN_FD_MAX_DATA;
+    uint32_t                index;
+
+    for (index = 0; index < (sizeof(fdLengths) / sizeof(fdLengths[0])); index++)
+    {
+        if (len <= fdLengths[index])
+        {
+            ret = fdLengths[index];
+            break;
+        }
+    }
+
+    return ret;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+///
+/// @fn: create_can_socket
+///
+/// @details Windows version.  There is no SocketCAN here, so there is
+///          never a socket.
+///
+/// @param[in] interface_name
+/// @param[in] socketHandle
+///
+/// @returns NULL
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+dfu_can_sock_t * create_can_socket(const char *interface_name, dfu_can_sock_t * socketHandle)
+{
+    (void)socketHandle;
+
+    printf("\r\n CAN interface [%s] needs SocketCAN (Linux only)!", interface_name ? interface_name : "");
+
+    return NULL;
+}
+
+//
+// Without a socket there's nothing for the rest to do.
+//
+bool queue_can_frame(dfu_can_sock_t * socketHandle, uint32_t canId, const uint8_t *data, uint8_t len)
+{
+    (void)socketHandle;
+    (void)canId;
+    (void)data;
+    (void)len;
+
+    return false;
+}
+
+uint32_t flush_can_frames(dfu_can_sock_t * socketHandle)
+{
+    (void)socketHandle;
+
+    return 0;
+}
+
+bool set_can_rx_filter(dfu_can_sock_t * socketHandle,
+                       const uint32_t *ids,
+                       const uint32_t *masks,
+                       uint32_t count)
+{
+    (void)socketHandle;
+    (void)ids;
+    (void)masks;
+    (void)count;
+
+    return false;
+}
+
+bool receive_can_frame(dfu_can_sock_t * socketHandle,
+                       uint32_t timeoutMS,
+                       uint32_t *canId,
+                       const uint8_t **data,
+                       uint8_t *len)
+{
+    (void)socketHandle;
+    (void)timeoutMS;
+    (void)canId;
+    (void)data;
+    (void)len;
+
+    return false;
+}
+
+void close_can_socket(dfu_can_sock_t * socketHandle)
+{
+    (void)socketHandle;
+
+    return;
+}
+
+#else // Linux versions below
+
+///
+/// @fn: create_can_socket
+///
+/// @details Linux version.  Opens a CAN_RAW socket on the interface,
+///          switches on CAN-FD frames if the interface can carry them
+///          and attaches the default RX filter.
+///
+/// @param[in] interface_name: Which interface to bind with ("can0",
+///                            "vcan0", ...).
+/// @param[in] socketHandle: The handle to use for this
+///
+/// @returns The address of the socket handle if success. NULL
+///          else.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+dfu_can_sock_t * create_can_socket(const char *interface_name, dfu_can_sock_t * socketHandle)
+{
+    dfu_can_sock_t *            ret = NULL;
+
+    if (
+           (interface_name != NULL) &&
+           (strlen(interface_name) > 0) &&
+           (strlen(interface_name) < IFNAMSIZ) &&
+           (socketHandle != NULL)
+       )
+    {
+        struct ifreq            ifr;
+        struct sockaddr_can     addr;
+        uint32_t                index;
+
+        memset(socketHandle, 0, sizeof(*socketHandle));
+        socketHandle->maxData = CAN_CLASSIC_MAX_DATA;
+
+        // The receive batch always reads into the same frames.
+        for (index = 0; index < CAN_BATCH_MAX_FRAMES; index++)
+        {
+            socketHandle->rxBatch.iov[index].iov_base = &socketHandle->rxBatch.frames[index];
+            socketHandle->rxBatch.iov[index].iov_len = sizeof(struct canfd_frame);
+            socketHandle->rxBatch.msgs[index].msg_hdr.msg_iov = &socketHandle->rxBatch.iov[index];
+            socketHandle->rxBatch.msgs[index].msg_hdr.msg_iovlen = 1;
+        }
+
+        socketHandle->sockfd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+        if (socketHandle->sockfd == -1)
+        {
+            perror("socket");
+        }
+        else
+        {
+            memset(&ifr, 0, sizeof(ifr));
+            strncpy(ifr.ifr_name, interface_name, IFNAMSIZ - 1);
+
+            if (ioctl(socketHandle->sockfd, SIOCGIFINDEX, &ifr) == -1)
+            {
+                perror("ioctl SIOCGIFINDEX");
+            }
+            else
+            {
+                socketHandle->ifIndex = ifr.ifr_ifindex;
+
+            #if (CAN_USE_FD==1)
+                //
+                // An interface that can carry CAN-FD frames says so with
+                // its MTU.  Without FD we carry on with classic frames.
+                //
+                if (
+                       (ioctl(socketHandle->sockfd, SIOCGIFMTU, &ifr) == 0) &&
+                       (ifr.ifr_mtu == CANFD_MTU)
+                   )
+                {
+                    int         enable = 1;
+
+                    if (setsockopt(socketHandle->sockfd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0)
+                    {
+                        perror("setsockopt CAN_RAW_FD_FRAMES");
+                    }
+                    else
+                    {
+                        socketHandle->fdFrames = true;
+                        socketHandle->maxData = CAN_FD_MAX_DATA;
+                    }
+                }
+            #endif
+
+                //
+                // Keep the rest of the bus's traffic in the kernel, from
+                // the moment we're bound.  Not fatal: without it we just
+                // see (and discard) more frames.
+                //
+            #if (CAN_USE_RX_FILTER==1)
+                {
+                    uint32_t    acceptID = CAN_RX_ACCEPT_ID;
+                    uint32_t    acceptMask = CAN_RX_ACCEPT_MASK;
+
+                    set_can_rx_filter(socketHandle, &acceptID, &acceptMask, 1);
+                }
+            #endif
+
+                memset(&addr, 0, sizeof(addr));
+                addr.can_family = AF_CAN;
+                addr.can_ifindex = socketHandle->ifIndex;
+
+                if (bind(socketHandle->sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+                {
+                    perror("bind");
+                }
+                else
+                {
+                    // Set for successful return
+                    ret = socketHandle;
+
+                    printf("CAN socket bound to interface %s. Index: %d. Socket FD: %d. %s frames\n",
+                           interface_name,
+                           socketHandle->ifIndex,
+                           socketHandle->sockfd,
+                           socketHandle->fdFrames ? "CAN-FD" : "Classic");
+                }
+            }
+
+            if (ret == NULL)
+            {
+                close_can_socket(socketHandle);
+            }
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: queue_can_frame
+///
+/// @details Builds a frame into the next free TX batch slot.  If the
+///          batch is full it is flushed first.
+///
+/// @param[in] socketHandle
+/// @param[in] canId
+/// @param[in] data
+/// @param[in] len
+///
+/// @returns true if the frame was queued.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool queue_can_frame(dfu_can_sock_t * socketHandle, uint32_t canId, const uint8_t *data, uint8_t len)
+{
+    bool                    ret = false;
+    dfu_can_tx_batch_t *    batch;
+    struct canfd_frame *    frame;
+    uint8_t                 frameLen;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->sockfd >= 0) &&
+           ((data) || (len == 0)) &&
+           (len <= socketHandle->maxData)
+       )
+    {
+        batch = &socketHandle->txBatch;
+
+        if (batch->count >= CAN_BATCH_MAX_FRAMES)
+        {
+            flush_can_frames(socketHandle);
+        }
+
+        if (batch->count < CAN_BATCH_MAX_FRAMES)
+        {
+            frame = &batch->frames[batch->count];
+            frameLen = socketHandle->fdFrames ? get_can_frame_len(len) : CAN_CLASSIC_MAX_DATA;
+
+            if (canId & CAN_ID_EXTENDED)
+            {
+                frame->can_id = (canId & CAN_EFF_MASK) | CAN_EFF_FLAG;
+            }
+            else
+            {
+                frame->can_id = canId & CAN_SFF_MASK;
+            }
+            frame->len = frameLen;
+            frame->flags = ( (socketHandle->fdFrames) && (CAN_FD_USE_BRS == 1) ) ? CANFD_BRS : 0;
+            frame->__res0 = 0;
+            frame->__res1 = 0;
+            if (len > 0)
+            {
+                memcpy(frame->data, data, len);
+            }
+            memset(&frame->data[len], CAN_ISOTP_PAD_BYTE, frameLen - len);
+
+            // The MTU we write is what tells the kernel FD from classic.
+            batch->iov[batch->count].iov_base = frame;
+            batch->iov[batch->count].iov_len = socketHandle->fdFrames ? CANFD_MTU : CAN_MTU;
+
+            memset(&batch->msgs[batch->count], 0, sizeof(struct mmsghdr));
+            batch->msgs[batch->count].msg_hdr.msg_iov = &batch->iov[batch->count];
+            batch->msgs[batch->count].msg_hdr.msg_iovlen = 1;
+
+            batch->count++;
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: flush_can_frames
+///
+/// @details Pushes every queued frame to the kernel with sendmmsg().
+///          A CAN interface's TX queue is short (10 frames by
+///          default), so a full queue (ENOBUFS) is waited out for up to
+///          CAN_TX_TIMEOUT_MS; one dropped frame would cost the whole
+///          segmented message.
+///
+/// @param[in] socketHandle
+///
+/// @returns The number of frames sent.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint32_t flush_can_frames(dfu_can_sock_t * socketHandle)
+{
+    uint32_t                ret = 0;
+    dfu_can_tx_batch_t *    batch;
+    uint64_t                deadlineUS;
+    int                     sent;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->sockfd >= 0)
+       )
+    {
+        batch = &socketHandle->txBatch;
+        deadlineUS = TIMER_GetMicroseconds() + (CAN_TX_TIMEOUT_MS * 1000U);
+
+        while (ret < batch->count)
+        {
+            sent = sendmmsg(socketHandle->sockfd,
+                            &batch->msgs[ret],
+                            batch->count - ret,
+                            0);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (
+                       ((errno == ENOBUFS) || (errno == EAGAIN)) &&
+                       (TIMER_GetMicroseconds() < deadlineUS)
+                   )
+                {
+                    // Give the controller a moment to drain its queue
+                    TIMER_SleepUS(100U);
+                    continue;
+                }
+
+                perror("sendmmsg");
+                break;
+            }
+
+            ret += (uint32_t)sent;
+        }
+
+        batch->count = 0;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: set_can_rx_filter
+///
+/// @details Linux version.  Attaches the entries as a CAN_RAW_FILTER.
+///          Each entry only matches its own frame format (11 or 29
+///          bit), and never remote frames.
+///
+/// @param[in] socketHandle
+/// @param[in] ids
+/// @param[in] masks
+/// @param[in] count: Up to CAN_RX_FILTER_MAX_SOURCES.  0 passes
+///                   everything.
+///
+/// @returns true if the filter was attached.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool set_can_rx_filter(dfu_can_sock_t * socketHandle,
+                       const uint32_t *ids,
+                       const uint32_t *masks,
+                       uint32_t count)
+{
+    bool                    ret = false;
+    struct can_filter       filters[CAN_RX_FILTER_MAX_SOURCES];
+    uint32_t                index;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->sockfd >= 0) &&
+           (count <= CAN_RX_FILTER_MAX_SOURCES) &&
+           (((ids) && (masks)) || (count == 0))
+       )
+    {
+        if (count == 0)
+        {
+            filters[0].can_id = 0;
+            filters[0].can_mask = 0;
+            count = 1;
+        }
+        else
+        {
+            for (index = 0; index < count; index++)
+            {
+                if (ids[index] & CAN_ID_EXTENDED)
+                {
+                    filters[index].can_id = (ids[index] & CAN_EFF_MASK) | CAN_EFF_FLAG;
+                    filters[index].can_mask = (masks[index] & CAN_EFF_MASK) | CAN_EFF_FLAG | CAN_RTR_FLAG;
+                }
+                else
+                {
+                    filters[index].can_id = ids[index] & CAN_SFF_MASK;
+                    filters[index].can_mask = (masks[index] & CAN_SFF_MASK) | CAN_EFF_FLAG | CAN_RTR_FLAG;
+                }
+            }
+        }
+
+        if (setsockopt(socketHandle->sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, (socklen_t)(count * sizeof(struct can_filter))) < 0)
+        {
+            perror("setsockopt CAN_RAW_FILTER");
+        }
+        else
+        {
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: receive_can_frame
+///
+/// @details Hands out the next frame of the receive batch.  When the
+///          batch is used up, one recvmmsg() refills it with whatever
+///          the kernel has; only if that's nothing do we wait.
+///
+/// @param[in] socketHandle
+/// @param[in] timeoutMS
+/// @param[out] canId
+/// @param[out] data
+/// @param[out] len
+///
+/// @returns false if nothing arrived in time.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool receive_can_frame(dfu_can_sock_t * socketHandle,
+                       uint32_t timeoutMS,
+                       uint32_t *canId,
+                       const uint8_t **data,
+                       uint8_t *len)
+{
+    bool                    ret = false;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->sockfd >= 0) &&
+           (canId) &&
+           (data) &&
+           (len)
+       )
+    {
+        dfu_can_rx_batch_t *    batch = &socketHandle->rxBatch;
+        bool                    waited = false;
+        bool                    done = false;
+
+        while (!done)
+        {
+            if (batch->next >= batch->count)
+            {
+                int             received;
+
+                batch->next = 0;
+                batch->count = 0;
+
+                received = recvmmsg(socketHandle->sockfd,
+                                    batch->msgs,
+                                    CAN_BATCH_MAX_FRAMES,
+                                    MSG_DONTWAIT,
+                                    NULL);
+                if (received > 0)
+                {
+                    batch->count = (uint32_t)received;
+                }
+                else
+                {
+                    struct pollfd   pfd;
+
+                    if (
+                           (received < 0) &&
+                           (errno != EAGAIN) &&
+                           (errno != EWOULDBLOCK) &&
+                           (errno != EINTR)
+                       )
+                    {
+                        perror("recvmmsg");
+                        done = true;
+                    }
+                    else
+                    if ( (waited) || (timeoutMS == 0) )
+                    {
+                        done = true;
+                    }
+                    else
+                    {
+                        pfd.fd = socketHandle->sockfd;
+                        pfd.events = POLLIN;
+                        pfd.revents = 0;
+                        waited = true;
+                        done = (poll(&pfd, 1, (int)timeoutMS) <= 0);
+                    }
+                }
+            }
+            else
+            {
+                struct canfd_frame *    frame = &batch->frames[batch->next];
+                uint32_t                frameSize = batch->msgs[batch->next].msg_len;
+
+                batch->next++;
+
+                if (
+                       ((frame->can_id & (CAN_ERR_FLAG | CAN_RTR_FLAG)) == 0) &&
+                       (
+                          ((frameSize == CAN_MTU) && (frame->len <= CAN_CLASSIC_MAX_DATA)) ||
+                          ((frameSize == CANFD_MTU) && (frame->len <= CAN_FD_MAX_DATA))
+                       )
+                   )
+                {
+                    if (frame->can_id & CAN_EFF_FLAG)
+                    {
+                        *canId = (frame->can_id & CAN_EFF_MASK) | CAN_ID_EXTENDED;
+                    }
+                    else
+                    {
+                        *canId = frame->can_id & CAN_SFF_MASK;
+                    }
+                    *data = frame->data;
+                    *len = frame->len;
+
+                    ret = true;
+                    done = true;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: close_can_socket
+///
+/// @details Closes the socket.  Queued frames are dropped.
+///
+/// @param[in] socketHandle
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void close_can_socket(dfu_can_sock_t * socketHandle)
+{
+    if (socketHandle)
+    {
+        if (socketHandle->sockfd >= 0)
+        {
+            close(socketHandle->sockfd);
+        }
+
+        socketHandle->sockfd = -1;
+        socketHandle->txBatch.count = 0;
+        socketHandle->rxBatch.count = 0;
+        socketHandle->rxBatch.next = 0;
+    }
+
+    return;
+}
+
+#endif // _WIN32 && _WIN64
@@ -0,0 +1,772 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: iface_can.c
+**
+** DESCRIPTION: CAN interface library for the DFU tools.
+**
+** DFU messages travel ISO-TP style (can_isotp) over a SocketCAN raw
+** socket (can_sockets), so a message isn't limited to one frame.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iface_can.h"
+#include "dfu_client_config.h"
+#include "dfu_proto_api.h"
+
+/*
+** Physical IDs are 4 bytes.  A string is at most 8 hex digits.
+**
+*/
+#define CAN_PHYSICAL_ID_LEN             (4U)
+#define CAN_ID_STRING_LEN               (8U + 1U)
+
+#define CAN_INTERFACE_SIGNATURE     (0xCA4D0983)
+struct ifaceCANEnvStruct
+{
+    uint32_t                    signature;
+    dfuProtocol *               dfu;
+    dfu_can_sock_t              socketHandle;
+    canIsoTpStruct              isotp;
+    void *                      userPtr;
+    uint32_t                    destID;
+    bool                        destAny;
+    char                        interfaceName[MAX_IFACE_NAME_LEN+1];
+};
+
+/*
+** CAN environment instances.
+**
+*/
+static ifaceCANEnvStruct        canEnvs[MAX_CAN_INTERFACES];
+
+
+/*
+** Internal prototypes
+**
+*/
+static bool dfuClientCANInitEnv(ifaceCANEnvStruct *env);
+static ifaceCANEnvStruct * dfuClientCANAllocEnv(void);
+static bool dfuClientCANFreeEnv(ifaceCANEnvStruct * env);
+static uint32_t dfuClientCANResponseID(uint32_t canID);
+static void dfuClientCANIDToBytes(uint32_t canID, uint8_t *bytes);
+uint8_t *dfuClientCANRxCallback(dfuProtocol * dfu, uint16_t * rxBuffLen, dfuUserPtr userPtr);
+bool dfuClientCANTxCallback(dfuProtocol * dfu, uint8_t *txBuff, uint16_t txBuffLen, dfuMsgTargetEnum target, dfuUserPtr userPtr);
+void dfuClientCANErrCallback(dfuProtocol * dfu, uint8_t *msg, uint16_t msgLen, dfuErrorCodeEnum error, dfuUserPtr userPtr);
+
+#define VALID_CAN_ENV(env)   ( (env != NULL) && (env->signature == CAN_INTERFACE_SIGNATURE) )
+
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                            PUBLIC API FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: dfuClientCANInit
+**
+** DESCRIPTION: Initializes the CAN aspect of the tool.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Until a destination is set, messages go to every target
+**           (CAN_FUNCTIONAL_ID).
+**
+*/
+ifaceCANEnvStruct * dfuClientCANInit(dfuProtocol **callerDFU, const char *interfaceName, void *userPtr)
+{
+    ifaceCANEnvStruct *           ret = NULL;
+
+    if (interfaceName)
+    {
+        ret = dfuClientCANAllocEnv();
+        if (ret)
+        {
+            if (create_can_socket(interfaceName, &ret->socketHandle))
+            {
+                // Save our interface name
+                snprintf(ret->interfaceName, MAX_IFACE_NAME_LEN, "%s", interfaceName);
+
+                canIsoTpInit(&ret->isotp, &ret->socketHandle, CAN_RESPONSE_ID_OFFSET);
+                ret->destID = CAN_FUNCTIONAL_ID;
+                ret->destAny = true;
+
+                // Get the protocol library set up.
+                ret->dfu = dfuCreate(dfuClientCANRxCallback,
+                                     dfuClientCANTxCallback,
+                                     dfuClientCANErrCallback,
+                                     (void *)ret,
+                                     0);
+                if (ret->dfu)
+                {
+                    dfuSetMTU(ret->dfu, MAX_CAN_MSG_LEN);
+                    ret->userPtr = (void *)userPtr;
+                    *callerDFU = ret->dfu;
+                }
+                else
+                {
+                    close_can_socket(&ret->socketHandle);
+                    dfuClientCANFreeEnv(ret);
+                    ret = NULL;
+                }
+            }
+            else
+            {
+                // Nothing to close; the socket layer cleaned up after itself.
+                dfuClientCANFreeEnv(ret);
+                ret = NULL;
+            }
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANUnInit
+**
+** DESCRIPTION: Clean up CAN-specific items.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANUnInit(ifaceCANEnvStruct *env)
+{
+    bool                        ret = false;
+
+    if (VALID_CAN_ENV(env))
+    {
+        // Do any clean up here
+        dfuDestroy(env->dfu);
+        close_can_socket(&env->socketHandle);
+
+        // Free things
+        ret = dfuClientCANFreeEnv(env);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANSetDest
+**
+** DESCRIPTION: Converts a STRING formatted CAN ID into the ID that is
+**              saved to the environment as the DESTINATION.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANSetDest(ifaceCANEnvStruct * env, char *dest)
+{
+    bool                    ret = false;
+
+    if ( (VALID_CAN_ENV(env)) && (dest) )
+    {
+        uint8_t             bytes[CAN_PHYSICAL_ID_LEN];
+
+        if (strcmp(dest, "FF:FF:FF:FF:FF:FF") == 0)
+        {
+            env->destID = CAN_FUNCTIONAL_ID;
+            ret = true;
+        }
+        else
+        if (ifaceCANMACStringToBytes(dest, bytes, sizeof(bytes)) != NULL)
+        {
+            env->destID = ((uint32_t)bytes[0] << 24) |
+                          ((uint32_t)bytes[1] << 16) |
+                          ((uint32_t)bytes[2] << 8) |
+                          (uint32_t)bytes[3];
+            ret = true;
+        }
+
+        if (ret)
+        {
+            env->destAny = (env->destID == CAN_FUNCTIONAL_ID);
+
+        #if ( (CAN_USE_RX_FILTER==1) && (CAN_RX_FILTER_BY_DEST==1) )
+            //
+            // Only the new destination may talk to us now.  Every
+            // target means the default acceptance filter.
+            //
+            if (env->destAny)
+            {
+                dfuClientCANSetRxSources(env, NULL, 0);
+            }
+            else
+            {
+                dfuClientCANSetRxSources(env, &env->destID, 1);
+            }
+        #endif
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANSetRxSources
+**
+** DESCRIPTION: Rebuilds the kernel RX filter so only the response IDs
+**              of the listed targets get through.
+**
+** PARAMETERS: ids: Target CAN IDs, count of them.  NULL/0 goes back to
+**             CAN_RX_ACCEPT_ID / CAN_RX_ACCEPT_MASK.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANSetRxSources(ifaceCANEnvStruct * env, const uint32_t *ids, uint32_t count)
+{
+    bool                    ret = false;
+
+    if (
+           (VALID_CAN_ENV(env)) &&
+           (count <= CAN_RX_FILTER_MAX_SOURCES) &&
+           ((ids) || (count == 0))
+       )
+    {
+        uint32_t            filterIDs[CAN_RX_FILTER_MAX_SOURCES];
+        uint32_t            filterMasks[CAN_RX_FILTER_MAX_SOURCES];
+        uint32_t            index;
+
+        if (count == 0)
+        {
+            filterIDs[0] = CAN_RX_ACCEPT_ID;
+            filterMasks[0] = CAN_RX_ACCEPT_MASK;
+            count = 1;
+        }
+        else
+        {
+            for (index = 0; index < count; index++)
+            {
+                filterIDs[index] = dfuClientCANResponseID(ids[index]);
+                filterMasks[index] = 0x1FFFFFFFU;
+            }
+        }
+
+        ret = set_can_rx_filter(&env->socketHandle, filterIDs, filterMasks, count);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANFindEnv
+**
+** DESCRIPTION: The CAN interface a protocol instance belongs to.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if "dfu" does not belong to a CAN interface.
+**
+** COMMENTS:
+**
+*/
+ifaceCANEnvStruct * dfuClientCANFindEnv(dfuProtocol *dfu)
+{
+    ifaceCANEnvStruct *     ret = NULL;
+    uint32_t                index;
+
+    for (index = 0; index < MAX_CAN_INTERFACES; index++)
+    {
+        if (
+               (VALID_CAN_ENV((&canEnvs[index]))) &&
+               (dfu) &&
+               (canEnvs[index].dfu == dfu)
+           )
+        {
+            ret = &canEnvs[index];
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANGetMaxMTU
+**
+** DESCRIPTION: The largest DFU message the CAN interface behind a
+**              protocol instance can carry.
+**
+** PARAMETERS:
+**
+** RETURNS: 0 if "dfu" does not belong to a CAN interface.
+**
+** COMMENTS:
+**
+*/
+uint16_t dfuClientCANGetMaxMTU(dfuProtocol *dfu)
+{
+    uint16_t                ret = 0;
+
+    if (dfuClientCANFindEnv(dfu))
+    {
+        ret = MAX_MSG_LEN;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANGetStats
+**
+** DESCRIPTION: What the interface's ISO-TP layer has done so far.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientCANGetStats(ifaceCANEnvStruct * env, canIsoTpStatsStruct *stats)
+{
+    bool                    ret = false;
+
+    if ( (VALID_CAN_ENV(env)) && (stats) )
+    {
+        canIsoTpGetStats(&env->isotp, stats);
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANWatchAll
+**
+** DESCRIPTION: Adds the socket of every open CAN interface to an event
+**              loop, so the loop wakes when a frame arrives.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of sockets added.
+**
+** COMMENTS:
+**
+*/
+uint32_t dfuClientCANWatchAll(eventLoopStruct *loop, eventLoopFdCallback callback, void *ctx)
+{
+    uint32_t                ret = 0;
+#if !defined(_WIN32) && !defined(_WIN64)
+    uint32_t                index;
+
+    for (index = 0; index < MAX_CAN_INTERFACES; index++)
+    {
+        if (
+               (VALID_CAN_ENV((&canEnvs[index]))) &&
+               (eventLoopAddFd(loop, canEnvs[index].socketHandle.sockfd, callback, ctx))
+           )
+        {
+            ret++;
+        }
+    }
+#else
+    (void)loop;
+    (void)callback;
+    (void)ctx;
+#endif
+
+    return (ret);
+}
+
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: dfuClientCANAllocEnv
+**
+** DESCRIPTION: Search the env pool for an available environment. If found,
+**              initialize it.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static ifaceCANEnvStruct * dfuClientCANAllocEnv(void)
+{
+    ifaceCANEnvStruct *                 ret = NULL;
+    uint32_t                            index;
+
+    for (index = 0; index < MAX_CAN_INTERFACES; index++)
+    {
+        if (canEnvs[index].signature != CAN_INTERFACE_SIGNATURE)
+        {
+            if (dfuClientCANInitEnv(&canEnvs[index]))
+            {
+                ret = &canEnvs[index];
+                break;
+            }
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANFreeEnv
+**
+** DESCRIPTION: Clean up and return env to pool.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool dfuClientCANFreeEnv(ifaceCANEnvStruct * env)
+{
+    bool                    ret = false;
+
+    if (VALID_CAN_ENV(env))
+    {
+        // Clean up
+        dfuClientCANInitEnv(env);
+        env->signature = 0x00000000;
+
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANInitEnv
+**
+** DESCRIPTION: Inits the environment item to defaults.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static bool dfuClientCANInitEnv(ifaceCANEnvStruct *env)
+{
+    bool                        ret = false;
+
+    if (env)
+    {
+        env->dfu = NULL;
+        env->userPtr = NULL;
+        env->destID = CAN_FUNCTIONAL_ID;
+        env->destAny = true;
+        env->interfaceName[0] = '\0';
+
+        // Validate the item (makes it unavailable)
+        env->signature = CAN_INTERFACE_SIGNATURE;
+
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientCANResponseID
+**
+** DESCRIPTION: The ID a target answers on, from the ID it listens on.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t dfuClientCANResponseID(uint32_t canID)
+{
+    return ( ((canID & ~CAN_ID_EXTENDED) + CAN_RESPONSE_ID_OFFSET) | (canID & CAN_ID_EXTENDED) );
+}
+
+/*!
+** FUNCTION: dfuClientCANIDToBytes
+**
+** DESCRIPTION: A CAN ID as a 4 byte physical ID.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void dfuClientCANIDToBytes(uint32_t canID, uint8_t *bytes)
+{
+    bytes[0] = (uint8_t)(canID >> 24);
+    bytes[1] = (uint8_t)(canID >> 16);
+    bytes[2] = (uint8_t)(canID >> 8);
+    bytes[3] = (uint8_t)canID;
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//         CALLBACKS THAT MUST BE PROVIDED TO THE DFU PROTOCOL LIBRARY
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+///
+/// @fn: dfuClientCANRxCallback
+///
+/// @details Fetch the next complete DFU message from the interface,
+///          reassembled from its frames.  Stash the SRC & DST IDs for
+///          use with device lists, etc.  The returned pointer stays
+///          valid until the next call.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t *dfuClientCANRxCallback(dfuProtocol * dfu, uint16_t * rxBuffLen, dfuUserPtr userPtr)
+{
+    uint8_t                 *ret = NULL;
+    ifaceCANEnvStruct       *env = (ifaceCANEnvStruct *)userPtr;
+
+    if (
+           (VALID_CAN_ENV(env)) &&
+           (dfu) &&
+           (rxBuffLen)
+       )
+    {
+        const uint8_t *     msg;
+        uint32_t            canID = 0;
+        uint16_t            msgLen = 0;
+
+        // Initial response length
+        *rxBuffLen = 0;
+
+        msg = canIsoTpReceive(&env->isotp, CAN_RX_POLL_TIMEOUT_MS, &canID, &msgLen);
+
+        if (
+               (msg) &&
+               (msgLen > 0) &&
+               (msgLen <= MAX_MSG_LEN) &&
+               ((canID & ~CAN_ID_EXTENDED) >= CAN_RESPONSE_ID_OFFSET)
+           )
+        {
+            uint8_t         srcID[CAN_PHYSICAL_ID_LEN];
+            uint8_t         dstID[CAN_PHYSICAL_ID_LEN];
+
+            // Save the length of what we just received to the caller.
+            *rxBuffLen = msgLen;
+
+            //
+            // The target is known by the ID it listens on, not the one
+            // it answered on.
+            //
+            dfuClientCANIDToBytes(env->destID, dstID);
+            dfuClientCANIDToBytes(((canID & ~CAN_ID_EXTENDED) - CAN_RESPONSE_ID_OFFSET) | (canID & CAN_ID_EXTENDED), srcID);
+            dfuSetDstPhysicalID(dfu, dstID, CAN_PHYSICAL_ID_LEN);
+            dfuSetSrcPhysicalID(dfu, srcID, CAN_PHYSICAL_ID_LEN);
+
+            ret = (uint8_t *)msg;
+        }
+    }
+
+    return (ret);
+}
+
+///
+/// @fn: dfuClientCANTxCallback
+///
+/// @details Sends one DFU message, split into as many frames as it
+///          takes.  A message to every target has to fit one frame
+///          (ISO-TP has no flow control for those).
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool dfuClientCANTxCallback(dfuProtocol * dfu, uint8_t *txBuff, uint16_t txBuffLen, dfuMsgTargetEnum target, dfuUserPtr userPtr)
+{
+    bool                    ret = false;
+    ifaceCANEnvStruct *     env = (ifaceCANEnvStruct *) userPtr;
+
+    if (
+           (VALID_CAN_ENV(env)) &&
+           (dfu) &&
+           (txBuff) &&
+           (txBuffLen > 0) &&
+           (txBuffLen <= MAX_MSG_LEN)
+       )
+    {
+        if ( (target == DFU_TARGET_ANY) || (env->destAny) )
+        {
+            ret = canIsoTpSend(&env->isotp, CAN_FUNCTIONAL_ID, 0, txBuff, txBuffLen);
+        }
+        else
+        {
+            ret = canIsoTpSend(&env->isotp,
+                               env->destID,
+                               dfuClientCANResponseID(env->destID),
+                               txBuff,
+                               txBuffLen);
+        }
+    }
+
+    return (ret);
+}
+
+void dfuClientCANErrCallback(dfuProtocol * dfu, uint8_t *msg, uint16_t msgLen, dfuErrorCodeEnum error, dfuUserPtr userPtr)
+{
+    return;
+}
+
+///
+/// @fn: ifaceCANMACBytesToString
+///
+/// @details Converts a CAN physical ID (4 big-endian bytes) to a C
+///          STRING, provided by the caller.
+///          This is one of the REQUIRED MAC conversion
+///          functions that each interface type (ETHERNET,
+///          CAN, UART, ETC) must provided.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+char* ifaceCANMACBytesToString(uint8_t* mac, uint8_t macLen, char* destStr, uint8_t destStrLen)
+{
+    char*                   ret = NULL;
+
+    if (
+           (mac) &&
+           (macLen >= CAN_PHYSICAL_ID_LEN) &&
+           (destStr) &&
+           (destStrLen >= CAN_ID_STRING_LEN)
+       )
+    {
+        uint32_t            canID = ((uint32_t)mac[0] << 24) |
+                                    ((uint32_t)mac[1] << 16) |
+                                    ((uint32_t)mac[2] << 8) |
+                                    (uint32_t)mac[3];
+
+        if (canID & CAN_ID_EXTENDED)
+        {
+            snprintf(destStr, destStrLen, "%08X", (unsigned int)(canID & 0x1FFFFFFFU));
+        }
+        else
+        {
+            snprintf(destStr, destStrLen, "%03X", (unsigned int)(canID & 0x7FFU));
+        }
+
+        ret = destStr;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: ifaceCANMACStringToBytes
+///
+/// @details Function to convert from a CAN ID STRING, to a 4 byte
+///          physical ID, provided by the caller.  Hex, with or without
+///          "0x".  IDs over 0x7FF, or written with all 8 digits, are
+///          29-bit.
+///          This is one of the REQUIRED MAC conversion functions that
+///          each interface type (ETHERNET, CAN, UART, ETC) must
+///          provide.
+///
+/// @param[in]
+/// @param[in]
+/// @param[in]
+/// @param[in]
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t* ifaceCANMACStringToBytes(char* macStr, uint8_t* mac, uint8_t macLen)
+{
+    uint8_t*                ret = NULL;
+
+    if (
+           (macStr) &&
+           (mac) &&
+           (macLen >= CAN_PHYSICAL_ID_LEN)
+       )
+    {
+        const char *        digits = macStr;
+        char *              end = NULL;
+        unsigned long       value;
+
+        if ( (digits[0] == '0') && ((digits[1] == 'x') || (digits[1] == 'X')) )
+        {
+            digits += 2;
+        }
+
+        value = strtoul(digits, &end, 16);
+        if (
+               (end != digits) &&
+               (*end == '\0') &&
+               ((end - digits) <= 8) &&
+               (value <= 0x1FFFFFFFUL)
+           )
+        {
+            uint32_t        canID = (uint32_t)value;
+
+            if ( (value > 0x7FFUL) || ((end - digits) == 8) )
+            {
+                canID |= CAN_ID_EXTENDED;
+            }
+            dfuClientCANIDToBytes(canID, mac);
+
+            ret = mac;
+        }
+    }
+
+    return (ret);
+}
@@ -0,0 +1,88 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: iface_link.h
+**
+** DESCRIPTION: Interface-neutral access to the link behind a protocol
+**              instance, whichever interface (Ethernet, CAN) it is on.
+**
+** The sequence and install layers use this rather than calling into
+** each interface themselves.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_proto_api.h"
+#include "event_loop.h"
+
+// Add your types, definitions, macros, etc. here
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: ifaceLinkSetRxSources
+**
+** DESCRIPTION: Narrows the interface's kernel RX filter to the listed
+**              devices, so traffic from any other device on the link
+**              never reaches this protocol instance.
+**
+** PARAMETERS: ids:   Physical IDs, idLen bytes apart: a MAC on
+**                    Ethernet, a CAN ID (4 big-endian bytes) on CAN.
+**             count: How many.  NULL/0 lets every device through again.
+**
+** RETURNS: false if "dfu" isn't on a known interface, or the filter
+**          couldn't be set.
+**
+** COMMENTS:
+**
+*/
+bool ifaceLinkSetRxSources(dfuProtocol *dfu, const uint8_t *ids, uint8_t idLen, uint32_t count);
+
+/*!
+** FUNCTION: ifaceLinkGetMaxMTU
+**
+** DESCRIPTION: The largest DFU message the link can carry, and the size
+**              the interface uses until told otherwise.
+**
+** PARAMETERS: defaultMTU: [OUT] May be NULL.
+**
+** RETURNS: 0 if "dfu" isn't on a known interface.
+**
+** COMMENTS: On Ethernet this is the interface's real MTU, up to
+**           ENET_MAX_LINK_MTU; on CAN, the largest message ISO-TP can
+**           carry.
+**
+*/
+uint16_t ifaceLinkGetMaxMTU(dfuProtocol *dfu, uint16_t *defaultMTU);
+
+/*!
+** FUNCTION: ifaceLinkWatchAll
+**
+** DESCRIPTION: Adds every open interface socket that can be waited on
+**              to an event loop, so the loop wakes when a frame arrives.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of sockets added.
+**
+** COMMENTS: Interfaces with nothing to wait on (Windows) are only
+**           serviced by the loop's idle callbacks.
+**
+*/
+uint32_t ifaceLinkWatchAll(eventLoopStruct *loop, eventLoopFdCallback callback, void *ctx);
+
+#if defined(__cplusplus)
+}
+#endif
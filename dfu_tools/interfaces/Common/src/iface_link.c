@@ -0,0 +1,170 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: iface_link.c
+**
+** DESCRIPTION: Interface-neutral access to the link behind a protocol
+**              instance.  Each call finds which interface owns the
+**              instance and hands the request to it.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "iface_link.h"
+#include "iface_enet.h"
+#include "iface_can.h"
+#include "dfu_client_config.h"
+
+/*
+** Bytes in an Ethernet MAC and in a CAN physical ID.
+**
+*/
+#define IFACE_LINK_MAC_LEN              (6U)
+#define IFACE_LINK_CAN_ID_LEN           (4U)
+
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                            PUBLIC API FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+/*!
+** FUNCTION: ifaceLinkSetRxSources
+**
+** DESCRIPTION: Narrows the interface's kernel RX filter to the listed
+**              devices, so traffic from any other device on the link
+**              never reaches this protocol instance.
+**
+** PARAMETERS: ids:   Physical IDs, idLen bytes apart: a MAC on
+**                    Ethernet, a CAN ID (4 big-endian bytes) on CAN.
+**             count: How many.  NULL/0 lets every device through again.
+**
+** RETURNS: false if "dfu" isn't on a known interface, or the filter
+**          couldn't be set.
+**
+** COMMENTS: The IDs are repacked into the form each interface takes.
+**
+*/
+bool ifaceLinkSetRxSources(dfuProtocol *dfu, const uint8_t *ids, uint8_t idLen, uint32_t count)
+{
+    bool                        ret = false;
+    ifaceEthEnvStruct *         ethEnv = dfuClientEthernetFindEnv(dfu);
+    ifaceCANEnvStruct *         canEnv = dfuClientCANFindEnv(dfu);
+    uint32_t                    index;
+
+    if ( (ids == NULL) || (count == 0) )
+    {
+        count = 0;
+    }
+
+    if (ethEnv)
+    {
+        uint8_t                 macs[ENET_RX_FILTER_MAX_SOURCES * IFACE_LINK_MAC_LEN];
+
+        if ( (count <= ENET_RX_FILTER_MAX_SOURCES) && ((count == 0) || (idLen >= IFACE_LINK_MAC_LEN)) )
+        {
+            for (index = 0; index < count; index++)
+            {
+                memcpy(&macs[index * IFACE_LINK_MAC_LEN], &ids[index * idLen], IFACE_LINK_MAC_LEN);
+            }
+
+            ret = dfuClientEthernetSetRxSources(ethEnv, (count > 0) ? macs : NULL, count);
+        }
+    }
+    else
+    if (canEnv)
+    {
+        uint32_t                canIds[CAN_RX_FILTER_MAX_SOURCES];
+
+        if ( (count <= CAN_RX_FILTER_MAX_SOURCES) && ((count == 0) || (idLen >= IFACE_LINK_CAN_ID_LEN)) )
+        {
+            for (index = 0; index < count; index++)
+            {
+                const uint8_t * id = &ids[index * idLen];
+
+                canIds[index] = ((uint32_t)id[0] << 24) |
+                                ((uint32_t)id[1] << 16) |
+                                ((uint32_t)id[2] << 8) |
+                                (uint32_t)id[3];
+            }
+
+            ret = dfuClientCANSetRxSources(canEnv, (count > 0) ? canIds : NULL, count);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: ifaceLinkGetMaxMTU
+**
+** DESCRIPTION: The largest DFU message the link can carry, and the size
+**              the interface uses until told otherwise.
+**
+** PARAMETERS: defaultMTU: [OUT] May be NULL.
+**
+** RETURNS: 0 if "dfu" isn't on a known interface.
+**
+** COMMENTS:
+**
+*/
+uint16_t ifaceLinkGetMaxMTU(dfuProtocol *dfu, uint16_t *defaultMTU)
+{
+    uint16_t                    ret = 0;
+    uint16_t                    linkDefault = 0;
+
+    if (dfuClientEthernetFindEnv(dfu))
+    {
+        ret = dfuClientEthernetGetMaxMTU(dfu);
+        linkDefault = MAX_ETHERNET_MSG_LEN;
+    }
+    else
+    if (dfuClientCANFindEnv(dfu))
+    {
+        ret = dfuClientCANGetMaxMTU(dfu);
+        linkDefault = MAX_CAN_MSG_LEN;
+    }
+
+    if (defaultMTU)
+    {
+        *defaultMTU = linkDefault;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: ifaceLinkWatchAll
+**
+** DESCRIPTION: Adds every open interface socket that can be waited on
+**              to an event loop, so the loop wakes when a frame arrives.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of sockets added.
+**
+** COMMENTS: Both Ethernet and CAN sockets.  The callback only has to
+**           drive the protocol: each interface's RX callback does the
+**           reading.
+**
+*/
+uint32_t ifaceLinkWatchAll(eventLoopStruct *loop, eventLoopFdCallback callback, void *ctx)
+{
+    uint32_t                    ret;
+
+    ret = dfuClientEthernetWatchAll(loop, callback, ctx);
+    ret += dfuClientCANWatchAll(loop, callback, ctx);
+
+    return (ret);
+}
@@ -33,6 +33,7 @@
     #include <linux/if_ether.h>
     #include <linux/if_arp.h>
     #include <net/ethernet.h>
+    #include <sys/uio.h>
 #else
     #include <pcap.h>
     #include <winsock2.h>
@@ -41,6 +42,77 @@
 #endif // _WIN32
 
 
+/*
+** Largest payload an 802.3 length field can describe.  Anything bigger
+** has to go out with the DFU EtherType.
+**
+*/
+#define ENET_LEGACY_MAX_PAYLOAD             (1500U)
+
+/*
+** Largest frame we ever build or receive (header + length field +
+** payload, no FCS).
+**
+*/
+#define ENET_MAX_FRAME_LEN                  (14U + ENET_MAX_LINK_MTU)
+
+/*
+** How the DFU message length is carried in a frame.
+**
+*/
+typedef enum
+{
+    ENET_FRAME_MODE_LENGTH = 0,         // 802.3 length field, payload <= 1500
+    ENET_FRAME_MODE_ETHERTYPE = 1       // DFU EtherType, then 2-byte length
+}dfu_frame_mode_t;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+/*
+** PACKET_MMAP (TPACKET_V2) receive ring state.  The kernel hands over
+** each frame slot as soon as a frame lands in it; we take them in order
+** and give each slot back once the frame in it has been released.
+**
+*/
+typedef struct
+{
+    uint8_t *                   map;
+    size_t                      mapLen;
+    uint32_t                    blockSize;
+    uint32_t                    frameSize;
+    uint32_t                    framesPerBlock;
+    uint32_t                    frameCount;
+    uint32_t                    frameIndex;
+    bool                        frameOutstanding;
+}dfu_rx_ring_t;
+
+/*
+** Pre-built per-destination data: the 12 address bytes of the frame
+** header and the sockaddr_ll that goes with them.
+**
+*/
+typedef struct
+{
+    uint8_t                     header[12];
+    struct sockaddr_ll          addr;
+    bool                        valid;
+}dfu_tx_dest_t;
+
+/*
+** Batched transmit state.  Frames are built in place and sent with a
+** single sendmmsg() per burst.
+**
+*/
+typedef struct
+{
+    dfu_tx_dest_t               dests[ENET_TX_MAX_DESTINATIONS];
+    uint32_t                    nextDest;
+    uint8_t                     frames[ENET_TX_BATCH_MAX_FRAMES][ENET_MAX_FRAME_LEN];
+    struct iovec                iov[ENET_TX_BATCH_MAX_FRAMES];
+    struct mmsghdr              msgs[ENET_TX_BATCH_MAX_FRAMES];
+    uint32_t                    count;
+}dfu_tx_batch_t;
+#endif
+
 /*
 ** Portable socket handle struct.
 **
@@ -49,11 +121,16 @@ typedef struct
 {
 #if !defined(_WIN32) && !defined(_WIN64)
     int                 sockfd;
+    int                 ifIndex;
+    dfu_rx_ring_t       rxRing;
+    dfu_tx_batch_t      txBatch;
 #else
     pcap_t *            handle;
 #endif
     uint8_t             myMAC[6];
-    uint8_t             buffer[2048];
+    uint32_t            linkMTU;
+    dfu_frame_mode_t    frameMode;
+    uint8_t             buffer[ENET_MAX_FRAME_LEN];
 }dfu_sock_t;
 
 
@@ -105,6 +182,36 @@ int get_mac_address(const char *interface_name, dfu_sock_t * socketHandle, uint8
 */
 dfu_sock_t * create_raw_socket(const char *interface_name, dfu_sock_t * socketHandle);
 
+/*!
+** FUNCTION: set_ethernet_frame_mode
+**
+** DESCRIPTION: Picks the framing used for messages that would fit in a
+**              legacy 802.3 frame.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Larger messages always use the DFU EtherType.
+**
+*/
+void set_ethernet_frame_mode(dfu_sock_t * socketHandle, dfu_frame_mode_t mode);
+
+/*!
+** FUNCTION: get_ethernet_max_payload
+**
+** DESCRIPTION: The largest DFU message this socket can carry in one
+**              frame, given the interface's MTU.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint16_t get_ethernet_max_payload(dfu_sock_t * socketHandle);
+
 /*!
 ** FUNCTION: send_ethernet_message
 **
@@ -123,6 +230,60 @@ void send_ethernet_message(dfu_sock_t * socketHandle,
                            uint8_t *payload,
                            uint16_t payload_size);
 
+/*!
+** FUNCTION: queue_ethernet_message
+**
+** DESCRIPTION: Builds a frame into the socket's TX batch without sending
+**              it.  The frame goes out on the next flush.
+**
+** PARAMETERS:
+**
+** RETURNS: true if the frame was queued (or sent, if the batch had to
+**          be flushed to make room and the platform can't batch).
+**
+** COMMENTS: The destination header and sockaddr_ll are built once per
+**           destination and reused for later frames.
+**
+*/
+bool queue_ethernet_message(dfu_sock_t * socketHandle,
+                            uint8_t *dest_mac,
+                            uint8_t *payload,
+                            uint16_t payload_size);
+
+/*!
+** FUNCTION: flush_ethernet_messages
+**
+** DESCRIPTION: Sends every queued frame with as few system calls as the
+**              platform allows.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of frames handed to the kernel.
+**
+** COMMENTS:
+**
+*/
+uint32_t flush_ethernet_messages(dfu_sock_t * socketHandle);
+
+/*!
+** FUNCTION: set_ethernet_rx_filter
+**
+** DESCRIPTION: Builds and attaches a kernel packet filter that passes
+**              only DFU frames addressed to us (or broadcast).
+**
+** PARAMETERS: srcMACs: 6 bytes per entry, srcCount entries.  NULL/0
+**             accepts any source.  Broadcasts are accepted from any
+**             source either way.
+**
+** RETURNS: true if the filter was attached.
+**
+** COMMENTS: Call again whenever the set of active devices changes.
+**
+*/
+bool set_ethernet_rx_filter(dfu_sock_t * socketHandle,
+                            const uint8_t *srcMACs,
+                            uint32_t srcCount);
+
 /*!
 ** FUNCTION: receive_ethernet_message
 **
@@ -132,11 +293,61 @@ void send_ethernet_message(dfu_sock_t * socketHandle,
 **
 ** RETURNS:
 **
-** COMMENTS:
+** COMMENTS: The copy always starts with a 14-byte header holding an
+**           802.3-style length, whichever framing was received.
 **
 */
 uint8_t *receive_ethernet_message(dfu_sock_t *socketHandle, uint8_t *destBuff, uint16_t *destBuffLen, uint8_t *expected_src_mac);
 
+/*!
+** FUNCTION: receive_ethernet_message_zc
+**
+** DESCRIPTION: Zero-copy receive.  Returns the address of the next valid
+**              frame (starting at the destination MAC) without copying it
+**              into a caller buffer.
+**
+** PARAMETERS: payloadLen: [OUT] The payload length of the frame.
+**             payload:    [OUT] Where the payload starts (after the
+**                         length field, whichever framing was used).
+**
+** RETURNS: Address of the frame, or NULL if nothing was received.
+**
+** COMMENTS: The frame stays valid until release_ethernet_message() or the
+**           next receive call on this socket.  On Linux with the RX ring
+**           enabled, the address points into the ring itself.
+**
+*/
+uint8_t *receive_ethernet_message_zc(dfu_sock_t *socketHandle, uint16_t *payloadLen, uint8_t **payload);
+
+/*!
+** FUNCTION: release_ethernet_message
+**
+** DESCRIPTION: Tells the socket layer the caller is done with the frame
+**              returned by receive_ethernet_message_zc().
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Safe to call when nothing is outstanding.
+**
+*/
+void release_ethernet_message(dfu_sock_t *socketHandle);
+
+/*!
+** FUNCTION: close_raw_socket
+**
+** DESCRIPTION: Tears down the socket and any receive ring mapped on it.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void close_raw_socket(dfu_sock_t *socketHandle);
+
 #if defined(__cplusplus)
 }
 #endif
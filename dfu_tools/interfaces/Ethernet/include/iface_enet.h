@@ -17,6 +17,10 @@
 
 #include "dfu_proto_api.h"
 #include "ethernet_sockets.h"
+#include "event_loop.h"
+#if (ENET_USE_IMPAIRMENT==1)
+    #include "net_impair.h"
+#endif
 
 // Add your types, definitions, macros, etc. here
 
@@ -72,6 +76,117 @@ bool dfuClientEthernetUnInit(ifaceEthEnvStruct *env);
 */
 bool dfuClientEthernetSetDest(ifaceEthEnvStruct * env, char *dest);
 
+/*!
+** FUNCTION: dfuClientEthernetSetRxSources
+**
+** DESCRIPTION: Rebuilds the kernel RX filter so only the listed
+**              devices get through.
+**
+** PARAMETERS: macs: 6 bytes per device, count devices.  NULL/0 lets
+**             every device through.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientEthernetSetRxSources(ifaceEthEnvStruct * env, const uint8_t *macs, uint32_t count);
+
+/*!
+** FUNCTION: dfuClientEthernetFindEnv
+**
+** DESCRIPTION: The Ethernet interface a protocol instance belongs to.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if "dfu" does not belong to an Ethernet interface.
+**
+** COMMENTS:
+**
+*/
+ifaceEthEnvStruct * dfuClientEthernetFindEnv(dfuProtocol *dfu);
+
+/*!
+** FUNCTION: dfuClientEthernetGetMaxMTU
+**
+** DESCRIPTION: The largest DFU message the Ethernet interface behind a
+**              protocol instance can carry, from the interface's MTU.
+**
+** PARAMETERS:
+**
+** RETURNS: 0 if "dfu" does not belong to an Ethernet interface.
+**
+** COMMENTS:
+**
+*/
+uint16_t dfuClientEthernetGetMaxMTU(dfuProtocol *dfu);
+
+/*!
+** FUNCTION: dfuClientEthernetWatchAll
+**
+** DESCRIPTION: Adds the socket of every open Ethernet interface to an
+**              event loop, so the loop wakes when a frame arrives.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of sockets added (always 0 on Windows, where
+**          the pcap handle isn't a descriptor).
+**
+** COMMENTS: The callback should drive the client, which reads the
+**           socket.
+**
+*/
+uint32_t dfuClientEthernetWatchAll(eventLoopStruct *loop, eventLoopFdCallback callback, void *ctx);
+
+#if (ENET_USE_IMPAIRMENT==1)
+/*!
+** FUNCTION: dfuClientEthernetSetImpairment
+**
+** DESCRIPTION: Puts an impairment shim (net_impair) between this
+**              interface's protocol callbacks and its socket.
+**
+** PARAMETERS: tx: What happens to frames we send.  NULL for none.
+**             rx: What happens to frames we receive.  NULL for none.
+**
+** RETURNS: false if a shim couldn't be set up.
+**
+** COMMENTS: For testing only (ENET_USE_IMPAIRMENT).  Replaces any shim
+**           already there.
+**
+*/
+bool dfuClientEthernetSetImpairment(ifaceEthEnvStruct * env,
+                                    const netImpairProfileStruct *tx,
+                                    const netImpairProfileStruct *rx);
+
+/*!
+** FUNCTION: dfuClientEthernetSetDefaultImpairment
+**
+** DESCRIPTION: Impairment for every interface opened from now on.
+**
+** PARAMETERS: tx, rx: NULL for none.
+**
+** RETURNS:
+**
+** COMMENTS: Each interface's seeds are offset by twice its index.
+**
+*/
+void dfuClientEthernetSetDefaultImpairment(const netImpairProfileStruct *tx, const netImpairProfileStruct *rx);
+
+/*!
+** FUNCTION: dfuClientEthernetGetImpairStats
+**
+** DESCRIPTION: What the interface's impairment has done so far.
+**
+** PARAMETERS: tx, rx: [OUT] Either may be NULL.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientEthernetGetImpairStats(ifaceEthEnvStruct * env, netImpairStatsStruct *tx, netImpairStatsStruct *rx);
+#endif
+
 ///
 /// @fn: ifaceEthernetMACBytesToString
 ///
@@ -17,8 +17,22 @@
 #include "ethernet_sockets.h"
 #include "dfu_platform_utils.h"
 
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <errno.h>
+    #include <poll.h>
+    #include <sys/mman.h>
+    #include <linux/filter.h>
+#endif
+
 #define DEBUG_SOCKETS               (0)
 
+/*
+** Internal prototypes shared by both platforms.
+**
+*/
+static uint8_t *validate_frame(uint8_t *frame, uint32_t frameLen, uint16_t *payloadLen, uint8_t **payload);
+static uint16_t put_length_field(dfu_sock_t *socketHandle, uint8_t *frame, uint16_t payload_size);
+
 
 /*!
 ** FUNCTION: print_mac_address
@@ -38,6 +52,74 @@ void print_mac_address(unsigned char *mac)
            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
 
+///
+/// @fn: set_ethernet_frame_mode
+///
+/// @details Picks the framing used for messages that would fit in a
+///          legacy 802.3 frame.  Larger ones always use the EtherType.
+///
+/// @param[in] socketHandle
+/// @param[in] mode
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void set_ethernet_frame_mode(dfu_sock_t * socketHandle, dfu_frame_mode_t mode)
+{
+    if (socketHandle)
+    {
+        socketHandle->frameMode = mode;
+    }
+
+    return;
+}
+
+///
+/// @fn: get_ethernet_max_payload
+///
+/// @details The largest DFU message one frame can carry on this
+///          interface.  Above 1500 bytes the EtherType framing (and
+///          its 2-byte length field) is required.
+///
+/// @param[in] socketHandle
+///
+/// @returns 0 if the handle is invalid.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint16_t get_ethernet_max_payload(dfu_sock_t * socketHandle)
+{
+    uint16_t            ret = 0;
+
+    if (socketHandle)
+    {
+        uint32_t        mtu = socketHandle->linkMTU;
+
+        if (mtu == 0)
+        {
+            mtu = ENET_LEGACY_MAX_PAYLOAD;
+        }
+        else
+        if (mtu > ENET_MAX_LINK_MTU)
+        {
+            mtu = ENET_MAX_LINK_MTU;
+        }
+
+        if (
+               (mtu > ENET_LEGACY_MAX_PAYLOAD) ||
+               (socketHandle->frameMode == ENET_FRAME_MODE_ETHERTYPE)
+           )
+        {
+            mtu -= 2;
+        }
+
+        ret = (uint16_t)mtu;
+    }
+
+    return ret;
+}
+
 #if defined(_WIN32) || defined(_WIN64)
 
 static bool pcapDLLLoaded = false;
@@ -55,6 +137,7 @@ typedef struct
 {
     BYTE        address[8];    // Most MAC addresses are 6 bytes, but allow for 8
     ULONG       length;        // Actual length of the MAC address
+    ULONG       mtu;           // Interface MTU
     int         found;         // Flag to indicate if MAC was found
 } MAC_ADDRESS;
 
@@ -154,6 +237,7 @@ MAC_ADDRESS GetMACByFriendlyName(const char* friendlyName)
                 memcpy(result.address, pCurrent->PhysicalAddress,
                       pCurrent->PhysicalAddressLength);
                 result.length = pCurrent->PhysicalAddressLength;
+                result.mtu = pCurrent->Mtu;
                 result.found = 1;
                 break;
             }
@@ -374,28 +458,11 @@ dfu_sock_t *create_raw_socket(const char *interface_name, dfu_sock_t *socketHand
                        if ((macAddress.found) && (macAddress.length == 6))
                        {
                            memcpy(socketHandle->myMAC, macAddress.address, 6);
+                           socketHandle->linkMTU = macAddress.mtu;
+                           socketHandle->frameMode = (dfu_frame_mode_t)ENET_DEFAULT_FRAME_MODE;
 
                            // Set up packet filter for broadcast and direct frames
-                           struct bpf_program fp;
-                           char filter_exp[] = "ether broadcast or ether dst host %02x:%02x:%02x:%02x:%02x:%02x";
-                           char actual_filter[100];
-
-                           snprintf(actual_filter, sizeof(actual_filter), filter_exp,
-                                    socketHandle->myMAC[0], socketHandle->myMAC[1], socketHandle->myMAC[2],
-                                    socketHandle->myMAC[3], socketHandle->myMAC[4], socketHandle->myMAC[5]);
-
-                           if (pcap_compile(socketHandle->handle, &fp, actual_filter, 0, PCAP_NETMASK_UNKNOWN) == 0)
-                           {
-                               if (pcap_setfilter(socketHandle->handle, &fp) != 0)
-                               {
-                                   fprintf(stderr, "Failed to set filter: %s\n", pcap_geterr(socketHandle->handle));
-                               }
-                               pcap_freecode(&fp);
-                           }
-                           else
-                           {
-                               fprintf(stderr, "Failed to compile filter: %s\n", pcap_geterr(socketHandle->handle));
-                           }
+                           set_ethernet_rx_filter(socketHandle, NULL, 0);
 
                            // Set non-blocking mode
                            if (pcap_setnonblock(socketHandle->handle, 1, errbuf) != -1)
@@ -453,13 +520,17 @@ void send_ethernet_message(dfu_sock_t * socketHandle,
                            uint8_t *payload,
                            uint16_t payload_size)
 {
-    if ( (socketHandle) && (interface_name) )
+    if (
+           (socketHandle) &&
+           (interface_name) &&
+           (payload_size <= get_ethernet_max_payload(socketHandle))
+       )
     {
-        uint16_t         payloadLen;
-        int16_t          bytesSent;
+        uint16_t         hdrLen;
+        int              bytesSent;
 
         // Set the destination MAC address in the frame
-        memset(socketHandle->buffer, 0, MAX_ETHERNET_MSG_LEN);
+        memset(socketHandle->buffer, 0, 60);
         memcpy(socketHandle->buffer, dest_mac, 6); // Destination MAC address
 
         // Get the source MAC address (the MAC of the interface)
@@ -477,24 +548,20 @@ void send_ethernet_message(dfu_sock_t * socketHandle,
             }
         }
     #endif
-        //
-        // Payload will be less than 1500 bytes, so field is length,
-        // not EtherType
-        //
-        payloadLen = to_big_endian_16(payload_size);
-        memcpy(&socketHandle->buffer[12], &payloadLen, 2);
+        // 802.3 length, or EtherType + length for big/EtherType-mode frames
+        hdrLen = put_length_field(socketHandle, socketHandle->buffer, payload_size);
 
         // Copy the payload
-        memcpy(socketHandle->buffer + 14, payload, payload_size);
+        memcpy(socketHandle->buffer + hdrLen, payload, payload_size);
 
         // Send packet
-        bytesSent = pcap_inject(socketHandle->handle, socketHandle->buffer, 14 + payload_size);
+        bytesSent = pcap_inject(socketHandle->handle, socketHandle->buffer, hdrLen + payload_size);
         if (bytesSent < 0)
         {
             fprintf(stderr, "Error sending the packet! pcap_inject() result was < 0...[%d]", bytesSent);
         }
         else
-        if (bytesSent != 14 + payload_size)
+        if (bytesSent != hdrLen + payload_size)
         {
             fprintf(stderr, "Error sending the packet: %s\n", pcap_geterr(socketHandle->handle));
         }
@@ -509,6 +576,128 @@ void send_ethernet_message(dfu_sock_t * socketHandle,
     return;
 }
 
+///
+/// @fn: queue_ethernet_message
+///
+/// @details Windows version.  NPCAP has no batching here, so the frame
+///          is sent immediately.
+///
+/// @param[in] socketHandle
+/// @param[in] dest_mac
+/// @param[in] payload
+/// @param[in] payload_size
+///
+/// @returns true if the frame was sent.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool queue_ethernet_message(dfu_sock_t * socketHandle,
+                            uint8_t *dest_mac,
+                            uint8_t *payload,
+                            uint16_t payload_size)
+{
+    bool            ret = false;
+
+    if (socketHandle)
+    {
+        send_ethernet_message(socketHandle, "", dest_mac, payload, payload_size);
+        ret = true;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: set_ethernet_rx_filter
+///
+/// @details Windows version.  Generates a pcap filter expression and
+///          lets NPCAP compile it.
+///
+/// @param[in] socketHandle
+/// @param[in] srcMACs: 6 bytes per entry.  NULL accepts any source.
+/// @param[in] srcCount
+///
+/// @returns true if the filter was attached.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool set_ethernet_rx_filter(dfu_sock_t * socketHandle,
+                            const uint8_t *srcMACs,
+                            uint32_t srcCount)
+{
+    bool                ret = false;
+    struct bpf_program  fp;
+    char                filter[128 + (ENET_RX_FILTER_MAX_SOURCES * 32)];
+    int                 len;
+    uint32_t            index;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->handle) &&
+           (srcCount <= ENET_RX_FILTER_MAX_SOURCES) &&
+           ((srcMACs) || (srcCount == 0))
+       )
+    {
+        len = snprintf(filter, sizeof(filter),
+                       "(ether[12:2] <= %u or ether proto 0x%04x) and (ether broadcast or (ether dst %02x:%02x:%02x:%02x:%02x:%02x",
+                       ENET_LEGACY_MAX_PAYLOAD, ENET_DFU_ETHERTYPE,
+                       socketHandle->myMAC[0], socketHandle->myMAC[1], socketHandle->myMAC[2],
+                       socketHandle->myMAC[3], socketHandle->myMAC[4], socketHandle->myMAC[5]);
+
+        for (index = 0; index < srcCount; index++)
+        {
+            const uint8_t *mac = &srcMACs[index * 6];
+
+            len += snprintf(&filter[len], sizeof(filter) - len,
+                            "%s ether src %02x:%02x:%02x:%02x:%02x:%02x%s",
+                            (index == 0) ? " and (" : " or",
+                            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                            (index == srcCount - 1) ? ")" : "");
+        }
+
+        // Close "(ether dst ..." and "(ether broadcast or ..."; the source
+        // check only applies to frames sent to us.
+        len += snprintf(&filter[len], sizeof(filter) - len, "))");
+
+        if (pcap_compile(socketHandle->handle, &fp, filter, 1, PCAP_NETMASK_UNKNOWN) == 0)
+        {
+            if (pcap_setfilter(socketHandle->handle, &fp) == 0)
+            {
+                ret = true;
+            }
+            else
+            {
+                fprintf(stderr, "Failed to set filter: %s\n", pcap_geterr(socketHandle->handle));
+            }
+            pcap_freecode(&fp);
+        }
+        else
+        {
+            fprintf(stderr, "Failed to compile filter: %s\n", pcap_geterr(socketHandle->handle));
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: flush_ethernet_messages
+///
+/// @details Windows version.  Nothing is ever queued.
+///
+/// @param[in] socketHandle
+///
+/// @returns 0
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint32_t flush_ethernet_messages(dfu_sock_t * socketHandle)
+{
+    (void)socketHandle;
+
+    return 0;
+}
+
 ///
 /// @fn: receive_ethernet_message
 ///
@@ -533,37 +722,119 @@ uint8_t *receive_ethernet_message(dfu_sock_t *socketHandle, uint8_t *destBuff, u
     if (
            (socketHandle) &&
            (socketHandle->handle) &&
+           (destBuff) &&
            (destBuffLen) &&
            (*destBuffLen > 14)
        )
     {
-        struct pcap_pkthdr         *hdr;
-        const uint8_t              *pPacket;
-        int                         result;
+        uint8_t *           frame;
+        uint8_t *           payload = NULL;
+        uint16_t            payloadLen = 0;
 
-        result = pcap_next_ex(socketHandle->handle, &hdr, &pPacket);
-        if ( (result == 1) && (pPacket != NULL) )
+        frame = receive_ethernet_message_zc(socketHandle, &payloadLen, &payload);
+        if ( (frame) && ((payloadLen + 14) <= *destBuffLen) )
         {
-            uint16_t            payloadLen;
+            uint16_t        lengthField = to_big_endian_16(payloadLen);
 
-            memcpy(&payloadLen, pPacket+12, 2);
-            payloadLen = from_big_endian_16(payloadLen);
+            // Addresses, then an 802.3-style length, then the payload
+            memcpy(destBuff, frame, 12);
+            memcpy(&destBuff[12], &lengthField, 2);
+            memcpy(&destBuff[14], payload, payloadLen);
 
-            if ((payloadLen + 14) <= *destBuffLen)
-            {
-                memcpy(destBuff, pPacket, hdr->len);
+            *destBuffLen = payloadLen;
+            ret = destBuff;
+        }
+    }
 
-                *destBuffLen = payloadLen;
-                ret = destBuff;
-            }
+    return (ret);
+}
+
+///
+/// @fn: receive_ethernet_message_zc
+///
+/// @details Zero-copy receive. NPCAP already hands us a pointer to
+///          its own capture buffer, so just validate and return it.
+///
+/// @param[in] socketHandle : The specific port to get data from
+/// @param[out] payloadLen: The payload length of the frame.
+/// @param[out] payload: Where the payload starts.
+///
+/// @returns Address of the frame or NULL.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t *receive_ethernet_message_zc(dfu_sock_t *socketHandle, uint16_t *payloadLen, uint8_t **payload)
+{
+    uint8_t             *ret = NULL;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->handle) &&
+           (payloadLen)
+       )
+    {
+        struct pcap_pkthdr         *hdr;
+        const uint8_t              *pPacket;
+
+        if ( (pcap_next_ex(socketHandle->handle, &hdr, &pPacket) == 1) && (pPacket != NULL) )
+        {
+            ret = validate_frame((uint8_t *)pPacket, hdr->caplen, payloadLen, payload);
         }
     }
 
     return (ret);
 }
 
+///
+/// @fn: release_ethernet_message
+///
+/// @details Nothing to do for NPCAP; the capture buffer is recycled
+///          on the next pcap_next_ex() call.
+///
+/// @param[in] socketHandle
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void release_ethernet_message(dfu_sock_t *socketHandle)
+{
+    (void)socketHandle;
+    return;
+}
+
+///
+/// @fn: close_raw_socket
+///
+/// @details Closes the NPCAP handle.
+///
+/// @param[in] socketHandle
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void close_raw_socket(dfu_sock_t *socketHandle)
+{
+    if ( (socketHandle) && (socketHandle->handle) )
+    {
+        pcap_close(socketHandle->handle);
+        socketHandle->handle = NULL;
+    }
+
+    return;
+}
+
 #else // Linux versions below
 
+static bool setup_rx_ring(dfu_sock_t *socketHandle);
+static struct tpacket2_hdr *get_rx_frame(dfu_rx_ring_t *ring);
+static dfu_tx_dest_t *get_tx_dest(dfu_sock_t *socketHandle, uint8_t *dest_mac);
+static uint32_t build_rx_filter(const uint8_t *myMAC,
+                                const uint8_t *srcMACs,
+                                uint32_t srcCount,
+                                struct sock_filter *prog);
+
 ///
 /// @fn: get_mac_address
 ///
@@ -590,7 +861,7 @@ int get_mac_address(const char *interface_name, dfu_sock_t * socketHandle, uint8
     if (ioctl(socketHandle->sockfd, SIOCGIFHWADDR, &ifr) == -1)
     {
         perror("ioctl");
-        close(socketHandle->sockfd);
+        close_raw_socket(socketHandle);
         return -1;
     }
 
@@ -627,6 +898,10 @@ dfu_sock_t * create_raw_socket(const char *interface_name, dfu_sock_t * socketHa
     {
         // Create a raw socket
         socketHandle->sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        memset(&socketHandle->rxRing, 0, sizeof(socketHandle->rxRing));
+        socketHandle->txBatch.count = 0;
+        socketHandle->txBatch.nextDest = 0;
+        memset(socketHandle->txBatch.dests, 0, sizeof(socketHandle->txBatch.dests));
         if (socketHandle->sockfd == -1)
         {
             perror("socket");
@@ -644,12 +919,14 @@ dfu_sock_t * create_raw_socket(const char *interface_name, dfu_sock_t * socketHa
         if (setsockopt(socketHandle->sockfd, SOL_SOCKET, SO_DONTROUTE, &sock_opt, sizeof(sock_opt)) < 0)
         {
             perror("setsockopt SO_DONTROUTE");
+            close_raw_socket(socketHandle);
             return NULL;
         }
 
         if (setsockopt(socketHandle->sockfd, SOL_SOCKET, SO_NO_CHECK, &sock_opt, sizeof(sock_opt)) < 0)
         {
             perror("setsockopt SO_NO_CHECK");
+            close_raw_socket(socketHandle);
             return NULL;
         }
 
@@ -657,6 +934,7 @@ dfu_sock_t * create_raw_socket(const char *interface_name, dfu_sock_t * socketHa
         if (setsockopt(socketHandle->sockfd, SOL_SOCKET, SO_BINDTODEVICE, interface_name, strlen(interface_name)) < 0)
         {
             perror("setsockupt SO_BINDTODEVICE");
+            close_raw_socket(socketHandle);
             return NULL;
         }
 
@@ -672,19 +950,65 @@ dfu_sock_t * create_raw_socket(const char *interface_name, dfu_sock_t * socketHa
         if (bind(socketHandle->sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
         {
             perror("bind");
-            close(socketHandle->sockfd);
+            close_raw_socket(socketHandle);
+            return NULL;
+        }
+
+        //
+        // Cache the interface index and our MAC so the transmit path
+        // never has to ask the kernel for them again.
+        //
+        socketHandle->ifIndex = addr.sll_ifindex;
+        if (get_mac_address(interface_name, socketHandle, socketHandle->myMAC) != 0)
+        {
             return NULL;
         }
 
+        //
+        // The interface MTU decides how big a DFU message can get.  If
+        // the kernel won't say, assume a standard 1500 byte link.
+        //
+        {
+            struct ifreq        ifr;
+
+            memset(&ifr, 0, sizeof(ifr));
+            strncpy(ifr.ifr_name, interface_name, IFNAMSIZ - 1);
+            socketHandle->linkMTU = ENET_LEGACY_MAX_PAYLOAD;
+            if (ioctl(socketHandle->sockfd, SIOCGIFMTU, &ifr) == 0)
+            {
+                socketHandle->linkMTU = (uint32_t)ifr.ifr_mtu;
+            }
+            socketHandle->frameMode = (dfu_frame_mode_t)ENET_DEFAULT_FRAME_MODE;
+        }
+
+        //
+        // Keep the rest of the segment's traffic in the kernel.  Not
+        // fatal: without it we just see (and discard) more frames.
+        //
+    #if (ENET_USE_RX_FILTER==1)
+        set_ethernet_rx_filter(socketHandle, NULL, 0);
+    #endif
+
         // Enable Ethernet broadcast support
         int broadcastEnable = 1;
         if (setsockopt(socketHandle->sockfd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable)) == -1)
         {
             perror("setsockopt");
-            close(socketHandle->sockfd);
+            close_raw_socket(socketHandle);
             return NULL;
         }
 
+        //
+        // Map the receive ring.  If the kernel won't give us one, we
+        // carry on with plain recvfrom() receives.
+        //
+    #if (ENET_USE_RX_RING==1)
+        if (!setup_rx_ring(socketHandle))
+        {
+            fprintf(stderr, "RX ring unavailable; using recvfrom()\n");
+        }
+    #endif
+
         // Set for successful return
         ret = socketHandle;
 
@@ -697,10 +1021,12 @@ dfu_sock_t * create_raw_socket(const char *interface_name, dfu_sock_t * socketHa
 ///
 /// @fn: send_ethernet_message
 ///
-/// @details Linux version of sending a raw ethernet message.
+/// @details Linux version of sending a raw ethernet message.  Anything
+///          already queued goes out in the same burst, ahead of this
+///          frame.
 ///
 /// @param[in] socketHandle
-/// @param[in] interface_name
+/// @param[in] interface_name: UNUSED (the index is cached at creation)
 /// @param[in] dest_mac
 /// @param[in] payload
 /// @param[in] payload_size
@@ -715,95 +1041,206 @@ void send_ethernet_message(dfu_sock_t * socketHandle,
                            uint8_t *payload,
                            uint16_t payload_size)
 {
-    unsigned char buffer[ETH_FRAME_LEN];
-    struct ifreq ifr;
-    struct sockaddr_ll addr = {0};
-    ssize_t bytesSent;
+    (void)interface_name;
 
-    if (payload_size > (ETH_FRAME_LEN - 14))
+    if (queue_ethernet_message(socketHandle, dest_mac, payload, payload_size))
     {
-        fprintf(stderr, "Payload size too large.\n");
-        return;
+        flush_ethernet_messages(socketHandle);
     }
 
-    // Set the destination MAC address in the frame
-    memset(buffer, 0, ETH_FRAME_LEN);
-    memcpy(buffer, dest_mac, ETH_ALEN); // Destination MAC address
+    return;
+}
 
-    // Get the source MAC address (the MAC of the interface)
-    strncpy(ifr.ifr_name, interface_name, IFNAMSIZ - 1);
-    ifr.ifr_name[IFNAMSIZ - 1] = '\0'; // Ensure null termination
+///
+/// @fn: queue_ethernet_message
+///
+/// @details Builds a frame into the next free TX batch slot.  If the
+///          batch is full it is flushed first.
+///
+/// @param[in] socketHandle
+/// @param[in] dest_mac
+/// @param[in] payload
+/// @param[in] payload_size
+///
+/// @returns true if the frame was queued.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool queue_ethernet_message(dfu_sock_t * socketHandle,
+                            uint8_t *dest_mac,
+                            uint8_t *payload,
+                            uint16_t payload_size)
+{
+    bool                ret = false;
+    dfu_tx_batch_t*     batch;
+    dfu_tx_dest_t*      dest;
+    uint8_t*            frame;
+    size_t              frame_size;
+    uint16_t            hdrLen;
 
-    if (ioctl(socketHandle->sockfd, SIOCGIFHWADDR, &ifr) == -1)
+    if (payload_size > get_ethernet_max_payload(socketHandle))
     {
-        perror("ioctl(SIOCGIFHWADDR)");
-        return;
+        fprintf(stderr, "Payload size too large.\n");
     }
+    else
+    if (
+           (socketHandle) &&
+           (socketHandle->sockfd >= 0) &&
+           (dest_mac) &&
+           (payload)
+       )
+    {
+        batch = &socketHandle->txBatch;
 
-    /*
-    printf("Source MAC address: %02X:%02X:%02X:%02X:%02X:%02X\n",
-           (unsigned char)ifr.ifr_hwaddr.sa_data[0],
-           (unsigned char)ifr.ifr_hwaddr.sa_data[1],
-           (unsigned char)ifr.ifr_hwaddr.sa_data[2],
-           (unsigned char)ifr.ifr_hwaddr.sa_data[3],
-           (unsigned char)ifr.ifr_hwaddr.sa_data[4],
-           (unsigned char)ifr.ifr_hwaddr.sa_data[5]);
-    */
-
-    memcpy(buffer + 6, ifr.ifr_hwaddr.sa_data, 6); // Source MAC address
+        if (batch->count >= ENET_TX_BATCH_MAX_FRAMES)
+        {
+            flush_ethernet_messages(socketHandle);
+        }
 
-    // Ethernet type (custom protocol, e.g., 0x1234)
-    uint16_t ethertype = htons(payload_size); // TDW TEST to_little_endian_16(payload_size);
-    memcpy(&buffer[12], &ethertype, 2);
+        if (batch->count < ENET_TX_BATCH_MAX_FRAMES)
+        {
+            dest = get_tx_dest(socketHandle, dest_mac);
+            frame = batch->frames[batch->count];
 
-    // Payload
-    memcpy(buffer + 14, payload, payload_size);
+            // Addresses come pre-built, then the length field(s)
+            memcpy(frame, dest->header, sizeof(dest->header));
+            hdrLen = put_length_field(socketHandle, frame, payload_size);
+            memcpy(&frame[hdrLen], payload, payload_size);
 
-    // Set the sockaddr_ll structure for sending
-    addr.sll_family = AF_PACKET;
-    addr.sll_ifindex = if_nametoindex(interface_name); // Get index directly in send function
-    addr.sll_protocol = 0; // TDW TEST htons(ETH_P_ALL); // Use same protocol as EtherType
-    addr.sll_halen = ETH_ALEN;
-    addr.sll_hatype = 1;
-    memcpy(addr.sll_addr, dest_mac, ETH_ALEN);
+            // Pad to minimum (minus FCS), if necessary
+            frame_size = hdrLen + payload_size;
+            if (frame_size < ETH_ZLEN)
+            {
+                memset(frame + frame_size, 0, ETH_ZLEN - frame_size);
+                frame_size = ETH_ZLEN;
+            }
 
-    /*
-    printf("Sending message to MAC: %02X:%02X:%02X:%02X:%02X:%02X\n",
-           dest_mac[0], dest_mac[1], dest_mac[2], dest_mac[3], dest_mac[4], dest_mac[5]);
-    */
+            batch->iov[batch->count].iov_base = frame;
+            batch->iov[batch->count].iov_len = frame_size;
 
+            memset(&batch->msgs[batch->count], 0, sizeof(struct mmsghdr));
+            batch->msgs[batch->count].msg_hdr.msg_name = &dest->addr;
+            batch->msgs[batch->count].msg_hdr.msg_namelen = sizeof(dest->addr);
+            batch->msgs[batch->count].msg_hdr.msg_iov = &batch->iov[batch->count];
+            batch->msgs[batch->count].msg_hdr.msg_iovlen = 1;
 
-    // Padd to minimum, if necessary
-    #define MIN_FRAME_LENGTH   (60)
-    size_t frame_size = 14 + payload_size;
-    if (frame_size < MIN_FRAME_LENGTH)
-    {
-        // Minimum size minus FCS
-        memset(buffer + frame_size, 0, MIN_FRAME_LENGTH - frame_size);
-        frame_size = MIN_FRAME_LENGTH;
+            batch->count++;
+            ret = true;
+        }
     }
 
-    // Send the packet
-    int flags = 0;
-    flags |= MSG_CONFIRM | MSG_EOR;
-    bytesSent = sendto(socketHandle->sockfd, buffer, frame_size, flags, (struct sockaddr*)&addr, sizeof(addr));
-    if (bytesSent == -1)
-    {
-        perror("sendto");
-        return;
-    }
+    return ret;
 }
 
 ///
-/// @fn: receive_ethernet_message
+/// @fn: flush_ethernet_messages
 ///
-/// @details Uses raw sockets to receive our Ethernet frame.
+/// @details Pushes every queued frame to the kernel with sendmmsg().
+///          Frames the kernel refuses are dropped; the protocol layer
+///          retries on timeout like it would for a lost frame.
 ///
-/// @param[in] socketHandle : The specific port to get data from
-/// @param[in] destBuff: Where the received data is placed.
-/// @param[in][out] destBuffLen: [IN]: The max frame length to receive.
-//                               [OUT]: The # of bytes actually received.
-/// @param[in] expected_src_mac: UNUSED
+/// @param[in] socketHandle
+///
+/// @returns The number of frames sent.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint32_t flush_ethernet_messages(dfu_sock_t * socketHandle)
+{
+    uint32_t            ret = 0;
+    dfu_tx_batch_t*     batch;
+    int                 sent;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->sockfd >= 0)
+       )
+    {
+        batch = &socketHandle->txBatch;
+
+        while (ret < batch->count)
+        {
+            sent = sendmmsg(socketHandle->sockfd,
+                            &batch->msgs[ret],
+                            batch->count - ret,
+                            MSG_CONFIRM);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                perror("sendmmsg");
+                break;
+            }
+
+            ret += (uint32_t)sent;
+        }
+
+        batch->count = 0;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: set_ethernet_rx_filter
+///
+/// @details Linux version.  Generates a classic BPF program and
+///          attaches it with SO_ATTACH_FILTER.  Replacing a filter is
+///          atomic, so this can be called at any time.
+///
+/// @param[in] socketHandle
+/// @param[in] srcMACs: 6 bytes per entry.  NULL accepts any source.
+/// @param[in] srcCount
+///
+/// @returns true if the filter was attached.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+bool set_ethernet_rx_filter(dfu_sock_t * socketHandle,
+                            const uint8_t *srcMACs,
+                            uint32_t srcCount)
+{
+    bool                ret = false;
+    struct sock_filter  prog[12 + (ENET_RX_FILTER_MAX_SOURCES * 4)];
+    struct sock_fprog   fprog;
+
+    if (
+           (socketHandle) &&
+           (socketHandle->sockfd >= 0) &&
+           (srcCount <= ENET_RX_FILTER_MAX_SOURCES) &&
+           ((srcMACs) || (srcCount == 0))
+       )
+    {
+        memset(&fprog, 0, sizeof(fprog));
+        fprog.len = (unsigned short)build_rx_filter(socketHandle->myMAC, srcMACs, srcCount, prog);
+        fprog.filter = prog;
+
+        if (setsockopt(socketHandle->sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+        {
+            perror("setsockopt SO_ATTACH_FILTER");
+        }
+        else
+        {
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+///
+/// @fn: receive_ethernet_message
+///
+/// @details Uses raw sockets to receive our Ethernet frame.
+///
+/// @param[in] socketHandle : The specific port to get data from
+/// @param[in] destBuff: Where the received data is placed.
+/// @param[in][out] destBuffLen: [IN]: The max frame length to receive.
+//                               [OUT]: The # of bytes actually received.
+/// @param[in] expected_src_mac: UNUSED
 ///
 /// @returns
 ///
@@ -813,6 +1250,8 @@ uint8_t *receive_ethernet_message(dfu_sock_t *socketHandle, uint8_t *destBuff, u
 {
     uint8_t*            ret = NULL;
 
+    (void)expected_src_mac;
+
     if (
            (socketHandle) &&
            (destBuff) &&
@@ -820,37 +1259,106 @@ uint8_t *receive_ethernet_message(dfu_sock_t *socketHandle, uint8_t *destBuff, u
            (*destBuffLen > 14)
        )
     {
-        unsigned char       buffer[ETH_FRAME_LEN];
-        ssize_t             numbytes;
-        uint16_t            payloadLen;
+        uint8_t *           frame;
+        uint8_t *           payload = NULL;
+        uint16_t            payloadLen = 0;
 
-        // Receive data
-        numbytes = recvfrom(socketHandle->sockfd, buffer, *destBuffLen, 0, NULL, NULL);
-        if (numbytes == -1)
+        //
+        // Take the frame from wherever it landed (ring or socket
+        // buffer) and copy it out in the legacy 802.3 layout.
+        //
+        frame = receive_ethernet_message_zc(socketHandle, &payloadLen, &payload);
+        if ( (frame) && ((payloadLen + 14) <= *destBuffLen) )
         {
-            perror("recvfrom");
-            return NULL;
+            uint16_t        lengthField = htons(payloadLen);
+
+            memcpy(destBuff, frame, 12);
+            memcpy(&destBuff[12], &lengthField, 2);
+            memcpy(&destBuff[14], payload, payloadLen);
+
+            // Return the payload length part
+            *destBuffLen = payloadLen;
+
+            // Return the address of the caller's buffer when success.
+            ret = destBuff;
+        }
+
+        release_ethernet_message(socketHandle);
+    }
+
+    return ret;
+}
+
+///
+/// @fn: receive_ethernet_message_zc
+///
+/// @details Zero-copy receive.  With the RX ring mapped, returns the
+///          address of the next valid frame inside the ring; the ring
+///          slot is held until release_ethernet_message() is called
+///          (or the next receive call releases it for us).  Without the
+///          ring, falls back to one recvfrom() into the socket's own
+///          buffer.
+///
+/// @param[in] socketHandle : The specific port to get data from
+/// @param[out] payloadLen: The payload length of the frame.
+/// @param[out] payload: Where the payload starts.
+///
+/// @returns Address of the frame (destination MAC first) or NULL.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+uint8_t *receive_ethernet_message_zc(dfu_sock_t *socketHandle, uint16_t *payloadLen, uint8_t **payload)
+{
+    uint8_t*            ret = NULL;
+
+    if ( (socketHandle) && (payloadLen) )
+    {
+        dfu_rx_ring_t*      ring = &socketHandle->rxRing;
+
+        if (ring->map == NULL)
+        {
+            ssize_t             numbytes;
+
+            numbytes = recvfrom(socketHandle->sockfd, socketHandle->buffer, sizeof(socketHandle->buffer), 0, NULL, NULL);
+            if (numbytes == -1)
+            {
+                perror("recvfrom");
+                return NULL;
+            }
+
+            return validate_frame(socketHandle->buffer, (uint32_t)numbytes, payloadLen, payload);
         }
 
-        if (numbytes > 14)
+        // Caller forgot to release the last one?
+        release_ethernet_message(socketHandle);
+
+        while (ret == NULL)
         {
-            memcpy(&payloadLen, &buffer[12], 2);
-            payloadLen = from_big_endian_16(payloadLen);
+            struct tpacket2_hdr*    pkt = get_rx_frame(ring);
 
-            if (
-                  (numbytes > payloadLen) &&
-                  (numbytes-payloadLen >= 14) &&
-                  ((payloadLen + 14) <= *destBuffLen)
-               )
+            if ((__atomic_load_n(&pkt->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
             {
-                // Copy the entire frame, including the source/dest/len
-                memcpy(destBuff, buffer, payloadLen + 14);
+                struct pollfd           pfd;
+
+                // Slot still empty. Sleep briefly in the kernel.
+                pfd.fd = socketHandle->sockfd;
+                pfd.events = POLLIN | POLLERR;
+                pfd.revents = 0;
+                poll(&pfd, 1, ENET_RX_RING_POLL_TIMEOUT_MS);
+
+                if ((__atomic_load_n(&pkt->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+                {
+                    break;
+                }
+            }
 
-                // Return the payload length part
-                *destBuffLen = payloadLen;
+            ring->frameOutstanding = true;
 
-                // Return the address of the caller's buffer when success.
-                ret = destBuff;
+            ret = validate_frame((uint8_t *)pkt + pkt->tp_mac, pkt->tp_snaplen, payloadLen, payload);
+            if (ret == NULL)
+            {
+                // Not one of ours; drop it and keep walking.
+                release_ethernet_message(socketHandle);
             }
         }
     }
@@ -858,4 +1366,428 @@ uint8_t *receive_ethernet_message(dfu_sock_t *socketHandle, uint8_t *destBuff, u
     return ret;
 }
 
+///
+/// @fn: release_ethernet_message
+///
+/// @details Releases the ring slot handed out by the last zero-copy
+///          receive, returning it to the kernel.
+///
+/// @param[in] socketHandle
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void release_ethernet_message(dfu_sock_t *socketHandle)
+{
+    if (socketHandle)
+    {
+        dfu_rx_ring_t*      ring = &socketHandle->rxRing;
+
+        if ( (ring->map) && (ring->frameOutstanding) )
+        {
+            ring->frameOutstanding = false;
+
+            __atomic_store_n(&get_rx_frame(ring)->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            ring->frameIndex = (ring->frameIndex + 1) % ring->frameCount;
+        }
+    }
+
+    return;
+}
+
+///
+/// @fn: close_raw_socket
+///
+/// @details Unmaps the RX ring (if any) and closes the socket.
+///
+/// @param[in] socketHandle
+///
+/// @returns
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+void close_raw_socket(dfu_sock_t *socketHandle)
+{
+    if (socketHandle)
+    {
+        if (socketHandle->rxRing.map)
+        {
+            munmap(socketHandle->rxRing.map, socketHandle->rxRing.mapLen);
+        }
+        memset(&socketHandle->rxRing, 0, sizeof(socketHandle->rxRing));
+
+        if (socketHandle->sockfd >= 0)
+        {
+            close(socketHandle->sockfd);
+            socketHandle->sockfd = -1;
+        }
+    }
+
+    return;
+}
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                         INTERNAL SUPPORT FUNCTIONS
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+///
+/// @fn: setup_rx_ring
+///
+/// @details Switches the socket to TPACKET_V2 and maps an RX ring
+///          sized by the ENET_RX_RING_xxx settings, with one slot per
+///          frame big enough for the largest frame the link carries.
+///
+/// @param[in] socketHandle
+///
+/// @returns true if the ring is mapped and ready.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static bool setup_rx_ring(dfu_sock_t *socketHandle)
+{
+    int                     version = TPACKET_V2;
+    struct tpacket_req      req;
+    uint32_t                frameSize;
+    void*                   map;
+
+    // Header, room for the MAC header the kernel lines up, and the frame
+    frameSize = TPACKET_ALIGN(TPACKET_ALIGN(TPACKET2_HDRLEN) + 16U + 16U + socketHandle->linkMTU);
+    if (frameSize > ENET_RX_RING_BLOCK_SIZE)
+    {
+        fprintf(stderr, "RX ring blocks too small for a %u byte MTU\n", socketHandle->linkMTU);
+        return false;
+    }
+
+    if (setsockopt(socketHandle->sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        perror("setsockopt PACKET_VERSION");
+        return false;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = ENET_RX_RING_BLOCK_SIZE;
+    req.tp_block_nr = ENET_RX_RING_BLOCK_COUNT;
+    req.tp_frame_size = frameSize;
+    req.tp_frame_nr = (ENET_RX_RING_BLOCK_SIZE / frameSize) * ENET_RX_RING_BLOCK_COUNT;
+
+    if (setsockopt(socketHandle->sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt PACKET_RX_RING");
+        return false;
+    }
+
+    map = mmap(NULL,
+               (size_t)req.tp_block_size * req.tp_block_nr,
+               PROT_READ | PROT_WRITE,
+               MAP_SHARED,
+               socketHandle->sockfd,
+               0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap RX ring");
+        return false;
+    }
+
+    socketHandle->rxRing.map = (uint8_t *)map;
+    socketHandle->rxRing.mapLen = (size_t)req.tp_block_size * req.tp_block_nr;
+    socketHandle->rxRing.blockSize = req.tp_block_size;
+    socketHandle->rxRing.frameSize = req.tp_frame_size;
+    socketHandle->rxRing.framesPerBlock = req.tp_block_size / req.tp_frame_size;
+    socketHandle->rxRing.frameCount = req.tp_frame_nr;
+
+    return true;
+}
+
+///
+/// @fn: get_rx_frame
+///
+/// @details Finds the ring slot the next frame is taken from.  Slots
+///          don't straddle blocks, so any space left at the end of a
+///          block is skipped.
+///
+/// @param[in] ring
+///
+/// @returns The slot's header.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static struct tpacket2_hdr *get_rx_frame(dfu_rx_ring_t *ring)
+{
+    size_t              offset;
+
+    offset = ((size_t)(ring->frameIndex / ring->framesPerBlock) * ring->blockSize) +
+             ((size_t)(ring->frameIndex % ring->framesPerBlock) * ring->frameSize);
+
+    return (struct tpacket2_hdr *)(ring->map + offset);
+}
+
+///
+/// @fn: get_tx_dest
+///
+/// @details Finds (or builds) the pre-built header and sockaddr_ll for
+///          a destination MAC.  When the table is full the oldest
+///          entry is replaced; anything queued that still points at it
+///          is flushed first.
+///
+/// @param[in] socketHandle
+/// @param[in] dest_mac
+///
+/// @returns The destination entry.  Never NULL.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static dfu_tx_dest_t *get_tx_dest(dfu_sock_t *socketHandle, uint8_t *dest_mac)
+{
+    dfu_tx_batch_t*     batch = &socketHandle->txBatch;
+    dfu_tx_dest_t*      ret = NULL;
+    uint32_t            index;
+
+    for (index = 0; index < ENET_TX_MAX_DESTINATIONS; index++)
+    {
+        if (
+               (batch->dests[index].valid) &&
+               (memcmp(batch->dests[index].header, dest_mac, ETH_ALEN) == 0)
+           )
+        {
+            ret = &batch->dests[index];
+            break;
+        }
+    }
+
+    if (ret == NULL)
+    {
+        if (batch->count > 0)
+        {
+            flush_ethernet_messages(socketHandle);
+        }
+
+        ret = &batch->dests[batch->nextDest];
+        batch->nextDest = (batch->nextDest + 1) % ENET_TX_MAX_DESTINATIONS;
+
+        memcpy(ret->header, dest_mac, ETH_ALEN);
+        memcpy(&ret->header[ETH_ALEN], socketHandle->myMAC, ETH_ALEN);
+
+        memset(&ret->addr, 0, sizeof(ret->addr));
+        ret->addr.sll_family = AF_PACKET;
+        ret->addr.sll_ifindex = socketHandle->ifIndex;
+        ret->addr.sll_protocol = 0;
+        ret->addr.sll_halen = ETH_ALEN;
+        ret->addr.sll_hatype = 1;
+        memcpy(ret->addr.sll_addr, dest_mac, ETH_ALEN);
+
+        ret->valid = true;
+    }
+
+    return ret;
+}
+
+///
+/// @fn: build_rx_filter
+///
+/// @details Generates the classic BPF program used by
+///          set_ethernet_rx_filter().  In order it checks:
+///            - DFU EtherType, or an 802.3 length field (<= 1500)
+///            - destination is our MAC or broadcast
+///            - for our MAC only, source is one of srcMACs (skipped if
+///              srcCount is 0).  Broadcasts pass from any source, so
+///              other devices' discovery frames are still seen.
+///
+/// @param[in] myMAC
+/// @param[in] srcMACs: 6 bytes per entry.
+/// @param[in] srcCount: At most ENET_RX_FILTER_MAX_SOURCES.
+/// @param[out] prog: Room for 12 + (4 * srcCount) instructions.
+///
+/// @returns The number of instructions generated.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static uint32_t build_rx_filter(const uint8_t *myMAC,
+                                const uint8_t *srcMACs,
+                                uint32_t srcCount,
+                                struct sock_filter *prog)
+{
+    uint32_t            pc = 0;
+    uint32_t            srcStart = 10;
+    uint32_t            reject;
+    uint32_t            accept;
+    uint32_t            index;
+
+    //
+    // Everything jumps forward to one of the two "ret" instructions at
+    // the end, so work out where they land before emitting anything.
+    //
+    if (srcCount > 0)
+    {
+        reject = srcStart + (srcCount * 4);
+        accept = reject + 1;
+    }
+    else
+    {
+        accept = srcStart;
+        reject = accept + 1;
+    }
+
+    #define BPF_JUMP_TO(target)     ((uint8_t)((target) - (pc + 1)))
+    #define BPF_MAC_HI(mac)         (((uint32_t)(mac)[0] << 24) | ((uint32_t)(mac)[1] << 16) | \
+                                     ((uint32_t)(mac)[2] << 8) | (uint32_t)(mac)[3])
+    #define BPF_MAC_LO(mac)         (((uint32_t)(mac)[4] << 8) | (uint32_t)(mac)[5])
+
+    // DFU EtherType, or an 802.3 length (not some other EtherType)
+    prog[pc] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12); pc++;
+    prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ENET_DFU_ETHERTYPE, 1, 0); pc++;
+    prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, ENET_LEGACY_MAX_PAYLOAD, BPF_JUMP_TO(reject), 0); pc++;
+
+    // Destination: our MAC...
+    prog[pc] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0); pc++;
+    prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BPF_MAC_HI(myMAC), 0, 2); pc++;
+    prog[pc] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4); pc++;
+    prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BPF_MAC_LO(myMAC), BPF_JUMP_TO(srcStart), BPF_JUMP_TO(reject)); pc++;
+
+    // ...or broadcast, which skips the source check
+    prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xFFFFFFFF, 0, BPF_JUMP_TO(reject)); pc++;
+    prog[pc] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4); pc++;
+    prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xFFFF, BPF_JUMP_TO(accept), BPF_JUMP_TO(reject)); pc++;
+
+    // Source: any of the listed devices.  A miss falls through to the next.
+    for (index = 0; index < srcCount; index++)
+    {
+        const uint8_t *mac = &srcMACs[index * 6];
+
+        prog[pc] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 6); pc++;
+        prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BPF_MAC_HI(mac), 0, 2); pc++;
+        prog[pc] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 10); pc++;
+        prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BPF_MAC_LO(mac), BPF_JUMP_TO(accept), 0); pc++;
+    }
+
+    if (srcCount > 0)
+    {
+        prog[pc] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0); pc++;
+        prog[pc] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0x40000); pc++;
+    }
+    else
+    {
+        prog[pc] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0x40000); pc++;
+        prog[pc] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0); pc++;
+    }
+
+    #undef BPF_JUMP_TO
+    #undef BPF_MAC_HI
+    #undef BPF_MAC_LO
+
+    return pc;
+}
+
 #endif // _WIN32 && _WIN64
+
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+//                  INTERNAL SUPPORT FUNCTIONS (ALL PLATFORMS)
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+// $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+
+///
+/// @fn: validate_frame
+///
+/// @details Works out which framing a frame uses and checks its length
+///          field against what actually arrived.
+///
+/// @param[in] frame: Start of the frame (destination MAC).
+/// @param[in] frameLen: Number of bytes captured.
+/// @param[out] payloadLen: Payload length from the header.
+/// @param[out] payload: OPTIONAL. Where the payload starts.
+///
+/// @returns The frame address if it is usable, NULL otherwise.
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static uint8_t *validate_frame(uint8_t *frame, uint32_t frameLen, uint16_t *payloadLen, uint8_t **payload)
+{
+    uint16_t            typeLen;
+    uint16_t            len;
+    uint32_t            hdrLen = 14;
+
+    if (frameLen <= 14)
+    {
+        return NULL;
+    }
+
+    memcpy(&typeLen, &frame[12], 2);
+    typeLen = from_big_endian_16(typeLen);
+
+    if (typeLen == ENET_DFU_ETHERTYPE)
+    {
+        if (frameLen < 16)
+        {
+            return NULL;
+        }
+
+        memcpy(&len, &frame[14], 2);
+        len = from_big_endian_16(len);
+        hdrLen = 16;
+    }
+    else
+    if (typeLen <= ENET_LEGACY_MAX_PAYLOAD)
+    {
+        len = typeLen;
+    }
+    else
+    {
+        // Somebody else's EtherType
+        return NULL;
+    }
+
+    if ((uint32_t)(len + hdrLen) > frameLen)
+    {
+        return NULL;
+    }
+
+    *payloadLen = len;
+    if (payload)
+    {
+        *payload = frame + hdrLen;
+    }
+
+    return frame;
+}
+
+///
+/// @fn: put_length_field
+///
+/// @details Writes the length (and, when needed, the DFU EtherType)
+///          after the two MAC addresses.
+///
+/// @param[in] socketHandle
+/// @param[in] frame: Start of the frame being built.
+/// @param[in] payload_size
+///
+/// @returns Offset of the payload within the frame (14 or 16).
+///
+/// @tracereq(@req{xxxxxxx}}
+///
+static uint16_t put_length_field(dfu_sock_t *socketHandle, uint8_t *frame, uint16_t payload_size)
+{
+    uint16_t            ret = 14;
+    uint16_t            field;
+
+    if (
+           (socketHandle->frameMode == ENET_FRAME_MODE_ETHERTYPE) ||
+           (payload_size > ENET_LEGACY_MAX_PAYLOAD)
+       )
+    {
+        field = to_big_endian_16(ENET_DFU_ETHERTYPE);
+        memcpy(&frame[12], &field, 2);
+        field = to_big_endian_16(payload_size);
+        memcpy(&frame[14], &field, 2);
+        ret = 16;
+    }
+    else
+    {
+        field = to_big_endian_16(payload_size);
+        memcpy(&frame[12], &field, 2);
+    }
+
+    return ret;
+}
@@ -21,6 +21,7 @@
 #include "iface_enet.h"
 #include "dfu_client_config.h"
 #include "dfu_proto_api.h"
+#include "async_timer.h"
 
 //
 // Only set to 1 if the message receiver needs to
@@ -40,14 +41,36 @@ struct ifaceEthEnvStruct
     uint8_t                     destMAC[6];
     uint8_t                     myMAC[6];
     char                        interfaceName[MAX_IFACE_NAME_LEN+1];
-    uint8_t                     msgBuff[MAX_MSG_LEN+128];
+#if (ENET_USE_IMPAIRMENT==1)
+    netImpairStruct *           txImpair;
+    netImpairStruct *           rxImpair;
+    uint8_t                     impairStage[6 + MAX_MSG_LEN];
+#endif
 };
 
+#if (ENET_USE_IMPAIRMENT==1)
+/*
+** Impairment applied to every interface opened from now on (see
+** dfuClientEthernetSetDefaultImpairment()).
+**
+*/
+typedef struct
+{
+    bool                        haveTx;
+    bool                        haveRx;
+    netImpairProfileStruct      tx;
+    netImpairProfileStruct      rx;
+}ifaceEthImpairDefaultsStruct;
+#endif
+
 /*
 ** Ethernet environment instances.
 **
 */
 static ifaceEthEnvStruct        enetEnvs[MAX_ETHERNET_INTERFACES];
+#if (ENET_USE_IMPAIRMENT==1)
+static ifaceEthImpairDefaultsStruct enetImpairDefaults;
+#endif
 
 
 /*
@@ -57,6 +80,11 @@ static ifaceEthEnvStruct        enetEnvs[MAX_ETHERNET_INTERFACES];
 static bool dfuClientEthernetInitEnv(ifaceEthEnvStruct *env);
 static ifaceEthEnvStruct * dfuClientEthernetAllocEnv(void);
 static bool dfuClientEthernetFreeEnv(ifaceEthEnvStruct * env);
+static bool dfuClientEthernetTransmit(ifaceEthEnvStruct * env, uint8_t *dest, uint8_t *payload, uint16_t payloadLen);
+#if (ENET_USE_IMPAIRMENT==1)
+static uint32_t dfuClientEthernetImpairTx(ifaceEthEnvStruct * env);
+static uint8_t *dfuClientEthernetImpairRx(ifaceEthEnvStruct * env, uint8_t *srcMAC, uint16_t *payloadLen, uint8_t **payload);
+#endif
 uint8_t *dfuClientEnetRxCallback(dfuProtocol * dfu, uint16_t * rxBuffLen, dfuUserPtr userPtr);
 bool dfuClientEnetTxCallback(dfuProtocol * dfu, uint8_t *txBuff, uint16_t txBuffLen, dfuMsgTargetEnum target, dfuUserPtr userPtr);
 void dfuClientEnetErrCallback(dfuProtocol * dfu, uint8_t *msg, uint16_t msgLen, dfuErrorCodeEnum error, dfuUserPtr userPtr);
@@ -96,8 +124,8 @@ ifaceEthEnvStruct * dfuClientEthernetInit(dfuProtocol **callerDFU, const char *i
                 // Save our interface name
                 snprintf(ret->interfaceName, MAX_IFACE_NAME_LEN, "%s", interfaceName);
 
-                // Sock our MAC address away.
-                get_mac_address(interfaceName, &ret->socketHandle, ret->myMAC);
+                // Sock our MAC address away (cached by the socket layer).
+                memcpy(ret->myMAC, ret->socketHandle.myMAC, sizeof(ret->myMAC));
 
                 // Get the protocol library set up.
                 ret->dfu = dfuCreate(dfuClientEnetRxCallback,
@@ -110,11 +138,28 @@ ifaceEthEnvStruct * dfuClientEthernetInit(dfuProtocol **callerDFU, const char *i
                     dfuSetMTU(ret->dfu, MAX_ETHERNET_MSG_LEN);
                     ret->userPtr = (void *)userPtr;
                     *callerDFU = ret->dfu;
+
+                #if (ENET_USE_IMPAIRMENT==1)
+                    if ( (enetImpairDefaults.haveTx) || (enetImpairDefaults.haveRx) )
+                    {
+                        netImpairProfileStruct  tx = enetImpairDefaults.tx;
+                        netImpairProfileStruct  rx = enetImpairDefaults.rx;
+                        uint32_t                envIndex = (uint32_t)(ret - enetEnvs);
+
+                        // Each interface gets its own loss pattern.
+                        tx.seed += envIndex * 2U;
+                        rx.seed += envIndex * 2U;
+                        dfuClientEthernetSetImpairment(ret,
+                                                       enetImpairDefaults.haveTx ? &tx : NULL,
+                                                       enetImpairDefaults.haveRx ? &rx : NULL);
+                    }
+                #endif
                 }
             }
             else
             {
-                dfuClientEthernetUnInit(ret);
+                // Nothing to close; the socket layer cleaned up after itself.
+                dfuClientEthernetFreeEnv(ret);
                 ret = NULL;
             }
         }
@@ -141,8 +186,13 @@ bool dfuClientEthernetUnInit(ifaceEthEnvStruct *env)
 
     if (VALID_ETH_ENV(env))
     {
-        // Do any clean up here
+        // Do any clean up here.
+    #if (ENET_USE_IMPAIRMENT==1)
+        // Frames the impairment is still holding back are dropped.
+        dfuClientEthernetSetImpairment(env, NULL, NULL);
+    #endif
         dfuDestroy(env->dfu);
+        close_raw_socket(&env->socketHandle);
 
         // Free things
         ret = dfuClientEthernetFreeEnv(env);
@@ -172,10 +222,266 @@ bool dfuClientEthernetSetDest(ifaceEthEnvStruct * env, char *dest)
     if ( (VALID_ETH_ENV(env)) && (dest) )
     {
         ret = (ifaceEthernetMACStringToBytes(dest, env->destMAC, sizeof(env->destMAC)) != NULL) ? true : false;
+
+    #if ( (ENET_USE_RX_FILTER==1) && (ENET_RX_FILTER_BY_DEST==1) )
+        //
+        // Only the new destination may talk to us now.  Broadcast
+        // means "anyone".
+        //
+        if (ret)
+        {
+            if (memcmp(env->destMAC, ENET_BROADCAST_MAC, 6) == 0)
+            {
+                dfuClientEthernetSetRxSources(env, NULL, 0);
+            }
+            else
+            {
+                dfuClientEthernetSetRxSources(env, env->destMAC, 1);
+            }
+        }
+    #endif
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientEthernetSetRxSources
+**
+** DESCRIPTION: Rebuilds the kernel RX filter so only the listed
+**              devices (plus the usual length/destination checks) get
+**              through.
+**
+** PARAMETERS: macs: 6 bytes per device, count devices.  NULL/0 lets
+**             every device through.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientEthernetSetRxSources(ifaceEthEnvStruct * env, const uint8_t *macs, uint32_t count)
+{
+    bool                    ret = false;
+
+    if (VALID_ETH_ENV(env))
+    {
+        ret = set_ethernet_rx_filter(&env->socketHandle, macs, count);
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientEthernetFindEnv
+**
+** DESCRIPTION: The Ethernet interface a protocol instance belongs to.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if "dfu" does not belong to an Ethernet interface.
+**
+** COMMENTS:
+**
+*/
+ifaceEthEnvStruct * dfuClientEthernetFindEnv(dfuProtocol *dfu)
+{
+    ifaceEthEnvStruct *     ret = NULL;
+    uint32_t                index;
+
+    for (index = 0; index < MAX_ETHERNET_INTERFACES; index++)
+    {
+        if (
+               (VALID_ETH_ENV((&enetEnvs[index]))) &&
+               (dfu) &&
+               (enetEnvs[index].dfu == dfu)
+           )
+        {
+            ret = &enetEnvs[index];
+            break;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientEthernetGetMaxMTU
+**
+** DESCRIPTION: The largest DFU message the Ethernet interface behind a
+**              protocol instance can carry, from the interface's MTU.
+**
+** PARAMETERS:
+**
+** RETURNS: 0 if "dfu" does not belong to an Ethernet interface.
+**
+** COMMENTS:
+**
+*/
+uint16_t dfuClientEthernetGetMaxMTU(dfuProtocol *dfu)
+{
+    uint16_t                ret = 0;
+    ifaceEthEnvStruct *     env = dfuClientEthernetFindEnv(dfu);
+
+    if (env)
+    {
+        ret = get_ethernet_max_payload(&env->socketHandle);
+        if (ret > MAX_MSG_LEN)
+        {
+            ret = MAX_MSG_LEN;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientEthernetWatchAll
+**
+** DESCRIPTION: Adds the socket of every open Ethernet interface to an
+**              event loop, so the loop wakes when a frame arrives.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of sockets added.
+**
+** COMMENTS: On Windows the pcap handle isn't a descriptor, so nothing
+**           is added and the caller's loop has to poll.
+**
+*/
+uint32_t dfuClientEthernetWatchAll(eventLoopStruct *loop, eventLoopFdCallback callback, void *ctx)
+{
+    uint32_t                ret = 0;
+#if !defined(_WIN32) && !defined(_WIN64)
+    uint32_t                index;
+
+    for (index = 0; index < MAX_ETHERNET_INTERFACES; index++)
+    {
+        if (
+               (VALID_ETH_ENV((&enetEnvs[index]))) &&
+               (eventLoopAddFd(loop, enetEnvs[index].socketHandle.sockfd, callback, ctx))
+           )
+        {
+            ret++;
+        }
+    }
+#else
+    (void)loop;
+    (void)callback;
+    (void)ctx;
+#endif
+
+    return (ret);
+}
+
+#if (ENET_USE_IMPAIRMENT==1)
+/*!
+** FUNCTION: dfuClientEthernetSetImpairment
+**
+** DESCRIPTION: Puts an impairment shim (net_impair) between this
+**              interface's protocol callbacks and its socket.
+**
+** PARAMETERS: tx: What happens to frames we send.  NULL for none.
+**             rx: What happens to frames we receive.  NULL for none.
+**
+** RETURNS: false if a shim couldn't be set up (that direction is then
+**          left unimpaired).
+**
+** COMMENTS: Replaces any shim already there; frames it was holding
+**           back are dropped.
+**
+*/
+bool dfuClientEthernetSetImpairment(ifaceEthEnvStruct * env,
+                                    const netImpairProfileStruct *tx,
+                                    const netImpairProfileStruct *rx)
+{
+    bool                    ret = false;
+
+    if (VALID_ETH_ENV(env))
+    {
+        netImpairDestroy(env->txImpair);
+        netImpairDestroy(env->rxImpair);
+        env->txImpair = NULL;
+        env->rxImpair = NULL;
+
+        // Queued messages carry the other end's MAC in front.
+        if (tx)
+        {
+            env->txImpair = netImpairCreate(tx, (uint16_t)(6U + MAX_MSG_LEN));
+        }
+        if (rx)
+        {
+            env->rxImpair = netImpairCreate(rx, (uint16_t)(6U + MAX_MSG_LEN));
+        }
+
+        ret = ( ((tx == NULL) || (env->txImpair)) &&
+                ((rx == NULL) || (env->rxImpair)) );
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientEthernetSetDefaultImpairment
+**
+** DESCRIPTION: Impairment for every interface opened from now on.
+**
+** PARAMETERS: tx, rx: As dfuClientEthernetSetImpairment().  NULL for
+**                     none.
+**
+** RETURNS:
+**
+** COMMENTS: For tools that don't open the interfaces themselves.  Each
+**           interface's seeds are offset by twice its index, so
+**           interfaces opened in the same order see the same losses
+**           run to run, but not the same as each other.
+**
+*/
+void dfuClientEthernetSetDefaultImpairment(const netImpairProfileStruct *tx, const netImpairProfileStruct *rx)
+{
+    memset(&enetImpairDefaults, 0, sizeof(enetImpairDefaults));
+
+    if (tx)
+    {
+        enetImpairDefaults.tx = *tx;
+        enetImpairDefaults.haveTx = true;
+    }
+    if (rx)
+    {
+        enetImpairDefaults.rx = *rx;
+        enetImpairDefaults.haveRx = true;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: dfuClientEthernetGetImpairStats
+**
+** DESCRIPTION: What the interface's impairment has done so far.
+**
+** PARAMETERS: tx, rx: [OUT] Either may be NULL.  All zero for a
+**                     direction without a shim.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool dfuClientEthernetGetImpairStats(ifaceEthEnvStruct * env, netImpairStatsStruct *tx, netImpairStatsStruct *rx)
+{
+    bool                    ret = false;
+
+    if (VALID_ETH_ENV(env))
+    {
+        netImpairGetStats(env->txImpair, tx);
+        netImpairGetStats(env->rxImpair, rx);
+        ret = true;
     }
 
     return (ret);
 }
+#endif
 
 
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
@@ -200,7 +506,7 @@ bool dfuClientEthernetSetDest(ifaceEthEnvStruct * env, char *dest)
 static ifaceEthEnvStruct * dfuClientEthernetAllocEnv(void)
 {
     ifaceEthEnvStruct *                 ret = NULL;
-    int                                 index;
+    uint32_t                            index;
 
     for (index = 0; index < MAX_ETHERNET_INTERFACES; index++)
     {
@@ -274,6 +580,122 @@ static bool dfuClientEthernetInitEnv(ifaceEthEnvStruct *env)
     return (ret);
 }
 
+/*!
+** FUNCTION: dfuClientEthernetTransmit
+**
+** DESCRIPTION: Sends one frame.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the kernel didn't take it.
+**
+** COMMENTS: Sent straight away rather than left queued: the protocol
+**           has one request outstanding at a time, so nothing would
+**           ever join it in a batch, and a send that failed later
+**           could no longer be reported to the caller.
+**
+*/
+static bool dfuClientEthernetTransmit(ifaceEthEnvStruct * env, uint8_t *dest, uint8_t *payload, uint16_t payloadLen)
+{
+    bool                        ret = false;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (queue_ethernet_message(&env->socketHandle, dest, payload, payloadLen))
+    {
+        ret = (flush_ethernet_messages(&env->socketHandle) > 0) ? true : false;
+    }
+#else
+    // NPCAP sends on queue; there is never anything to flush.
+    ret = queue_ethernet_message(&env->socketHandle, dest, payload, payloadLen);
+#endif
+
+    return (ret);
+}
+
+#if (ENET_USE_IMPAIRMENT==1)
+/*!
+** FUNCTION: dfuClientEthernetImpairTx
+**
+** DESCRIPTION: Sends every frame the TX impairment has finished
+**              holding back.
+**
+** PARAMETERS:
+**
+** RETURNS: The number of frames sent.
+**
+** COMMENTS: Each message is the destination MAC, then the payload.
+**
+*/
+static uint32_t dfuClientEthernetImpairTx(ifaceEthEnvStruct * env)
+{
+    uint32_t                    ret = 0;
+    const uint8_t *             msg;
+    uint16_t                    len = 0;
+
+    while ((msg = netImpairNext(env->txImpair, TIMER_GetMicroseconds(), &len)) != NULL)
+    {
+        if (
+               (len > 6) &&
+               (dfuClientEthernetTransmit(env, (uint8_t *)msg, (uint8_t *)&msg[6], (uint16_t)(len - 6)))
+           )
+        {
+            ret++;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: dfuClientEthernetImpairRx
+**
+** DESCRIPTION: Receive through the RX impairment: hands back a frame
+**              that has been held back long enough, or else reads one
+**              from the socket into the impairment and tries again.
+**
+** PARAMETERS: srcMAC: [OUT] Who sent it.
+**
+** RETURNS: NULL if nothing is ready.  The frame stays valid until the
+**          next call.
+**
+** COMMENTS: Each message is the source MAC, then the payload.
+**
+*/
+static uint8_t *dfuClientEthernetImpairRx(ifaceEthEnvStruct * env, uint8_t *srcMAC, uint16_t *payloadLen, uint8_t **payload)
+{
+    uint8_t *                   ret = NULL;
+    const uint8_t *             msg;
+    uint16_t                    len = 0;
+
+    msg = netImpairNext(env->rxImpair, TIMER_GetMicroseconds(), &len);
+    if (msg == NULL)
+    {
+        uint8_t *               frame = receive_ethernet_message_zc(&env->socketHandle, payloadLen, payload);
+
+        if ( (frame) && (*payloadLen > 0) && (*payloadLen <= MAX_MSG_LEN) )
+        {
+            memcpy(env->impairStage, frame + 6, 6);
+            memcpy(&env->impairStage[6], *payload, *payloadLen);
+            netImpairSubmit(env->rxImpair, env->impairStage, (uint16_t)(6U + *payloadLen), TIMER_GetMicroseconds());
+        }
+        release_ethernet_message(&env->socketHandle);
+
+        msg = netImpairNext(env->rxImpair, TIMER_GetMicroseconds(), &len);
+    }
+
+    *payloadLen = 0;
+    if ( (msg) && (len > 6) )
+    {
+        memcpy(srcMAC, msg, 6);
+        *payloadLen = (uint16_t)(len - 6);
+        *payload = (uint8_t *)&msg[6];
+        ret = (uint8_t *)msg;
+    }
+
+    return (ret);
+}
+#endif
+
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 // $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
 //         CALLBACKS THAT MUST BE PROVIDED TO THE DFU PROTOCOL LIBRARY
@@ -285,7 +707,8 @@ static bool dfuClientEthernetInitEnv(ifaceEthEnvStruct *env)
 ///
 /// @details Fetch the most recent ethernet message from the interface.
 ///          Stash the SRC & DST MAC addresses for use with device
-///          lists, etc.
+///          lists, etc.  The returned pointer refers directly to the
+///          received frame; it is released on the next call.
 ///
 /// @param[in]
 /// @param[in]
@@ -307,35 +730,65 @@ uint8_t *dfuClientEnetRxCallback(dfuProtocol * dfu, uint16_t * rxBuffLen, dfuUse
            (rxBuffLen)
        )
     {
-        uint8_t *   res = NULL;
-        uint16_t    maxRxLen = sizeof(env->msgBuff);
+        uint8_t *   frame = NULL;
+        uint8_t *   payload = NULL;
+        uint16_t    payloadLen = 0;
+        uint8_t     srcMAC[6];
 
         // Initial response length
         *rxBuffLen = 0;
 
+    #if (ENET_USE_IMPAIRMENT==1)
+        // Frames the TX impairment held back that are due now
+        if (env->txImpair)
+        {
+            dfuClientEthernetImpairTx(env);
+        }
+    #endif
+
         //
-        // We send in the max length to receive.  Once the call completes,
-        // "maxRxLen" should contain the length of what we received, including
-        // the Ethernet header (src MAC, dst MAC, length)
+        // The protocol engine is done with whatever we handed it on the
+        // previous call, so give that ring slot back before taking the
+        // next one.
         //
-        res = receive_ethernet_message(&env->socketHandle, env->msgBuff, &maxRxLen, NULL);
-        if ( (res) && (maxRxLen > 0) )
+        release_ethernet_message(&env->socketHandle);
+
+        //
+        // Zero-copy: "frame" points at the received frame (ring slot
+        // on Linux), starting with the Ethernet header (dst MAC, src MAC,
+        // length/EtherType). "payload" is the DFU message after it.
+        // Through the RX impairment it's a copy, held back as long as
+        // the impairment says.
+        //
+    #if (ENET_USE_IMPAIRMENT==1)
+        if (env->rxImpair)
         {
-            uint8_t                     srcMAC[6];
+            frame = dfuClientEthernetImpairRx(env, srcMAC, &payloadLen, &payload);
+        }
+        else
+    #endif
+        {
+            frame = receive_ethernet_message_zc(&env->socketHandle, &payloadLen, &payload);
+            if (frame)
+            {
+                memcpy(srcMAC, frame + 6, 6);
+            }
+        }
 
+        if ( (frame) && (payloadLen > 0) && (payloadLen <= MAX_MSG_LEN) )
+        {
             // Save the length of what we just received to the caller.
-            *rxBuffLen = maxRxLen;
+            *rxBuffLen = payloadLen;
 
             // Save the SRC and DST MAC to the engine
             dfuSetDstPhysicalID(dfu, env->destMAC, 6);
-            memcpy(srcMAC, env->msgBuff + 6, 6);
             dfuSetSrcPhysicalID(dfu, srcMAC, 6);
 
         #if (COMPARE_SRC_MAC==1)
             if (memcmp(env->destMAC, srcMAC, 6) == 0)
         #endif
             {
-                ret = (uint8_t *)&env->msgBuff[14];
+                ret = payload;
             }
         }
     }
@@ -346,7 +799,11 @@ uint8_t *dfuClientEnetRxCallback(dfuProtocol * dfu, uint16_t * rxBuffLen, dfuUse
 ///
 /// @fn: dfuClientEnetTxCallback
 ///
-/// @details Transmits a raw ethernet frame.
+/// @details Transmits a raw ethernet frame.  With batching on, the
+///          frame is only queued; it goes out on the next flush (at
+///          the latest, the next receive).  With a TX impairment, it
+///          goes out once the impairment has held it back long enough
+///          (checked here and on every receive).
 ///
 /// @param[in]
 /// @param[in]
@@ -367,7 +824,7 @@ bool dfuClientEnetTxCallback(dfuProtocol * dfu, uint8_t *txBuff, uint16_t txBuff
            (dfu) &&
            (txBuff) &&
            (txBuffLen > 0) &&
-           (txBuffLen <= MAX_ETHERNET_MSG_LEN)
+           (txBuffLen <= get_ethernet_max_payload(&env->socketHandle))
        )
     {
         uint8_t                 *pDst = env->destMAC; // default
@@ -377,8 +834,25 @@ bool dfuClientEnetTxCallback(dfuProtocol * dfu, uint8_t *txBuff, uint16_t txBuff
             pDst = (uint8_t *)&ENET_BROADCAST_MAC[0];
         }
 
-        send_ethernet_message(&env->socketHandle, env->interfaceName, pDst, txBuff, txBuffLen);
-        ret = true;
+    #if (ENET_USE_IMPAIRMENT==1)
+        if (env->txImpair)
+        {
+            //
+            // The impairment decides when (and whether) it goes out.
+            // A lost frame still counts as sent, as it would on a
+            // real link.
+            //
+            memcpy(env->impairStage, pDst, 6);
+            memcpy(&env->impairStage[6], txBuff, txBuffLen);
+            netImpairSubmit(env->txImpair, env->impairStage, (uint16_t)(6U + txBuffLen), TIMER_GetMicroseconds());
+            dfuClientEthernetImpairTx(env);
+            ret = true;
+        }
+        else
+    #endif
+        {
+            ret = dfuClientEthernetTransmit(env, pDst, txBuff, txBuffLen);
+        }
     }
 
     return (ret);
@@ -103,6 +103,18 @@ void TIMER_Cancel(ASYNC_TIMER_STRUCT *pTimer);
 uint64_t TIMER_GetElapsedMillisecs (ASYNC_TIMER_STRUCT *pTimerInfo1,
                                     ASYNC_TIMER_STRUCT *pTimerInfo2);
 
+/*
+** FUNCTION: TIMER_GetMicroseconds
+**
+** DESCRIPTION: Monotonic time in microseconds, from an arbitrary
+**              origin.  For timers finer than the 1mS ticks above.
+**
+** ARGUMENTS:
+**
+** NOTES:
+*/
+uint64_t TIMER_GetMicroseconds(void);
+
 /*
 ** FUNCTION: SleepMS
 ** DESCRIPTION: Synchronous sleep for the number of mS called for.
@@ -110,6 +122,14 @@ uint64_t TIMER_GetElapsedMillisecs (ASYNC_TIMER_STRUCT *pTimerInfo1,
 */
 void SleepMS(uint64_t Delay);
 
+/*
+** FUNCTION: TIMER_SleepUS
+** DESCRIPTION: Synchronous sleep that gives up the CPU, unlike
+**              SleepMS().  Windows sleeps in whole mS, rounded up.
+**
+*/
+void TIMER_SleepUS(uint64_t Delay);
+
 
 #ifdef __cplusplus
 }
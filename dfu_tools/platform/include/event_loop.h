@@ -0,0 +1,234 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: event_loop.h
+**
+** DESCRIPTION: Single-threaded reactor: waits in the kernel for a
+**              readable descriptor, a key press or a timer, and runs the
+**              callbacks registered for it.
+**
+** This header is platform-independent.  Timers live on a timer wheel
+** owned by the loop, whose next deadline sets how long the loop sleeps.
+** On Linux the loop waits in epoll.  Elsewhere descriptors aren't
+** supported; key presses and idle hooks are checked every
+** EVENT_LOOP_FALLBACK_SLEEP_MS, sleeping in between.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+#include "timer_wheel.h"
+
+/*
+** Opaque loop.
+**
+*/
+typedef struct eventLoopStruct eventLoopStruct;
+
+/*
+** Callbacks.
+**
+**   eventLoopFdCallback:    "fd" is readable.  The loop is level
+**                           triggered: if the callback leaves data
+**                           unread it is called again next time round.
+**   eventLoopTimerCallback: The timer expired.
+**   eventLoopKeyCallback:   A key is waiting on the console.  The key is
+**                           NOT consumed.
+**   eventLoopIdleCallback:  Called after every wake-up and at least every
+**                           EVENT_LOOP_IDLE_PERIOD_MS.  This is where a
+**                           library's drive/idle function goes.
+**
+*/
+typedef void (*eventLoopFdCallback)(eventLoopStruct *loop, int fd, void *ctx);
+typedef void (*eventLoopTimerCallback)(eventLoopStruct *loop, int timerId, void *ctx);
+typedef void (*eventLoopKeyCallback)(eventLoopStruct *loop, void *ctx);
+typedef void (*eventLoopIdleCallback)(eventLoopStruct *loop, void *ctx);
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: eventLoopCreate
+**
+** DESCRIPTION: Makes a new, empty loop.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL on failure.
+**
+** COMMENTS:
+**
+*/
+eventLoopStruct *eventLoopCreate(void);
+
+/*!
+** FUNCTION: eventLoopDestroy
+**
+** DESCRIPTION: Cancels every timer and frees the loop.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Descriptors added with eventLoopAddFd() are not closed.
+**
+*/
+void eventLoopDestroy(eventLoopStruct *loop);
+
+/*!
+** FUNCTION: eventLoopAddFd
+**
+** DESCRIPTION: Calls "callback" whenever "fd" is readable.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the loop is full, or descriptors aren't supported
+**          on this platform.
+**
+** COMMENTS:
+**
+*/
+bool eventLoopAddFd(eventLoopStruct *loop, int fd, eventLoopFdCallback callback, void *ctx);
+
+/*!
+** FUNCTION: eventLoopRemoveFd
+**
+** DESCRIPTION: Stops watching a descriptor.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void eventLoopRemoveFd(eventLoopStruct *loop, int fd);
+
+/*!
+** FUNCTION: eventLoopAddTimer
+**
+** DESCRIPTION: Calls "callback" after delayMS, then every periodMS.
+**
+** PARAMETERS: periodMS: 0 for a one-shot timer.
+**
+** RETURNS: The timer id, or -1 if the loop is full.
+**
+** COMMENTS: A one-shot timer is removed once it has fired.  O(1): the
+**           timer goes on the loop's wheel, which sets how long the
+**           loop sleeps.
+**
+*/
+int eventLoopAddTimer(eventLoopStruct *loop,
+                      uint32_t delayMS,
+                      uint32_t periodMS,
+                      eventLoopTimerCallback callback,
+                      void *ctx);
+
+/*!
+** FUNCTION: eventLoopCancelTimer
+**
+** DESCRIPTION: Removes a timer before it fires.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void eventLoopCancelTimer(eventLoopStruct *loop, int timerId);
+
+/*!
+** FUNCTION: eventLoopWatchKeyboard
+**
+** DESCRIPTION: Calls "callback" when a key is waiting on the console.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the loop is full.
+**
+** COMMENTS: On Linux this watches stdin, so a terminal in canonical
+**           mode only reports a key after Enter.  If stdin is a plain
+**           file (epoll refuses those) there is nothing to watch.
+**
+*/
+bool eventLoopWatchKeyboard(eventLoopStruct *loop, eventLoopKeyCallback callback, void *ctx);
+
+/*!
+** FUNCTION: eventLoopAddIdle
+**
+** DESCRIPTION: Adds a hook that runs after every wake-up.
+**
+** PARAMETERS:
+**
+** RETURNS: false if EVENT_LOOP_MAX_IDLE hooks are already there.
+**
+** COMMENTS:
+**
+*/
+bool eventLoopAddIdle(eventLoopStruct *loop, eventLoopIdleCallback callback, void *ctx);
+
+/*!
+** FUNCTION: eventLoopGetTimerWheel
+**
+** DESCRIPTION: The wheel the loop's timers run on, for callers that
+**              keep their own timerWheelEntryStructs.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if "loop" is.
+**
+** COMMENTS: Entries armed on it fire from inside eventLoopRun(), on the
+**           loop's thread, and set how long the loop sleeps.  The loop
+**           sleeps in whole milliseconds, rounded up, so they fire up
+**           to 1mS late but never early.
+**
+*/
+timerWheelStruct *eventLoopGetTimerWheel(eventLoopStruct *loop);
+
+/*!
+** FUNCTION: eventLoopStop
+**
+** DESCRIPTION: Makes eventLoopRun() return once the current callback is
+**              done.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: For use from inside a callback.
+**
+*/
+void eventLoopStop(eventLoopStruct *loop);
+
+/*!
+** FUNCTION: eventLoopRun
+**
+** DESCRIPTION: Dispatches events until eventLoopStop() or the timeout.
+**
+** PARAMETERS: timeoutMS: 0 to run until stopped.
+**
+** RETURNS: true if stopped, false if the timeout ran out.
+**
+** COMMENTS: With idle hooks registered the wait is capped at
+**           EVENT_LOOP_IDLE_PERIOD_MS so they keep running.  Timers
+**           cap it at the wheel's next deadline.
+**
+*/
+bool eventLoopRun(eventLoopStruct *loop, uint32_t timeoutMS);
+
+#ifdef __cplusplus
+}
+#endif
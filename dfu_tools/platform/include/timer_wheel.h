@@ -0,0 +1,202 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: timer_wheel.h
+**
+** DESCRIPTION: Hierarchical timer wheel for large numbers of concurrent
+**              timeouts (per-session, per-chunk retransmit, ...).
+**
+** Arming and cancelling are O(1) and nothing is allocated: each timer is
+** a timerWheelEntryStruct owned by the caller, linked into a slot of the
+** wheel while armed.  Time is TIMER_GetMicroseconds(), resolved to
+** TIMER_WHEEL_TICK_US.  A wheel is not locked, so only one thread (the
+** one running its event loop) may use it.
+**
+** REVISION HISTORY:
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dfu_client_config.h"
+
+#define TIMER_WHEEL_SLOTS               (1U << TIMER_WHEEL_SLOT_BITS)
+
+/*
+** "No timer armed" from timerWheelNextDeadline().
+**
+*/
+#define TIMER_WHEEL_NEVER               (UINT64_MAX)
+
+typedef struct timerWheelStruct timerWheelStruct;
+typedef struct timerWheelEntryStruct timerWheelEntryStruct;
+
+/*
+** Expiry callback.  The entry is already disarmed, so the callback may
+** re-arm it (or arm/cancel any other entry).
+**
+*/
+typedef void (*timerWheelCallback)(timerWheelStruct *wheel, timerWheelEntryStruct *entry, void *ctx);
+
+/*
+** List links, shared by entries and slot heads.
+**
+*/
+typedef struct timerWheelLinkStruct
+{
+    struct timerWheelLinkStruct *   next;
+    struct timerWheelLinkStruct *   prev;
+}timerWheelLinkStruct;
+
+/*
+** One timer.  "link" must stay first.  Set up with timerWheelEntryInit()
+** and don't touch the rest.
+**
+*/
+struct timerWheelEntryStruct
+{
+    timerWheelLinkStruct        link;
+    uint64_t                    expiresTick;
+    uint64_t                    expiresUS;
+    timerWheelCallback          callback;
+    void *                      ctx;
+    uint8_t                     level;
+    uint8_t                     slot;
+    bool                        armed;
+};
+
+/*
+** The wheel.  Usually static or embedded; it is large
+** (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS list heads).
+**
+*/
+struct timerWheelStruct
+{
+    uint64_t                    originUS;
+    uint64_t                    currentTick;
+    uint32_t                    armedCount;
+    uint64_t                    occupied[TIMER_WHEEL_LEVELS];
+    timerWheelLinkStruct        slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** FUNCTION: timerWheelInit
+**
+** DESCRIPTION: Empties a wheel and starts it at "nowUS".
+**
+** PARAMETERS: nowUS: Usually TIMER_GetMicroseconds().
+**
+** RETURNS:
+**
+** COMMENTS: Any entries still armed are simply forgotten.
+**
+*/
+void timerWheelInit(timerWheelStruct *wheel, uint64_t nowUS);
+
+/*!
+** FUNCTION: timerWheelEntryInit
+**
+** DESCRIPTION: Prepares an entry (disarmed) with its callback.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void timerWheelEntryInit(timerWheelEntryStruct *entry, timerWheelCallback callback, void *ctx);
+
+/*!
+** FUNCTION: timerWheelArm
+**
+** DESCRIPTION: Arms (or re-arms) an entry to expire "delayUS" after
+**              "nowUS".
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: O(1).  The expiry is rounded up to the next tick, so an
+**           entry never fires early.
+**
+*/
+void timerWheelArm(timerWheelStruct *wheel, timerWheelEntryStruct *entry, uint64_t nowUS, uint64_t delayUS);
+
+/*!
+** FUNCTION: timerWheelCancel
+**
+** DESCRIPTION: Disarms an entry.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it was armed.
+**
+** COMMENTS: O(1).
+**
+*/
+bool timerWheelCancel(timerWheelStruct *wheel, timerWheelEntryStruct *entry);
+
+/*!
+** FUNCTION: timerWheelIsArmed
+**
+** DESCRIPTION: Whether an entry is waiting to fire.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool timerWheelIsArmed(const timerWheelEntryStruct *entry);
+
+/*!
+** FUNCTION: timerWheelAdvance
+**
+** DESCRIPTION: Turns the wheel up to "nowUS", calling back every entry
+**              that has expired, earliest first.
+**
+** PARAMETERS:
+**
+** RETURNS: How many entries fired.
+**
+** COMMENTS: Work is per elapsed tick plus per expired entry; an empty
+**           wheel jumps straight to "nowUS".
+**
+*/
+uint32_t timerWheelAdvance(timerWheelStruct *wheel, uint64_t nowUS);
+
+/*!
+** FUNCTION: timerWheelNextDeadline
+**
+** DESCRIPTION: How long a caller can sleep before it needs to call
+**              timerWheelAdvance().
+**
+** PARAMETERS:
+**
+** RETURNS: Microseconds from "nowUS" (0 if something is already due),
+**          or TIMER_WHEEL_NEVER if nothing is armed.
+**
+** COMMENTS: Exact for timers in the bottom level.  For timers further
+**           out it is when they next move down a level, so it may be
+**           early but never late.
+**
+*/
+uint64_t timerWheelNextDeadline(const timerWheelStruct *wheel, uint64_t nowUS);
+
+#ifdef __cplusplus
+}
+#endif
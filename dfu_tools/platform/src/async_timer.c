@@ -257,6 +257,46 @@ uint64_t TIMER_GetElapsedMillisecs (ASYNC_TIMER_STRUCT *pTimerInfo1,
     return (0);
 }
 
+/*!
+** FUNCTION: TIMER_GetMicroseconds
+**
+** DESCRIPTION: Monotonic time in microseconds, from an arbitrary
+**              origin.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+uint64_t TIMER_GetMicroseconds(void)
+{
+    uint64_t                    ret;
+
+#if defined(_WIN32) || defined(_WIN64)
+    static LARGE_INTEGER        frequency;
+    LARGE_INTEGER               counter;
+
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+
+    // Split to avoid overflowing counter * 1000000
+    ret = ((uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000ULL) +
+          (((uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000ULL) / (uint64_t)frequency.QuadPart);
+#else
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ret = ((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000ULL);
+#endif
+
+    return (ret);
+}
+
 /*!
 ** FUNCTION: SleepMS
 **
@@ -283,6 +323,37 @@ void SleepMS(uint64_t Delay)
     return;
 }
 
+/*!
+** FUNCTION: TIMER_SleepUS
+**
+** DESCRIPTION: Synchronous sleep for the number of uS called for,
+**              giving up the CPU meanwhile.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Windows sleeps in whole milliseconds, rounded up.
+**
+*/
+void TIMER_SleepUS(uint64_t Delay)
+{
+    if (Delay > 0)
+    {
+#if defined(_WIN32) || defined(_WIN64)
+        Sleep((DWORD)((Delay + 999U) / 1000U));
+#else
+        struct timespec             ts;
+
+        ts.tv_sec = (time_t)(Delay / 1000000U);
+        ts.tv_nsec = (long)(Delay % 1000000U) * 1000L;
+        nanosleep(&ts, NULL);
+#endif
+    }
+
+    return;
+}
+
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 //                 INTERNAL SUPPORT FUNCTION IMPLEMENTATIONS
@@ -0,0 +1,757 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: event_loop.c
+**
+** DESCRIPTION: Single-threaded reactor: waits in the kernel for a
+**              readable descriptor, a key press or a timer, and runs the
+**              callbacks registered for it.
+**
+**  REVISION HISTORY:
+**
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event_loop.h"
+#include "async_timer.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <windows.h>
+    #include <conio.h>
+#else
+    #include <errno.h>
+    #include <unistd.h>
+    #include <sys/epoll.h>
+#endif
+
+/*
+** What a slot in the loop is watching.
+**
+*/
+typedef enum
+{
+    EVENT_SOURCE_FREE = 0,
+    EVENT_SOURCE_FD,
+    EVENT_SOURCE_TIMER,
+    EVENT_SOURCE_KEY
+}eventSourceKindEnum;
+
+/*
+** One watched descriptor, timer or keyboard.  A timer is an entry on the
+** loop's wheel; "timer" stays first so the wheel's callback can get back
+** to the slot.
+**
+*/
+typedef struct
+{
+    timerWheelEntryStruct       timer;
+    eventSourceKindEnum         kind;
+    int                         fd;
+    uint32_t                    periodMS;
+    eventLoopFdCallback         fdCallback;
+    eventLoopTimerCallback      timerCallback;
+    eventLoopKeyCallback        keyCallback;
+    void *                      ctx;
+}eventSourceStruct;
+
+/*
+** One idle hook.
+**
+*/
+typedef struct
+{
+    eventLoopIdleCallback       callback;
+    void *                      ctx;
+}eventIdleStruct;
+
+struct eventLoopStruct
+{
+    int                         epfd;
+    eventSourceStruct           sources[EVENT_LOOP_MAX_SOURCES];
+    eventIdleStruct             idle[EVENT_LOOP_MAX_IDLE];
+    uint32_t                    idleCount;
+    timerWheelStruct            wheel;
+    bool                        stopping;
+};
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static int _eventLoopTakeSource(eventLoopStruct *loop, eventSourceKindEnum kind, int fd);
+static void _eventLoopReleaseSource(eventLoopStruct *loop, int index);
+static void _eventLoopDispatch(eventLoopStruct *loop, int index);
+static void _eventLoopTimerExpired(timerWheelStruct *wheel, timerWheelEntryStruct *entry, void *ctx);
+static int _eventLoopWheelWait(eventLoopStruct *loop, int waitMS);
+static void _eventLoopRunIdle(eventLoopStruct *loop);
+
+
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+//                    EXPORTED API FUNCTION IMPLEMENTATIONS
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+
+/*!
+** FUNCTION: eventLoopCreate
+**
+** DESCRIPTION: Makes a new, empty loop.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL on failure.
+**
+** COMMENTS:
+**
+*/
+eventLoopStruct *eventLoopCreate(void)
+{
+    eventLoopStruct *           ret = (eventLoopStruct *)calloc(1, sizeof(eventLoopStruct));
+
+    if (ret)
+    {
+        ret->epfd = -1;
+        timerWheelInit(&ret->wheel, TIMER_GetMicroseconds());
+
+#if !defined(_WIN32) && !defined(_WIN64)
+        ret->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (ret->epfd < 0)
+        {
+            free(ret);
+            ret = NULL;
+        }
+#endif
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: eventLoopDestroy
+**
+** DESCRIPTION: Cancels every timer and frees the loop.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: Descriptors added with eventLoopAddFd() are not closed.
+**
+*/
+void eventLoopDestroy(eventLoopStruct *loop)
+{
+    int                         index;
+
+    if (loop)
+    {
+        for (index = 0; index < (int)EVENT_LOOP_MAX_SOURCES; index++)
+        {
+            _eventLoopReleaseSource(loop, index);
+        }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+        close(loop->epfd);
+#endif
+        free(loop);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: eventLoopAddFd
+**
+** DESCRIPTION: Calls "callback" whenever "fd" is readable.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the loop is full, or descriptors aren't supported
+**          on this platform.
+**
+** COMMENTS:
+**
+*/
+bool eventLoopAddFd(eventLoopStruct *loop, int fd, eventLoopFdCallback callback, void *ctx)
+{
+    bool                        ret = false;
+    int                         index;
+
+    if ( (loop) && (fd >= 0) && (callback) )
+    {
+        index = _eventLoopTakeSource(loop, EVENT_SOURCE_FD, fd);
+        if (index >= 0)
+        {
+            loop->sources[index].fdCallback = callback;
+            loop->sources[index].ctx = ctx;
+            ret = true;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: eventLoopRemoveFd
+**
+** DESCRIPTION: Stops watching a descriptor.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void eventLoopRemoveFd(eventLoopStruct *loop, int fd)
+{
+    int                         index;
+
+    if (loop)
+    {
+        for (index = 0; index < (int)EVENT_LOOP_MAX_SOURCES; index++)
+        {
+            if (
+                   (loop->sources[index].kind == EVENT_SOURCE_FD) &&
+                   (loop->sources[index].fd == fd)
+               )
+            {
+                _eventLoopReleaseSource(loop, index);
+            }
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: eventLoopAddTimer
+**
+** DESCRIPTION: Calls "callback" after delayMS, then every periodMS.
+**
+** PARAMETERS: periodMS: 0 for a one-shot timer.
+**
+** RETURNS: The timer id, or -1 if the loop is full.
+**
+** COMMENTS: A one-shot timer is removed once it has fired.  O(1): the
+**           timer goes on the loop's wheel, which sets how long the
+**           loop sleeps.
+**
+*/
+int eventLoopAddTimer(eventLoopStruct *loop,
+                      uint32_t delayMS,
+                      uint32_t periodMS,
+                      eventLoopTimerCallback callback,
+                      void *ctx)
+{
+    int                         ret = -1;
+
+    if ( (loop) && (callback) )
+    {
+        ret = _eventLoopTakeSource(loop, EVENT_SOURCE_TIMER, -1);
+
+        if (ret >= 0)
+        {
+            eventSourceStruct *     source = &loop->sources[ret];
+
+            source->periodMS = periodMS;
+            source->timerCallback = callback;
+            source->ctx = ctx;
+            timerWheelEntryInit(&source->timer, _eventLoopTimerExpired, loop);
+            timerWheelArm(&loop->wheel, &source->timer, TIMER_GetMicroseconds(), (uint64_t)delayMS * 1000U);
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: eventLoopCancelTimer
+**
+** DESCRIPTION: Removes a timer before it fires.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void eventLoopCancelTimer(eventLoopStruct *loop, int timerId)
+{
+    if (
+           (loop) &&
+           (timerId >= 0) &&
+           (timerId < (int)EVENT_LOOP_MAX_SOURCES) &&
+           (loop->sources[timerId].kind == EVENT_SOURCE_TIMER)
+       )
+    {
+        _eventLoopReleaseSource(loop, timerId);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: eventLoopWatchKeyboard
+**
+** DESCRIPTION: Calls "callback" when a key is waiting on the console.
+**
+** PARAMETERS:
+**
+** RETURNS: false if the loop is full.
+**
+** COMMENTS: On Linux this watches stdin, so a terminal in canonical
+**           mode only reports a key after Enter.  If stdin is a plain
+**           file (epoll refuses those) there is nothing to watch.
+**
+*/
+bool eventLoopWatchKeyboard(eventLoopStruct *loop, eventLoopKeyCallback callback, void *ctx)
+{
+    bool                        ret = false;
+    int                         index = -1;
+
+    if ( (loop) && (callback) )
+    {
+#if !defined(_WIN32) && !defined(_WIN64)
+        index = _eventLoopTakeSource(loop, EVENT_SOURCE_KEY, STDIN_FILENO);
+#else
+        index = _eventLoopTakeSource(loop, EVENT_SOURCE_KEY, -1);
+#endif
+        if (index >= 0)
+        {
+            loop->sources[index].keyCallback = callback;
+            loop->sources[index].ctx = ctx;
+            ret = true;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: eventLoopAddIdle
+**
+** DESCRIPTION: Adds a hook that runs after every wake-up.
+**
+** PARAMETERS:
+**
+** RETURNS: false if EVENT_LOOP_MAX_IDLE hooks are already there.
+**
+** COMMENTS:
+**
+*/
+bool eventLoopAddIdle(eventLoopStruct *loop, eventLoopIdleCallback callback, void *ctx)
+{
+    bool                        ret = false;
+
+    if (
+           (loop) &&
+           (callback) &&
+           (loop->idleCount < EVENT_LOOP_MAX_IDLE)
+       )
+    {
+        loop->idle[loop->idleCount].callback = callback;
+        loop->idle[loop->idleCount].ctx = ctx;
+        loop->idleCount++;
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: eventLoopGetTimerWheel
+**
+** DESCRIPTION: The wheel the loop's timers run on, for callers that
+**              keep their own timerWheelEntryStructs.
+**
+** PARAMETERS:
+**
+** RETURNS: NULL if "loop" is.
+**
+** COMMENTS: Entries armed on it fire from inside eventLoopRun(), on the
+**           loop's thread, and set how long the loop sleeps.  The loop
+**           sleeps in whole milliseconds, rounded up, so they fire up
+**           to 1mS late but never early.
+**
+*/
+timerWheelStruct *eventLoopGetTimerWheel(eventLoopStruct *loop)
+{
+    return ( (loop) ? &loop->wheel : NULL );
+}
+
+/*!
+** FUNCTION: eventLoopStop
+**
+** DESCRIPTION: Makes eventLoopRun() return once the current callback is
+**              done.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: For use from inside a callback.
+**
+*/
+void eventLoopStop(eventLoopStruct *loop)
+{
+    if (loop)
+    {
+        loop->stopping = true;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: eventLoopRun
+**
+** DESCRIPTION: Dispatches events until eventLoopStop() or the timeout.
+**
+** PARAMETERS: timeoutMS: 0 to run until stopped.
+**
+** RETURNS: true if stopped, false if the timeout ran out.
+**
+** COMMENTS: With idle hooks registered the wait is capped at
+**           EVENT_LOOP_IDLE_PERIOD_MS so they keep running.  Timers
+**           cap it at the wheel's next deadline.
+**
+*/
+bool eventLoopRun(eventLoopStruct *loop, uint32_t timeoutMS)
+{
+    bool                        ret = false;
+    ASYNC_TIMER_STRUCT          runTimer;
+    uint64_t                    elapsedMS;
+    int                         index;
+
+    if (loop)
+    {
+        loop->stopping = false;
+        TIMER_Start(&runTimer);
+
+        while (!loop->stopping)
+        {
+            int                 waitMS = -1;
+
+            if (timeoutMS > 0)
+            {
+                elapsedMS = TIMER_GetElapsedMillisecs(&runTimer, NULL);
+                if (elapsedMS >= timeoutMS)
+                {
+                    break;
+                }
+                waitMS = (int)(timeoutMS - elapsedMS);
+            }
+
+            if (
+                   (loop->idleCount > 0) &&
+                   ( (waitMS < 0) || (waitMS > (int)EVENT_LOOP_IDLE_PERIOD_MS) )
+               )
+            {
+                waitMS = (int)EVENT_LOOP_IDLE_PERIOD_MS;
+            }
+
+            waitMS = _eventLoopWheelWait(loop, waitMS);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+            {
+                struct epoll_event  events[EVENT_LOOP_MAX_SOURCES];
+                int                 count = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_SOURCES, waitMS);
+
+                if ( (count < 0) && (errno != EINTR) )
+                {
+                    break;
+                }
+
+                for (index = 0; (index < count) && (!loop->stopping); index++)
+                {
+                    _eventLoopDispatch(loop, (int)events[index].data.u32);
+                }
+            }
+#else
+            for (index = 0; (index < (int)EVENT_LOOP_MAX_SOURCES) && (!loop->stopping); index++)
+            {
+                if ( (loop->sources[index].kind == EVENT_SOURCE_KEY) && (_kbhit()) )
+                {
+                    _eventLoopDispatch(loop, index);
+                }
+            }
+
+            if (!loop->stopping)
+            {
+                if ( (waitMS < 0) || (waitMS > (int)EVENT_LOOP_FALLBACK_SLEEP_MS) )
+                {
+                    waitMS = (int)EVENT_LOOP_FALLBACK_SLEEP_MS;
+                }
+                Sleep((DWORD)waitMS);
+            }
+#endif
+
+            if (!loop->stopping)
+            {
+                timerWheelAdvance(&loop->wheel, TIMER_GetMicroseconds());
+            }
+
+            if (!loop->stopping)
+            {
+                _eventLoopRunIdle(loop);
+            }
+        }
+
+        ret = loop->stopping;
+    }
+
+    return (ret);
+}
+
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+//                 INTERNAL SUPPORT FUNCTION IMPLEMENTATIONS
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+
+/*!
+** FUNCTION: _eventLoopTakeSource
+**
+** DESCRIPTION: Claims a free slot and (on Linux) adds its descriptor
+**              to the epoll set.
+**
+** PARAMETERS: fd: -1 for a timer, which has none.
+**
+** RETURNS: The slot index, or -1.
+**
+** COMMENTS:
+**
+*/
+static int _eventLoopTakeSource(eventLoopStruct *loop, eventSourceKindEnum kind, int fd)
+{
+    int                         ret = -1;
+    int                         index;
+
+    for (index = 0; index < (int)EVENT_LOOP_MAX_SOURCES; index++)
+    {
+        if (loop->sources[index].kind == EVENT_SOURCE_FREE)
+        {
+            memset(&loop->sources[index], 0, sizeof(eventSourceStruct));
+            loop->sources[index].fd = fd;
+            ret = index;
+            break;
+        }
+    }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    if ( (ret >= 0) && (kind != EVENT_SOURCE_TIMER) )
+    {
+        struct epoll_event      event;
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = (uint32_t)ret;
+
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            ret = -1;
+        }
+    }
+#else
+    if ( (ret >= 0) && (kind == EVENT_SOURCE_FD) )
+    {
+        // No descriptor support here
+        ret = -1;
+    }
+#endif
+
+    if (ret >= 0)
+    {
+        loop->sources[ret].kind = kind;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _eventLoopReleaseSource
+**
+** DESCRIPTION: Frees a slot.  A timer comes off the wheel; a
+**              descriptor is only taken out of the epoll set, as it
+**              belongs to the caller.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _eventLoopReleaseSource(eventLoopStruct *loop, int index)
+{
+    eventSourceStruct *         source = &loop->sources[index];
+
+    if (source->kind == EVENT_SOURCE_TIMER)
+    {
+        timerWheelCancel(&loop->wheel, &source->timer);
+    }
+#if !defined(_WIN32) && !defined(_WIN64)
+    else
+    if (source->kind != EVENT_SOURCE_FREE)
+    {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, source->fd, NULL);
+    }
+#endif
+
+    if (source->kind != EVENT_SOURCE_FREE)
+    {
+        source->kind = EVENT_SOURCE_FREE;
+        source->fd = -1;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _eventLoopDispatch
+**
+** DESCRIPTION: Runs the callback for a slot that is ready.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: A one-shot timer is released before its callback runs, so
+**           the callback is free to add another timer.  A periodic one
+**           is re-armed from now, so a late wake-up delays the next
+**           expiry rather than firing a burst to catch up.
+**
+*/
+static void _eventLoopDispatch(eventLoopStruct *loop, int index)
+{
+    eventSourceStruct *         source = &loop->sources[index];
+    void *                      ctx = source->ctx;
+
+    switch (source->kind)
+    {
+        case EVENT_SOURCE_FD:
+            source->fdCallback(loop, source->fd, ctx);
+            break;
+
+        case EVENT_SOURCE_KEY:
+            source->keyCallback(loop, ctx);
+            break;
+
+        case EVENT_SOURCE_TIMER:
+        {
+            eventLoopTimerCallback  callback = source->timerCallback;
+
+            if (source->periodMS == 0)
+            {
+                _eventLoopReleaseSource(loop, index);
+            }
+            else
+            {
+                timerWheelArm(&loop->wheel, &source->timer, TIMER_GetMicroseconds(), (uint64_t)source->periodMS * 1000U);
+            }
+
+            callback(loop, index, ctx);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _eventLoopTimerExpired
+**
+** DESCRIPTION: Wheel callback for the loop's own timers.
+**
+** PARAMETERS: ctx: The loop.
+**
+** RETURNS:
+**
+** COMMENTS: Once eventLoopStop() has been called the rest of the
+**           timers due in this turn are put back as due, so they fire
+**           on the next eventLoopRun() instead of being lost.
+**
+*/
+static void _eventLoopTimerExpired(timerWheelStruct *wheel, timerWheelEntryStruct *entry, void *ctx)
+{
+    eventLoopStruct *           loop = (eventLoopStruct *)ctx;
+    eventSourceStruct *         source = (eventSourceStruct *)entry;
+
+    if (loop->stopping)
+    {
+        timerWheelArm(wheel, entry, TIMER_GetMicroseconds(), 0);
+    }
+    else
+    {
+        _eventLoopDispatch(loop, (int)(source - loop->sources));
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _eventLoopWheelWait
+**
+** DESCRIPTION: Caps a wait at the wheel's next deadline.
+**
+** PARAMETERS: waitMS: -1 for no limit.
+**
+** RETURNS: The wait in mS, or -1.
+**
+** COMMENTS: Rounded up to whole milliseconds, so timers fire late
+**           rather than early.
+**
+*/
+static int _eventLoopWheelWait(eventLoopStruct *loop, int waitMS)
+{
+    int                         ret = waitMS;
+    uint64_t                    wheelUS = timerWheelNextDeadline(&loop->wheel, TIMER_GetMicroseconds());
+
+    if (wheelUS != TIMER_WHEEL_NEVER)
+    {
+        uint64_t                wheelMS = (wheelUS + 999U) / 1000U;
+
+        if ( (ret < 0) || (wheelMS < (uint64_t)ret) )
+        {
+            ret = (int)wheelMS;
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: _eventLoopRunIdle
+**
+** DESCRIPTION: Runs every idle hook.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _eventLoopRunIdle(eventLoopStruct *loop)
+{
+    uint32_t                    index;
+
+    for (index = 0; (index < loop->idleCount) && (!loop->stopping); index++)
+    {
+        loop->idle[index].callback(loop, loop->idle[index].ctx);
+    }
+
+    return;
+}
@@ -0,0 +1,547 @@
+//#############################################################################
+//#############################################################################
+//#############################################################################
+/*! \file
+**
+** MODULE: timer_wheel.c
+**
+** DESCRIPTION: Hierarchical timer wheel.
+**
+** Level 0 has one slot per tick.  Each level above has slots
+** TIMER_WHEEL_SLOTS times wider.  An entry is filed in the lowest level
+** whose span covers its remaining time; when a level-0 lap completes,
+** the next slot of the level above is "cascaded" (its entries re-filed
+** one level lower).  Each level keeps a bitmap of non-empty slots so the
+** next deadline is found without walking the slots.
+**
+**  REVISION HISTORY:
+**
+**
+*/
+//#############################################################################
+//#############################################################################
+//#############################################################################
+#include <stddef.h>
+#include <string.h>
+#include "timer_wheel.h"
+
+#if (TIMER_WHEEL_SLOT_BITS > 6)
+    #error "TIMER_WHEEL_SLOT_BITS must fit the 64-bit occupancy bitmap"
+#endif
+
+#define TIMER_WHEEL_SLOT_MASK       ((uint64_t)TIMER_WHEEL_SLOTS - 1U)
+#define TIMER_WHEEL_BITMAP_MASK     ((TIMER_WHEEL_SLOTS == 64U) ? UINT64_MAX : (((uint64_t)1U << TIMER_WHEEL_SLOTS) - 1U))
+
+/*
+** Ticks covered by one slot of "level", and by the whole wheel.
+**
+*/
+#define TIMER_WHEEL_LEVEL_SHIFT(level)  ((uint32_t)(level) * TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SPAN                ((uint64_t)1U << TIMER_WHEEL_LEVEL_SHIFT(TIMER_WHEEL_LEVELS))
+
+
+/*
+** Internal support prototypes.
+**
+*/
+static void _timerWheelInsert(timerWheelStruct *wheel, timerWheelEntryStruct *entry);
+static void _timerWheelUnlink(timerWheelStruct *wheel, timerWheelEntryStruct *entry);
+static void _timerWheelDetachSlot(timerWheelStruct *wheel, uint32_t level, uint32_t slot, timerWheelLinkStruct *list);
+static void _timerWheelCascade(timerWheelStruct *wheel, uint32_t level, uint32_t slot);
+static uint32_t _timerWheelLowestBit(uint64_t bits);
+
+
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+//                    EXPORTED API FUNCTION IMPLEMENTATIONS
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+
+/*!
+** FUNCTION: timerWheelInit
+**
+** DESCRIPTION: Empties a wheel and starts it at "nowUS".
+**
+** PARAMETERS: nowUS: Usually TIMER_GetMicroseconds().
+**
+** RETURNS:
+**
+** COMMENTS: Any entries still armed are simply forgotten.
+**
+*/
+void timerWheelInit(timerWheelStruct *wheel, uint64_t nowUS)
+{
+    uint32_t                    level;
+    uint32_t                    slot;
+
+    if (wheel)
+    {
+        memset(wheel, 0, sizeof(timerWheelStruct));
+        wheel->originUS = nowUS;
+
+        for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+            {
+                wheel->slots[level][slot].next = &wheel->slots[level][slot];
+                wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+            }
+        }
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: timerWheelEntryInit
+**
+** DESCRIPTION: Prepares an entry (disarmed) with its callback.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+void timerWheelEntryInit(timerWheelEntryStruct *entry, timerWheelCallback callback, void *ctx)
+{
+    if (entry)
+    {
+        memset(entry, 0, sizeof(timerWheelEntryStruct));
+        entry->callback = callback;
+        entry->ctx = ctx;
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: timerWheelArm
+**
+** DESCRIPTION: Arms (or re-arms) an entry to expire "delayUS" after
+**              "nowUS".
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: O(1).  The expiry is rounded up to the next tick, so an
+**           entry never fires early.
+**
+*/
+void timerWheelArm(timerWheelStruct *wheel, timerWheelEntryStruct *entry, uint64_t nowUS, uint64_t delayUS)
+{
+    if ( (wheel) && (entry) && (entry->callback) )
+    {
+        uint64_t                sinceOriginUS;
+
+        if (entry->armed)
+        {
+            _timerWheelUnlink(wheel, entry);
+        }
+        else
+        {
+            wheel->armedCount++;
+        }
+
+        entry->expiresUS = nowUS + delayUS;
+        sinceOriginUS = (entry->expiresUS > wheel->originUS) ? (entry->expiresUS - wheel->originUS) : 0;
+        entry->expiresTick = (sinceOriginUS + TIMER_WHEEL_TICK_US - 1U) / TIMER_WHEEL_TICK_US;
+        entry->armed = true;
+
+        _timerWheelInsert(wheel, entry);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: timerWheelCancel
+**
+** DESCRIPTION: Disarms an entry.
+**
+** PARAMETERS:
+**
+** RETURNS: true if it was armed.
+**
+** COMMENTS: O(1).
+**
+*/
+bool timerWheelCancel(timerWheelStruct *wheel, timerWheelEntryStruct *entry)
+{
+    bool                        ret = false;
+
+    if ( (wheel) && (entry) && (entry->armed) )
+    {
+        _timerWheelUnlink(wheel, entry);
+        entry->armed = false;
+        wheel->armedCount--;
+        ret = true;
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: timerWheelIsArmed
+**
+** DESCRIPTION: Whether an entry is waiting to fire.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+bool timerWheelIsArmed(const timerWheelEntryStruct *entry)
+{
+    return ( (entry) && (entry->armed) );
+}
+
+/*!
+** FUNCTION: timerWheelAdvance
+**
+** DESCRIPTION: Turns the wheel up to "nowUS", calling back every entry
+**              that has expired, earliest first.
+**
+** PARAMETERS:
+**
+** RETURNS: How many entries fired.
+**
+** COMMENTS: Work is per elapsed tick plus per expired entry; an empty
+**           wheel jumps straight to "nowUS".
+**
+*/
+uint32_t timerWheelAdvance(timerWheelStruct *wheel, uint64_t nowUS)
+{
+    uint32_t                    ret = 0;
+
+    if ( (wheel) && (nowUS >= wheel->originUS) )
+    {
+        uint64_t                nowTick = (nowUS - wheel->originUS) / TIMER_WHEEL_TICK_US;
+
+        while (wheel->currentTick <= nowTick)
+        {
+            uint64_t            tick = wheel->currentTick;
+            uint32_t            level;
+            timerWheelLinkStruct expired;
+
+            if (wheel->armedCount == 0)
+            {
+                wheel->currentTick = nowTick + 1U;
+                break;
+            }
+
+            // A level-0 lap is done: bring the next slot of each level down
+            for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            {
+                if ((tick & (((uint64_t)1U << TIMER_WHEEL_LEVEL_SHIFT(level)) - 1U)) != 0)
+                {
+                    break;
+                }
+                _timerWheelCascade(wheel, level, (uint32_t)((tick >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK));
+            }
+
+            if (wheel->occupied[0] == 0)
+            {
+                // Nothing in level 0 until the next lap
+                wheel->currentTick = ((tick >> TIMER_WHEEL_SLOT_BITS) + 1U) << TIMER_WHEEL_SLOT_BITS;
+                if (wheel->currentTick > nowTick)
+                {
+                    wheel->currentTick = nowTick + 1U;
+                }
+                continue;
+            }
+
+            /*
+            ** Take the slot off the wheel and move on before calling back,
+            ** so a callback that re-arms for "now" lands in the next tick.
+            **
+            */
+            _timerWheelDetachSlot(wheel, 0, (uint32_t)(tick & TIMER_WHEEL_SLOT_MASK), &expired);
+            wheel->currentTick = tick + 1U;
+
+            while (expired.next != &expired)
+            {
+                timerWheelEntryStruct * entry = (timerWheelEntryStruct *)expired.next;
+
+                entry->link.next->prev = entry->link.prev;
+                entry->link.prev->next = entry->link.next;
+                entry->link.next = NULL;
+                entry->link.prev = NULL;
+                entry->armed = false;
+                wheel->armedCount--;
+
+                entry->callback(wheel, entry, entry->ctx);
+                ret++;
+            }
+        }
+    }
+
+    return (ret);
+}
+
+/*!
+** FUNCTION: timerWheelNextDeadline
+**
+** DESCRIPTION: How long a caller can sleep before it needs to call
+**              timerWheelAdvance().
+**
+** PARAMETERS:
+**
+** RETURNS: Microseconds from "nowUS" (0 if something is already due),
+**          or TIMER_WHEEL_NEVER if nothing is armed.
+**
+** COMMENTS: Exact for timers in the bottom level.  For timers further
+**           out it is when they next move down a level, so it may be
+**           early but never late.
+**
+*/
+uint64_t timerWheelNextDeadline(const timerWheelStruct *wheel, uint64_t nowUS)
+{
+    uint64_t                    ret = TIMER_WHEEL_NEVER;
+
+    if ( (wheel) && (wheel->armedCount > 0) )
+    {
+        uint64_t                bestTick = UINT64_MAX;
+        uint64_t                deadlineUS;
+        uint32_t                level;
+
+        for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            uint32_t            shift = TIMER_WHEEL_LEVEL_SHIFT(level);
+            uint64_t            block = wheel->currentTick >> shift;
+            uint32_t            current = (uint32_t)(block & TIMER_WHEEL_SLOT_MASK);
+            uint64_t            bits = wheel->occupied[level];
+            uint64_t            ahead;
+
+            if (bits == 0)
+            {
+                continue;
+            }
+
+            // Rotate so bit 0 is the slot "currentTick" falls in
+            ahead = (current == 0) ? bits : (((bits >> current) | (bits << (TIMER_WHEEL_SLOTS - current))) & TIMER_WHEEL_BITMAP_MASK);
+
+            /*
+            ** The current slot is due now only if its cascade (or, in
+            ** level 0, its tick) hasn't been processed yet; otherwise
+            ** whatever is in it belongs to the next lap.
+            **
+            */
+            if ((wheel->currentTick & (((uint64_t)1U << shift) - 1U)) != 0)
+            {
+                ahead &= ~(uint64_t)1U;
+            }
+
+            block += (ahead != 0) ? _timerWheelLowestBit(ahead) : TIMER_WHEEL_SLOTS;
+
+            if ((block << shift) < bestTick)
+            {
+                bestTick = block << shift;
+            }
+        }
+
+        deadlineUS = wheel->originUS + (bestTick * TIMER_WHEEL_TICK_US);
+        ret = (deadlineUS > nowUS) ? (deadlineUS - nowUS) : 0;
+    }
+
+    return (ret);
+}
+
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+//                 INTERNAL SUPPORT FUNCTION IMPLEMENTATIONS
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+
+/*!
+** FUNCTION: _timerWheelInsert
+**
+** DESCRIPTION: Files an armed entry in the lowest level whose span
+**              covers the time it has left.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: An entry already due goes in the current tick's slot.  One
+**           beyond the wheel's span is parked in the top level's
+**           furthest slot and re-filed when that slot cascades.
+**
+*/
+static void _timerWheelInsert(timerWheelStruct *wheel, timerWheelEntryStruct *entry)
+{
+    uint64_t                    tick = entry->expiresTick;
+    uint64_t                    delta;
+    uint32_t                    level;
+    uint32_t                    slot;
+    timerWheelLinkStruct *      head;
+
+    if (tick < wheel->currentTick)
+    {
+        tick = wheel->currentTick;
+    }
+
+    delta = tick - wheel->currentTick;
+    if (delta >= TIMER_WHEEL_SPAN)
+    {
+        tick = wheel->currentTick + TIMER_WHEEL_SPAN - 1U;
+        delta = TIMER_WHEEL_SPAN - 1U;
+    }
+
+    for (level = 0; level < (TIMER_WHEEL_LEVELS - 1U); level++)
+    {
+        if (delta < ((uint64_t)1U << TIMER_WHEEL_LEVEL_SHIFT(level + 1U)))
+        {
+            break;
+        }
+    }
+
+    slot = (uint32_t)((tick >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK);
+    head = &wheel->slots[level][slot];
+
+    // Append, so entries due on the same tick fire in the order armed
+    entry->link.next = head;
+    entry->link.prev = head->prev;
+    head->prev->next = &entry->link;
+    head->prev = &entry->link;
+
+    entry->level = (uint8_t)level;
+    entry->slot = (uint8_t)slot;
+    wheel->occupied[level] |= ((uint64_t)1U << slot);
+
+    return;
+}
+
+/*!
+** FUNCTION: _timerWheelUnlink
+**
+** DESCRIPTION: Takes an entry out of whatever list it is in, keeping
+**              its slot's bitmap bit right.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS: The entry may be in a list that Advance has detached, in
+**           which case its old slot is checked and left alone if
+**           something else has been filed there since.
+**
+*/
+static void _timerWheelUnlink(timerWheelStruct *wheel, timerWheelEntryStruct *entry)
+{
+    timerWheelLinkStruct *      head = &wheel->slots[entry->level][entry->slot];
+
+    entry->link.next->prev = entry->link.prev;
+    entry->link.prev->next = entry->link.next;
+    entry->link.next = NULL;
+    entry->link.prev = NULL;
+
+    if (head->next == head)
+    {
+        wheel->occupied[entry->level] &= ~((uint64_t)1U << entry->slot);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _timerWheelDetachSlot
+**
+** DESCRIPTION: Moves a slot's whole list onto "list" and marks the
+**              slot empty.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _timerWheelDetachSlot(timerWheelStruct *wheel, uint32_t level, uint32_t slot, timerWheelLinkStruct *list)
+{
+    timerWheelLinkStruct *      head = &wheel->slots[level][slot];
+
+    if (head->next != head)
+    {
+        list->next = head->next;
+        list->prev = head->prev;
+        list->next->prev = list;
+        list->prev->next = list;
+        head->next = head;
+        head->prev = head;
+    }
+    else
+    {
+        list->next = list;
+        list->prev = list;
+    }
+
+    wheel->occupied[level] &= ~((uint64_t)1U << slot);
+
+    return;
+}
+
+/*!
+** FUNCTION: _timerWheelCascade
+**
+** DESCRIPTION: Re-files every entry of one slot, which now lands them
+**              a level (or more) lower.
+**
+** PARAMETERS:
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static void _timerWheelCascade(timerWheelStruct *wheel, uint32_t level, uint32_t slot)
+{
+    timerWheelLinkStruct        list;
+
+    _timerWheelDetachSlot(wheel, level, slot, &list);
+
+    while (list.next != &list)
+    {
+        timerWheelEntryStruct * entry = (timerWheelEntryStruct *)list.next;
+
+        list.next = entry->link.next;
+        list.next->prev = &list;
+
+        _timerWheelInsert(wheel, entry);
+    }
+
+    return;
+}
+
+/*!
+** FUNCTION: _timerWheelLowestBit
+**
+** DESCRIPTION: Index of the lowest set bit.
+**
+** PARAMETERS: bits: Must not be 0.
+**
+** RETURNS:
+**
+** COMMENTS:
+**
+*/
+static uint32_t _timerWheelLowestBit(uint64_t bits)
+{
+    uint32_t                    ret = 0;
+
+#if defined(__GNUC__)
+    ret = (uint32_t)__builtin_ctzll(bits);
+#else
+    while ((bits & 1U) == 0)
+    {
+        bits >>= 1;
+        ret++;
+    }
+#endif
+
+    return (ret);
+}
@@ -12,7 +12,8 @@
 //#############################################################################
 //#############################################################################
 //#############################################################################
-#include "miniYaml.h"
+#include <stddef.h>
+#include "miniyaml.h"
 
 /*
 ** Internal support function prototypes.